@@ -66,6 +66,7 @@ Var* dv_LoadXML(char* filename, int use_names);
 Var* dv_loadPDS4(char* filename);
 #endif
 int dv_WriteIOM(Var*, const char*, const char*, int);
+int dv_WriteTIFF(Var*, const char*, int, const struct iom_tiff_opts*);
 int dv_WriteGRD(Var* s, char* filename, int force, char* title, char* task);
 int dv_WriteISIS(Var* s, char* filename, int force, char* title);
 int dv_WritePGM(Var* obj, char* filename, int force);
@@ -76,7 +77,7 @@ int dv_WriteVicar(Var* obj, char* filename, int force);
 int dv_WriteIMath(Var* obj, char* filename, int force);
 int dv_WriteENVI(Var* obj, char* filename, int force);
 int dv_WriteGFX_Image(Var* ob, char* filename, int force, char* GFX_type);
-int dv_WriteCSV(Var* the_data, char* filename, char* separator, int header, int force);
+int dv_WriteCSV(Var* the_data, char* filename, char* separator, int header, int force, int precision);
 /*
 ** NOTE:
 **   WriteGFX_Image can be broken down into individual type, e.g.
@@ -107,4 +108,9 @@ char* dv_locate_file(const char* fname);
 */
 void dv_set_iom_verbosity();
 
+/*
+** Let iomedley run its loops on davinci's worker threads.
+*/
+void dv_init_iomedley();
+
 #endif /* _DVIO_H_ */
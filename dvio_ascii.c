@@ -1,24 +1,61 @@
 #include "parser.h"
+#include "textout.h"
+
 /**
  ** This is a simple ASCII output function
+ **
+ ** Values are tab separated, one row per line, with a blank line
+ ** between bands.  Integers are written in full; floats and doubles
+ ** with %.10g by default, or with the given number of significant
+ ** digits, or with precision 0 the fewest digits that read back the
+ ** same.
  **/
 
-int WriteAscii(Var* s, char* filename, int force)
+typedef struct {
+	Var* v;
+	size_t x, y;
+	int precision;
+} ascii_job;
+
+static void ascii_values(void* ctx, size_t begin, size_t end, dv_text* out)
 {
-	size_t dsize;
-	int format;
-	int ival;
-	double dval;
-	int i, j, k;
-	int x, y, z;
-	size_t pos;
+	ascii_job* job = (ascii_job*)ctx;
+	size_t n, i, j, k, len;
+	char* p;
+
+	for (n = begin; n < end; n++) {
+		i = n % job->x;
+		j = (n / job->x) % job->y;
+		k = n / job->x / job->y;
+		if ((p = dv_text_room(out, DV_FMT_MAX + 2)) == NULL) return;
+		len = 0;
+		if (i) {
+			p[len++] = '\t';
+		} else if (j == 0 && k) {
+			p[len++] = '\n';
+		}
+		len += dv_fmt_value(p + len, job->v, cpos(i, j, k, job->v), job->precision);
+		if (i == job->x - 1) p[len++] = '\n';
+		out->len += len;
+	}
+}
+
+int WriteAscii(Var* s, char* filename, int force, int precision)
+{
+	ascii_job job;
 	FILE* fp;
+	int i, ok;
 
 	if (!force && file_exists(filename)) {
 		parse_error("File %s already exists.", filename);
 		return 0;
 	}
 
+	if (V_TYPE(s) != ID_VAL && V_TYPE(s) != ID_STRING && V_TYPE(s) != ID_TEXT) {
+		parse_error("Only values, strings and text can be written as ascii");
+		return 0;
+	}
+
 	if ((fp = fopen(filename, "w")) == NULL) {
 		parse_error("Unable to open file: %s\n", filename);
 		return 0;
@@ -38,37 +75,16 @@ int WriteAscii(Var* s, char* filename, int force)
 		return (1);
 	}
 
-	dsize  = V_DSIZE(s);
-	format = V_FORMAT(s);
-
-	x = GetX(s);
-	y = GetY(s);
-	z = GetZ(s);
+	job.v         = s;
+	job.x         = GetX(s);
+	job.y         = GetY(s);
+	job.precision = precision < 0 ? 10 : precision;
+	ok            = dv_write_text(fp, V_DSIZE(s), ascii_values, &job);
 
-	for (k = 0; k < z; k++) {
-		if (k) fputc('\n', fp);
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				if (i) fputc('\t', fp);
-				pos = cpos(i, j, k, s);
-				switch (format) {
-				case DV_UINT8:
-				case DV_INT16:
-				case DV_INT32:
-					ival = extract_int(s, pos);
-					fprintf(fp, "%d", ival);
-					break;
-				case DV_FLOAT:
-				case DV_DOUBLE:
-					dval = extract_double(s, pos);
-					fprintf(fp, "%.10g", dval);
-					break;
-				}
-			}
-			fputc('\n', fp);
-		}
+	if (fclose(fp) != 0 || !ok) {
+		parse_error("Error writing file: %s", filename);
+		return 0;
 	}
-	fclose(fp);
 	return (1);
 }
 
@@ -132,6 +148,8 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 	int column            = 0;
 	int row               = 0;
 	char* format_str      = NULL;
+	int cache             = 0;
+	char* cache_key       = NULL;
 
 	void* data           = NULL;
 	u8* u8data;
@@ -147,7 +165,7 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 	float* fdata;
 	double* ddata;
 
-	Alist alist[9];
+	Alist alist[10];
 	alist[0]      = make_alist("filename", ID_STRING, NULL, &filename);
 	alist[1]      = make_alist("x", DV_INT32, NULL, &x);
 	alist[2]      = make_alist("y", DV_INT32, NULL, &y);
@@ -156,7 +174,8 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 	alist[5]      = make_alist("column", DV_INT32, NULL, &column);
 	alist[6]      = make_alist("row", DV_INT32, NULL, &row);
 	alist[7]      = make_alist("delim", ID_STRING, NULL, &delim);
-	alist[8].name = NULL;
+	alist[8]      = make_alist("cache", DV_INT32, NULL, &cache);
+	alist[9].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -178,9 +197,19 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 		parse_error(NULL);
 		return (NULL);
 	}
+	if (cache) {
+		cache_key = malloc(strlen(delim) + 128);
+		sprintf(cache_key, "%d:%d:%d:%d:%d:%d:%s", x, y, z, format, column, row, delim);
+		if ((s = dv_tcache_load(fname, "ascii", cache_key)) != NULL) {
+			free(cache_key);
+			free(fname);
+			return (s);
+		}
+	}
 	if ((fp = fopen(fname, "r")) == NULL) {
 		sprintf(error_buf, "Cannot open file: %s\n", fname);
 		parse_error(NULL);
+		free(cache_key);
 		return (NULL);
 	}
 	if (x == 0 && y == 0 && z == 0) {
@@ -192,6 +221,7 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 			dv_getline(&ptr, fp);
 			if (ptr == NULL) {
 				fprintf(stderr, "Early EOF, aborting.\n");
+				free(cache_key);
 				return (NULL);
 			}
 		}
@@ -216,6 +246,7 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 
 		if (x * y * z != count) {
 			fprintf(stderr, "Unable to determine file size.\n");
+			free(cache_key);
 			return (NULL);
 		}
 		if (VERBOSE) fprintf(stderr, "Apparent file size: %dx%dx%d\n", x, y, z);
@@ -252,6 +283,7 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 		dv_getline(&ptr, fp);
 		if (ptr == NULL) {
 			fprintf(stderr, "Early EOF, aborting.\n");
+			free(cache_key);
 			return (NULL);
 		}
 	}
@@ -322,5 +354,11 @@ Var* ff_ascii(vfuncptr func, Var* arg)
 	V_SIZE(s)[1] = y;
 	V_SIZE(s)[2] = z;
 
+	if (cache) {
+		dv_tcache_save(fname, "ascii", cache_key, s);
+		free(cache_key);
+	}
+	free(fname);
+
 	return (s);
 }
@@ -20,6 +20,7 @@
 
 #include "csv.h"
 #include "dvio.h"
+#include "textout.h"
 #include <ctype.h>
 #include <fcntl.h>
 
@@ -880,10 +881,11 @@ static int isaspace(unsigned char c)
     @param fdelim [in] character to uses for field separator.
     @param header [in] whether 1st line is names of columns and not part of data.
     @param collapse [in] whether to collapse consecutive field separators or treat as empty fields.
+    @param cache [in] whether to use (and refresh) the binary table cache of the file.
     @param v_return [out] Var data structure that data is read into and returned in.
     @return 1 on success, 0 on failure.
 */
-static int load_csv(char* filename, char fdelim, int header, int collapse, Var** v_return)
+static int load_csv(char* filename, char fdelim, int header, int collapse, int cache, Var** v_return)
 {
 	char* file     = NULL;
 	char* temp_str = NULL;
@@ -908,6 +910,7 @@ static int load_csv(char* filename, char fdelim, int header, int collapse, Var**
 	char* fname = NULL;
 	FILE* fp;
 	int iscompressed = 0;
+	char cache_key[64];
 
 	*v_return = NULL;
 
@@ -919,6 +922,12 @@ static int load_csv(char* filename, char fdelim, int header, int collapse, Var**
 		return 0;
 	}
 
+	snprintf(cache_key, sizeof(cache_key), "%d:%d:%d", fdelim, header, collapse);
+	if (cache && (*v_return = dv_tcache_load(fname, "load_csv", cache_key)) != NULL) {
+		free(fname);
+		return 1;
+	}
+
 	/*uncompress the file if necessary */
 	if (fname && (fp = fopen(fname, "rb")) != NULL) {
 		if (iom_is_compressed(fp)) {
@@ -1102,6 +1111,12 @@ static int load_csv(char* filename, char fdelim, int header, int collapse, Var**
 	free(fname);
 	csv_free(&p);
 
+	if (cache) {
+		fname = dv_locate_file(filename);
+		dv_tcache_save(fname, "load_csv", cache_key, *v_return);
+		free(fname);
+	}
+
 	return 1;
 }
 
@@ -1113,16 +1128,17 @@ Var* ff_loadcsv(vfuncptr func, Var* args)
 {
 	char* filename = NULL;
 	Var* v_return;
-	int rc, header = 1, collapse_fdelim = 0;
+	int rc, header = 1, collapse_fdelim = 0, cache = 0;
 	char* field_delim = "\t";
 
-	Alist alist[6];
+	Alist alist[7];
 	alist[0]      = make_alist("filename", ID_STRING, NULL, &filename);
 	alist[1]      = make_alist("separator", ID_STRING, NULL, &field_delim);
 	alist[2]      = make_alist("delimiter", ID_STRING, NULL, &field_delim);
 	alist[3]      = make_alist("header", DV_INT32, NULL, &header);
 	alist[4]      = make_alist("collapse", DV_INT32, NULL, &collapse_fdelim);
-	alist[5].name = NULL;
+	alist[5]      = make_alist("cache", DV_INT32, NULL, &cache);
+	alist[6].name = NULL;
 
 	if (parse_args(func, args, alist) == 0) return (NULL);
 
@@ -1131,7 +1147,7 @@ Var* ff_loadcsv(vfuncptr func, Var* args)
 		return NULL;
 	}
 
-	if (!load_csv(filename, *field_delim, header, collapse_fdelim, &v_return)) return NULL;
+	if (!load_csv(filename, *field_delim, header, collapse_fdelim, cache, &v_return)) return NULL;
 
 	return v_return;
 }
@@ -1152,22 +1168,108 @@ static void free_coldefs(coldef* cols, int n)
 	free(cols);
 }
 
+typedef struct {
+	Var** data;
+	int count;
+	const char* delim;
+	size_t dlen;
+	int precision;
+} csv_job;
+
+/* the rows of a column; strings go on every row */
+static size_t csv_rows(Var* v)
+{
+	if (v == NULL) return (0);
+	if (V_TYPE(v) == ID_VAL) return (V_SIZE(v)[1]);
+	if (V_TYPE(v) == ID_TEXT) return (V_TEXT(v).Row);
+	return (0);
+}
+
+/*
+ * drd
+ * [Bug 2169] load_csv() does not promote floating point data to doubles
+ *
+ * Saadat reports that the output was now coming out as E format with
+ * little resolution.
+ * The changes here are to make the output match the inputs
+ * The DV_FLOAT inputs hand 4 decimal places, the DV_DOUBLE inputs 1 decimal place
+ *
+ * The change is to %.4f from %G for DV_FLOAT,
+ *                  %.1f from %G for DV_DOUBLE
+ *
+ * That is still the default; precision= asks for significant digits instead.
+ */
+static size_t csv_value(char* buf, Var* v, size_t i, int precision)
+{
+	if (precision < 0 && V_FORMAT(v) == DV_FLOAT) return (dv_fmt_fixed(buf, ((float*)V_DATA(v))[i], 4));
+	if (precision < 0 && V_FORMAT(v) == DV_DOUBLE) return (dv_fmt_fixed(buf, ((double*)V_DATA(v))[i], 1));
+	return (dv_fmt_value(buf, v, i, precision));
+}
+
+static void csv_records(void* ctx, size_t begin, size_t end, dv_text* out)
+{
+	csv_job* job = (csv_job*)ctx;
+	size_t row, j, columns, len;
+	const char* text;
+	char* p;
+	Var* v;
+	int i;
+
+	for (row = begin; row < end; row++) {
+		for (i = 0; i < job->count; i++) {
+			v = job->data[i];
+
+			if (v == NULL) { // combine
+			} else if (V_TYPE(v) != ID_STRING && row >= csv_rows(v)) {
+				// a column with fewer rows than others
+				columns = V_TYPE(v) == ID_VAL ? V_SIZE(v)[0] : 1;
+				if (i < job->count - 1) {
+					for (j = 1; j < columns; j++) dv_text_add(out, job->delim, job->dlen);
+				}
+			} else if (V_TYPE(v) == ID_VAL) {
+				columns = V_SIZE(v)[0];
+				for (j = 0; j < columns; j++) {
+					if ((p = dv_text_room(out, DV_FMT_MAX + job->dlen)) == NULL) return;
+					len = csv_value(p, v, row * columns + j, job->precision);
+					if (j + 1 < columns) {
+						memcpy(p + len, job->delim, job->dlen);
+						len += job->dlen;
+					}
+					out->len += len;
+				}
+			} else if (V_TYPE(v) == ID_STRING) {
+				dv_text_add(out, V_STRING(v), strlen(V_STRING(v)));
+			} else if ((text = V_TEXT(v).text[row]) != NULL) {
+				len = strlen(text);
+				if ((p = dv_text_room(out, 2 * len + 2)) == NULL) return;
+				out->len += csv_write(p, 2 * len + 2, text, len);
+			}
+
+			if (i < job->count - 1) dv_text_add(out, job->delim, job->dlen);
+		}
+		dv_text_add(out, "\n", 1);
+	}
+}
+
 /**
  *  Writes data out as csv file.
     @param the_data [in] object to write out passed from ff_write in ff_write.c.
     @param filename [in] name of file to write to.
     @param field_delim [in] string to use as field separator.
     @param force [in] whether to overwrite an existing file of same name if found.
+    @param precision [in] significant digits for float and double values,
+           0 for the fewest that read back the same, -1 for the default.
     @return 1 on success, 0 on failure.
  */
-int dv_WriteCSV(Var* the_data, char* filename, char* field_delim, int header, int force)
+int dv_WriteCSV(Var* the_data, char* filename, char* field_delim, int header, int force, int precision)
 {
-	int i, j, count, row, max, columns, error;
+	int i, count, error;
+	size_t max;
 	Var** data  = NULL;
 	char** keys = NULL;
 	FILE* file  = NULL;
 	struct stat filestats;
-	char record_delim[] = "\n";
+	csv_job job;
 
 	if (field_delim == NULL) {
 		field_delim = "\t";
@@ -1201,14 +1303,6 @@ int dv_WriteCSV(Var* the_data, char* filename, char* field_delim, int header, in
 					error = 1;
 					break;
 				}
-
-				if (data[i] != NULL && V_SIZE(data[i])[2] > 1) {
-					parse_error(
-					    "Multiple bands (z>1) not supported.\nColumn %d has z dimension %d\n", i,
-					    V_SIZE(data[i])[2]);
-					error = 1;
-					break;
-				}
 			}
 		}
 	} else { // else data is a basic type so no sub structures
@@ -1226,20 +1320,30 @@ int dv_WriteCSV(Var* the_data, char* filename, char* field_delim, int header, in
 		}
 	}
 
-	if (error) {
-		free(keys);
-		free(data);
-	}
+	/* check every column before anything is written */
+	for (i = 0; !error && i < count; i++) {
+		if (data[i] == NULL || V_TYPE(data[i]) == ID_STRING || V_TYPE(data[i]) == ID_TEXT) continue;
 
-	for (i = 0; i < count; i++) {
-		if (V_ORG(data[i]) != BSQ) {
+		if (V_TYPE(data[i]) != ID_VAL) {
+			parse_error("Unknown type: %d for column %d: %s\n", V_TYPE(data[i]), i,
+			            keys[i] == NULL ? "(null)" : keys[i]);
+			error = 1;
+		} else if (V_SIZE(data[i])[2] > 1) {
+			parse_error("Multiple bands (z>1) not supported.\nColumn %d has z dimension %d\n", i,
+			            (int)V_SIZE(data[i])[2]);
+			error = 1;
+		} else if (V_ORG(data[i]) != BSQ) {
 			parse_error("Only BSQ data format supported\nColumn %s is not BSQ\n", keys[i]);
-			free(keys);
-			free(data);
-			return 0;
+			error = 1;
 		}
 	}
 
+	if (error) {
+		free(keys);
+		free(data);
+		return 0;
+	}
+
 	/* just opening in text output mode because text output OS will handle differences */
 	file = fopen(filename, "w");
 	if (file == NULL) {
@@ -1254,130 +1358,23 @@ int dv_WriteCSV(Var* the_data, char* filename, char* field_delim, int header, in
 
 	/* calculate max number of rows */
 	max = 0;
-	for (i                                = 0; i < count; i++)
-		if (max < V_SIZE(data[i])[1]) max = V_SIZE(data[i])[1];
-
-	row = 0;
-	for (row = 0; row < max; row++) {
-		for (i = 0; i < count; i++) {
-
-			if (data[i] == NULL) { // combine
-				if (i < count - 1) fprintf(file, "%s", field_delim);
-				continue;
-			}
-
-			// if a column has fewer rows than others
-			if ((V_TYPE(data[i]) == ID_VAL && row >= V_SIZE(data[i])[1]) ||
-			    (V_TYPE(data[i]) == ID_TEXT && V_TEXT(data[i]).Row <= row)) {
-
-				if (i < count - 1) {
-					for (j = 0; j < V_SIZE(data[i])[0]; j++) fprintf(file, "%s", field_delim);
-				}
-				continue;
-			}
-			/*
-			 * drd
-			 * [Bug 2169] load_csv() does not promote floating point data to doubles
-			 *
-			 * Saadat reports that the output was now coming out as E format with
-			 * little resolution.
-			 * The changes here are to make the output match the inputs
-			 * The DV_FLOAT inputs hand 4 decimal places, the DV_DOUBLE inputs 1 decimal place
-			 *
-			 * The change is to %.4f from %G for DV_FLOAT,
-			 *                  %.1f from %G for DV_DOUBLE
-			 *
-			 */
-
-			if (V_TYPE(data[i]) == ID_VAL) {
-				columns = V_SIZE(data[i])[0];
-				for (j = 0; j < columns; j++) {
-					switch (V_FORMAT(data[i])) {
-					case DV_UINT8:
-						fprintf(file, "%"PRIu8, ((u8*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_UINT16:
-						fprintf(file, "%"PRIu16, ((u16*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_UINT32:
-						fprintf(file, "%"PRIu32, ((u32*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_UINT64:
-						fprintf(file, "%"PRIu64, ((u64*)V_DATA(data[i]))[row * columns + j]);
-						break;
-
-
-					case DV_INT8:
-						fprintf(file, "%"PRIi8, ((i8*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_INT16:
-						fprintf(file, "%"PRIi16, ((i16*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_INT32:
-						fprintf(file, "%"PRIi32, ((i32*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_INT64:
-						fprintf(file, "%"PRIi64, ((i64*)V_DATA(data[i]))[row * columns + j]);
-						break;
-
-					case DV_FLOAT:
-						fprintf(file, "%.4f", ((float*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					case DV_DOUBLE:
-						fprintf(file, "%.1f", ((double*)V_DATA(data[i]))[row * columns + j]);
-						break;
-					default:
-						parse_error("unknown format for ID_VAL: %d\n", V_FORMAT(data[i]));
-						free(keys);
-						free(data);
-						fclose(file);
-						return 0;
-					}
-					if (j + 1 < V_SIZE(data[i])[0]) fprintf(file, "%s", field_delim);
-				}
-			}
-
-			/*
-			 * drd
-			 * Added 'else if' for ID_STRING, a NULL terminated character string.
-			 * This handler was simply missing.
-			 * Already had ID_TEXT, a 1-D Array of Strings
-			 *
-			 * See enum definitions in parser.h
-			 *
-			 * todo: is ID_TEXT ever used by a call to dv_WriteCSV()?
-			 *
-			 */
-			else if (V_TYPE(data[i]) == ID_STRING) {
-				fprintf(file, "%s", V_STRING(data[i]));
-			}
-
-			else if (V_TYPE(data[i]) == ID_TEXT) {
-
-				if (V_TEXT(data[i]).text[row] != NULL)
-					csv_fwrite(file, V_TEXT(data[i]).text[row], strlen(V_TEXT(data[i]).text[row]));
-
-			} else {
-				keys[i] = keys[i] == NULL ? "(null)" : keys[i];
-				parse_error("Unknown type: %d for column %d: %s\n", V_TYPE(data[i]), i, keys[i]);
-				free(keys);
-				free(data);
-				fclose(file);
-				return 0;
-			}
-
-			if (i < count - 1) fprintf(file, "%s", field_delim);
-
-		} // end for (columns)
+	for (i = 0; i < count; i++) {
+		if (max < csv_rows(data[i])) max = csv_rows(data[i]);
+	}
 
-		fprintf(file, "%s", record_delim);
-	} // end while (rows)
+	job.data      = data;
+	job.count     = count;
+	job.delim     = field_delim;
+	job.dlen      = strlen(field_delim);
+	job.precision = precision;
+	error         = !dv_write_text(file, max, csv_records, &job);
 
-	fclose(file);
+	if (fclose(file) != 0) error = 1;
+	if (error) parse_error("Error writing file \"%s\"", filename);
 	free(data);
 	free(keys);
 
-	return 1;
+	return !error;
 }
 
 /**
@@ -1398,7 +1395,7 @@ static int print_headers(Var** data, char** keys, int count, FILE* file, char* f
 
 		key = keys[i] == NULL ? "" : keys[i];
 
-		if (data[i] != NULL && V_SIZE(data[i])[0] > 1) {
+		if (data[i] != NULL && V_TYPE(data[i]) == ID_VAL && V_SIZE(data[i])[0] > 1) {
 			for (j = 0; j < V_SIZE(data[i])[0]; j++) {
 				if (strlen(key) > 0) fprintf(file, "%s[%d]", keys[i], j);
 				if (j < V_SIZE(data[i])[0] - 1) fprintf(file, "%s", fdelim);
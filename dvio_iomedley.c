@@ -10,6 +10,7 @@
 
 #include "dvio.h"
 #include "config.h"
+#include "parallel.h"
 #include "parser.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,7 @@
 typedef int (*_iom_is_func)(FILE*);
 typedef int (*_iom_header_func)(FILE*, char*, struct iom_iheader*);
 typedef int (*_iom_write_func)(char*, unsigned char*, struct iom_iheader*, int);
+typedef int (*_iom_slice_func)(FILE*, char*, struct iom_iheader*, struct iom_iheader*);
 
 typedef struct {
 	const char* type;            /* Canonical name. */
@@ -35,6 +37,7 @@ typedef struct {
 	_iom_header_func header;     /* Funtion to read header & data. */
 	_iom_write_func write;       /* Function to write new file. */
 	unsigned short int maxbytes; /* Max bytes per pixel. */
+	_iom_slice_func slice;       /* Reads only the subset, or NULL. */
 } iom_io_interface;
 
 /* Recognized types/file extensions, used during file creation. */
@@ -47,21 +50,26 @@ static const char* tiff_extensions[] = {"tif", "tiff", NULL};
 static const char* png_extensions[] = {"png", NULL};
 
 static iom_io_interface interfaces[] = {
-    {"GIF", gif_extensions, iom_isGIF, iom_GetGIFHeader, iom_WriteGIF, 1},
-    {"JPEG", jpeg_extensions, iom_isJPEG, iom_GetJPEGHeader, iom_WriteJPEG, 1},
-    {"TIFF", tiff_extensions, iom_isTIFF, iom_GetTIFFHeader, iom_WriteTIFF, 8},
-    {"BMP", bmp_extensions, iom_isBMP, iom_GetBMPHeader, iom_WriteBMP, 1},
+    {"GIF", gif_extensions, iom_isGIF, iom_GetGIFHeader, iom_WriteGIF, 1, NULL},
+    {"JPEG", jpeg_extensions, iom_isJPEG, iom_GetJPEGHeader, iom_WriteJPEG, 1, NULL},
+    {"TIFF", tiff_extensions, iom_isTIFF, iom_GetTIFFHeader, iom_WriteTIFF, 8, iom_GetTIFFHeaderSlice},
+    {"BMP", bmp_extensions, iom_isBMP, iom_GetBMPHeader, iom_WriteBMP, 1, NULL},
 #ifdef HAVE_LIBPNG
-    {"PNG", png_extensions, iom_isPNG, iom_GetPNGHeader, iom_WritePNG, 2},
+    {"PNG", png_extensions, iom_isPNG, iom_GetPNGHeader, iom_WritePNG, 2, NULL},
 #endif
-    {NULL, NULL, NULL, NULL, NULL, 0}};
+    {NULL, NULL, NULL, NULL, NULL, 0, NULL}};
 
 /*********/
 
+void dv_init_iomedley()
+{
+	iom_PARALLEL_FOR = dv_parallel_for;
+}
+
 Var* dv_LoadIOM(FILE* fp, char* filename, struct iom_iheader* s)
 {
 
-	struct iom_iheader h;
+	struct iom_iheader h, skip;
 	unsigned char* data;
 	Var* v;
 	char hbuf[HBUFSIZE];
@@ -86,12 +94,22 @@ Var* dv_LoadIOM(FILE* fp, char* filename, struct iom_iheader* s)
 
 	/* Read file and populate header, including image data. */
 
-	if (!(*interfaces[interface].header)(fp, filename, &h)) {
-		return NULL;
-	}
+	if (s != NULL && interfaces[interface].slice != NULL) {
+		/* Only the subset is read, leaving just the skips to apply. */
+		if (!(*interfaces[interface].slice)(fp, filename, &h, s)) {
+			return NULL;
+		}
+		iom_init_iheader(&skip);
+		memcpy(skip.s_skip, s->s_skip, sizeof(skip.s_skip));
+		iom_MergeHeaderAndSlice(&h, &skip);
+	} else {
+		if (!(*interfaces[interface].header)(fp, filename, &h)) {
+			return NULL;
+		}
 
-	if (s != NULL) {
-		iom_MergeHeaderAndSlice(&h, s);
+		if (s != NULL) {
+			iom_MergeHeaderAndSlice(&h, s);
+		}
 	}
 
 	data = iom_read_qube_data(-1, &h); /* Sending fd -1 because we always set h->data. */
@@ -179,3 +197,29 @@ int dv_WriteIOM(Var* obj, const char* filename, const char* type, int force)
 
 	return 1;
 }
+
+/*
+** Write a TIFF file with the given layout options (see iom_WriteTIFFOpts()).
+*/
+int dv_WriteTIFF(Var* obj, const char* filename, int force, const struct iom_tiff_opts* opts)
+{
+	struct iom_iheader h;
+	int status;
+
+	if (V_TYPE(obj) != ID_VAL) {
+		parse_error("error: object must be a value type (ie. an array, not a struct)\n");
+		return 0;
+	}
+
+	var2iom_iheader(obj, &h);
+
+	status = iom_WriteTIFFOpts((char*)filename, V_DATA(obj), &h, force, opts);
+	iom_cleanup_iheader(&h);
+
+	if (status == 0) {
+		parse_error("Writing of TIFF file %s failed.\n", filename);
+		return 0;
+	}
+
+	return 1;
+}
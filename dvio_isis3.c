@@ -41,6 +41,7 @@
 #include "dvio_isis3.h"
 
 #include "dvio.h"
+#include "endian_norm.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -51,8 +52,8 @@
 
 #define _FILE_OFFSET_BITS 64
 
-static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names,
-                         int use_units); // drd static so only visible in this file
+static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names, int use_units,
+                         const int sub[6]); // drd static so only visible in this file
 static Var* do_writeISIS3(Var* obj, char* ISIS3_filename, char* bsqTile, int valTs,
                           int valTl); // drd static so only visible in this file
 
@@ -64,39 +65,16 @@ static void add_converted_to_struct(Var* dv_struct, char* name, char* value);
 static int stringFinder(FILE* fp);
 static int cNameMaker(char* inputString);
 static int readNextLine(FILE* fp);
-static int getCubeParams(FILE* fp);
-static Var* readCube(FILE* fp);
+static int getCubeParams(FILE* fp, Isis3Core* c);
+static Var* readCube(FILE* fp, Isis3Core* c, const size_t lo[3], const size_t hi[3]);
 static int writeCube(FILE* fp, minIsisInfo* isisinfo, unsigned char* data);
+static size_t pixelSize(const char* type);
 static char inputString[2048];
 static char continuationString[2048];
 static char string1[200], string2[200], string3[200], string4[200];
 static char string1_2[80], string2_2[80], string3_2[80], string4_2[80];
 static char interString[80];
 
-static int StartByte     = 1;
-static int Format        = 1;
-static size_t Samples    = 1;
-static size_t Lines      = 1;
-static size_t totalBands = 1;
-static size_t sampleSize = 1; // "Type"
-static int ByteOrder     = 1;
-static double Base       = 0.0;
-static double Multiplier = 1.0;
-
-static size_t tileSize    = 1;
-static size_t TileSamples = 1;
-static size_t TileLines   = 1;
-
-static size_t subTileSize    = 1;
-static size_t tiles          = 1;
-static size_t row            = 1;
-static size_t Row            = 1;
-static size_t Bands          = 1;
-static size_t tilesPerRow    = 1;
-static size_t subTileSamples = 1;
-static size_t totalRows      = 1;
-static size_t subTileLines   = 1;
-
 static char cubeStub[][160] = {
     {"Object = IsisCube"},      // 00
     {"  Object = Core"},        // 01
@@ -267,7 +245,7 @@ Var* do_writeISIS3(Var* obj, char* ISIS3_filename, char* bsqTile, int valTs, int
 
 	FILE* fp;
 
-	minIsisInfo isisinfo; // in isis3Include.h
+	minIsisInfo isisinfo = {0}; // in isis3Include.h
 
 	if ((fp = fopen(ISIS3_filename, "wb")) == NULL) {
 		fprintf(stderr, "Unable to open file: %s\n", ISIS3_filename);
@@ -501,9 +479,16 @@ Var* do_writeISIS3(Var* obj, char* ISIS3_filename, char* bsqTile, int valTs, int
 
 		get_struct_element(obj, 0, &name, &objTemp);
 
-		isis3Data = (unsigned char*)V_DATA(objTemp);
+		if (V_TYPE(objTemp) != ID_VAL || V_ORG(objTemp) != BSQ || GetX(objTemp) != isisinfo.Samples ||
+		    GetY(objTemp) != isisinfo.Lines || GetZ(objTemp) != isisinfo.Bands ||
+		    NBYTES(V_FORMAT(objTemp)) != pixelSize(isisinfo.Type)) {
+			parse_error("write_isis3: cube data must be a %dx%dx%d BSQ array of %s to match the label",
+			            isisinfo.Samples, isisinfo.Lines, isisinfo.Bands, isisinfo.Type);
+		} else {
+			isis3Data = (unsigned char*)V_DATA(objTemp);
 
-		writeResult = writeCube(fp, &isisinfo, isis3Data);
+			writeResult = writeCube(fp, &isisinfo, isis3Data);
+		}
 
 		fclose(fp);
 
@@ -521,6 +506,7 @@ Var* ReadISIS3(vfuncptr func, Var* arg) // drd proto for this is in func.h
 	int data       = 1; // parse the cube
 	int use_names  = 1; // reverse name and info if 1
 	int use_units  = 0; // use the units field if 1
+	int sub[6]     = {0, 0, 0, 0, 0, 0}; // 1 based x, y and z ranges, 0 for all
 	int i;
 
 	/*
@@ -533,12 +519,18 @@ Var* ReadISIS3(vfuncptr func, Var* arg) // drd proto for this is in func.h
 		return (NULL);
 	}
 
-	Alist alist[5];
-	alist[0]      = make_alist("filename", ID_UNK, NULL, &fn);
-	alist[1]      = make_alist("data", DV_INT32, NULL, &data);
-	alist[2]      = make_alist("use_names", DV_INT32, NULL, &use_names);
-	alist[3]      = make_alist("use_units", DV_INT32, NULL, &use_units);
-	alist[4].name = NULL;
+	Alist alist[11];
+	alist[0]       = make_alist("filename", ID_UNK, NULL, &fn);
+	alist[1]       = make_alist("data", DV_INT32, NULL, &data);
+	alist[2]       = make_alist("use_names", DV_INT32, NULL, &use_names);
+	alist[3]       = make_alist("use_units", DV_INT32, NULL, &use_units);
+	alist[4]       = make_alist("xlow", DV_INT32, NULL, &sub[0]);
+	alist[5]       = make_alist("xhigh", DV_INT32, NULL, &sub[1]);
+	alist[6]       = make_alist("ylow", DV_INT32, NULL, &sub[2]);
+	alist[7]       = make_alist("yhigh", DV_INT32, NULL, &sub[3]);
+	alist[8]       = make_alist("zlow", DV_INT32, NULL, &sub[4]);
+	alist[9]       = make_alist("zhigh", DV_INT32, NULL, &sub[5]);
+	alist[10].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) {
 		return (NULL);
@@ -549,7 +541,7 @@ Var* ReadISIS3(vfuncptr func, Var* arg) // drd proto for this is in func.h
 		Var* s = new_struct(V_TEXT(fn).Row);
 		for (i = 0; i < V_TEXT(fn).Row; i++) {
 			filename = strdup(V_TEXT(fn).text[i]);
-			Var* t   = do_loadISIS3(func, filename, data, use_names, use_units);
+			Var* t   = do_loadISIS3(func, filename, data, use_names, use_units, sub);
 			if (t) {
 				add_struct(s, filename, t);
 			}
@@ -562,14 +554,15 @@ Var* ReadISIS3(vfuncptr func, Var* arg) // drd proto for this is in func.h
 		}
 	} else if (V_TYPE(fn) == ID_STRING) {
 		filename = V_STRING(fn);
-		return (do_loadISIS3(func, filename, data, use_names, use_units));
+		return (do_loadISIS3(func, filename, data, use_names, use_units, sub));
 	} else {
 		parse_error("Illegal argument to function %s(%s), expected STRING", func->name, "filename");
 		return (NULL);
 	}
 }
 
-static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names, int use_units)
+static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names, int use_units,
+                         const int sub[6])
 {
 
 	char* fname;
@@ -593,6 +586,10 @@ static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names,
 	char* ObjectName[5];
 	int i, k, step, count;
 	int lineInCount = 0;
+	Isis3Core core;
+	size_t dims[3] = {0, 0, 0}, lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+	static const char* axis[]     = {"x", "y", "z"};
+	static const char* axisName[] = {"samples", "lines", "bands"};
 
 	volatile int stopCount = 32; // find stop
 	double* testD;
@@ -680,14 +677,24 @@ static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names,
 	// parse_error("/**************************************************/\n");
 	if (data == 1) { // we parse cube info
 		// parse_error("Parsing Cube Parameters...\n");
-		int check;
-		check = getCubeParams(fp);
-		if (check != -1) {
-			cubeVar = readCube(fp);
-		} else {
+		if (getCubeParams(fp, &core) == -1) {
 			fclose(fp);
 			return NULL;
 		}
+		dims[0] = core.Samples;
+		dims[1] = core.Lines;
+		dims[2] = core.Bands;
+		for (i = 0; i < 3; i++) {
+			lo[i] = (sub[2 * i] > 0 ? sub[2 * i] - 1 : 0);
+			hi[i] = (sub[2 * i + 1] > 0 ? sub[2 * i + 1] : dims[i]);
+			if (sub[2 * i] < 0 || sub[2 * i + 1] < 0 || lo[i] >= hi[i] || hi[i] > dims[i]) {
+				parse_error("%s: %slow/%shigh is outside the %zu %s of the cube", func->name, axis[i], axis[i],
+				            dims[i], axisName[i]);
+				fclose(fp);
+				return NULL;
+			}
+		}
+		cubeVar = readCube(fp, &core, lo, hi);
 		fseeko(fp, 0, SEEK_SET);
 	}
 
@@ -1321,6 +1328,15 @@ static Var* do_loadISIS3(vfuncptr func, char* filename, int data, int use_names,
 	// pp_print(cubeVar);
 	if ((cubeVar != NULL) && (data != 0)) {
 		add_struct(v, "cube", cubeVar);
+		if (hi[0] - lo[0] != dims[0] || hi[1] - lo[1] != dims[1] || hi[2] - lo[2] != dims[2]) {
+			/* describe the part of the cube that was read */
+			Var *o, *d, *e;
+			if (find_struct(IsisCube, "Core", &o) >= 0 && find_struct(o, "Dimensions", &d) >= 0) {
+				if (find_struct(d, "Samples", &e) >= 0 && V_FORMAT(e) == DV_INT32) V_INT(e) = hi[0] - lo[0];
+				if (find_struct(d, "Lines", &e) >= 0 && V_FORMAT(e) == DV_INT32) V_INT(e) = hi[1] - lo[1];
+				if (find_struct(d, "Bands", &e) >= 0 && V_FORMAT(e) == DV_INT32) V_INT(e) = hi[2] - lo[2];
+			}
+		}
 	}
 	add_struct(v, "IsisCube", IsisCube);
 	if (naifKeywordsObj != NULL) {
@@ -1859,54 +1875,33 @@ int readNextLine(FILE* fp)
 	return locali;
 }
 
-Var* readCube(FILE* fp)
+/*
+** Read the part of the cube selected by lo and hi (0 based, hi is one
+** past the end) on each axis.  BandSequential cubes are read a band,
+** or a line if only some samples are wanted, at a time.  Tile cubes are
+** read a row of the needed tiles at a time and the lines of each tile
+** copied into place.  The data is swapped once it is all in memory.
+*/
+static Var* readCube(FILE* fp, Isis3Core* c, const size_t lo[3], const size_t hi[3])
 {
-
-#define CUBEDEBUG
-#ifdef CUBEDEBUG
-
-	FILE* fpc;
-
-#endif
-
-	Var* dv_struct          = new_struct(0);
-	unsigned char* cubeData = NULL;
-	unsigned char inBuffer[4];
-	unsigned char swapBuffer[4];
-	int cubeElement = 0;
-	int x, y, z;
-	size_t element      = 0;
-	size_t linearOffset = 0;
-	size_t offset       = 0;
-	size_t allSized     = 0;
-
-	if (Format == I3Tile) {
-		tileSize       = TileSamples * TileLines * sampleSize;
-		tilesPerRow    = Samples / TileSamples;
-		subTileSamples = Samples % TileSamples; // What is left over going across
-		subTileSize    = subTileSamples * TileLines * sampleSize;
-		totalRows      = Lines / TileLines;
-		subTileLines   = Lines % TileLines; // What is left going down
-
-		if (subTileSamples != 0) {
-			tilesPerRow += 1;
-		}
-		if (subTileLines != 0) {
-			totalRows += 1;
-		}
-	}
-	allSized = (size_t)Samples * (size_t)Lines * (size_t)totalBands * (size_t)sampleSize;
+	unsigned char *cubeData, *tileRow = NULL, *dst;
+	size_t ss = c->sampleSize;
+	size_t ns = hi[0] - lo[0], nl = hi[1] - lo[1], nb = hi[2] - lo[2];
+	size_t lineSize = ns * ss;
+	size_t allSized = ns * nl * nb * ss;
+	size_t tileSize, tilesPerRow, totalRows, sheet, tc0, tc1, tr, t, y, x0, x1, r;
+	size_t b, l;
+	off_t offset;
+	int cubeElement;
 
 	if (allSized >= 2147483647ll) {
 		char biggie[64];
-		sprintf(biggie, "%lu", allSized);
+		sprintf(biggie, "%zu", allSized);
 		commaize(biggie);
 		parse_error(
 		    "Warning:  Size is %s bytes.\nThis is larger than the 32bit integer max of "
 		    "2,147,483,647.\nProceeding...\n",
 		    biggie);
-		// for now, we are done
-		//  return NULL;
 	}
 	cubeData = malloc(allSized);
 
@@ -1915,420 +1910,233 @@ Var* readCube(FILE* fp)
 		return NULL;
 	}
 
-	if (Format == BandSequential) {
-
-		fseeko(fp, StartByte - 1, SEEK_SET); // Need only the one fseeko() to set up all
-		offset = 0;                          // This is the offset in to the storage structure
-		for (z = 0; z < totalBands; z++) {
-			for (y = 0; y < Lines; y++) {
-				for (x = 0; x < Samples; x++) {
-					if (1 == fread(inBuffer, sampleSize, 1, fp)) {
-
-						if (ByteOrder == Msb) {
-							switch (sampleSize) {
-							case 2:
-								swapBuffer[1] = inBuffer[0];
-								swapBuffer[0] = inBuffer[1];
-								break;
-							case 4:
-								swapBuffer[3] = inBuffer[0];
-								swapBuffer[2] = inBuffer[1];
-								swapBuffer[1] = inBuffer[2];
-								swapBuffer[0] = inBuffer[3];
-								break;
-							default:;
-							}
-
-							for (element = 0; element < sampleSize; element++) {
-								cubeData[offset + element] = swapBuffer[element];
-							}
-						} else {
-							for (element = 0; element < sampleSize; element++) {
-								cubeData[offset + element] = inBuffer[element];
-							}
-						}
-
-						offset += sampleSize; // offset increases by sample size
-
-					} // end of good read
-					else {
-						parse_error("Bad Read for Band Sequential Cube");
-						return NULL;
+	dst = cubeData;
+	if (c->Format == BandSequential) {
+		for (b = lo[2]; b < hi[2]; b++) {
+			offset = c->StartByte - 1 + (b * c->Lines + lo[1]) * c->Samples * ss;
+			if (ns == c->Samples) {
+				/* whole lines, so the band is in one piece */
+				if (fseeko(fp, offset, SEEK_SET) != 0 || fread(dst, lineSize, nl, fp) != nl) {
+					goto bad_read;
+				}
+				dst += lineSize * nl;
+				continue;
+			}
+			for (l = 0; l < nl; l++, dst += lineSize) {
+				if (fseeko(fp, offset + (l * c->Samples + lo[0]) * ss, SEEK_SET) != 0 ||
+				    fread(dst, ss, ns, fp) != ns) {
+					goto bad_read;
+				}
+			}
+		}
+	} else {
+		/*
+		** Tiles run across then down each band; the ones on the right
+		** and bottom edges are padded out to full size.
+		*/
+		tileSize    = c->TileSamples * c->TileLines * ss;
+		tilesPerRow = (c->Samples + c->TileSamples - 1) / c->TileSamples;
+		totalRows   = (c->Lines + c->TileLines - 1) / c->TileLines;
+		sheet       = tilesPerRow * totalRows * tileSize;
+		tc0         = lo[0] / c->TileSamples;
+		tc1         = (hi[0] - 1) / c->TileSamples + 1;
+
+		if ((tileRow = malloc((tc1 - tc0) * tileSize)) == NULL) {
+			free(cubeData);
+			parse_error("Cannot malloc() enough space to hold Cube\n");
+			return NULL;
+		}
+		for (b = lo[2]; b < hi[2]; b++) {
+			for (tr = lo[1] / c->TileLines; tr * c->TileLines < hi[1]; tr++) {
+				offset = c->StartByte - 1 + b * sheet + (tr * tilesPerRow + tc0) * tileSize;
+				if (fseeko(fp, offset, SEEK_SET) != 0 || fread(tileRow, tileSize, tc1 - tc0, fp) != tc1 - tc0) {
+					goto bad_read;
+				}
+				for (r = 0; r < c->TileLines; r++) {
+					y = tr * c->TileLines + r;
+					if (y < lo[1] || y >= hi[1]) continue;
+					dst = cubeData + (((b - lo[2]) * nl + (y - lo[1])) * ns) * ss;
+					for (t = tc0; t < tc1; t++) {
+						x0 = max(t * c->TileSamples, lo[0]);
+						x1 = min((t + 1) * c->TileSamples, hi[0]);
+						memcpy(dst + (x0 - lo[0]) * ss,
+						       tileRow + (t - tc0) * tileSize + (r * c->TileSamples + x0 - t * c->TileSamples) * ss,
+						       (x1 - x0) * ss);
 					}
-				} // end x
-			}     // end y
-		}         // end z
-	}             // end BandSequential
-
-	if (Format == I3Tile) {
-		linearOffset = 0; // Where the write starts to the storage area
-		// printf("totalRows = %lld\n", totalRows);
-		for (Bands = 0; Bands < totalBands; Bands++) {
-			for (Row = 0; Row < totalRows; Row++) {
-				for (row = 0; row < TileLines; row++) {
-					for (tiles = 0; tiles < tilesPerRow; tiles++) {
-						offset = StartByte - 1;
-						offset += Bands * (Samples * Lines *
-						                   sampleSize); // How many whole "sheets" we have read
-						offset += (Row * tilesPerRow *
-						           tileSize); // This is the number of full Rows of full tiles
-						offset += (tiles * tileSize); // This is the offset of the number of full
-						                              // tiles already read in the Row
-						offset +=
-						    (row * TileSamples *
-						     sampleSize); // How many full rows we have read so far in this tile
-
-						fseeko(fp, offset, SEEK_SET); // for Tiled, fseeko() each TileSample start
-
-						for (x = 0; x < TileSamples; x++) { // Reading across a tile
-							if (1 == fread(inBuffer, sampleSize, 1, fp)) {
-
-								if ((subTileSamples != 0) && (tiles == (tilesPerRow - 1))) {
-									if (x >= subTileSamples) {
-										continue; // We read it, we just don't put it in the
-										          // structure
-									}
-								}
-
-								if ((subTileLines != 0) && (Row == (totalRows - 1))) {
-									if (row >= subTileLines) {
-										continue; // We read it, we just don't put it in the
-										          // structure
-									}
-								}
-
-								if (ByteOrder == Msb) {
-									switch (sampleSize) {
-									case 2:
-										swapBuffer[1] = inBuffer[0];
-										swapBuffer[0] = inBuffer[1];
-										break;
-									case 4:
-										swapBuffer[3] = inBuffer[0];
-										swapBuffer[2] = inBuffer[1];
-										swapBuffer[1] = inBuffer[2];
-										swapBuffer[0] = inBuffer[3];
-										break;
-									default:;
-									}
-
-									for (element = 0; element < sampleSize; element++) {
-										cubeData[linearOffset + element] = swapBuffer[element];
-									}
-								} else {
-									for (element = 0; element < sampleSize; element++) {
-										cubeData[linearOffset + element] = inBuffer[element];
-									}
-								}
-								linearOffset += sampleSize; // linearOffset into the RAM data just
-								                            // keeps incrementing
+				}
+			}
+		}
+		free(tileRow);
+	}
 
-							} // end of good read
+	if (c->ByteOrder == Msb) {
+		MSB(cubeData, allSized / ss, ss);
+	} else {
+		LSB(cubeData, allSized / ss, ss);
+	}
 
-							else {
-								parse_error("Bad Read for Tile Cube\n");
-								return NULL;
-							}
-						} // end TileSamples
-					}     // end tilesPerRow
-				}         // end rows
-			}             // end Rows
-		}                 // end Bands
-	}                     // end I3Tile
-
-	switch (sampleSize) {
+	switch (ss) {
 	case 1: cubeElement  = DV_UINT8; break;
 	case 2: cubeElement  = DV_INT16; break;
 	case 4: cubeElement  = DV_FLOAT; break;
 	default: cubeElement = DV_UINT8;
 	}
 
-	dv_struct = newVal(BSQ, Samples, Lines, totalBands, cubeElement, cubeData);
-
-#ifdef CUBEDEBUG
-	fpc = fopen("bincube.bin", "wb");
-	fwrite(cubeData, allSized, 1, fpc);
-	fclose(fpc);
-#endif
-
-	cubeData = NULL;
+	return newVal(BSQ, ns, nl, nb, cubeElement, cubeData);
 
-	return dv_struct;
+bad_read:
+	free(tileRow);
+	free(cubeData);
+	parse_error(c->Format == BandSequential ? "Bad Read for Band Sequential Cube" : "Bad Read for Tile Cube\n");
+	return NULL;
 }
 
-int getCubeParams(FILE* fp)
+/* the Core of the cube label, which fp is at the start of */
+static int getCubeParams(FILE* fp, Isis3Core* c)
 {
-	int retVal = 1;
+	char line[2048], s1[200], s2[200], s3[200], s4[200];
 	int count;
-	fgets(inputString, 2046, fp);
-	sscanf(inputString, "%s%s%s%s", string1, string2, string3, string4);
-	if (strcmp("IsisCube", string3) != 0) {
+
+	c->StartByte   = 1;
+	c->Format      = BandSequential;
+	c->TileSamples = c->TileLines = 1;
+	c->Samples = c->Lines = c->Bands = 1;
+	c->sampleSize = 1;
+	c->ByteOrder  = Lsb;
+	c->Base       = 0.0;
+	c->Multiplier = 1.0;
+
+	if (fgets(line, sizeof(line), fp) == NULL ||
+	    sscanf(line, "%199s%199s%199s%199s", s1, s2, s3, s4) < 3 || strcmp("IsisCube", s3) != 0) {
 		parse_error("This is not an Isis3 Cube\n");
 		return -1;
 	}
 
-	while (strcmp("End_Object", string1) != 0) {
-		fgets(inputString, 2046, fp);
-		count = sscanf(inputString, "%s%s%s%s", string1, string2, string3, string4);
-		if (strlen(inputString) < 3) { // Some blank lines
-			continue;
+	s1[0] = '\0';
+	while (strcmp("End_Object", s1) != 0) {
+		if (fgets(line, sizeof(line), fp) == NULL) {
+			parse_error("This is not an Isis3 Cube\n");
+			return -1;
 		}
-
+		count = sscanf(line, "%199s%199s%199s%199s", s1, s2, s3, s4);
 		if (count != 3) { // There something to parse out only if there are three strings
 			continue;
 		}
 
-		if (strcmp("StartByte", string1) == 0) {
-			sscanf(string3, "%d", &StartByte);
-		}
-
-		else if (strcmp("Format", string1) == 0) {
-			if (strcmp("Tile", string3) == 0) {
-				Format = I3Tile;
-			} else {
-				Format = BandSequential;
-			}
-		}
-
-		else if (strcmp("TileSamples", string1) == 0) {
-			sscanf(string3, "%zd", &TileSamples);
-		}
-
-		else if (strcmp("TileLines", string1) == 0) {
-			sscanf(string3, "%zd", &TileLines);
-		}
-
-		else if (strcmp("Samples", string1) == 0) {
-			sscanf(string3, "%zd", &Samples);
-		}
-
-		else if (strcmp("Lines", string1) == 0) {
-			sscanf(string3, "%zd", &Lines);
-		}
-
-		else if (strcmp("Bands", string1) == 0) {
-			sscanf(string3, "%zd", &totalBands);
-		}
-
-		else if (strcmp("Type", string1) == 0) {
-			if (strcmp("UnsignedByte", string3) == 0) {
-				sampleSize = 1;
-			} else if (strcmp("SignedWord", string3) == 0) {
-				sampleSize = 2;
-			} else {
-				sampleSize = 4; // only other choice is Real which is really float of size 4
-			}
-		}
-
-		else if (strcmp("ByteOrder", string1) == 0) {
-			if (strcmp("Lsb", string3) == 0) {
-				ByteOrder = Lsb;
+		if (strcmp("StartByte", s1) == 0) {
+			sscanf(s3, "%zu", &c->StartByte);
+		} else if (strcmp("Format", s1) == 0) {
+			c->Format = (strcmp("Tile", s3) == 0 ? I3Tile : BandSequential);
+		} else if (strcmp("TileSamples", s1) == 0) {
+			sscanf(s3, "%zu", &c->TileSamples);
+		} else if (strcmp("TileLines", s1) == 0) {
+			sscanf(s3, "%zu", &c->TileLines);
+		} else if (strcmp("Samples", s1) == 0) {
+			sscanf(s3, "%zu", &c->Samples);
+		} else if (strcmp("Lines", s1) == 0) {
+			sscanf(s3, "%zu", &c->Lines);
+		} else if (strcmp("Bands", s1) == 0) {
+			sscanf(s3, "%zu", &c->Bands);
+		} else if (strcmp("Type", s1) == 0) {
+			if (strcmp("UnsignedByte", s3) == 0) {
+				c->sampleSize = 1;
+			} else if (strcmp("SignedWord", s3) == 0) {
+				c->sampleSize = 2;
 			} else {
-				ByteOrder = Msb;
+				c->sampleSize = 4; // only other choice is Real which is really float of size 4
 			}
+		} else if (strcmp("ByteOrder", s1) == 0) {
+			c->ByteOrder = (strcmp("Lsb", s3) == 0 ? Lsb : Msb);
+		} else if (strcmp("Base", s1) == 0) {
+			sscanf(s3, "%lf", &c->Base);
+		} else if (strcmp("Multiplier", s1) == 0) {
+			sscanf(s3, "%lf", &c->Multiplier);
 		}
+	}
 
-		else if (strcmp("Base", string1) == 0) {
-			sscanf(string3, "%lf", &Base);
-		}
-
-		else if (strcmp("Multiplier", string1) == 0) {
-			sscanf(string3, "%lf", &Multiplier);
-		}
-
-		else {
-			; // nothing for now
-		}
-	} // end of the while loop
-
-	// parse_error("Completed parsing cube parameters...\n");
-
-	return retVal;
+	if (c->StartByte < 1 || c->Samples < 1 || c->Lines < 1 || c->Bands < 1 ||
+	    (c->Format == I3Tile && (c->TileSamples < 1 || c->TileLines < 1))) {
+		parse_error("Bad cube dimensions in Isis3 label\n");
+		return -1;
+	}
+	return 1;
 }
 
-int writeCube(FILE* fp, minIsisInfo* isisinfo, unsigned char* data)
+/* bytes in a pixel of the given Type */
+static size_t pixelSize(const char* type)
 {
-	unsigned char* cubeData = NULL;
-	unsigned char outBuffer[4];
-	unsigned char swapBuffer[4];
-	unsigned char fakeBuffer[] = {0, 0, 0, 0};
-	int cubeElement            = 0;
-	int x, y, z;
-	int writeCount        = 0;
-	int wrtSampleSize     = 0;
-	size_t wrtTileSize    = 0;
-	size_t wrtTileSamples = 0;
-
-	size_t wrtSubTileSize    = 0;
-	size_t wrtTiles          = 0;
-	size_t wrt_row           = 0;
-	size_t wrtRow            = 0;
-	size_t wrtBands          = 0;
-	size_t wrtTilesPerRow    = 0;
-	size_t wrtSubTileSamples = 0;
-	size_t wrtTotalRows      = 0;
-	size_t wrtSubTileLines   = 0;
-
-	size_t wrtElement  = 0;
-	size_t wrtOffset   = 0;
-	size_t wrtAllSized = 0;
-#undef OUTDEBUG
-#ifdef OUTDEBUG
-	FILE* snog;
-	snog = fopen("data.txt", "wt");
-#endif
-	if (strcmp("UnsignedByte", isisinfo->Type) == 0) {
-		wrtSampleSize = 1;
-	} else if (strcmp("SignedWord", isisinfo->Type) == 0) {
-		wrtSampleSize = 2;
-	} else {
-		wrtSampleSize = 4; // only other choice is Real which is really float of size 4
+	if (type != NULL && strcmp("UnsignedByte", type) == 0) {
+		return 1;
+	} else if (type != NULL && strcmp("SignedWord", type) == 0) {
+		return 2;
 	}
+	return 4; // only other choice is Real which is really float of size 4
+}
 
-	wrtAllSized = (size_t)isisinfo->Samples * (size_t)isisinfo->Lines * (size_t)isisinfo->Bands *
-	              (size_t)wrtSampleSize;
+/*
+** Write the cube data, a band at a time for BandSequential or a row of
+** tiles at a time for Tile, through a buffer that is swapped to the
+** file's byte order.
+*/
+static int writeCube(FILE* fp, minIsisInfo* isisinfo, unsigned char* data)
+{
+	unsigned char* buf;
+	size_t ss, ns = isisinfo->Samples, nl = isisinfo->Lines, nb = isisinfo->Bands;
+	size_t ts, tl, tileSize, tilesPerRow, totalRows, n, b, tr, t, r, y, x0, x1;
+	int msb = isisinfo->ByteOrder != NULL && strcmp(isisinfo->ByteOrder, "Lsb") != 0;
 
-	if (wrtAllSized >= 2147483647ll) {
+	ss = pixelSize(isisinfo->Type);
+	if (ns * nl * nb * ss >= 2147483647ll) {
 		char biggie[64];
-		sprintf(biggie, "%zu", wrtAllSized);
+		sprintf(biggie, "%zu", ns * nl * nb * ss);
 		commaize(biggie);
 		parse_error("Warning:  Size is %s bytes.\n", biggie);
 	}
 
-	cubeData = data;
-
-	if (strcmp(isisinfo->Format, "BandSequential") == 0) {
-
-		wrtOffset = 0; // This is the offset in to the storage structure
-		for (z = 0; z < isisinfo->Bands; z++) {
-			for (y = 0; y < isisinfo->Lines; y++) {
-				for (x = 0; x < isisinfo->Samples; x++) {
-					for (wrtElement = 0; wrtElement < wrtSampleSize; wrtElement++) {
-						outBuffer[wrtElement] = cubeData[wrtOffset + wrtElement];
-					}
-					if (strcmp(isisinfo->ByteOrder, "Lsb") == 0) {
-						writeCount = fwrite(outBuffer, wrtSampleSize, 1, fp);
-					} else {
-						switch (wrtSampleSize) {
-						case 2:
-							swapBuffer[1] = outBuffer[0];
-							swapBuffer[0] = outBuffer[1];
-							break;
-						case 4:
-							swapBuffer[3] = outBuffer[0];
-							swapBuffer[2] = outBuffer[1];
-							swapBuffer[1] = outBuffer[2];
-							swapBuffer[0] = outBuffer[3];
-							break;
-						default:;
-						}
-						writeCount = fwrite(swapBuffer, wrtSampleSize, 1, fp);
-					}
-					if (writeCount != 1) {
-						parse_error("Bad Write for Band Sequential Cube");
-						return 0;
+	if (isisinfo->Format == NULL || strcmp(isisinfo->Format, "Tile") != 0) {
+		ts = ns;
+		tl = nl;
+	} else {
+		ts = isisinfo->TileSamples;
+		tl = isisinfo->TileLines;
+	}
+	tileSize    = ts * tl * ss;
+	tilesPerRow = (ns + ts - 1) / ts;
+	totalRows   = (nl + tl - 1) / tl;
+	n           = tilesPerRow * tileSize;
+
+	/* a BandSequential band is a single row of one tile */
+	if ((buf = calloc(n, 1)) == NULL) {
+		parse_error("Could not allocate space for writing cube");
+		return 0;
+	}
+	for (b = 0; b < nb; b++) {
+		for (tr = 0; tr < totalRows; tr++) {
+			for (t = 0; t < tilesPerRow; t++) {
+				x0 = t * ts;
+				x1 = min(x0 + ts, ns);
+				for (r = 0; r < tl; r++) {
+					y = tr * tl + r;
+					if (y >= nl) {
+						/* padding below the last line */
+						memset(buf + t * tileSize + r * ts * ss, 0, ts * ss);
+						continue;
 					}
-
-					wrtOffset += wrtSampleSize;
-
-				} // end x
-			}     // end y
-		}         // end z
-	}             // end BandSequential
-
-	else { // Tiled
-
-		wrtTileSize    = isisinfo->TileSamples * isisinfo->TileLines * wrtSampleSize;
-		wrtTilesPerRow = isisinfo->Samples / isisinfo->TileSamples;
-		wrtSubTileSamples =
-		    isisinfo->Samples % isisinfo->TileSamples; // What is left over going across
-		wrtSubTileSize  = wrtSubTileSamples * isisinfo->TileLines * wrtSampleSize;
-		wrtTotalRows    = isisinfo->Lines / isisinfo->TileLines;
-		wrtSubTileLines = isisinfo->Lines % isisinfo->TileLines; // What is left going down
-
-		if (wrtSubTileSamples != 0) {
-			wrtTilesPerRow += 1;
-		}
-		if (wrtSubTileLines != 0) {
-			wrtTotalRows += 1;
+					memcpy(buf + t * tileSize + r * ts * ss, data + ((b * nl + y) * ns + x0) * ss, (x1 - x0) * ss);
+				}
+			}
+			if (msb) {
+				MSB(buf, n / ss, ss);
+			} else {
+				LSB(buf, n / ss, ss);
+			}
+			if (fwrite(buf, 1, n, fp) != n) {
+				free(buf);
+				parse_error(ts == ns && tl == nl ? "Bad Write for Band Sequential Cube" : "Bad Write for Tiled Data");
+				return 0;
+			}
 		}
-
-		for (wrtBands = 0; wrtBands < isisinfo->Bands; wrtBands++) {
-			for (wrtRow = 0; wrtRow < wrtTotalRows; wrtRow++) {
-				for (wrtTiles = 0; wrtTiles < wrtTilesPerRow; wrtTiles++) {
-					for (wrt_row = 0; wrt_row < isisinfo->TileLines; wrt_row++) {
-						wrtOffset = 0;
-						wrtOffset += wrtBands * (isisinfo->Samples * isisinfo->Lines * wrtSampleSize); // How many whole "sheets" we have read
-						wrtOffset += (wrtRow * wrtTilesPerRow *
-						              wrtTileSize); // This is the number of full Rows of full tiles
-						wrtOffset +=
-						    (wrtTiles * isisinfo->TileSamples *
-						     wrtSampleSize); // This is the X offset from the left, tile widths
-						wrtOffset += (wrt_row * isisinfo->TileSamples *
-						              (wrtTilesPerRow)*wrtSampleSize); // This is the Y offset
-
-#ifdef OUTDEBUG
-						fprintf(snog, "Bands=%d, Rows=%d, row=%3d, Tiles=%d, wrtOffset=%8d\n",
-						        wrtBands, wrtRow, wrt_row, wrtTiles, wrtOffset);
-#endif
-						writeCount = 1;
-
-						for (x = 0; x < isisinfo->TileSamples; x++) { // Reading across a tile
-
-							if (writeCount != 1) {
-								parse_error("Bad Write for Tiled Data");
-								return 0;
-							}
-
-							if ((wrtTiles == (wrtTilesPerRow - 1)) && (wrtSubTileSamples != 0)) {
-
-								if (x >= wrtSubTileSamples) {
-									writeCount = fwrite(fakeBuffer, wrtSampleSize, 1, fp);
-									continue;
-								}
-							}
-
-							if ((wrtRow == (wrtTotalRows - 1)) && (wrtSubTileLines != 0)) {
-
-								if (wrtRow >= wrtSubTileLines) {
-									writeCount = fwrite(fakeBuffer, wrtSampleSize, 1, fp);
-									continue;
-								}
-							}
-
-							for (wrtElement = 0; wrtElement < wrtSampleSize; wrtElement++) {
-								outBuffer[wrtElement] = cubeData[wrtOffset + wrtElement];
-							}
-							if (strcmp(isisinfo->ByteOrder, "Lsb") == 0) {
-								writeCount = fwrite(outBuffer, wrtSampleSize, 1, fp);
-							} else {
-								switch (wrtSampleSize) {
-								case 2:
-									swapBuffer[1] = outBuffer[0];
-									swapBuffer[0] = outBuffer[1];
-									break;
-								case 4:
-									swapBuffer[3] = outBuffer[0];
-									swapBuffer[2] = outBuffer[1];
-									swapBuffer[1] = outBuffer[2];
-									swapBuffer[0] = outBuffer[3];
-									break;
-								default:;
-								}
-								writeCount = fwrite(swapBuffer, wrtSampleSize, 1, fp);
-							}
-
-							wrtOffset += wrtSampleSize;
-
-						} // end TileSamples
-					}     // end tilesPerRow
-				}         // end rows
-			}             // end Rows
-		}                 // end Bands
-	}                     // end tiled
-#ifdef OUTDEBUG
-	fclose(snog);
-#endif
-	cubeData = NULL;
+	}
+	free(buf);
 	return 1;
 }
@@ -1,6 +1,8 @@
 #ifndef ISIS3INCLUDE_H_
 #define ISIS3INCLUDE_H_
 
+#include <stddef.h>
+
 #define DV_NAMEBUF_MAX 1025
 
 typedef enum _ISIS3ENUM {
@@ -58,6 +60,21 @@ typedef struct minISISINFO {
 
 } minIsisInfo;
 
+/* Core of a cube label, as needed to find the data */
+typedef struct _Isis3Core {
+	size_t StartByte; /* 1 based */
+	int Format;       /* I3Tile or BandSequential */
+	size_t TileSamples;
+	size_t TileLines;
+	size_t Samples;
+	size_t Lines;
+	size_t Bands;
+	size_t sampleSize; /* bytes per pixel, from Type */
+	int ByteOrder;     /* Lsb or Msb */
+	double Base;
+	double Multiplier;
+} Isis3Core;
+
 typedef struct _IsisCube {
 	// Object == Core
 	char Core[128];  // filename if data in separate file
@@ -4,6 +4,7 @@
 #include "header.h"
 #include "io_lablib3.h"
 #include "io_loadmod.h"
+#include "parallel.h"
 #include "parser.h"
 #include <ctype.h>
 #include <errno.h>
@@ -102,6 +103,13 @@ typedef struct _dataKeys {
 
 } dataKey;
 
+/* Which part of a TABLE object load_pds() should read */
+typedef struct _tableSubset {
+	Var* columns;  /* STRING or TEXT of column names, NULL for all of them */
+	int start_row; /* first row to read, 1 based */
+	int nrows;     /* number of rows to read, -1 for the rest of the table */
+} tableSubset;
+
 Var* dv_LoadISISFromPDS_New(FILE* fp, char* fn, int dptr, OBJDESC* qube);
 Var* dv_LoadISISSuffixesFromPDS_New(FILE* fp, char* fname, size_t dptr, OBJDESC* qube);
 Var* dv_LoadImage_New(FILE* fp, char* fn, int dptr, OBJDESC* image);
@@ -110,7 +118,6 @@ Var* dv_LoadHistogram_New(FILE* fp, char* fn, int dptr, OBJDESC* hist);
 static char* history_parse_buffer(FILE* in);
 static char* history_remove_isis_indents(const char* history);
 
-static void Set_Col_Var(Var** Data, FIELD** f, LABEL* label, int* size, char** Bufs);
 static void ProcessGroupIntoLabel(FILE* fp, int record_bytes, Var* v, char* name);
 static void ProcessObjectIntoLabel(FILE* fp, int record_bytes, Var* v, char* name, objectInfo* oi);
 static Var* ProcessIntoLabel(FILE* fp, int record_bytes, Var* v, int depth, size_t* label_ptr,
@@ -119,19 +126,18 @@ Var* write_PDS_Qube(Var* core, Var* side, Var* bottom, Var* back, FILE* fp);
 
 static Var* do_key(KEYWORD* key);
 static int readDataForObjects(Var* st, dataKey objSize[], int nObj, int load_suffix_data,
-                              int continueOnError);
+                              const tableSubset* subset, int continueOnError);
 static Var* traverseObj(OBJDESC* top, Var* v, dataKey objSizeMap[], int* nObj, OBJDESC* pFileObj,
                         Var* pFileVar);
 static char* getGeneralObjClass(const char* objClassName);
 static void pickFilename(char* outFname, const char* inFname);
 static int rfQube(const dataKey* objSize, Var* vQube, int load_suffix_data);
-static void rfBitField(int* j, char** Bufs, char* tmpbuf, FIELD** f, int ptr, int row, int* size,
-                       int num_items);
-static int rfTable(dataKey* objSize, Var* ob, LABEL* label);
+static int rfTable(dataKey* objSize, Var* ob, LABEL* label, const tableSubset* subset);
 static int rfImage(dataKey* objSize, Var* ob);
 static int rfHistory(dataKey* objSize, Var* ob);
 static int rfHistogram(dataKey* objSize, Var* ob);
-static Var* do_loadPDS(vfuncptr func, char* filename, int data, int suffix_data);
+static Var* do_loadPDS(vfuncptr func, char* filename, int data, int suffix_data,
+                       const tableSubset* subset);
 #ifdef HAVE_LIBXML2
 static Var* do_loadPDS4(vfuncptr func, char* filename, int data, int suffix_data);
 Var* dv_loadPDS4(char* filename);
@@ -1579,13 +1585,17 @@ Var* ReadPDS(vfuncptr func, Var* arg)
 	char* filename  = NULL;
 	int data        = 1;
 	int suffix_data = 0;
+	tableSubset subset = {NULL, 1, -1};
 	int i;
 
-	Alist alist[4];
+	Alist alist[7];
 	alist[0]      = make_alist("filename", ID_UNK, NULL, &fn);
 	alist[1]      = make_alist("data", DV_INT32, NULL, &data);
 	alist[2]      = make_alist("suffix_data", DV_INT32, NULL, &suffix_data);
-	alist[3].name = NULL;
+	alist[3]      = make_alist("columns", ID_UNK, NULL, &subset.columns);
+	alist[4]      = make_alist("start_row", DV_INT32, NULL, &subset.start_row);
+	alist[5]      = make_alist("nrows", DV_INT32, NULL, &subset.nrows);
+	alist[6].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -1594,12 +1604,22 @@ Var* ReadPDS(vfuncptr func, Var* arg)
 		return NULL;
 	}
 
+	if (subset.columns && V_TYPE(subset.columns) != ID_STRING && V_TYPE(subset.columns) != ID_TEXT) {
+		parse_error("Illegal argument to function %s(%s), expected STRING or TEXT", func->name,
+		            "columns");
+		return (NULL);
+	}
+	if (subset.start_row < 1) {
+		parse_error("%s(): start_row must be 1 or more", func->name);
+		return (NULL);
+	}
+
 	/* Handle loading many filenames */
 	if (V_TYPE(fn) == ID_TEXT) {
 		Var* s = new_struct(V_TEXT(fn).Row);
 		for (i = 0; i < V_TEXT(fn).Row; i++) {
 			filename = strdup(V_TEXT(fn).text[i]);
-			Var* t   = do_loadPDS(func, filename, data, suffix_data);
+			Var* t   = do_loadPDS(func, filename, data, suffix_data, &subset);
 			if (t) {
 				add_struct(s, filename, t);
 			}
@@ -1612,14 +1632,15 @@ Var* ReadPDS(vfuncptr func, Var* arg)
 		}
 	} else if (V_TYPE(fn) == ID_STRING) {
 		filename = V_STRING(fn);
-		return (do_loadPDS(func, filename, data, suffix_data));
+		return (do_loadPDS(func, filename, data, suffix_data, &subset));
 	} else {
 		parse_error("Illegal argument to function %s(%s), expected STRING", func->name, "filename");
 		return (NULL);
 	}
 }
 
-static Var* do_loadPDS(vfuncptr func, char* filename, int data, int suffix_data)
+static Var* do_loadPDS(vfuncptr func, char* filename, int data, int suffix_data,
+                       const tableSubset* subset)
 {
 	OBJDESC *ob, *obFile;
 	KEYWORD* key;
@@ -1696,7 +1717,7 @@ static Var* do_loadPDS(vfuncptr func, char* filename, int data, int suffix_data)
 
 	if (data) {
 		// TODO Read data within explicit FILE objects
-		readDataForObjects(v, objSize, nObj, suffix_data, 1);
+		readDataForObjects(v, objSize, nObj, suffix_data, subset, 1);
 	}
 
 	for (i=0; i < nObj; ++i) {
@@ -1716,7 +1737,8 @@ static Var* do_loadPDS(vfuncptr func, char* filename, int data, int suffix_data)
 	return (v);
 }
 
-static int readDataForObjects(Var* st, dataKey objSize[], int nObj, int load_suffix_data, int continueOnError)
+static int readDataForObjects(Var* st, dataKey objSize[], int nObj, int load_suffix_data,
+                              const tableSubset* subset, int continueOnError)
 {
 	int i;
 	int rc = 1;
@@ -1750,7 +1772,7 @@ static int readDataForObjects(Var* st, dataKey objSize[], int nObj, int load_suf
 						return 0;
 					}
 
-					rc &= rfTable(&objSize[i], sub, label);
+					rc &= rfTable(&objSize[i], sub, label, subset);
 				} else if (strcasecmp(objClass, GEN_OBJ_CLASS_HISTOGRAM) == 0) {
 					rc &= rfHistogram(&objSize[i], sub);
 				}
@@ -1830,378 +1852,445 @@ static int rfQube(const dataKey* objSize, Var* vQube, int load_suffix_data)
 	return 1;
 }
 
-static void rfBitField(int* j, char** Bufs, char* tmpbuf, FIELD** f, int ptr, int row, int* size, int num_items)
+/**
+ ** TABLE objects.
+ **
+ ** rfTable() reads the selected rows of a table in blocks of whole
+ ** records and decodes each selected column straight into the array that
+ ** ends up in the davinci struct; nothing is staged per column.  Every
+ ** block is decoded in parallel, one unit of work per column and row
+ ** slice.  Byte order is handled while decoding, so the same code runs on
+ ** either endian host.
+ **
+ ** BIT_COLUMNs share the bytes of their parent BIT_STRING column and are
+ ** shifted and masked out of it in the same pass.
+ **/
+
+#define TABLE_BLOCK_BYTES (8 << 20) /* records read per block, in bytes */
+#define TABLE_SLICE_ROWS 4096       /* rows below which a column isn't split up */
+
+typedef struct {
+	FIELD* f;
+	int dim;     /* items per row */
+	int format;  /* DV_xxx of the output; 0 for CHARACTER columns */
+	int scaled;  /* output is raw * scale + offset, as double */
+	void* data;  /* nrows * dim output items */
+	char** text; /* nrows output strings for CHARACTER columns */
+} tableColumn;
+
+typedef struct {
+	tableColumn* cols;
+	int ncols;
+	int nslices;
+	const unsigned char* block; /* first record of the block */
+	int reclen;
+	size_t row;  /* output row of the first record in the block */
+	size_t rows; /* records in the block */
+} tableBlock;
+
+static int table_is_msb(EFORMAT e)
 {
-	int i = (*j);
-	/*
-	** We've already loaded the entire contents of the all the bit collumns into a single value,
-	** now we're going to iterate through each bit-collumn and place it (but first we step one
-	*forward
-	** so that we are now on the first bit collumn
-	*/
-	i++;
-	while (i < num_items && f[i]->bitfield != NULL) {
-		memcpy(Bufs[i] + row * size[i], (tmpbuf + ptr),
-		       size[i]); /*Copy the whole thing in we'll fix it later */
-		i++;
-	}
-	*j = (i - 1);
+	return (e == MSB_INTEGER || e == MSB_UNSIGNED_INTEGER || e == MSB_BIT_FIELD || e == IEEE_REAL);
 }
 
-static int rfTable(dataKey* objSize, Var* ob, LABEL* label)
+static int table_is_signed(EFORMAT e)
 {
-	Var* data;
-	char** bufs;
-	char* tmpbuf;
-	int i, j, k;
-	int fd;
-	int Offset;
-	FIELD** f;
-	int* size;
-	int err;
-	int num_items = 0;
-	int rc;
-	char* fileName;
-
-	if (objSize->FileName == NULL) {
-		fprintf(stderr, "Null filename while reading TABLE\n");
-		return 0;
-	}
-
-	fileName = (char*)alloca(strlen(objSize->FileName) + 1);
-	pickFilename(fileName, objSize->FileName);
-	parse_error("Reading %s from %s...\n", objSize->Name, fileName);
-
-	f         = (FIELD**)label->fields.a;
-	num_items = label->fields.size; // This is a count of BOTH columns AND bit-columns
+	return (e == MSB_INTEGER || e == LSB_INTEGER);
+}
 
-	// Add new structure to parent ob
-	data = new_struct(0);
+static u64 table_uint(const unsigned char* p, int size, int msb)
+{
+	u64 u = 0;
+	int i;
 
-	// Initialize a set of buffers to read in the data
-	bufs   = (char**)calloc(num_items, sizeof(char*));
-	tmpbuf = (char*)calloc(label->reclen, 1);
-	size   = (int*)calloc(num_items, sizeof(int));
-	for (j = 0; j < num_items; j++) {
-		size[j] = f[j]->dimension ? f[j]->size * f[j]->dimension : f[j]->size;
-		bufs[j] = (char*)calloc((label->nrows * size[j]), sizeof(char));
+	if (msb) {
+		for (i = 0; i < size; i++) u = (u << 8) | p[i];
+	} else {
+		for (i = size - 1; i >= 0; i--) u = (u << 8) | p[i];
 	}
+	return u;
+}
 
-	Offset = objSize->dptr;
-
-	// TODO(rswinkle): Why are we using open/read instead of fopen/fread?
-	// and while we're at it why are we reading into an allocated buffer just to allocate
-	// another and copy it when creating the davinci arrays?
-#if defined(__CYGWIN__) || defined(__MINGW32__)
-	fd = open(fileName, O_RDONLY | O_BINARY, 0);
-#else
-	fd                                   = open(fileName, O_RDONLY, 0);
-#endif /* __CYGWIN__ */
+static i64 table_sign_extend(u64 u, int bits)
+{
+	if (bits < 64 && ((u >> (bits - 1)) & 1)) u |= ~(u64)0 << bits;
+	return (i64)u;
+}
 
-	rc = 1;
-	if (fd < 0) {
-		fprintf(stderr, "Unable to open file for reading \"%s\". Reason: %s.\n", fileName, strerror(errno));
-		rc = 0;
-	} else {
-		lseek(fd, Offset, SEEK_SET);
+static void table_ascii(char* num, const unsigned char* p, int size)
+{
+	if (size > 255) size = 255;
+	memcpy(num, p, size);
+	num[size] = '\0';
+}
 
-		for (i = 0; i < label->nrows && rc; i++) {
-			/*Read each row as a block */
-			if ((err = read(fd, tmpbuf, label->reclen)) != label->reclen) {
-				fprintf(stderr, "Short file: %s. Read %d bytes, should be %d\n", fileName, err,
-				        label->reclen);
-				rc = 0;
-			} else {
-				for (j = 0; j < num_items; j++) {
-					/*Place in the approiate buffer */
-					memcpy((bufs[j] + i * size[j]), (tmpbuf + f[j]->start), size[j]);
-					if (f[j]->eformat == MSB_BIT_FIELD)
-						rfBitField(&j, bufs, tmpbuf, f, f[j]->start, i, size, num_items);
-				}
-			}
-		}
+static i64 table_integer(const FIELD* f, const unsigned char* p)
+{
+	char num[256];
+	i32 i;
+	u64 u;
 
-		close(fd);
+	switch (f->eformat) {
+	case ASCII_INTEGER: table_ascii(num, p, f->size); return atoi(num);
+	case BYTE_OFFSET: memcpy(&i, p, sizeof(i)); return i;
+	default: break;
 	}
 
-	if (rc) {
-		/*Set each field Var's data and parameter information */
-		Set_Col_Var(&data, f, label, size, bufs);
-
-		add_struct(ob, "data", data);
+	u = table_uint(p, f->size, table_is_msb(f->eformat));
+	if (f->bitfield) {
+		u = (u >> f->bitfield->shifts) & f->bitfield->mask;
+		if (table_is_signed(f->bitfield->type)) return table_sign_extend(u, f->bitfield->bits);
+		return (i64)u;
 	}
+	if (table_is_signed(f->eformat)) return table_sign_extend(u, f->size * 8);
+	return (i64)u;
+}
 
-	free(tmpbuf);
-	free(size);
-	for (j = 0; j < num_items; j++) free(bufs[j]);
-	free(bufs);
+static double table_real(const FIELD* f, const unsigned char* p)
+{
+	char num[256];
+	u32 u32bits;
+	u64 u64bits;
+	float fv;
+	double dv;
+
+	if (f->eformat == ASCII_REAL) {
+		table_ascii(num, p, f->size);
+		return atof(num);
+	}
+	if (f->size == 4) {
+		u32bits = (u32)table_uint(p, 4, table_is_msb(f->eformat));
+		memcpy(&fv, &u32bits, sizeof(fv));
+		return fv;
+	}
+	u64bits = table_uint(p, 8, table_is_msb(f->eformat));
+	memcpy(&dv, &u64bits, sizeof(dv));
+	return dv;
+}
 
-	return rc;
+static double table_value(const FIELD* f, const unsigned char* p)
+{
+	switch (f->eformat) {
+	case IEEE_REAL:
+	case PC_REAL:
+	case ASCII_REAL: return table_real(f, p);
+	case MSB_UNSIGNED_INTEGER:
+	case LSB_UNSIGNED_INTEGER:
+		if (!f->bitfield) return (double)table_uint(p, f->size, table_is_msb(f->eformat));
+		break;
+	default: break;
+	}
+	return (double)table_integer(f, p);
 }
 
-static double Scale(int size, void* ptr, FIELD* f)
+/**
+ ** The davinci format a column is decoded to, 0 for text or -1 if the
+ ** column can't be converted.
+ **/
+static int table_column_format(const FIELD* f, int* scaled)
 {
-	unsigned char* ucp;
-	unsigned int* uip;
-	unsigned short* usp;
-	char* cp;
-	int* ip;
-	short* sp;
-	float* fp;
-	double* dp;
-	char num[256]; /* this was WAY too small at [9] */
+	*scaled = 0;
+	if (f->eformat == CHARACTER) return 0;
 
-	/*Set up pointer casts for our data type*/
+	if (f->scale != 1.0 || f->offset != 0.0) {
+		*scaled = 1;
+		return DV_DOUBLE;
+	}
 
-	ucp = ptr;
-	uip = ptr;
-	usp = ptr;
-	cp  = ptr;
-	ip  = ptr;
-	sp  = ptr;
-	fp  = ptr;
-	dp  = ptr;
+	if (f->bitfield) return DV_INT32;
 
 	switch (f->eformat) {
-	case LSB_UNSIGNED_INTEGER:
-	case MSB_UNSIGNED_INTEGER:
+	case MSB_INTEGER:
+	case LSB_INTEGER:
 		switch (f->size) {
-		case 4: return (((double)uip[0]) * f->scale + f->offset);
-		case 2: return (((double)usp[0]) * f->scale + f->offset);
-		case 1: return (((double)ucp[0]) * f->scale + f->offset);
+		case 1: return DV_INT8;
+		case 2: return DV_INT16;
+		case 4: return DV_INT32;
+		case 8: return DV_INT64;
 		}
 		break;
-
-	case MSB_INTEGER:
-	case LSB_INTEGER:
+	case MSB_UNSIGNED_INTEGER:
+	case LSB_UNSIGNED_INTEGER:
 		switch (f->size) {
-		case 4: return (((double)ip[0]) * f->scale + f->offset);
-		case 2: return (((double)sp[0]) * f->scale + f->offset);
-		case 1: return (((double)cp[0]) * f->scale + f->offset);
+		case 1: return DV_UINT8;
+		case 2: return DV_UINT16;
+		case 4: return DV_UINT32;
+		case 8: return DV_UINT64;
 		}
-
 		break;
-
 	case IEEE_REAL:
 	case PC_REAL:
 		switch (f->size) {
-		case 8: return (dp[0] * f->scale + f->offset);
-		case 4: return ((double)fp[0] * f->scale + f->offset);
+		case 4: return DV_FLOAT;
+		case 8: return DV_DOUBLE;
 		}
-
 		break;
-	case ASCII_INTEGER:
-		memcpy(num, cp, f->size);
-		num[f->size] = '\0';
-		return ((double)(atoi(num)) * f->scale + f->offset);
-
+	case MSB_BIT_FIELD:
+	case LSB_BIT_FIELD:
+		if (f->size <= 4) return DV_INT32;
 		break;
-	case ASCII_REAL:
-		memcpy(num, cp, f->size);
-		num[f->size] = '\0';
-		return ((double)(atof(num)) * f->scale + f->offset);
-	default:
-		// This should never happen
-		return 0;
+	case BYTE_OFFSET:
+		if (f->size == 4) return DV_INT32;
+		break;
+	case ASCII_INTEGER: return DV_INT32;
+	case ASCII_REAL: return DV_DOUBLE;
+	default: break;
 	}
+	return -1;
+}
 
-	return (0);
+#define TABLE_DECODE(type, expr)                                     \
+	for (i = 0; i < rows; i++, rec += reclen) {                      \
+		p = rec + f->start;                                          \
+		for (k = 0; k < c->dim; k++, p += f->size) {                 \
+			((type*)c->data)[out++] = (type)(expr);                  \
+		}                                                            \
+	}
+
+static void table_decode(tableColumn* c, const unsigned char* rec, int reclen, size_t row, size_t rows)
+{
+	const FIELD* f = c->f;
+	const unsigned char* p;
+	size_t out = row * c->dim;
+	size_t i;
+	int k;
+
+	if (c->format == 0) {
+		for (i = 0; i < rows; i++, rec += reclen) {
+			c->text[row + i] = (char*)calloc(f->size * c->dim + 1, sizeof(char));
+			memcpy(c->text[row + i], rec + f->start, f->size * c->dim);
+		}
+		return;
+	}
+
+	if (c->scaled) {
+		TABLE_DECODE(double, table_value(f, p) * f->scale + f->offset);
+		return;
+	}
+
+	switch (c->format) {
+	case DV_UINT8: TABLE_DECODE(u8, table_integer(f, p)); break;
+	case DV_UINT16: TABLE_DECODE(u16, table_integer(f, p)); break;
+	case DV_UINT32: TABLE_DECODE(u32, table_integer(f, p)); break;
+	case DV_UINT64: TABLE_DECODE(u64, table_uint(p, f->size, table_is_msb(f->eformat))); break;
+	case DV_INT8: TABLE_DECODE(i8, table_integer(f, p)); break;
+	case DV_INT16: TABLE_DECODE(i16, table_integer(f, p)); break;
+	case DV_INT32: TABLE_DECODE(i32, table_integer(f, p)); break;
+	case DV_INT64: TABLE_DECODE(i64, table_integer(f, p)); break;
+	case DV_FLOAT: TABLE_DECODE(float, table_real(f, p)); break;
+	case DV_DOUBLE: TABLE_DECODE(double, table_real(f, p)); break;
+	}
 }
 
-static char* DoScale(int rows, FIELD* f, char* in)
+static void table_decode_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	double* out;
-	void* ptr;
-	int count = 0;
-	int i, j;
-	int dim  = (f->dimension ? f->dimension : 1);
-	int size = f->size;
+	tableBlock* b = (tableBlock*)ctx;
+	size_t item, slice, r0, r1;
+
+	for (item = begin; item < end; item++) {
+		slice = item / b->ncols;
+		r0    = b->rows * slice / b->nslices;
+		r1    = b->rows * (slice + 1) / b->nslices;
+		table_decode(&b->cols[item % b->ncols], b->block + r0 * b->reclen, b->reclen, b->row + r0,
+		             r1 - r0);
+	}
+}
+
+/**
+ ** Is field f one of the requested columns?  Names match either the
+ ** label's NAME or ALIAS_NAME, or the member name load_pds() gives it.
+ **/
+static int table_wants_column(const FIELD* f, const tableSubset* subset)
+{
+	Var* columns;
+	char *want, *name;
+	int i, n, found = 0;
+
+	if (subset == NULL || subset->columns == NULL) return 1;
 
-	out = (double*)calloc(rows * dim, sizeof(double));
-	ptr = in;
-	for (i = 0; i < rows; i++) {
-		for (j = 0; j < dim; j++) {
-			out[count++] = Scale(size, ptr, f);
-			ptr          = (unsigned char*)ptr + size;
+	columns = subset->columns;
+	n       = (V_TYPE(columns) == ID_TEXT ? V_TEXT(columns).Row : 1);
+	for (i = 0; i < n && !found; i++) {
+		want = fix_name(V_TYPE(columns) == ID_TEXT ? V_TEXT(columns).text[i] : V_STRING(columns));
+
+		name  = fix_name(f->name);
+		found = !strcmp(want, name);
+		free(name);
+		if (!found && f->alias) {
+			name  = fix_name(f->alias);
+			found = !strcmp(want, name);
+			free(name);
 		}
+		free(want);
 	}
+	return found;
+}
+
+static void table_free_columns(tableColumn* cols, int ncols, size_t nrows)
+{
+	size_t i;
+	int j;
 
-	free(in);
-	return ((char*)out);
+	for (j = 0; j < ncols; j++) {
+		free(cols[j].data);
+		if (cols[j].text) {
+			for (i = 0; i < nrows; i++) free(cols[j].text[i]);
+			free(cols[j].text);
+		}
+	}
+	free(cols);
 }
 
-static void Set_Col_Var(Var** Data, FIELD** f, LABEL* label, int* size, char** Bufs)
+static int rfTable(dataKey* objSize, Var* ob, LABEL* label, const tableSubset* subset)
 {
-	int j, i, k;
-	void* data;
-	char** text;
-	Var* v;
-	char num[128];
-	int inum;
-	double fnum;
-	int step;
-	int dim;
-	int num_fields;
-	int nitems;
+	Var *data, *v;
+	FIELD** f;
+	FILE* fp;
+	tableColumn* cols;
+	tableBlock block;
+	unsigned char* buf;
+	size_t first, nrows, row, block_rows, n;
+	int num_items, ncols, nthreads;
+	int j, rc;
+	char* fileName;
 
-	num_fields = label->fields.size;
+	if (objSize->FileName == NULL) {
+		fprintf(stderr, "Null filename while reading TABLE\n");
+		return 0;
+	}
 
-	/**
-	*** Note: the calloc in all these routines is stupid, as it
-	***       allocates (nbytes*nitems, 1)
-	**/
-
-	for (j = 0; j < num_fields; j++) {
-		v      = NULL;
-		dim    = (f[j]->dimension ? f[j]->dimension : 1);
-		nitems = label->nrows * dim;
-		step   = 0;
-
-		/* Do appropriate endian conversion */
-		switch (f[j]->eformat) {
-		case LSB_INTEGER:
-		case LSB_UNSIGNED_INTEGER:
-		case LSB_BIT_FIELD: LSB(Bufs[j], label->nrows * dim, f[j]->size); break;
-		case MSB_INTEGER:
-		case MSB_UNSIGNED_INTEGER:
-		case MSB_BIT_FIELD: MSB(Bufs[j], label->nrows * dim, f[j]->size); break;
-		case IEEE_REAL: MSB(Bufs[j], label->nrows * dim, f[j]->size); break;
-		case PC_REAL: LSB(Bufs[j], label->nrows * dim, f[j]->size); break;
-		}
-
-		if (f[j]->scale != 1.0) {
-			/*
-			** special case: result is always a double
-			** regardless of input size
-			*/
-			Bufs[j] = DoScale(label->nrows, f[j], Bufs[j]);
-			data    = calloc(dim * sizeof(double) * label->nrows, sizeof(char));
-			memcpy(data, Bufs[j], dim * sizeof(double) * label->nrows);
-			v = newVal(BSQ, dim, label->nrows, 1, DV_DOUBLE, data);
-		} else {
+	fileName = (char*)alloca(strlen(objSize->FileName) + 1);
+	pickFilename(fileName, objSize->FileName);
+	parse_error("Reading %s from %s...\n", objSize->Name, fileName);
 
-			switch (f[j]->eformat) {
-			case CHARACTER:
-				text = (char**)calloc(label->nrows, sizeof(char*));
-				for (i = 0; i < label->nrows; i++) {
-					text[i] = (char*)calloc(size[j] + 1, sizeof(char));
-					memcpy(text[i], (Bufs[j] + i * size[j]), size[j]);
-					text[i][size[j]] = '\0';
-				}
-				v = newText(label->nrows, text);
-				break;
+	f         = (FIELD**)label->fields.a;
+	num_items = label->fields.size; // This is a count of BOTH columns AND bit-columns
 
-			case MSB_INTEGER:
-			case LSB_INTEGER:
-				switch (f[j]->size) {
-				case 8:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_INT64, data);
-					break;
-				case 4:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_INT32, data);
-					break;
-				case 2:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_INT16, data);
-					break;
-				case 1:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_INT8, data);
-				}
-				break;
+	if (label->reclen <= 0) {
+		parse_error("Table %s has no record length.", objSize->Name);
+		return 0;
+	}
 
-			case MSB_UNSIGNED_INTEGER:
-			case LSB_UNSIGNED_INTEGER:
-				switch (f[j]->size) {
-				case 8:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_UINT64, data);
-					break;
-				case 4:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_UINT32, data);
-					break;
-				case 2:
-					data = malloc(size[j] * label->nrows);
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_UINT16, data);
-					break;
-				case 1:
-					data = calloc(size[j] * label->nrows, sizeof(char));
-					memcpy(data, Bufs[j], size[j] * label->nrows);
-					v = newVal(BSQ, dim, label->nrows, 1, DV_UINT8, data);
-				}
-				break;
+	// rows to read
+	first = 0;
+	nrows = (label->nrows > 0 ? label->nrows : 0);
+	if (subset && subset->start_row > 1) {
+		if (subset->start_row > label->nrows) {
+			parse_error("start_row %d is past the end of %s (%d rows).", subset->start_row,
+			            objSize->Name, label->nrows);
+			return 0;
+		}
+		first = subset->start_row - 1;
+		nrows -= first;
+	}
+	if (subset && subset->nrows >= 0 && (size_t)subset->nrows < nrows) {
+		nrows = subset->nrows;
+	}
 
-			case IEEE_REAL:
-			case PC_REAL:
-				data = calloc(size[j] * label->nrows, sizeof(char));
-				memcpy(data, Bufs[j], size[j] * label->nrows);
+	// columns to read, with their output arrays
+	cols  = (tableColumn*)calloc(num_items, sizeof(tableColumn));
+	ncols = 0;
+	for (j = 0; j < num_items; j++) {
+		tableColumn* c = &cols[ncols];
 
-				switch (f[j]->size) {
-				case 8: v = newVal(BSQ, dim, label->nrows, 1, DV_DOUBLE, data); break;
-				case 4: v = newVal(BSQ, dim, label->nrows, 1, DV_FLOAT, data); break;
-				}
-				break;
+		if (!table_wants_column(f[j], subset)) continue;
 
-			// NOTE(rswinkle): What's the actual range of this format in a PDS file?
-			// Should it be int64?
-			case ASCII_INTEGER:
-				data = calloc(sizeof(int) * label->nrows, sizeof(char));
-				for (i = 0; i < (label->nrows * dim); i++) {
-					memcpy(num, Bufs[j] + f[j]->size * i, f[j]->size);
-					num[f[j]->size] = '\0';
-					inum            = atoi(num);
-					printf("inum = %d\n", inum);
-					memcpy((char*)data + step, &inum, sizeof(int));
-					step += sizeof(int);
-				}
+		c->f      = f[j];
+		c->dim    = (f[j]->dimension ? f[j]->dimension : 1);
+		c->format = table_column_format(f[j], &c->scaled);
+		if (c->format < 0) {
+			parse_error("Column data conversion failed for %s.", f[j]->name);
+			continue;
+		}
+		if (f[j]->start < 0 || f[j]->start + f[j]->size * c->dim > label->reclen ||
+		    (f[j]->bitfield && (f[j]->bitfield->shifts < 0 || f[j]->bitfield->bits < 1 ||
+		                        f[j]->bitfield->shifts + f[j]->bitfield->bits > f[j]->size * 8))) {
+			parse_error("Column %s doesn't fit in its record.", f[j]->name);
+			continue;
+		}
 
-				v = newVal(BSQ, dim, label->nrows, 1, DV_INT32, data);
-				break;
+		if (c->format == 0) {
+			c->text = (char**)calloc(max(nrows, 1), sizeof(char*));
+		} else {
+			c->data = malloc(max(nrows * c->dim * NBYTES(c->format), 1));
+		}
+		if (c->text == NULL && c->data == NULL) {
+			parse_error("Unable to allocate memory for column %s.", f[j]->name);
+			table_free_columns(cols, ncols, 0);
+			return 0;
+		}
+		ncols++;
+	}
 
-			case ASCII_REAL:
-				data = calloc(sizeof(double) * label->nrows, sizeof(char));
-				for (i = 0; i < (label->nrows * dim); i++) {
-					memcpy(num, Bufs[j] + f[j]->size * i, f[j]->size);
-					num[f[j]->size] = '\0';
-					fnum            = atof(num);
-					memcpy((char*)data + step, &fnum, sizeof(double));
-					step += sizeof(double);
-				}
+	if (subset && subset->columns && ncols == 0) {
+		parse_error("None of the requested columns are in %s.", objSize->Name);
+	}
 
-				v = newVal(BSQ, dim, label->nrows, 1, DV_DOUBLE, data);
-				break;
+	block_rows = max(TABLE_BLOCK_BYTES / label->reclen, 1);
+	block_rows = min(block_rows, max(nrows, 1));
+	buf        = (unsigned char*)malloc(block_rows * label->reclen);
 
-			// NOTE(rswinkle): Should this be unsigned?  or int64?
-			case BYTE_OFFSET:
-				data = calloc(size[j] * label->nrows, sizeof(char));
-				memcpy(data, Bufs[j], size[j] * label->nrows);
-				v = newVal(BSQ, dim, label->nrows, 1, DV_INT32, data);
+	rc = 1;
+	if ((fp = fopen(fileName, "rb")) == NULL) {
+		fprintf(stderr, "Unable to open file for reading \"%s\". Reason: %s.\n", fileName, strerror(errno));
+		rc = 0;
+	} else if (buf == NULL) {
+		parse_error("Unable to allocate a read buffer for %s.", objSize->Name);
+		rc = 0;
+	} else if (ncols && nrows) {
+		if (fseek(fp, (long)objSize->dptr + (long)first * label->reclen, SEEK_SET) != 0) {
+			fprintf(stderr, "Unable to seek in \"%s\". Reason: %s.\n", fileName, strerror(errno));
+			rc = 0;
+		}
+
+		nthreads = dv_num_threads();
+		for (row = 0; row < nrows && rc; row += n) {
+			n = min(block_rows, nrows - row);
+			if (fread(buf, label->reclen, n, fp) != n) {
+				fprintf(stderr, "Short file: %s. Read ends before row %ld of %ld\n", fileName,
+				        (long)(first + row + n), (long)(first + nrows));
+				rc = 0;
 				break;
+			}
 
-			case MSB_BIT_FIELD:
-			case LSB_BIT_FIELD:
-				data = calloc(size[j] * label->nrows, sizeof(char));
-				memcpy(data, Bufs[j], size[j] * label->nrows);
-				v = newVal(BSQ, dim, label->nrows, 1, DV_INT32, data);
-				break;
+			block.cols    = cols;
+			block.ncols   = ncols;
+			block.block   = buf;
+			block.reclen  = label->reclen;
+			block.row     = row;
+			block.rows    = n;
+			block.nslices = 1;
+			if (ncols < nthreads && n >= 2 * TABLE_SLICE_ROWS) {
+				block.nslices = min((nthreads + ncols - 1) / ncols, (int)(n / TABLE_SLICE_ROWS));
 			}
+
+			dv_parallel_for((size_t)ncols * block.nslices,
+			                (n * ncols < TABLE_SLICE_ROWS ? (size_t)ncols * block.nslices : 1),
+			                table_decode_kernel, &block);
 		}
-		if (v == NULL) {
-			parse_error("Column data conversion failed for %s.", f[j]->name);
+	}
+	if (fp) fclose(fp);
+	free(buf);
+
+	if (!rc) {
+		table_free_columns(cols, ncols, nrows);
+		return 0;
+	}
+
+	// Add new structure to parent ob
+	data = new_struct(0);
+	for (j = 0; j < ncols; j++) {
+		if (cols[j].format == 0) {
+			v = newText(nrows, cols[j].text);
 		} else {
-			add_struct(*Data, fix_name(f[j]->name), v);
+			v = newVal(BSQ, cols[j].dim, nrows, 1, cols[j].format, cols[j].data);
 		}
+		add_struct(data, fix_name(cols[j].f->name), v);
 	}
+	free(cols);
+
+	add_struct(ob, "data", data);
+	return 1;
 }
 
 static int rfImage(dataKey* objSize, Var* ob)
@@ -2651,7 +2740,7 @@ static int loadFieldBinary(Var* v, LABEL* label, dataKey* data_key, int use_name
 	count = get_struct_count(v);
 
 	if (count > 0 && !label->fields.a) {
-		if (!cvec_init_voidptr(&label->fields, 0, 8, NULL, NULL)) {
+		if (!cvec_voidptr(&label->fields, 0, 8, NULL, NULL)) {
 			parse_error("Error allocating memory for a FIELD list\n");
 			return 0;
 		}
@@ -3147,7 +3236,7 @@ static int loadBinaryTable(Var* v, LABEL* label, dataKey* data_key, int use_name
 
 	// call rfTable() to read in the table
 	if (get_data) {
-		ret_val = rfTable(data_key, v, label);
+		ret_val = rfTable(data_key, v, label, NULL);
 		if (!ret_val) {
 			// fail slow so the user can at least have the label
 			parse_error("Unable to read all or part of the binary table\n");
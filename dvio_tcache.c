@@ -0,0 +1,371 @@
+#include "parser.h"
+#include "dvio.h"
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif /* _WIN32 */
+
+/**
+ ** Columnar table cache.
+ **
+ ** load_csv(), ascii() and read_lines() can optionally keep a binary
+ ** sidecar of their result next to the file they parsed (<file>.<func>.dvcache).
+ ** The sidecar stores each column as a raw typed array (text columns as an
+ ** offsets table plus a string pool), so a later load of the same file
+ ** is a handful of memcpy()s instead of a full parse.
+ **
+ ** The header records the size and mtime (to the nanosecond where the
+ ** platform has it) of the source file and a key
+ ** describing the parse options; if any of them differ the cache is
+ ** ignored and rewritten by the caller.  Each function gets its own
+ ** sidecar so loading one file through several of them doesn't thrash.
+ **
+ ** Layout (native byte order, every section 8-byte aligned):
+ **
+ **    tcache_header
+ **    key bytes
+ **    ncols * { tcache_col, name bytes, payload }
+ **
+ ** where payload is V_DATA for ID_VAL columns and
+ ** u64 offsets[rows+1] followed by the NUL terminated strings for ID_TEXT.
+ ** A header with ncols == 0 holds a single unnamed value instead of a struct.
+ **/
+
+#define TCACHE_MAGIC "DVTCACHE"
+#define TCACHE_VERSION 2
+#define TCACHE_ENDIAN 0x01020304
+#define TCACHE_SUFFIX ".dvcache"
+
+#define TCACHE_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+typedef struct tcache_header {
+	char magic[8];
+	u32 version;
+	u32 endian;
+	u64 src_size;
+	i64 src_mtime;
+	i64 src_mtime_nsec;
+	u32 keylen;
+	u32 ncols;
+} tcache_header;
+
+typedef struct tcache_col {
+	u32 namelen;
+	u32 type;
+	i32 format;
+	i32 org;
+	u64 size[3];
+	u64 nbytes;
+} tcache_col;
+
+/* 0 where stat() only has whole seconds */
+static i64 tcache_mtime_nsec(const struct stat* sbuf)
+{
+#if defined(__APPLE__)
+	return sbuf->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	return 0;
+#else
+	return sbuf->st_mtim.tv_nsec;
+#endif
+}
+
+static char* tcache_path(const char* fname, const char* func)
+{
+	char* path = malloc(strlen(fname) + strlen(func) + strlen(TCACHE_SUFFIX) + 2);
+	if (path == NULL) return NULL;
+	sprintf(path, "%s.%s%s", fname, func, TCACHE_SUFFIX);
+	return path;
+}
+
+static int tcache_pad(FILE* fp, size_t n)
+{
+	static const char zeros[8] = { 0 };
+	size_t pad                 = TCACHE_ALIGN(n) - n;
+
+	return (pad == 0 || fwrite(zeros, 1, pad, fp) == pad);
+}
+
+static int tcache_write_column(FILE* fp, const char* name, Var* v)
+{
+	tcache_col col;
+	size_t i, rows, len;
+	u64 off;
+
+	memset(&col, 0, sizeof(col));
+	col.namelen = name ? strlen(name) : 0;
+	col.type    = V_TYPE(v);
+
+	if (V_TYPE(v) == ID_VAL) {
+		col.format  = V_FORMAT(v);
+		col.org     = V_ORG(v);
+		col.size[0] = V_SIZE(v)[0];
+		col.size[1] = V_SIZE(v)[1];
+		col.size[2] = V_SIZE(v)[2];
+		col.nbytes  = (u64)V_DSIZE(v) * NBYTES(V_FORMAT(v));
+	} else {
+		rows        = V_TEXT(v).Row;
+		col.size[0] = rows;
+		col.nbytes  = (rows + 1) * sizeof(u64);
+		for (i = 0; i < rows; i++) {
+			col.nbytes += strlen(V_TEXT(v).text[i]) + 1;
+		}
+	}
+
+	if (fwrite(&col, sizeof(col), 1, fp) != 1) return 0;
+	if (col.namelen && fwrite(name, 1, col.namelen, fp) != col.namelen) return 0;
+	if (!tcache_pad(fp, col.namelen)) return 0;
+
+	if (V_TYPE(v) == ID_VAL) {
+		if (col.nbytes && fwrite(V_DATA(v), 1, col.nbytes, fp) != col.nbytes) return 0;
+	} else {
+		rows = V_TEXT(v).Row;
+		off  = 0;
+		for (i = 0; i <= rows; i++) {
+			if (fwrite(&off, sizeof(u64), 1, fp) != 1) return 0;
+			if (i < rows) off += strlen(V_TEXT(v).text[i]) + 1;
+		}
+		for (i = 0; i < rows; i++) {
+			len = strlen(V_TEXT(v).text[i]) + 1;
+			if (fwrite(V_TEXT(v).text[i], 1, len, fp) != len) return 0;
+		}
+	}
+
+	return tcache_pad(fp, col.nbytes);
+}
+
+static int tcache_cacheable(Var* v)
+{
+	int i, n;
+	Var* e;
+
+	if (V_TYPE(v) == ID_VAL || V_TYPE(v) == ID_TEXT) return 1;
+	if (V_TYPE(v) != ID_STRUCT) return 0;
+
+	n = get_struct_count(v);
+	for (i = 0; i < n; i++) {
+		get_struct_element(v, i, NULL, &e);
+		if (V_TYPE(e) != ID_VAL && V_TYPE(e) != ID_TEXT) return 0;
+	}
+	return 1;
+}
+
+/**
+ ** dv_tcache_save() - write v to func's sidecar cache of fname.
+ **
+ ** key identifies the parse options that produced v.  Failure to write the
+ ** cache is not an error for the caller; it just means the next load parses
+ ** the file again.
+ **/
+int dv_tcache_save(const char* fname, const char* func, const char* key, Var* v)
+{
+	tcache_header h;
+	struct stat sbuf;
+	char *path, *tmp;
+	char* name;
+	FILE* fp;
+	Var* e;
+	int i, ok;
+
+	if (v == NULL || !tcache_cacheable(v)) return 0;
+	if (stat(fname, &sbuf) < 0) return 0;
+	if ((path = tcache_path(fname, func)) == NULL) return 0;
+
+	// write to a temporary and rename so a concurrent reader never sees a partial file
+	if ((tmp = malloc(strlen(path) + 32)) == NULL) {
+		free(path);
+		return 0;
+	}
+	sprintf(tmp, "%s.%d", path, (int)getpid());
+
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		if (VERBOSE > 1) fprintf(stderr, "Unable to write table cache %s\n", path);
+		free(tmp);
+		free(path);
+		return 0;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TCACHE_MAGIC, sizeof(h.magic));
+	h.version        = TCACHE_VERSION;
+	h.endian         = TCACHE_ENDIAN;
+	h.src_size       = sbuf.st_size;
+	h.src_mtime      = sbuf.st_mtime;
+	h.src_mtime_nsec = tcache_mtime_nsec(&sbuf);
+	h.keylen         = strlen(key);
+	h.ncols          = (V_TYPE(v) == ID_STRUCT) ? get_struct_count(v) : 0;
+
+	ok = (fwrite(&h, sizeof(h), 1, fp) == 1);
+	ok = ok && (h.keylen == 0 || fwrite(key, 1, h.keylen, fp) == h.keylen);
+	ok = ok && tcache_pad(fp, h.keylen);
+
+	if (V_TYPE(v) == ID_STRUCT) {
+		for (i = 0; ok && i < h.ncols; i++) {
+			get_struct_element(v, i, &name, &e);
+			ok = tcache_write_column(fp, name, e);
+		}
+	} else {
+		ok = ok && tcache_write_column(fp, NULL, v);
+	}
+
+	if (fclose(fp) != 0) ok = 0;
+
+	if (ok && rename(tmp, path) == 0) {
+		if (VERBOSE > 1) fprintf(stderr, "Wrote table cache %s\n", path);
+	} else {
+		unlink(tmp);
+		ok = 0;
+	}
+
+	free(tmp);
+	free(path);
+	return ok;
+}
+
+/**
+ ** Build a Var from one cached column.  *pos is advanced past it.
+ ** Returns NULL if the column is truncated or malformed.
+ **/
+static Var* tcache_read_column(const char* buf, size_t len, size_t* pos, char** name)
+{
+	tcache_col col;
+	const char* p;
+	const u64* offsets;
+	TextStore* s;
+	void* data;
+	size_t i, rows, need, nchars;
+
+	if (*pos + sizeof(col) > len) return NULL;
+	memcpy(&col, buf + *pos, sizeof(col));
+	*pos += sizeof(col);
+
+	if (*pos + TCACHE_ALIGN(col.namelen) > len) return NULL;
+	if (name) {
+		*name = calloc(col.namelen + 1, 1);
+		memcpy(*name, buf + *pos, col.namelen);
+	}
+	*pos += TCACHE_ALIGN(col.namelen);
+
+	if (*pos + col.nbytes > len) return NULL;
+	p = buf + *pos;
+	*pos += TCACHE_ALIGN(col.nbytes);
+
+	if (col.type == ID_VAL) {
+		need = col.size[0] * col.size[1] * col.size[2] * NBYTES(col.format);
+		if (need != col.nbytes) return NULL;
+
+		if ((data = malloc(need ? need : 1)) == NULL) {
+			memory_error(errno, need);
+			return NULL;
+		}
+		memcpy(data, p, need);
+		return newVal(col.org, col.size[0], col.size[1], col.size[2], col.format, data);
+	}
+
+	if (col.type != ID_TEXT) return NULL;
+
+	rows    = col.size[0];
+	offsets = (const u64*)p;
+	need    = (rows + 1) * sizeof(u64);
+	if (need > col.nbytes) return NULL;
+
+	/* the rows are back to back, NUL terminated, so they load as one block */
+	nchars = col.nbytes - need;
+	if (rows && (nchars == 0 || p[col.nbytes - 1] != '\0')) return NULL;
+	for (i = 0; i < rows; i++) {
+		if (offsets[i] >= nchars) return NULL;
+	}
+	if ((s = new_text_store(rows, nchars)) == NULL) {
+		memory_error(errno, nchars);
+		return NULL;
+	}
+	memcpy(s->chars, p + need, nchars);
+	for (i = 0; i < rows; i++) {
+		s->rows[i] = s->chars + offsets[i];
+	}
+	return newTextView(s, 0, rows);
+}
+
+/**
+ ** dv_tcache_load() - load the cached result of parsing fname with func/key.
+ **
+ ** Returns NULL if there is no cache, or if it is stale (the source changed
+ ** size or mtime), was written with different options, or is unreadable.
+ **/
+Var* dv_tcache_load(const char* fname, const char* func, const char* key)
+{
+	tcache_header h;
+	struct stat sbuf, cbuf;
+	char* path;
+	char* buf;
+	char* name;
+	size_t pos;
+	Var *v, *e;
+	int fd, i;
+
+	if (stat(fname, &sbuf) < 0) return NULL;
+	if ((path = tcache_path(fname, func)) == NULL) return NULL;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		free(path);
+		return NULL;
+	}
+	if (fstat(fd, &cbuf) < 0 || cbuf.st_size < (off_t)sizeof(h)) {
+		close(fd);
+		free(path);
+		return NULL;
+	}
+
+#ifndef _WIN32
+	buf = mmap(NULL, cbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) buf = NULL;
+#else
+	if ((buf = malloc(cbuf.st_size)) != NULL && read(fd, buf, cbuf.st_size) != cbuf.st_size) {
+		free(buf);
+		buf = NULL;
+	}
+#endif /* _WIN32 */
+	close(fd);
+
+	if (buf == NULL) {
+		free(path);
+		return NULL;
+	}
+
+	v = NULL;
+	memcpy(&h, buf, sizeof(h));
+	pos = sizeof(h) + TCACHE_ALIGN(h.keylen);
+
+	if (memcmp(h.magic, TCACHE_MAGIC, sizeof(h.magic)) || h.version != TCACHE_VERSION ||
+	    h.endian != TCACHE_ENDIAN || h.src_size != (u64)sbuf.st_size ||
+	    h.src_mtime != (i64)sbuf.st_mtime || h.src_mtime_nsec != tcache_mtime_nsec(&sbuf) ||
+	    h.keylen != strlen(key) || pos > cbuf.st_size || memcmp(buf + sizeof(h), key, h.keylen)) {
+		if (VERBOSE > 1) fprintf(stderr, "Table cache %s is stale\n", path);
+	} else if (h.ncols == 0) {
+		v = tcache_read_column(buf, cbuf.st_size, &pos, NULL);
+	} else {
+		v = new_struct(h.ncols);
+		for (i = 0; i < h.ncols; i++) {
+			name = NULL;
+			if ((e = tcache_read_column(buf, cbuf.st_size, &pos, &name)) == NULL) {
+				// the partial struct is a temporary, so scope cleanup frees it
+				free(name);
+				v = NULL;
+				break;
+			}
+			add_struct(v, name, e);
+			free(name);
+		}
+	}
+
+#ifndef _WIN32
+	munmap(buf, cbuf.st_size);
+#else
+	free(buf);
+#endif /* _WIN32 */
+
+	if (v != NULL && VERBOSE > 1) fprintf(stderr, "Read table cache %s\n", path);
+	free(path);
+	return v;
+}
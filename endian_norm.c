@@ -37,22 +37,27 @@ void swap_endian(unsigned char* buf, size_t n, unsigned int size)
 	a = b;         \
 	b = t;
 
-	if (size == 1) return;
-
-	for (i = 0; i < total_bytes; i += size) {
-		switch (size) {
-		case 2: swap(buf[i], buf[i + 1]); break;
-		case 4:
+	/* one loop per size, so each is simple enough to vectorize */
+	switch (size) {
+	case 2:
+		for (i = 0; i < total_bytes; i += 2) {
+			swap(buf[i], buf[i + 1]);
+		}
+		break;
+	case 4:
+		for (i = 0; i < total_bytes; i += 4) {
 			swap(buf[i], buf[i + 3]);
 			swap(buf[i + 1], buf[i + 2]);
-			break;
-		case 8:
+		}
+		break;
+	case 8:
+		for (i = 0; i < total_bytes; i += 8) {
 			swap(buf[i], buf[i + 7]);
 			swap(buf[i + 1], buf[i + 6]);
 			swap(buf[i + 2], buf[i + 5]);
 			swap(buf[i + 3], buf[i + 4]);
-			break;
 		}
+		break;
 	}
 }
 
@@ -1,5 +1,6 @@
 #include "ff.h"
 #include "apidef.h"
+#include "parallel.h"
 #include <errno.h>
 #include <math.h>
 #include <string.h>
@@ -47,8 +48,7 @@ Var* V_func(const char* name, Var* arg)
 	// We can use &name and cmp_string because name is the first
 	// member of _vfuncptr
 	//
-	f = bsearch(&name, vfunclist, num_internal_funcs,
-	            sizeof(struct _vfuncptr), cmp_string);
+	f = find_vfunc(name);
 	if (f) {
 		return (f->fptr(f, arg));
 	}
@@ -70,6 +70,14 @@ Var* V_func(const char* name, Var* arg)
 	return NULL;
 }
 
+/**
+ ** find_vfunc() - the builtin function of the given name, or NULL
+ **/
+vfuncptr find_vfunc(const char* name)
+{
+	return bsearch(&name, vfunclist, num_internal_funcs, sizeof(struct _vfuncptr), cmp_string);
+}
+
 /**
  ** ff_dfunc() - function caller for intrinsic math (double) functions
  **
@@ -147,29 +155,19 @@ Var* ff_dfunc(vfuncptr func, Var* arg)
 }
 
 /**
- ** Worker function for bop, broken out so we can reuse it for other things.
+ ** The result of a binary operation on a and b, with the data allocated
+ ** but not set: a dimension of either can be 1 where the other's isn't.
  **/
 
-Var* ff_binary_op(const char* name,               // Function name, for errors
-                  Var* a, Var* b,                 // operands
-                  double (*fptr)(double, double), // function pointer
-                  int format)                     // output format
+static Var* binary_op_result(const char* name, Var* a, Var* b, int format)
 {
 	int size[3];
 	size_t dsize = 0;
 	size_t i;
 	int order;
 	Var* val = NULL;
-	int count;
 	int va, vb;
 	size_t dsizea = 1, dsizeb = 1;
-	double v1, v2, v3;
-
-	u_char* cdata;
-	short* sdata;
-	int* idata;
-	float* fdata;
-	double* ddata;
 
 	/**
 	 ** Verify that we can actually operate with these two objects.
@@ -178,7 +176,6 @@ Var* ff_binary_op(const char* name,               // Function name, for errors
 	 **
 	 **/
 
-	count = 0;
 	for (i = 0; i < 3; i++) {
 		va = V_SIZE(a)[orders[V_ORDER(a)][i]];
 		vb = V_SIZE(b)[orders[V_ORDER(b)][i]];
@@ -204,10 +201,6 @@ Var* ff_binary_op(const char* name,               // Function name, for errors
 
 	if (dsize == 0) dsize = 1; /* impossible? */
 
-	/**
-	 ** can we reuse one of the input values here?
-	 **/
-
 	// Initalize the return object
 
 	val           = newVar();
@@ -225,34 +218,95 @@ Var* ff_binary_op(const char* name,               // Function name, for errors
 	V_DATA(val) = (double*)calloc(dsize, NBYTES(format));
 	if (V_DATA(val) == NULL) {
 		parse_error("Unable to alloc %ld bytes.\n", dsize * NBYTES(format));
+		if (mem_claim(val)) free_var(val);
 		return NULL;
 	}
+	return (val);
+}
+
+static void binary_op_store(Var* val, size_t i, double v3)
+{
+	switch (V_FORMAT(val)) {
+	case DV_UINT8: ((u_char*)V_DATA(val))[i] = clamp_byte(v3); break;
+	case DV_INT16: ((short*)V_DATA(val))[i]  = clamp_short(v3); break;
+	case DV_INT32: ((int*)V_DATA(val))[i]    = clamp_int(v3); break;
+	case DV_FLOAT: ((float*)V_DATA(val))[i]  = clamp_float(v3); break;
+	case DV_DOUBLE: ((double*)V_DATA(val))[i] = v3; break;
+	}
+}
+
+/**
+ ** Worker function for bop, broken out so we can reuse it for other things.
+ **/
 
-	cdata = (u_char*)V_DATA(val);
-	sdata = (short*)V_DATA(val);
-	idata = (int*)V_DATA(val);
-	fdata = (float*)V_DATA(val);
-	ddata = (double*)V_DATA(val);
+Var* ff_binary_op(const char* name,               // Function name, for errors
+                  Var* a, Var* b,                 // operands
+                  double (*fptr)(double, double), // function pointer
+                  int format)                     // output format
+{
+	Var* val;
+	size_t i;
+	double v1, v2;
+
+	if ((val = binary_op_result(name, a, b, format)) == NULL) return (NULL);
 
 	/**
 	 ** For each output element (0-size), de-compute relative position using
 	 ** order, and re-compute offset to that element in the other var.
 	 **/
-	for (i = 0; i < dsize; i++) {
+	for (i = 0; i < V_DSIZE(val); i++) {
 		v1 = extract_double(a, rpos(i, val, a));
 		v2 = extract_double(b, rpos(i, val, b));
-		v3 = (*fptr)(v1, v2);
-		switch (format) {
-		case DV_UINT8: cdata[i]  = clamp_byte(v3); break;
-		case DV_INT16: sdata[i]  = clamp_short(v3); break;
-		case DV_INT32: idata[i]  = clamp_int(v3); break;
-		case DV_FLOAT: fdata[i]  = clamp_float(v3); break;
-		case DV_DOUBLE: ddata[i] = v3; break;
-		}
+		binary_op_store(val, i, (*fptr)(v1, v2));
 	}
 	return (val);
 }
 
+/**
+ ** ff_binary_op_block() - ff_binary_op() for functions that take whole
+ ** arrays of operands.  The output is done in parallel, a block at a
+ ** time, so block must be safe to call from several threads at once.
+ **/
+
+#define BINARY_OP_BLOCK 256
+
+typedef struct {
+	Var *a, *b, *val;
+	bdfunc block;
+} binary_op_job;
+
+static void binary_op_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	binary_op_job* job = (binary_op_job*)ctx;
+	double v1[BINARY_OP_BLOCK], v2[BINARY_OP_BLOCK], v3[BINARY_OP_BLOCK];
+	size_t i, j, n;
+
+	for (i = begin; i < end; i += n) {
+		n = min(end - i, BINARY_OP_BLOCK);
+		for (j = 0; j < n; j++) {
+			v1[j] = extract_double(job->a, rpos(i + j, job->val, job->a));
+			v2[j] = extract_double(job->b, rpos(i + j, job->val, job->b));
+		}
+		job->block(v1, v2, v3, n);
+		for (j = 0; j < n; j++) {
+			binary_op_store(job->val, i + j, v3[j]);
+		}
+	}
+}
+
+Var* ff_binary_op_block(const char* name, Var* a, Var* b, bdfunc block, int format)
+{
+	binary_op_job job;
+
+	if ((job.val = binary_op_result(name, a, b, format)) == NULL) return (NULL);
+
+	job.a     = a;
+	job.b     = b;
+	job.block = block;
+	dv_parallel_for(V_DSIZE(job.val), 4096, binary_op_kernel, &job);
+	return (job.val);
+}
+
 /**
  ** binary operator function, double
  **/
@@ -2253,6 +2307,39 @@ int decode_hexstring(char* str, char* buf)
 ** value can be a hex representation (ala ISIS)
 */
 
+typedef struct {
+	const unsigned char* data;
+	unsigned char* out;
+	int size;
+	char value[16];
+} deleted_job;
+
+#define DELETED_LOOP(T)                                        \
+	{                                                          \
+		const T* d = (const T*)job->data;                      \
+		T v;                                                   \
+		memcpy(&v, job->value, sizeof(T));                     \
+		for (i = begin; i < end; i++) out[i] = (d[i] == v);    \
+	}
+
+/* compare the words of the object bit for bit with the value */
+static void deleted_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	deleted_job* job   = ctx;
+	unsigned char* out = job->out;
+	size_t i;
+
+	switch (job->size) {
+	case 1: DELETED_LOOP(u8); break;
+	case 2: DELETED_LOOP(u16); break;
+	case 4: DELETED_LOOP(u32); break;
+	case 8: DELETED_LOOP(u64); break;
+	default:
+		for (i = begin; i < end; i++)
+			out[i] = (memcmp(job->data + i * job->size, job->value, job->size) == 0);
+	}
+}
+
 Var* ff_deleted(vfuncptr func, Var* arg)
 {
 	Var* obj       = NULL;
@@ -2262,7 +2349,7 @@ Var* ff_deleted(vfuncptr func, Var* arg)
 	int nbytes;
 	size_t dsize;
 	unsigned char *data, *out;
-	size_t i;
+	deleted_job job;
 
 	Alist alist[3];
 	alist[0]      = make_alist("obj", ID_VAL, NULL, &obj);
@@ -2298,11 +2385,11 @@ Var* ff_deleted(vfuncptr func, Var* arg)
 	}
 	out = calloc(dsize, 1);
 
-	for (i = 0; i < dsize; i++) {
-		if (memcmp(data + (i * nbytes), vbuf, bytes) == 0) {
-			out[i] = 1;
-		}
-	}
+	job.data = data;
+	job.out  = out;
+	job.size = nbytes;
+	memcpy(job.value, vbuf, sizeof(job.value));
+	dv_parallel_for(dsize, 65536, deleted_kernel, &job);
 
 	v            = newVar();
 	V_TYPE(v)    = ID_VAL;
@@ -2324,9 +2411,6 @@ Var* ff_set_deleted(vfuncptr func, Var* arg)
 	char vbuf[16]  = {0};
 	int bytes      = 0;
 	int nbytes;
-	size_t dsize;
-	unsigned char* data;
-	size_t i;
 
 	Alist alist[4];
 	alist[0]      = make_alist("obj", ID_VAL, NULL, &obj);
@@ -2363,19 +2447,84 @@ Var* ff_set_deleted(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
-	dsize  = V_DSIZE(obj);
 	nbytes = NBYTES(V_FORMAT(obj));
 	if (bytes != nbytes) {
 		parse_error("Word sizes differ");
 		return (NULL);
 	}
-	v    = V_DUP(obj);
-	data = V_DATA(v);
+	v = V_DUP(obj);
+	if (!where_fill(v, mask, vbuf)) {
+		parse_error("%s: Unable to allocate memory", func->name);
+		if (mem_claim(v)) free_var(v);
+		return (NULL);
+	}
+	return (v);
+}
+
+/*
+** The elements of obj where mask is set.  The mask can have fewer
+** axes than obj, eg. one band for a whole cube.  For TEXT, the rows
+** where mask is set.
+*/
+Var* ff_compress(vfuncptr func, Var* arg)
+{
+	Var *obj = NULL, *mask = NULL, *v;
+	size_t count = 0;
+	char** text;
+	int i, n;
+
+	Alist alist[3];
+	alist[0]      = make_alist("obj", ID_UNK, NULL, &obj);
+	alist[1]      = make_alist("mask", ID_VAL, NULL, &mask);
+	alist[2].name = NULL;
+
+	if (parse_args(func, arg, alist) == 0) return (NULL);
+
+	if (obj == NULL) {
+		parse_error("%s: No value specified for keyword: obj.", func->name);
+		return (NULL);
+	}
+	if (mask == NULL) {
+		parse_error("%s: No value specified for keyword: mask.", func->name);
+		return (NULL);
+	}
 
-	for (i = 0; i < dsize; i++) {
-		if (extract_int(mask, i)) {
-			memcpy(data + (nbytes * i), vbuf, bytes);
+	if (V_TYPE(obj) == ID_TEXT) {
+		if (V_DSIZE(mask) != 1 && V_DSIZE(mask) != V_TEXT(obj).Row) {
+			parse_error("%s: mask must have one value per row", func->name);
+			return (NULL);
 		}
+		if ((text = calloc(V_TEXT(obj).Row, sizeof(char*))) == NULL) {
+			parse_error("%s: Unable to allocate memory", func->name);
+			return (NULL);
+		}
+		for (i = n = 0; i < V_TEXT(obj).Row; i++) {
+			if (extract_int(mask, V_DSIZE(mask) == 1 ? 0 : i)) {
+				text[n++] = strdup(V_TEXT(obj).text[i]);
+			}
+		}
+		if (n == 0) {
+			free(text);
+			parse_error("%s: nothing selected", func->name);
+			return (NULL);
+		}
+		return (newText(n, text));
+	}
+	if (V_TYPE(obj) != ID_VAL) {
+		parse_error("%s: obj must be a value or TEXT", func->name);
+		return (NULL);
+	}
+	if ((GetX(mask) != 1 && GetX(mask) != GetX(obj)) || (GetY(mask) != 1 && GetY(mask) != GetY(obj)) ||
+	    (GetZ(mask) != 1 && GetZ(mask) != GetZ(obj))) {
+		parse_error("%s: Sizes don't match", func->name);
+		return (NULL);
+	}
+
+	if ((v = where_select(obj, mask, &count)) == NULL) {
+		if (count == 0)
+			parse_error("%s: nothing selected", func->name);
+		else
+			parse_error("%s: Unable to allocate memory", func->name);
 	}
 	return (v);
 }
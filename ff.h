@@ -237,8 +237,8 @@ struct _vfuncptr vfunclist[] = {
     {"fit", ff_fit, NULL, NULL},
     {"ipi", ff_ipi, NULL, NULL},
 
-    {"bbr", ff_bop, (void*)bbr, NULL},
-    {"btemp", ff_bop, (void*)btemp, NULL},
+    {"bbr", ff_bbr, NULL, NULL},
+    {"btemp", ff_btemp, NULL, NULL},
     {"atan2", ff_bop, (void*)atan2, NULL},
 
     {"vignette", ff_vignette, NULL, NULL},
@@ -265,6 +265,7 @@ struct _vfuncptr vfunclist[] = {
     {"rgb", ff_rgb, NULL, NULL},
     {"ramp", ff_ramp, NULL, NULL},
     {"sawtooth", ff_sawtooth, NULL, NULL},
+    {"grassfire", ff_grassfire, NULL, NULL},
     {"grassfile", ff_grassfire, NULL, NULL},
 
     {"entropy", ff_entropy, NULL, NULL},
@@ -321,6 +322,7 @@ struct _vfuncptr vfunclist[] = {
 #endif
     {"deleted", ff_deleted, NULL, NULL},
     {"set_deleted", ff_set_deleted, NULL, NULL},
+    {"compress", ff_compress, NULL, NULL},
 
     {"bindct", ff_bindct, NULL, NULL},
     {"binidct", ff_bindct, NULL, NULL},
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "parallel.h"
 
 /**
  ** black-body radiance support function
@@ -35,3 +36,284 @@ double btemp(double f, double radiance)
 
 	return (C2 * f / log(1.0 + (C1 * f * f * f / radiance)));
 }
+
+/**
+ ** bbr() and btemp() over n values, for ff_binary_op_block().  The
+ ** loops have no calls but exp() and log(), so the compiler can keep
+ ** everything else in vector registers.
+ **/
+
+void bbr_block(const double* wn, const double* temp, double* out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		double e = exp(C2 * wn[i] / (temp[i] > 0 ? temp[i] : 1.0)) - 1.0;
+		out[i]   = temp[i] > 0 ? (C1 * (wn[i] * wn[i] * wn[i])) / e : 0.0;
+	}
+}
+
+void btemp_block(const double* f, const double* radiance, double* out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		double x = log(1.0 + (C1 * f[i] * f[i] * f[i] / (radiance[i] > 0 ? radiance[i] : 1.0)));
+		out[i]   = (radiance[i] > 0 && x > 0) ? C2 * f[i] / x : 0.0;
+	}
+}
+
+/**
+ ** Band radiance through a spectral response function (SRF): the SRF
+ ** weighted mean of bbr() over the wavenumbers of the band.
+ **
+ ** Every band of a band set is tabulated once, every SRF_STEP K from
+ ** SRF_TMIN to SRF_TMAX, and looked up with linear interpolation.  The
+ ** last band set's tables are kept for the next call.  Temperatures
+ ** outside the tables are done directly.
+ **/
+
+#define SRF_TMIN 10.0
+#define SRF_TMAX 1000.0
+#define SRF_STEP 0.1
+#define SRF_NT ((size_t)((SRF_TMAX - SRF_TMIN) / SRF_STEP + 1.5))
+
+typedef struct {
+	size_t n, nb;  /* wavenumbers, bands */
+	double* wn;    /* n wavenumbers, then n weights for each band */
+	double* table; /* SRF_NT radiances for each band */
+} srf_lut;
+
+static srf_lut srf_cache = {0, 0, NULL, NULL};
+
+static double srf_radiance(const double* wn, const double* w, size_t n, double temp)
+{
+	double sum = 0, wsum = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		sum += w[i] * bbr(wn[i], temp);
+		wsum += w[i];
+	}
+	return (wsum != 0 ? sum / wsum : 0.0);
+}
+
+static void srf_table_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	srf_lut* lut = (srf_lut*)ctx;
+	size_t i, band;
+
+	for (i = begin; i < end; i++) {
+		band           = i / SRF_NT;
+		lut->table[i] = srf_radiance(lut->wn, lut->wn + lut->n * (band + 1), lut->n,
+		                              SRF_TMIN + (i % SRF_NT) * SRF_STEP);
+	}
+}
+
+/* the tables for wavenumbers wn and weights srf (nb rows of n), or NULL */
+static srf_lut* srf_tables(Var* wn, Var* srf)
+{
+	size_t n = V_DSIZE(wn), nb, i, j, sy;
+	double* key;
+
+	if (GetX(srf) != n) return (NULL);
+	nb = V_DSIZE(srf) / n;
+	sy = GetY(srf);
+
+	key = (double*)malloc(n * (nb + 1) * sizeof(double));
+	if (key == NULL) return (NULL);
+	for (i = 0; i < n; i++) {
+		key[i] = extract_double(wn, i);
+	}
+	for (j = 0; j < nb; j++) {
+		for (i = 0; i < n; i++) {
+			key[n * (j + 1) + i] = extract_double(srf, cpos(i, j % sy, j / sy, srf));
+		}
+	}
+
+	if (srf_cache.table && srf_cache.n == n && srf_cache.nb == nb &&
+	    !memcmp(srf_cache.wn, key, n * (nb + 1) * sizeof(double))) {
+		free(key);
+		return (&srf_cache);
+	}
+
+	free(srf_cache.wn);
+	free(srf_cache.table);
+	srf_cache.n     = n;
+	srf_cache.nb    = nb;
+	srf_cache.wn    = key;
+	srf_cache.table = (double*)malloc(nb * SRF_NT * sizeof(double));
+	if (srf_cache.table == NULL) {
+		free(srf_cache.wn);
+		srf_cache.wn = NULL;
+		return (NULL);
+	}
+	dv_parallel_for(nb * SRF_NT, 256, srf_table_kernel, &srf_cache);
+	return (&srf_cache);
+}
+
+static double srf_bbr(const srf_lut* lut, size_t band, double temp)
+{
+	const double* t = lut->table + band * SRF_NT;
+	double k, f;
+	size_t i;
+
+	if (temp <= 0) return (0.0);
+	if (temp < SRF_TMIN || temp >= SRF_TMAX) {
+		return (srf_radiance(lut->wn, lut->wn + lut->n * (band + 1), lut->n, temp));
+	}
+	k = (temp - SRF_TMIN) / SRF_STEP;
+	i = (size_t)k;
+	f = k - i;
+	return (t[i] + f * (t[i + 1] - t[i]));
+}
+
+static double srf_btemp(const srf_lut* lut, size_t band, double radiance)
+{
+	const double* t = lut->table + band * SRF_NT;
+	const double* w = lut->wn + lut->n * (band + 1);
+	size_t lo = 0, hi = SRF_NT - 1, mid;
+	double tlo, thi, tm;
+	int iter;
+
+	if (radiance <= 0) return (0.0);
+
+	if (radiance >= t[0] && radiance < t[SRF_NT - 1]) {
+		while (hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if (radiance < t[mid]) {
+				hi = mid;
+			} else {
+				lo = mid;
+			}
+		}
+		return (SRF_TMIN + (lo + (radiance - t[lo]) / (t[hi] - t[lo])) * SRF_STEP);
+	}
+
+	/* off the table: bisect */
+	if (radiance < t[0]) {
+		tlo = 0, thi = SRF_TMIN;
+	} else {
+		tlo = SRF_TMAX, thi = 2 * SRF_TMAX;
+		while (srf_radiance(lut->wn, w, lut->n, thi) < radiance && thi < 1e7) thi *= 2;
+	}
+	for (iter = 0; iter < 60; iter++) {
+		tm = (tlo + thi) / 2;
+		if (srf_radiance(lut->wn, w, lut->n, tm) < radiance) {
+			tlo = tm;
+		} else {
+			thi = tm;
+		}
+	}
+	return ((tlo + thi) / 2);
+}
+
+typedef struct {
+	const srf_lut* lut;
+	Var *in, *out;
+	size_t plane;
+	int inverse;
+} srf_job;
+
+/*
+** bbr(): pixel i of the temperature gives pixel i of every band.
+** btemp(): pixel i of band b (BSQ order) is read through cpos().
+*/
+static void srf_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	srf_job* job = (srf_job*)ctx;
+	size_t i, band, p;
+	int x = GetX(job->in);
+	double v;
+
+	for (i = begin; i < end; i++) {
+		band = i / job->plane;
+		p    = i % job->plane;
+		if (job->inverse) {
+			v = srf_btemp(job->lut, band, extract_double(job->in, cpos(p % x, p / x, band, job->in)));
+		} else {
+			v = srf_bbr(job->lut, band, extract_double(job->in, cpos(p % x, p / x, 0, job->in)));
+		}
+		if (V_FORMAT(job->out) == DV_FLOAT) {
+			((float*)V_DATA(job->out))[i] = v;
+		} else {
+			((double*)V_DATA(job->out))[i] = v;
+		}
+	}
+}
+
+static Var* srf_op(vfuncptr func, Var* wn, Var* in, Var* srf, int format, int inverse)
+{
+	srf_job job;
+	size_t x = GetX(in), y = GetY(in), nb;
+	void* data;
+
+	if ((job.lut = srf_tables(wn, srf)) == NULL) {
+		parse_error("%s: srf must have a row of %zu weights, one for each wavenumber, per band", func->name,
+		            V_DSIZE(wn));
+		return (NULL);
+	}
+	nb = job.lut->nb;
+	if (inverse && (size_t)GetZ(in) != nb) {
+		parse_error("%s: radiance has %zu bands, srf has %zu", func->name, (size_t)GetZ(in), nb);
+		return (NULL);
+	}
+	if (!inverse && GetZ(in) != 1) {
+		parse_error("%s: temperature must have a single band with srf", func->name);
+		return (NULL);
+	}
+
+	data = calloc(x * y * nb, NBYTES(format));
+	if (data == NULL) {
+		parse_error("%s: Unable to alloc %zu bytes", func->name, x * y * nb * NBYTES(format));
+		return (NULL);
+	}
+	job.in      = in;
+	job.out     = newVal(BSQ, x, y, nb, format, data);
+	job.plane   = x * y;
+	job.inverse = inverse;
+	dv_parallel_for(x * y * nb, 4096, srf_kernel, &job);
+	return (job.out);
+}
+
+/**
+ ** bbr(wn, temp [, srf=VAL] [, format=STR])
+ ** btemp(wn, radiance [, srf=VAL] [, format=STR])
+ **/
+
+static Var* planck(vfuncptr func, Var* arg, int inverse)
+{
+	Var *wn = NULL, *v = NULL, *srf = NULL;
+	char* format_str      = NULL;
+	const char* formats[] = {"float", "double", NULL};
+	int format            = DV_DOUBLE;
+
+	Alist alist[5];
+	alist[0]      = make_alist("wn", ID_VAL, NULL, &wn);
+	alist[1]      = make_alist(inverse ? "radiance" : "temp", ID_VAL, NULL, &v);
+	alist[2]      = make_alist("srf", ID_VAL, NULL, &srf);
+	alist[3]      = make_alist("format", ID_ENUM, formats, &format_str);
+	alist[4].name = NULL;
+
+	if (parse_args(func, arg, alist) == 0) return (NULL);
+
+	if (wn == NULL || v == NULL) {
+		parse_error("Not enough arguments to function: %s()", func->name);
+		return (NULL);
+	}
+	if (format_str != NULL) format = dv_str_to_format(format_str);
+
+	if (srf != NULL) return (srf_op(func, wn, v, srf, format, inverse));
+
+	return (ff_binary_op_block(func->name, wn, v, inverse ? btemp_block : bbr_block, format));
+}
+
+Var* ff_bbr(vfuncptr func, Var* arg)
+{
+	return (planck(func, arg, 0));
+}
+
+Var* ff_btemp(vfuncptr func, Var* arg)
+{
+	return (planck(func, arg, 1));
+}
@@ -1,218 +1,382 @@
 #include "parser.h"
+#include "parallel.h"
+#include <errno.h>
 
 /*
-** compute_windowed_mean() - computes the mean and count of the pixels
-** within a wxh window, using a running-sum table.
-** Returns the mean and count for each pixel.
+** The box sums are separable, so they are built one axis at a time with a
+** sliding window sum, in place, over BSQ ordered working buffers:
+**
+**    x: every row is loaded from the input and summed along x
+**    y: every band is summed along y, a strip of columns at a time
+**    z: every line is summed along z, a strip of columns at a time
+**
+** Each step is O(1) per pixel regardless of the window size.  The only
+** full size buffers are the count and sum (and the sum of squares when
+** sigma is wanted); the window rows overwritten by the in-place passes
+** are kept in a small per-thread ring.
 */
-void init_sums(Var* data, int w, int h, int d, Var** rn, Var** rs, Var** rcount, Var** rmean,
-               Var** rsigma, double ignore)
+
+#define BOX_STRIP 256 /* columns per y/z work unit */
+
+enum { BOX_COUNT, BOX_SUM, BOX_SUM2, BOX_NCHANNELS };
+
+typedef struct boxsums {
+	Var* data;
+	size_t nx, ny, nz;
+	size_t stride[3]; /* element strides of data along x, y, z */
+	size_t h[3];      /* window half widths along x, y, z */
+	double ignore;
+	int nch;                     /* channels in use, BOX_SUM2 only for sigma */
+	double* ch[BOX_NCHANNELS];   /* [nz][ny][nx] working sums */
+	double* scratch;             /* per-thread ring + accumulator */
+	size_t scratch_size;         /* doubles of scratch per thread */
+	size_t nstrips;
+	int axis;                    /* axis of the current y/z pass */
+} boxsums;
+
+/*
+** Replace each of len positions along an axis (step elements apart, each a
+** run of width contiguous values) by the sum over the window of +-h
+** positions around it, clipped at the ends.
+**
+** The original values of the last h + 1 positions are kept in ring so the
+** trailing edge of the window can be subtracted after they are overwritten.
+*/
+static void box_slide(double* p, size_t len, size_t step, size_t width, size_t h, double* ring,
+                      double* acc)
 {
-	int x, y, z;
-	int i, j, k;
-	size_t p1, p2, p3, p4, p5, p6, p7, p8;
-	size_t nelements;
-	int east, south, north, west, front, back;
+	size_t i, j, r = h + 1;
+	double *q, *add, *old;
 
-	double *s, *s2;
-	int* n;
-	float* mean;
-	float* sigma;
-	int* c;
+	memset(acc, 0, width * sizeof(double));
+	for (j = 0; j < h && j < len; j++) {
+		q = p + j * step;
+		for (i = 0; i < width; i++) acc[i] += q[i];
+	}
 
+	for (j = 0; j < len; j++) {
+		q   = p + j * step;
+		old = ring + (j % r) * width; /* holds position j - h - 1 */
+
+		if (j + h < len) {
+			add = p + (j + h) * step;
+			for (i = 0; i < width; i++) acc[i] += add[i];
+		}
+		if (j > h) {
+			for (i = 0; i < width; i++) acc[i] -= old[i];
+		}
+		memcpy(old, q, width * sizeof(double));
+		memcpy(q, acc, width * sizeof(double));
+	}
+}
+
+#define BOX_LOAD_ROW(type)                                                    \
+	{                                                                         \
+		const type* d = (const type*)V_DATA(b->data) + base;                  \
+		for (i = 0; i < b->nx; i++) line[i] = d[i * b->stride[0]];            \
+	}                                                                         \
+	break
+
+/* rows are loaded and summed along x independently */
+static void box_x_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	boxsums* b     = (boxsums*)ctx;
+	double* ring   = b->scratch + tid * b->scratch_size;
+	double* acc    = ring + (b->h[0] + 1);
+	double* line;
+	size_t r, i, j, k, base, off;
 	double value;
-	double sum, sum2;
-	int count;
-
-	x         = GetX(data);
-	y         = GetY(data);
-	z         = GetZ(data);
-	nelements = V_DSIZE(data);
-
-	s     = calloc(nelements, sizeof(double)); /* running sum */
-	s2    = calloc(nelements, sizeof(double)); /* running sum */
-	n     = calloc(nelements, sizeof(int));    /* running count */
-	mean  = calloc(nelements, sizeof(float));
-	sigma = calloc(nelements, sizeof(float));
-	c     = calloc(nelements, sizeof(int));
-
-	/*
-	** compute the running sum and count of V
-	**
-	** s(i,j) = f(i,j) +s(i-1,j)+s(i,j-1)-s(i-1,j-1)
-	*/
-
-	for (k = 0; k < z; k++) {
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				p1 = cpos(i, j, k, data);
-
-				value = extract_double(data, p1);
-				if (value != ignore) {
-					s[p1]  = value;
-					s2[p1] = value * value;
-					n[p1]  = 1;
+	int c;
+
+	for (r = begin; r < end; r++) {
+		k    = r / b->ny;
+		j    = r % b->ny;
+		base = j * b->stride[1] + k * b->stride[2];
+		off  = r * b->nx;
+		line = b->ch[BOX_SUM] + off;
+
+		switch (V_FORMAT(b->data)) {
+		case DV_UINT8: BOX_LOAD_ROW(u8);
+		case DV_UINT16: BOX_LOAD_ROW(u16);
+		case DV_UINT32: BOX_LOAD_ROW(u32);
+		case DV_UINT64: BOX_LOAD_ROW(u64);
+		case DV_INT8: BOX_LOAD_ROW(i8);
+		case DV_INT16: BOX_LOAD_ROW(i16);
+		case DV_INT32: BOX_LOAD_ROW(i32);
+		case DV_INT64: BOX_LOAD_ROW(i64);
+		case DV_FLOAT: BOX_LOAD_ROW(float);
+		case DV_DOUBLE: BOX_LOAD_ROW(double);
+		}
+
+		for (i = 0; i < b->nx; i++) {
+			value = line[i];
+			if (value != b->ignore) {
+				b->ch[BOX_COUNT][off + i] = 1;
+				if (b->nch > BOX_SUM2) b->ch[BOX_SUM2][off + i] = value * value;
+			} else {
+				line[i]                   = 0;
+				b->ch[BOX_COUNT][off + i] = 0;
+				if (b->nch > BOX_SUM2) b->ch[BOX_SUM2][off + i] = 0;
+			}
+		}
+
+		if (b->h[0] == 0) continue;
+		for (c = 0; c < b->nch; c++) {
+			box_slide(b->ch[c] + off, b->nx, 1, 1, b->h[0], ring, acc);
+		}
+	}
+}
+
+/* strips of columns are summed along y (a band each) or z (a line each) */
+static void box_yz_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	boxsums* b   = (boxsums*)ctx;
+	size_t h     = b->h[b->axis];
+	double* ring = b->scratch + tid * b->scratch_size;
+	double* acc  = ring + (h + 1) * BOX_STRIP;
+	size_t u, outer, i0, width, off, len, step;
+	int c;
+
+	if (b->axis == 1) {
+		len  = b->ny;
+		step = b->nx;
+	} else {
+		len  = b->nz;
+		step = b->nx * b->ny;
+	}
+
+	for (u = begin; u < end; u++) {
+		outer = u / b->nstrips;
+		i0    = (u % b->nstrips) * BOX_STRIP;
+		width = min(b->nx - i0, (size_t)BOX_STRIP);
+		off   = (b->axis == 1 ? outer * b->nx * b->ny : outer * b->nx) + i0;
+
+		for (c = 0; c < b->nch; c++) {
+			box_slide(b->ch[c] + off, len, step, width, h, ring, acc);
+		}
+	}
+}
+
+/*
+** Fill b->ch[] with the windowed count, sum and (if nch > BOX_SUM2) sum of
+** squares of every pixel of data.  Returns 0 if out of memory.
+*/
+static int box_sums(boxsums* b)
+{
+	size_t n = b->nx * b->ny * b->nz;
+	size_t h;
+	int c, nchunks, axis;
+
+	for (c = 0; c < b->nch; c++) {
+		if ((b->ch[c] = (double*)malloc(n * sizeof(double))) == NULL) {
+			memory_error(errno, n * sizeof(double));
+			return 0;
+		}
+	}
+
+	b->nstrips = (b->nx + BOX_STRIP - 1) / BOX_STRIP;
+
+	b->scratch_size = b->h[0] + 2;
+	nchunks         = dv_parallel_chunks(b->ny * b->nz, 16);
+	b->scratch      = (double*)malloc(nchunks * b->scratch_size * sizeof(double));
+	if (b->scratch == NULL) {
+		memory_error(errno, nchunks * b->scratch_size * sizeof(double));
+		return 0;
+	}
+	dv_parallel_for(b->ny * b->nz, 16, box_x_kernel, b);
+
+	for (axis = 1; axis <= 2; axis++) {
+		h = b->h[axis];
+		if (h == 0) continue;
+
+		free(b->scratch);
+		b->axis         = axis;
+		b->scratch_size = (h + 2) * BOX_STRIP;
+		nchunks         = dv_parallel_chunks((axis == 1 ? b->nz : b->ny) * b->nstrips, 1);
+		b->scratch      = (double*)malloc(nchunks * b->scratch_size * sizeof(double));
+		if (b->scratch == NULL) {
+			memory_error(errno, nchunks * b->scratch_size * sizeof(double));
+			return 0;
+		}
+		dv_parallel_for((axis == 1 ? b->nz : b->ny) * b->nstrips, 1, box_yz_kernel, b);
+	}
+
+	free(b->scratch);
+	b->scratch = NULL;
+	return 1;
+}
+
+static void box_free(boxsums* b)
+{
+	int c;
+
+	for (c = 0; c < BOX_NCHANNELS; c++) free(b->ch[c]);
+	free(b->scratch);
+}
+
+typedef struct boxout {
+	boxsums* b;
+	float* mean;
+	float* sigma; /* may be NULL */
+	int* count;   /* may be NULL */
+} boxout;
+
+/* turn the sums into the outputs, which are in the org of the input */
+static void box_out_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	boxout* o  = (boxout*)ctx;
+	boxsums* b = o->b;
+	size_t r, i, j, k, p, q;
+	double count, sum, var;
+
+	for (r = begin; r < end; r++) {
+		k = r / b->ny;
+		j = r % b->ny;
+		for (i = 0; i < b->nx; i++) {
+			p     = r * b->nx + i;
+			q     = i * b->stride[0] + j * b->stride[1] + k * b->stride[2];
+			count = b->ch[BOX_COUNT][p];
+			sum   = b->ch[BOX_SUM][p];
+
+			if (o->count) o->count[q] = (int)count;
+
+			if (count == 0) {
+				o->mean[q] = b->ignore;
+				if (o->sigma) o->sigma[q] = b->ignore;
+				continue;
+			}
+
+			o->mean[q] = sum / count;
+			if (o->sigma) {
+				if (count > 1) {
+					var = (b->ch[BOX_SUM2][p] - (sum * sum / count)) / (count - 1);
+					o->sigma[q] = sqrt(var > 0 ? var : 0);
+				} else {
+					o->sigma[q] = b->ignore;
 				}
+			}
+		}
+	}
+}
+
+/*
+** The running (summed area) count and sum tables of data, in the org of
+** data.  These are only needed for boxfilter(verbose=1).
+*/
+static void running_sums(Var* data, double ignore, int** rn, double** rs)
+{
+	size_t nx = GetX(data), ny = GetY(data), nz = GetZ(data);
+	size_t nelements = V_DSIZE(data);
+	size_t stride[3];
+	size_t i, j, k, p;
+	double value;
+	int* n    = calloc(nelements, sizeof(int));
+	double* s = calloc(nelements, sizeof(double));
+
+	cstrides(data, stride);
+
+	for (p = 0; p < nelements; p++) {
+		value = extract_double(data, p);
+		if (value != ignore) {
+			s[p] = value;
+			n[p] = 1;
+		}
+	}
+
+	for (k = 0; k < nz; k++) {
+		for (j = 0; j < ny; j++) {
+			for (i = 0; i < nx; i++) {
+				p = i * stride[0] + j * stride[1] + k * stride[2];
 				if (i) {
-					p2 = cpos(i - 1, j, k, data);
-					s[p1] += s[p2];
-					s2[p1] += s2[p2];
-					n[p1] += n[p2];
+					s[p] += s[p - stride[0]];
+					n[p] += n[p - stride[0]];
 				}
 				if (j) {
-					p3 = cpos(i, j - 1, k, data);
-					s[p1] += s[p3];
-					s2[p1] += s2[p3];
-					n[p1] += n[p3];
+					s[p] += s[p - stride[1]];
+					n[p] += n[p - stride[1]];
+				}
+				if (k) {
+					s[p] += s[p - stride[2]];
+					n[p] += n[p - stride[2]];
 				}
 				if (i && j) {
-					p4 = cpos(i - 1, j - 1, k, data);
-					s[p1] -= s[p4];
-					s2[p1] -= s2[p4];
-					n[p1] -= n[p4];
+					s[p] -= s[p - stride[0] - stride[1]];
+					n[p] -= n[p - stride[0] - stride[1]];
 				}
-				if (k) {
-					p5 = cpos(i, j, k - 1, data);
-					s[p1] += s[p5];
-					s2[p1] += s2[p5];
-					n[p1] += n[p5];
-					if (i) {
-						p6 = cpos(i - 1, j, k - 1, data);
-						s[p1] -= s[p6];
-						s2[p1] -= s2[p6];
-						n[p1] -= n[p6];
-					}
-					if (j) {
-						p7 = cpos(i, j - 1, k - 1, data);
-						s[p1] -= s[p7];
-						s2[p1] -= s2[p7];
-						n[p1] -= n[p7];
-					}
-					if (i && j) {
-						p8 = cpos(i - 1, j - 1, k - 1, data);
-						s[p1] += s[p8];
-						s2[p1] += s2[p8];
-						n[p1] += n[p8];
-					}
+				if (i && k) {
+					s[p] -= s[p - stride[0] - stride[2]];
+					n[p] -= n[p - stride[0] - stride[2]];
+				}
+				if (j && k) {
+					s[p] -= s[p - stride[1] - stride[2]];
+					n[p] -= n[p - stride[1] - stride[2]];
+				}
+				if (i && j && k) {
+					s[p] += s[p - stride[0] - stride[1] - stride[2]];
+					n[p] += n[p - stride[0] - stride[1] - stride[2]];
 				}
 			}
 		}
 	}
 
-	/* Formula to compute windowed sum from running sum is:
-	**    s(u,v) = s(u+M-1,v+N-1) - s(u-1,v+N-1) - s(u+M-1,v-1) + s(u-1,v-1)
-	** This is:      sum(pt) = s(se) - s(sw) - s(ne) + s(nw).
-	** Given a 4x3 mask, it's this:
-	**
-	**              nw -- -- -- ne
-	**              -- pt -- -- --
-	**              -- -- -- -- --
-	**              sw -- -- -- se
-	**/
-
-	for (k = 0; k < z; k++) {
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				east  = min(i + (w / 2), x - 1);
-				south = min(j + (h / 2), y - 1);
-				front = min(k + (d / 2), z - 1);
-
-				west  = i - (w / 2) - 1;
-				north = j - (h / 2) - 1;
-				back  = k - (d / 2) - 1;
-
-				p1    = cpos(east, south, front, data);
-				count = n[p1];
-				sum   = s[p1];
-				sum2  = s2[p1];
-
-				if (west >= 0) {
-					p2 = cpos(west, south, front, data);
-					count -= n[p2];
-					sum -= s[p2];
-					sum2 -= s2[p2];
-				}
-
-				if (north >= 0) {
-					p3 = cpos(east, north, front, data);
-					count -= n[p3];
-					sum -= s[p3];
-					sum2 -= s2[p3];
-				}
+	*rn = n;
+	*rs = s;
+}
 
-				if (north >= 0 && west >= 0) {
-					p4 = cpos(west, north, front, data);
-					count += n[p4];
-					sum += s[p4];
-					sum2 += s2[p4];
-				}
+/*
+** init_sums() - computes the mean of the pixels within a w x h x d window
+** around each pixel and, if rsigma is not NULL, their count and standard
+** deviation.  Returns 0 if out of memory.
+*/
+int init_sums(Var* data, int w, int h, int d, Var** rcount, Var** rmean, Var** rsigma,
+              double ignore)
+{
+	boxsums b;
+	boxout o;
+	size_t nelements = V_DSIZE(data);
 
-				if (back >= 0) {
-					p5 = cpos(east, south, back, data);
-					count -= n[p5];
-					sum -= s[p5];
-					sum2 -= s2[p5];
-
-					if (west >= 0) {
-						p6 = cpos(west, south, back, data);
-						count += n[p6];
-						sum += s[p6];
-						sum2 += s2[p6];
-					}
-
-					if (north >= 0) {
-						p7 = cpos(east, north, back, data);
-						count += n[p7];
-						sum += s[p7];
-						sum2 += s2[p7];
-					}
-
-					if (north >= 0 && west >= 0) {
-						p8 = cpos(west, north, back, data);
-						count -= n[p8];
-						sum -= s[p8];
-						sum2 -= s2[p8];
-					}
-				}
+	memset(&b, 0, sizeof(b));
+	b.data   = data;
+	b.nx     = GetX(data);
+	b.ny     = GetY(data);
+	b.nz     = GetZ(data);
+	b.h[0]   = min((size_t)(w / 2), b.nx);
+	b.h[1]   = min((size_t)(h / 2), b.ny);
+	b.h[2]   = min((size_t)(d / 2), b.nz);
+	b.ignore = ignore;
+	b.nch    = (rsigma != NULL) ? BOX_NCHANNELS : BOX_SUM2;
+	cstrides(data, b.stride);
 
-				/*
-				                sum = s[cpos(min(i+w-1, x-1), min(j+h-1, y-1), k, data)];
-				                sum -= (i ? s[cpos(i-1, min(j+h-1, y-1), k, data)] : 0.0);
-				                sum -= (j ? s[cpos(min(i+w-1, x-1), j-1, k, data)] : 0.0);
-				                sum += (i == 0 || j == 0 ? 0.0 : s[cpos(i-1,j-1,k,data)]);
-				*/
-				if (count) {
-					p1       = cpos(i, j, k, data);
-					mean[p1] = sum / count;
-					if (count > 1) {
-						sigma[p1] = sqrt((sum2 - (sum * sum / count)) / (count - 1));
-					} else {
-						sigma[p1] = ignore;
-					}
-					c[p1] = count;
-				} else {
-					mean[cpos(i, j, k, data)]  = ignore;
-					sigma[cpos(i, j, k, data)] = ignore;
-					c[p1] = ignore;
-				}
-			}
-		}
+	if (!box_sums(&b)) {
+		box_free(&b);
+		return 0;
 	}
 
-	free(s2);
+	memset(&o, 0, sizeof(o));
+	o.b    = &b;
+	o.mean = calloc(nelements, sizeof(float));
+	if (rsigma != NULL) {
+		o.sigma = calloc(nelements, sizeof(float));
+		o.count = calloc(nelements, sizeof(int));
+	}
+	dv_parallel_for(b.ny * b.nz, 16, box_out_kernel, &o);
+	box_free(&b);
 
-	*rn     = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_INT32, n);
-	*rs     = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_DOUBLE, s);
-	*rcount = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_INT32, c);
-	*rmean = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_FLOAT, mean);
-	*rsigma = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_FLOAT, sigma);
+	*rmean = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_FLOAT, o.mean);
+	if (rsigma != NULL) {
+		*rsigma = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_FLOAT, o.sigma);
+		*rcount = newVal(V_ORG(data), V_SIZE(data)[0], V_SIZE(data)[1], V_SIZE(data)[2], DV_INT32, o.count);
+	}
+	return 1;
 }
 
 Var* ff_boxfilter(vfuncptr func, Var* arg)
 {
 	Var* v = NULL;
-	Var *rcount, *rmean, *rs, *rn, *rsigma;
+	Var *rcount, *rmean, *rsigma;
 	Var* a;
+	int* n;
+	double* s;
 	int x         = 0;
 	int y         = 0;
 	int z         = 0;
@@ -244,30 +408,26 @@ Var* ff_boxfilter(vfuncptr func, Var* arg)
 	if (z == 0) z    = 1;
 	if (size != 0) x = y = size;
 
-	if (x == 0 || y == 0) {
-		parse_error("%s(): No x or y specified", func->name);
+	if (x <= 0 || y <= 0 || z <= 0) {
+		parse_error("%s(): x, y and z must be positive", func->name);
 		return (NULL);
 	}
 
-	init_sums(v, x, y, z, &rn, &rs, &rcount, &rmean, &rsigma, ignore);
-
-	if (verbose) {
-		a = new_struct(0);
-		add_struct(a, "count", rcount);
-		add_struct(a, "mean", rmean);
-		add_struct(a, "sigma", rsigma);
-		add_struct(a, "n", rn);
-		add_struct(a, "s", rs);
-		return (a);
-	} else {
-		mem_claim(rcount);
-		free_var(rcount);
-		mem_claim(rn);
-		free_var(rn);
-		mem_claim(rs);
-		free_var(rs);
+	if (!verbose) {
+		if (!init_sums(v, x, y, z, NULL, &rmean, NULL, ignore)) return (NULL);
 		return (rmean);
 	}
+
+	if (!init_sums(v, x, y, z, &rcount, &rmean, &rsigma, ignore)) return (NULL);
+	running_sums(v, ignore, &n, &s);
+
+	a = new_struct(0);
+	add_struct(a, "count", rcount);
+	add_struct(a, "mean", rmean);
+	add_struct(a, "sigma", rsigma);
+	add_struct(a, "n", newVal(V_ORG(v), V_SIZE(v)[0], V_SIZE(v)[1], V_SIZE(v)[2], DV_INT32, n));
+	add_struct(a, "s", newVal(V_ORG(v), V_SIZE(v)[0], V_SIZE(v)[1], V_SIZE(v)[2], DV_DOUBLE, s));
+	return (a);
 }
 
 /*
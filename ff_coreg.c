@@ -1,4 +1,487 @@
 #include "parser.h"
+#include "parallel.h"
+#include "fft.h"
+#include <errno.h>
+
+/*
+** Phase correlation engine for coreg(method="phase") and coreg2().
+**
+** Each frame pair is reduced to a pyramid of 2x2 block means (ignore
+** pixels drop out of the means) until the search radius at the top is
+** small.  The top level is registered over the whole frame; every level
+** below doubles that estimate, crops the two frames to their overlap at
+** the rounded offset and only looks for a residual of +-COREG_REFINE
+** pixels.  Registration is FFT phase correlation: the frames are mean
+** removed, Hann windowed and whitened so the correlation surface has a
+** single sharp peak.  The whitening is regularized by COREG_WHITEN of the
+** largest cross power so smooth frames, whose high frequencies are all
+** rounding noise, still correlate.  The confidence is the peak height
+** relative to that of a perfect match, so 1 means the frames agree
+** exactly.  On the full resolution level the peak is then refined on a
+** COREG_UPSAMPLE times finer grid, evaluated directly from the cross
+** power spectrum, and finished with a parabolic fit.
+**
+** Several frame pairs are registered one per thread; a single pair
+** spreads its transforms across the threads instead.
+*/
+
+#define COREG_MIN_SIZE 32 /* pyramid levels stop at this edge length */
+#define COREG_MAX_LEVELS 8
+#define COREG_REFINE 2    /* residual search radius below the top level */
+#define COREG_MIN_OVERLAP 8
+#define COREG_WHITEN 1e-3
+#define COREG_UPSAMPLE 8
+
+typedef struct {
+	double* v;
+	u8* ok; /* 0 for ignore pixels */
+	int w, h;
+} coreg_image;
+
+typedef struct {
+	Var* pic[2];
+	int nz[2];
+	double ignore;
+	int search;
+	float* offset;     /* [nframes][2] */
+	float* confidence; /* [nframes] */
+	int threaded;      /* transforms may use the threads themselves */
+	int failed;
+} coreg_job;
+
+static void coreg_free_image(coreg_image* im)
+{
+	free(im->v);
+	free(im->ok);
+	im->v  = NULL;
+	im->ok = NULL;
+}
+
+static int coreg_alloc_image(coreg_image* im, int w, int h)
+{
+	im->w  = w;
+	im->h  = h;
+	im->v  = (double*)malloc((size_t)w * h * sizeof(double));
+	im->ok = (u8*)malloc((size_t)w * h);
+	if (im->v == NULL || im->ok == NULL) {
+		coreg_free_image(im);
+		return 0;
+	}
+	return 1;
+}
+
+static int coreg_load_image(coreg_image* im, Var* pic, int band, double ignore)
+{
+	int i, j;
+	size_t p;
+
+	if (!coreg_alloc_image(im, GetX(pic), GetY(pic))) return 0;
+
+	for (j = 0; j < im->h; j++) {
+		for (i = 0; i < im->w; i++) {
+			p         = (size_t)j * im->w + i;
+			im->v[p]  = extract_double(pic, cpos(i, j, band, pic));
+			im->ok[p] = (im->v[p] != ignore);
+		}
+	}
+	return 1;
+}
+
+/* the next pyramid level, each pixel the mean of the valid pixels of a 2x2 block */
+static int coreg_reduce(coreg_image* dst, const coreg_image* src)
+{
+	int i, j, di, dj, n;
+	double sum;
+	size_t p;
+
+	if (!coreg_alloc_image(dst, src->w / 2, src->h / 2)) return 0;
+
+	for (j = 0; j < dst->h; j++) {
+		for (i = 0; i < dst->w; i++) {
+			sum = 0;
+			n   = 0;
+			for (dj = 0; dj < 2; dj++) {
+				for (di = 0; di < 2; di++) {
+					p = (size_t)(2 * j + dj) * src->w + 2 * i + di;
+					if (src->ok[p]) {
+						sum += src->v[p];
+						n++;
+					}
+				}
+			}
+			p          = (size_t)j * dst->w + i;
+			dst->v[p]  = n ? sum / n : 0;
+			dst->ok[p] = (n > 0);
+		}
+	}
+	return 1;
+}
+
+/*
+** Copy a w x h crop at (x0, y0) of im into the real part of the padded
+** transform buffer, mean removed (ignore pixels get the mean) and windowed.
+*/
+static int coreg_fill(double* buf, int cols, const coreg_image* im, int x0, int y0, int w, int h,
+                      const double* wx, const double* wy)
+{
+	double sum = 0;
+	size_t n   = 0, p;
+	int i, j;
+
+	for (j = 0; j < h; j++) {
+		for (i = 0; i < w; i++) {
+			p = (size_t)(y0 + j) * im->w + x0 + i;
+			if (im->ok[p]) {
+				sum += im->v[p];
+				n++;
+			}
+		}
+	}
+	if (n == 0) return 0;
+	sum /= n;
+
+	for (j = 0; j < h; j++) {
+		for (i = 0; i < w; i++) {
+			p = (size_t)(y0 + j) * im->w + x0 + i;
+			if (im->ok[p]) buf[2 * ((size_t)j * cols + i)] = (im->v[p] - sum) * wx[i] * wy[j];
+		}
+	}
+	return 1;
+}
+
+/* fractional position of a peak from its two neighbours */
+static double coreg_subpixel(double l, double c, double r)
+{
+	double d = l - 2 * c + r;
+	double f;
+
+	if (d >= 0) return 0;
+	f = 0.5 * (l - r) / d;
+	return max(-0.5, min(0.5, f));
+}
+
+/*
+** Evaluate the inverse transform of the cross power spectrum R (rows x
+** cols) on a grid COREG_UPSAMPLE times finer than the pixels, +-1 pixel
+** around (*dx, *dy), and move the peak to the best point on it.  This is
+** the band-limited interpolation of the correlation surface, done as two
+** small matrix products rather than a bigger FFT.  Returns 0 when out of
+** memory.
+*/
+static int coreg_upsample(const double* R, int rows, int cols, double* dx, double* dy)
+{
+	const int K = 2 * COREG_UPSAMPLE + 1;
+	double *ex, *ey, *t, *s;
+	double f, a, best;
+	int u, v, kx, ky, bx = COREG_UPSAMPLE, by = COREG_UPSAMPLE;
+
+	ex = (double*)malloc(2 * (size_t)cols * K * sizeof(double));
+	ey = (double*)malloc(2 * (size_t)rows * K * sizeof(double));
+	t  = (double*)calloc(2 * (size_t)rows * K, sizeof(double));
+	s  = (double*)malloc((size_t)K * K * sizeof(double));
+	if (ex == NULL || ey == NULL || t == NULL || s == NULL) {
+		free(ex);
+		free(ey);
+		free(t);
+		free(s);
+		return 0;
+	}
+
+	/* exp(2 pi i f x / n) for the signed frequencies f and the grid points x */
+	for (u = 0; u < cols; u++) {
+		f = (u < cols / 2) ? u : u - cols;
+		for (kx = 0; kx < K; kx++) {
+			a                      = 2 * M_PI * f * (*dx + (double)(kx - COREG_UPSAMPLE) / COREG_UPSAMPLE) / cols;
+			ex[2 * (u * K + kx)]     = cos(a);
+			ex[2 * (u * K + kx) + 1] = sin(a);
+		}
+	}
+	for (v = 0; v < rows; v++) {
+		f = (v < rows / 2) ? v : v - rows;
+		for (ky = 0; ky < K; ky++) {
+			a                        = 2 * M_PI * f * (*dy + (double)(ky - COREG_UPSAMPLE) / COREG_UPSAMPLE) / rows;
+			ey[2 * (v * K + ky)]     = cos(a);
+			ey[2 * (v * K + ky) + 1] = sin(a);
+		}
+	}
+
+	/* t = R * ex along the rows, then the real part of ey^T * t */
+	for (v = 0; v < rows; v++) {
+		const double* r = R + 2 * (size_t)v * cols;
+		double* tv      = t + 2 * (size_t)v * K;
+		for (u = 0; u < cols; u++) {
+			const double* e = ex + 2 * (size_t)u * K;
+			for (kx = 0; kx < K; kx++) {
+				tv[2 * kx] += r[2 * u] * e[2 * kx] - r[2 * u + 1] * e[2 * kx + 1];
+				tv[2 * kx + 1] += r[2 * u] * e[2 * kx + 1] + r[2 * u + 1] * e[2 * kx];
+			}
+		}
+	}
+	best = -HUGE_VAL;
+	for (ky = 0; ky < K; ky++) {
+		for (kx = 0; kx < K; kx++) {
+			a = 0;
+			for (v = 0; v < rows; v++) {
+				a += t[2 * (v * K + kx)] * ey[2 * (v * K + ky)] - t[2 * (v * K + kx) + 1] * ey[2 * (v * K + ky) + 1];
+			}
+			s[ky * K + kx] = a;
+			if (a > best) {
+				best = a;
+				bx   = kx;
+				by   = ky;
+			}
+		}
+	}
+
+	*dx += (bx - COREG_UPSAMPLE) / (double)COREG_UPSAMPLE;
+	*dy += (by - COREG_UPSAMPLE) / (double)COREG_UPSAMPLE;
+	if (bx > 0 && bx < K - 1) {
+		*dx += coreg_subpixel(s[by * K + bx - 1], best, s[by * K + bx + 1]) / COREG_UPSAMPLE;
+	}
+	if (by > 0 && by < K - 1) {
+		*dy += coreg_subpixel(s[(by - 1) * K + bx], best, s[(by + 1) * K + bx]) / COREG_UPSAMPLE;
+	}
+
+	free(ex);
+	free(ey);
+	free(t);
+	free(s);
+	return 1;
+}
+
+/*
+** Phase correlate the w x h crops of a at (ax, ay) and b at (bx, by) and
+** find the peak offset of b relative to a within [lox, hix] x [loy, hiy],
+** upsampling around it when fine is set.  Returns -1 when out of memory,
+** 0 when either crop has no valid pixels.
+*/
+static int coreg_correlate(const coreg_image* a, int ax, int ay, const coreg_image* b, int bx, int by,
+                           int w, int h, int lox, int hix, int loy, int hiy, int fine, int threaded,
+                           double* dx, double* dy, double* conf)
+{
+	int rows = FFT_2D_Size(h), cols = FFT_2D_Size(w);
+	size_t n = (size_t)rows * cols, k;
+	double *fa, *fb, *wx, *wy;
+	double re, im, mag, eps, best, ideal = 0;
+	int i, j, px = 0, py = 0, ret = -1;
+
+#define COREG_AT(x, y) fa[2 * ((size_t)(((y) + rows) % rows) * cols + ((x) + cols) % cols)]
+
+	fa = (double*)calloc(2 * n, sizeof(double));
+	fb = (double*)calloc(2 * n, sizeof(double));
+	wx = (double*)malloc(w * sizeof(double));
+	wy = (double*)malloc(h * sizeof(double));
+	if (fa == NULL || fb == NULL || wx == NULL || wy == NULL) goto done;
+
+	for (i = 0; i < w; i++) wx[i] = 0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / w);
+	for (j = 0; j < h; j++) wy[j] = 0.5 - 0.5 * cos(2 * M_PI * (j + 0.5) / h);
+
+	ret = 0;
+	if (!coreg_fill(fa, cols, a, ax, ay, w, h, wx, wy) || !coreg_fill(fb, cols, b, bx, by, w, h, wx, wy)) {
+		goto done;
+	}
+
+	ret = -1;
+	if (!FFT_2D_Transform(fa, rows, cols, 0, threaded) || !FFT_2D_Transform(fb, rows, cols, 0, threaded)) {
+		goto done;
+	}
+
+	/*
+	** cross power spectrum conj(A) * B, whitened.  ideal is what the peak
+	** would be if every frequency were in phase.
+	*/
+	eps = 0;
+	for (k = 0; k < n; k++) {
+		re            = fa[2 * k] * fb[2 * k] + fa[2 * k + 1] * fb[2 * k + 1];
+		im            = fa[2 * k] * fb[2 * k + 1] - fa[2 * k + 1] * fb[2 * k];
+		fa[2 * k]     = re;
+		fa[2 * k + 1] = im;
+		eps         = max(eps, re * re + im * im);
+	}
+	eps = COREG_WHITEN * sqrt(eps);
+	for (k = 0; k < n; k++) {
+		mag = sqrt(fa[2 * k] * fa[2 * k] + fa[2 * k + 1] * fa[2 * k + 1]);
+		if (mag + eps > 0) {
+			ideal += mag / (mag + eps);
+			fa[2 * k] /= mag + eps;
+			fa[2 * k + 1] /= mag + eps;
+		}
+	}
+	if (fine) memcpy(fb, fa, 2 * n * sizeof(double));
+	if (!FFT_2D_Transform(fa, rows, cols, 1, threaded)) goto done;
+
+	/* offsets past half the transform size would alias */
+	lox = max(lox, -(cols / 2 - 1));
+	hix = min(hix, cols / 2 - 1);
+	loy = max(loy, -(rows / 2 - 1));
+	hiy = min(hiy, rows / 2 - 1);
+
+	best = -HUGE_VAL;
+	for (j = loy; j <= hiy; j++) {
+		for (i = lox; i <= hix; i++) {
+			if (COREG_AT(i, j) > best) {
+				best = COREG_AT(i, j);
+				px   = i;
+				py   = j;
+			}
+		}
+	}
+
+	*conf = (ideal > 0) ? max(0.0, min(1.0, best * n / ideal)) : 0;
+	if (fine) {
+		*dx = px;
+		*dy = py;
+		if (!coreg_upsample(fb, rows, cols, dx, dy)) goto done;
+	} else {
+		*dx = px + coreg_subpixel(COREG_AT(px - 1, py), best, COREG_AT(px + 1, py));
+		*dy = py + coreg_subpixel(COREG_AT(px, py - 1), best, COREG_AT(px, py + 1));
+	}
+	ret = 1;
+
+#undef COREG_AT
+done:
+	free(fa);
+	free(fb);
+	free(wx);
+	free(wy);
+	return ret;
+}
+
+/* register one frame pair, coarse to fine */
+static int coreg_frame(coreg_job* job, int frame)
+{
+	coreg_image pyr[2][COREG_MAX_LEVELS + 1];
+	int levels = 0, l, k, s, di, dj, x0, y0, w, h, r, ok = 1;
+	double dx = 0, dy = 0, rx, ry, conf = 0;
+
+	memset(pyr, 0, sizeof(pyr));
+	for (k = 0; k < 2; k++) {
+		if (!coreg_load_image(&pyr[k][0], job->pic[k], job->nz[k] > 1 ? frame : 0, job->ignore)) {
+			ok = 0;
+			goto done;
+		}
+	}
+
+	w = pyr[0][0].w;
+	h = pyr[0][0].h;
+	while (levels < COREG_MAX_LEVELS && (job->search >> (levels + 1)) >= 2 * COREG_REFINE &&
+	       min(w, h) >> (levels + 1) >= COREG_MIN_SIZE) {
+		levels++;
+		for (k = 0; k < 2; k++) {
+			if (!coreg_reduce(&pyr[k][levels], &pyr[k][levels - 1])) {
+				ok = 0;
+				goto done;
+			}
+		}
+	}
+
+	for (l = levels; l >= 0; l--) {
+		s = (job->search + (1 << l) - 1) >> l; /* search radius at this level */
+		w = pyr[0][l].w;
+		h = pyr[0][l].h;
+
+		if (l == levels) {
+			r = coreg_correlate(&pyr[0][l], 0, 0, &pyr[1][l], 0, 0, w, h, -s, s, -s, s, l == 0,
+			                    job->threaded, &dx, &dy, &conf);
+		} else {
+			dx *= 2;
+			dy *= 2;
+			di = max(-s, min(s, (int)floor(dx + 0.5)));
+			dj = max(-s, min(s, (int)floor(dy + 0.5)));
+			x0 = max(0, -di);
+			y0 = max(0, -dj);
+			if (w - abs(di) < COREG_MIN_OVERLAP || h - abs(dj) < COREG_MIN_OVERLAP) continue;
+
+			r = coreg_correlate(&pyr[0][l], x0, y0, &pyr[1][l], x0 + di, y0 + dj, w - abs(di),
+			                    h - abs(dj), max(-COREG_REFINE, -s - di), min(COREG_REFINE, s - di),
+			                    max(-COREG_REFINE, -s - dj), min(COREG_REFINE, s - dj), l == 0,
+			                    job->threaded, &rx, &ry, &conf);
+			if (r > 0) {
+				dx = di + rx;
+				dy = dj + ry;
+			}
+		}
+		if (r < 0) {
+			ok = 0;
+			goto done;
+		}
+		if (r == 0) {
+			/* nothing valid to line up */
+			dx = dy = conf = 0;
+			break;
+		}
+	}
+
+	job->offset[2 * frame]     = max(-job->search, min(job->search, dx));
+	job->offset[2 * frame + 1] = max(-job->search, min(job->search, dy));
+	job->confidence[frame]     = conf;
+
+done:
+	for (k = 0; k < 2; k++) {
+		for (l = 0; l <= levels; l++) coreg_free_image(&pyr[k][l]);
+	}
+	return ok;
+}
+
+static void coreg_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	coreg_job* job = (coreg_job*)ctx;
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		if (!coreg_frame(job, i)) job->failed = 1;
+	}
+}
+
+/*
+** coreg(method="phase"): register band k of pic2 against band k of pic1
+** (either may have a single band to register against every band of the
+** other).  Returns the offsets as a 2x1xN float and a 1x1xN confidence.
+*/
+static Var* coreg_phase(vfuncptr func, Var* pic1, Var* pic2, int search, int ignore)
+{
+	coreg_job job;
+	size_t nframes;
+	Var* out;
+
+	if (GetZ(pic1) != GetZ(pic2) && GetZ(pic1) != 1 && GetZ(pic2) != 1) {
+		parse_error("%s: images must have the same number of bands, or just one.\n", func->name);
+		return NULL;
+	}
+
+	job.pic[0]     = pic1;
+	job.pic[1]     = pic2;
+	job.nz[0]      = GetZ(pic1);
+	job.nz[1]      = GetZ(pic2);
+	job.ignore     = ignore;
+	job.search     = search;
+	job.failed     = 0;
+	nframes        = max(job.nz[0], job.nz[1]);
+	job.offset     = (float*)calloc(2 * nframes, sizeof(float));
+	job.confidence = (float*)calloc(nframes, sizeof(float));
+	if (job.offset == NULL || job.confidence == NULL) {
+		free(job.offset);
+		free(job.confidence);
+		memory_error(errno, 3 * nframes * sizeof(float));
+		return NULL;
+	}
+
+	job.threaded = (nframes == 1);
+	dv_parallel_for(nframes, 1, coreg_kernel, &job);
+
+	if (job.failed) {
+		free(job.offset);
+		free(job.confidence);
+		parse_error("%s: out of memory.\n", func->name);
+		return NULL;
+	}
+
+	out = new_struct(2);
+	add_struct(out, "offset", newVal(BSQ, 2, 1, nframes, DV_FLOAT, job.offset));
+	add_struct(out, "confidence", newVal(BSQ, 1, 1, nframes, DV_FLOAT, job.confidence));
+	return out;
+}
+
 
 Var* ff_coreg(vfuncptr func, Var* arg)
 {
@@ -25,6 +508,8 @@ Var* ff_coreg(vfuncptr func, Var* arg)
 	int ok       = 0;
 	size_t count = 0;
 	size_t total = 0;
+	char* method = NULL;
+	char* methods[] = {"search", "phase", NULL};
 
 	Alist alist[8];
 	alist[0]      = make_alist("pic1", ID_VAL, NULL, &pic1_in);
@@ -33,7 +518,8 @@ Var* ff_coreg(vfuncptr func, Var* arg)
 	alist[3]      = make_alist("ignore", DV_INT32, NULL, &ignore);
 	alist[4]      = make_alist("verbose", DV_INT32, NULL, &verbose);
 	alist[5]      = make_alist("random", DV_INT32, NULL, &random);
-	alist[6].name = NULL;
+	alist[6]      = make_alist("method", ID_ENUM, methods, &method);
+	alist[7].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -55,6 +541,10 @@ Var* ff_coreg(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
+	if (method != NULL && !strcmp(method, "phase")) {
+		return coreg_phase(func, pic1_in, pic2_in, search, ignore);
+	}
+
 	s_dia = search * 2 + 1;
 
 	solution = (float*)calloc(sizeof(float), s_dia * s_dia);
@@ -177,7 +667,6 @@ Var* ff_coreg(vfuncptr func, Var* arg)
 	return out;
 }
 
-#include "window.h"
 Var* ff_coreg2(vfuncptr func, Var* arg)
 {
 	Var* obj1     = NULL;
@@ -188,9 +677,13 @@ Var* ff_coreg2(vfuncptr func, Var* arg)
 	int x, y;
 	int i, j, k, m;
 	int size = 10;
-	float v1, v2;
+	float v1;
 	Var* sval;
 	size_t diameter;
+	int rows, cols;
+	size_t n, p;
+	double *m1 = NULL, *m2 = NULL;
+	double re, im;
 	int* answer;
 	int maxval;
 
@@ -210,7 +703,7 @@ Var* ff_coreg2(vfuncptr func, Var* arg)
 	}
 
 	x = GetX(obj1);
-	y = GetY(obj2);
+	y = GetY(obj1);
 	if (x != GetX(obj2) || y != GetY(obj2)) {
 		parse_error("%s: images are not same size.\n", func->name);
 		return (NULL);
@@ -230,31 +723,49 @@ Var* ff_coreg2(vfuncptr func, Var* arg)
 	sval = newVal(BSQ, diameter, diameter, 1, DV_INT32, solution);
 
 	/*
-	 ** Exhaustive search, skipping pixels that are blank in both
-	 **
-	 ** Right now this just counts non-ignore pixels that align.
+	 ** Count the non-ignore pixels that align at every offset.  That is
+	 ** the cross-correlation of the two valid pixel masks, done with FFTs
+	 ** padded far enough that offsets up to size don't wrap around.
 	 */
-	for (i = 0; i < x; i++) {
-		for (j = 0; j < y; j++) {
-			v1 = extract_float(obj1, cpos(i, j, 0, obj1));
-			if (v1 == ignore) continue;
+	rows = FFT_2D_Size(y + size);
+	cols = FFT_2D_Size(x + size);
+	n    = (size_t)rows * cols;
+	m1   = (double*)calloc(2 * n, sizeof(double));
+	m2   = (double*)calloc(2 * n, sizeof(double));
+	if (m1 == NULL || m2 == NULL) {
+		free(m1);
+		free(m2);
+		if (mem_claim(sval)) free_var(sval);
+		memory_error(errno, 4 * n * sizeof(double));
+		return NULL;
+	}
 
-			/*
-			** TODO: i*j load_windows will be expensive, but
-			** we're expecting sparse data for now, so it'll be
-			** cheaper than i*j rolls
-			*/
-			for (k = -size; k <= size; k++) {
-				for (m = -size; m <= size; m++) {
-					if (i + k >= 0 && i + k < x && j + m >= 0 && j + m < y) {
-						v2 = extract_float(obj2, cpos(i + k, j + m, 0, obj2));
-						if (v2 == ignore) continue;
-						((int*)(V_DATA(sval)))[cpos(k + size, m + size, 0, sval)] += 1;
-					}
-				}
-			}
+	for (j = 0; j < y; j++) {
+		for (i = 0; i < x; i++) {
+			m1[2 * ((size_t)j * cols + i)] = (extract_float(obj1, cpos(i, j, 0, obj1)) != ignore);
+			m2[2 * ((size_t)j * cols + i)] = (extract_float(obj2, cpos(i, j, 0, obj2)) != ignore);
+		}
+	}
+
+	if (!FFT_2D_Transform(m1, rows, cols, 0, 1) || !FFT_2D_Transform(m2, rows, cols, 0, 1)) {
+		goto nomem;
+	}
+	for (p = 0; p < n; p++) {
+		re            = m1[2 * p] * m2[2 * p] + m1[2 * p + 1] * m2[2 * p + 1];
+		im            = m1[2 * p] * m2[2 * p + 1] - m1[2 * p + 1] * m2[2 * p];
+		m1[2 * p]     = re;
+		m1[2 * p + 1] = im;
+	}
+	if (!FFT_2D_Transform(m1, rows, cols, 1, 1)) goto nomem;
+
+	for (k = -size; k <= size; k++) {
+		for (m = -size; m <= size; m++) {
+			p = (size_t)((m + rows) % rows) * cols + (k + cols) % cols;
+			solution[cpos(k + size, m + size, 0, sval)] = (int)floor(m1[2 * p] + 0.5);
 		}
 	}
+	free(m1);
+	free(m2);
 
 	answer = (int*)calloc(2, sizeof(int));
 	maxval = extract_int(sval, cpos(size, size, 0, sval));
@@ -276,6 +787,14 @@ Var* ff_coreg2(vfuncptr func, Var* arg)
 		add_struct(s, "counts", sval);
 		return (s);
 	} else {
+		if (mem_claim(sval)) free_var(sval);
 		return (newVal(BSQ, 2, 1, 1, DV_INT32, answer));
 	}
+
+nomem:
+	free(m1);
+	free(m2);
+	if (mem_claim(sval)) free_var(sval);
+	parse_error("%s: out of memory.\n", func->name);
+	return NULL;
 }
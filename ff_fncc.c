@@ -1,11 +1,9 @@
 #include "fft.h"
 #include "parser.h"
+#include "parallel.h"
 #include <errno.h>
 
-extern int mayer_realfft(int n, double* out);
-extern int mayer_realifft(int n, double* out);
-extern int mayer_fft(int n, double* out, double* im);
-extern int mayer_ifft(int n, double* out, double* im);
+extern void cdft(int n, double wr, double wi, double* a);
 
 double* flip_t(int trow, int tcol, double* t);
 
@@ -189,175 +187,161 @@ Var* ff_fncc(vfuncptr func, Var* arg)
 	return (result);
 }
 
-double* FFT_2D_Convolve(int trow, int tcol, int frow, int fcol, double* t, double* f)
+/*
+** Threaded 2-D FFT used by FFT_2D_Convolve() and the coreg() engine.
+**
+** The data is rows x cols interleaved (re, im) pairs with both sizes
+** powers of two (see FFT_2D_Size()).  Every row is transformed with the
+** reentrant cdft() and then every column, FFT2_GATHER columns at a time
+** through per-chunk scratch so the strided loads touch whole cache lines.
+** The inverse includes the 1/(rows*cols) scaling.
+*/
+
+#define FFT2_GATHER 8
+
+typedef struct {
+	double* a;
+	int rows, cols;
+	int inverse;
+	int failed;
+} fft2_pass;
+
+static void fft2_rows_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	double* pad_t;
-	double* pad_f;
-
-	double* f_vector_col;
-	double* f_vector_row;
-	double* t_vector_col;
-	double* t_vector_row;
-	double* t_fft;
-	double* f_fft;
-	double* f_vector_col_im;
-	double* f_vector_row_im;
-	double* t_vector_col_im;
-	double* t_vector_row_im;
-	double* t_fft_im;
-	double* f_fft_im;
+	fft2_pass* p = (fft2_pass*)ctx;
+	double wr    = cos(M_PI / p->cols);
+	double wi    = (p->inverse ? 1 : -1) * sin(M_PI / p->cols);
+	size_t i;
 
-	double* r;
+	for (i = begin; i < end; i++) {
+		cdft(2 * p->cols, wr, wi, p->a + 2 * i * p->cols);
+	}
+}
 
-	int i, j;
-	int col_pad;
-	int row_pad;
-	int row_byte_diff;
-	int col_byte_diff;
-	int row_byte;
-	int col_byte;
+static void fft2_cols_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	fft2_pass* p   = (fft2_pass*)ctx;
+	size_t rows    = p->rows, cols = p->cols;
+	double wr      = cos(M_PI / rows);
+	double wi      = (p->inverse ? 1 : -1) * sin(M_PI / rows);
+	double scale   = p->inverse ? 1.0 / ((double)rows * cols) : 1.0;
+	double* buf;
+	size_t c, i, k, n;
+
+	if ((buf = (double*)malloc(FFT2_GATHER * 2 * rows * sizeof(double))) == NULL) {
+		p->failed = 1;
+		return;
+	}
+
+	for (c = begin * FFT2_GATHER; c < end * FFT2_GATHER && c < cols; c += FFT2_GATHER) {
+		n = min(cols - c, FFT2_GATHER);
+		for (i = 0; i < rows; i++) {
+			const double* src = p->a + 2 * (i * cols + c);
+			for (k = 0; k < n; k++) {
+				buf[2 * (k * rows + i)]     = src[2 * k];
+				buf[2 * (k * rows + i) + 1] = src[2 * k + 1];
+			}
+		}
+		for (k = 0; k < n; k++) {
+			cdft(2 * rows, wr, wi, buf + 2 * k * rows);
+		}
+		for (i = 0; i < rows; i++) {
+			double* dst = p->a + 2 * (i * cols + c);
+			for (k = 0; k < n; k++) {
+				dst[2 * k]     = buf[2 * (k * rows + i)] * scale;
+				dst[2 * k + 1] = buf[2 * (k * rows + i) + 1] * scale;
+			}
+		}
+	}
+	free(buf);
+}
 
-	int gcol = fcol + tcol - 1;
-	int grow = frow + trow - 1;
+/* smallest power of two >= n */
+int FFT_2D_Size(int n)
+{
+	int p = 1;
+	while (p < n) p <<= 1;
+	return p;
+}
 
-	int col_chunk = gcol * sizeof(double);
+/*
+** In place forward (inverse == 0) or inverse transform of a.  With
+** threaded == 0 everything runs on the calling thread, for callers that
+** are already running one transform per thread.  Returns 0 when out of
+** memory.
+*/
+int FFT_2D_Transform(double* a, int rows, int cols, int inverse, int threaded)
+{
+	fft2_pass p;
+	size_t ngroups = (cols + FFT2_GATHER - 1) / FFT2_GATHER;
+
+	p.a       = a;
+	p.rows    = rows;
+	p.cols    = cols;
+	p.inverse = inverse;
+	p.failed  = 0;
+
+	if (threaded) {
+		dv_parallel_for(rows, 16, fft2_rows_kernel, &p);
+		dv_parallel_for(ngroups, 4, fft2_cols_kernel, &p);
+	} else {
+		fft2_rows_kernel(&p, 0, rows, 0);
+		fft2_cols_kernel(&p, 0, ngroups, 0);
+	}
+	return !p.failed;
+}
 
+double* FFT_2D_Convolve(int trow, int tcol, int frow, int fcol, double* t, double* f)
+{
+	double *fa, *ta, *r;
+	double re, im;
+	int gcol    = fcol + tcol - 1;
+	int grow    = frow + trow - 1;
+	int row_pad = FFT_2D_Size(grow);
+	int col_pad = FFT_2D_Size(gcol);
+	size_t n    = (size_t)row_pad * col_pad;
+	size_t i, j;
 	double tol = 1e-9;
 
-	pad_f = pad_template(frow, fcol, grow, gcol, f);
-
-	pad_t = pad_template(trow, tcol, grow, gcol, t);
-
-	row_pad = (int)pow(2., ceil(log((double)grow) / log(2.)));
-	col_pad = (int)pow(2., ceil(log((double)gcol) / log(2.)));
-
-	row_byte_diff = (row_pad - grow) * sizeof(double);
-	col_byte_diff = (col_pad - gcol) * sizeof(double);
-	row_byte      = row_pad * sizeof(double);
-	col_byte      = col_pad * sizeof(double);
-
-	f_vector_col = (double*)malloc(row_pad * sizeof(double)); // Collumn (has grow # of entries)
-	f_vector_row = (double*)malloc(col_pad * sizeof(double)); // Row (has gcol # of entries)
-	t_vector_col = (double*)malloc(row_pad * sizeof(double));
-	t_vector_row = (double*)malloc(col_pad * sizeof(double));
-	f_fft        = (double*)malloc(col_pad * row_pad * sizeof(double));
-	t_fft        = (double*)malloc(col_pad * row_pad * sizeof(double));
-	//    r =  (double *)malloc(grow*gcol*sizeof(double));
-	r = (double*)malloc(col_pad * row_pad * sizeof(double));
-
-	f_vector_col_im = (double*)malloc(row_pad * sizeof(double)); // Collumn (has grow # of entries)
-	f_vector_row_im = (double*)malloc(col_pad * sizeof(double)); // Row (has gcol # of entries)
-	t_vector_col_im = (double*)malloc(row_pad * sizeof(double));
-	t_vector_row_im = (double*)malloc(col_pad * sizeof(double));
-	f_fft_im        = (double*)malloc(col_pad * row_pad * sizeof(double));
-	t_fft_im        = (double*)malloc(col_pad * row_pad * sizeof(double));
-
-	/* First lets translate every col, row by row (this is easy) */
-
-	for (i = 0; i < grow; i++) {
-		memset(f_vector_row, 0x0, col_byte);
-		memset(t_vector_row, 0x0, col_byte);
+	fa = (double*)calloc(2 * n, sizeof(double));
+	ta = (double*)calloc(2 * n, sizeof(double));
+	r  = (double*)malloc(n * sizeof(double));
+	if (fa == NULL || ta == NULL || r == NULL) goto fail;
 
-		memset(f_vector_row_im, 0x0, col_byte);
-		memset(t_vector_row_im, 0x0, col_byte);
-
-		memcpy(f_vector_row, pad_f + (i * gcol), col_chunk);
-		memcpy(t_vector_row, pad_t + (i * gcol), col_chunk);
-
-		//        mayer_realfft(col_pad,f_vector_row);
-		//        mayer_realfft(col_pad,t_vector_row);
-
-		mayer_fft(col_pad, f_vector_row, f_vector_row_im);
-		mayer_fft(col_pad, t_vector_row, t_vector_row_im);
-
-		memcpy(f_fft + i * col_pad, f_vector_row, col_byte);
-		memcpy(t_fft + i * col_pad, t_vector_row, col_byte);
-
-		memcpy(f_fft_im + i * col_pad, f_vector_row_im, col_byte);
-		memcpy(t_fft_im + i * col_pad, t_vector_row_im, col_byte);
+	for (i = 0; i < frow; i++) {
+		for (j = 0; j < fcol; j++) fa[2 * (i * col_pad + j)] = f[i * fcol + j];
 	}
-
-	printf("+");
-
-	/*
-	** Now we process the rows, col by col.
-	** At the same time, after a collumn has been processed
-	** we do the multiplication and store the result back in f_fft
-	**
-	*/
-
-	for (j = 0; j < col_pad; j++) {
-		memset(f_vector_col, 0x0, row_byte);
-		memset(t_vector_col, 0x0, row_byte);
-		memset(f_vector_col_im, 0x0, row_byte);
-		memset(t_vector_col_im, 0x0, row_byte);
-		for (i = 0; i < grow; i++) {
-			f_vector_col[i]    = f_fft[i * col_pad + j];
-			t_vector_col[i]    = t_fft[i * col_pad + j];
-			f_vector_col_im[i] = f_fft_im[i * col_pad + j];
-			t_vector_col_im[i] = t_fft_im[i * col_pad + j];
-		}
-		//        mayer_realfft(row_pad,f_vector_col);
-		//        mayer_realfft(row_pad,t_vector_col);
-		mayer_fft(row_pad, f_vector_col, f_vector_col_im);
-		mayer_fft(row_pad, t_vector_col, t_vector_col_im);
-
-		for (i = 0; i < row_pad; i++) {
-			//            f_fft[i*col_pad+j] = f_vector_col[i];// * t_vector_col[i];// +
-			//            f_vector_col_im[i] * t_vector_col_im[i]*-1.;
-
-			f_fft[i * col_pad + j] =
-			    f_vector_col[i] * t_vector_col[i] + f_vector_col_im[i] * t_vector_col_im[i] * -1.;
-			f_fft_im[i * col_pad + j] =
-			    f_vector_col[i] * t_vector_col_im[i] + f_vector_col_im[i] * t_vector_col[i];
-		}
+	for (i = 0; i < trow; i++) {
+		for (j = 0; j < tcol; j++) ta[2 * (i * col_pad + j)] = t[i * tcol + j];
 	}
-	printf("+");
-
-	/*
-	** Now we have the maxtrix f_fft which is f*t in freq. space.
-	** Now we need to run an inverse fft on this matrix to get
-	** our convolution back!
-	*/
 
-	/*
-	** First we process colums, row by row
-	*/
-
-	for (i = 0; i < row_pad; i++) {
-		memcpy(f_vector_row, f_fft + (i * col_pad), col_byte);
-		memcpy(f_vector_row_im, f_fft_im + (i * col_pad), col_byte);
-		//        mayer_realifft(col_pad,f_vector_row);
-		mayer_ifft(col_pad, f_vector_row, f_vector_row_im);
-		memcpy(f_fft + (i * col_pad), f_vector_row, col_byte);
-		memcpy(f_fft_im + (i * col_pad), f_vector_row_im, col_byte);
+	if (!FFT_2D_Transform(fa, row_pad, col_pad, 0, 1) || !FFT_2D_Transform(ta, row_pad, col_pad, 0, 1)) {
+		goto fail;
 	}
-	printf("+");
-
-	/*
-	** Now we process the rows, column by collumn
-	*/
-
-	for (j = 0; j < col_pad; j++) {
-		for (i = 0; i < row_pad; i++) {
-			f_vector_col[i]    = f_fft[i * col_pad + j];
-			f_vector_col_im[i] = f_fft_im[i * col_pad + j];
-		}
 
-		//        mayer_realifft(row_pad,f_vector_col);
-		mayer_ifft(row_pad, f_vector_col, f_vector_col_im);
+	/* f*t in frequency space, then back */
+	for (i = 0; i < n; i++) {
+		re            = fa[2 * i] * ta[2 * i] - fa[2 * i + 1] * ta[2 * i + 1];
+		im            = fa[2 * i] * ta[2 * i + 1] + fa[2 * i + 1] * ta[2 * i];
+		fa[2 * i]     = re;
+		fa[2 * i + 1] = im;
+	}
+	if (!FFT_2D_Transform(fa, row_pad, col_pad, 1, 1)) goto fail;
 
-		for (i = 0; i < row_pad; i++) {
-			//            r[i*gcol+j]=f_vector_col[i];///(double)(col_pad*row_pad);
-			//            if (r[i*gcol+j] < tol && r[i*gcol+j] > -tol)
-			//                r[i*gcol+j]=0.;
-			r[i * col_pad + j] = f_vector_col[i] / (double)(col_pad * row_pad);
-			if (r[i * col_pad + j] < tol && r[i * col_pad + j] > -tol) r[i * col_pad + j] = 0.;
-		}
+	for (i = 0; i < n; i++) {
+		r[i] = fa[2 * i];
+		if (r[i] < tol && r[i] > -tol) r[i] = 0.;
 	}
-	printf("+\n");
 
+	free(fa);
+	free(ta);
 	return (r);
+
+fail:
+	free(fa);
+	free(ta);
+	free(r);
+	return (NULL);
 }
 
 double* pad_template(int trow, int tcol, int frow, int fcol, double* t)
@@ -15,47 +15,236 @@
  * after the fact for confirmation and some of his ideas made their way into
  * this code.
  *
- * This version is also much more memory efficient due to re-use of buffers
- * on a per-line basis during the forward/backward difference equation
- * calculations, although there's a slight time penalty for the extra copy
- * stage to move the buffers to the output object (which could probably be
- * eliminated with some more tweaking at the end of the "columns" pass).
+ * The filter runs in place on a float copy of the data, one axis at a time.
+ * Rows along x are interleaved VV_LANES at a time so the recursion runs
+ * across adjacent rows in lockstep; along y and z whole runs of contiguous
+ * columns are filtered together.  Work is spread across threads by
+ * dv_parallel_for().  Each lane does exactly the arithmetic of the original
+ * one-line-at-a-time version, so results are unchanged.
+ *
+ * With an ignore value the data (with ignored pixels zeroed) and a 0/1
+ * validity mask are filtered together and the result is their ratio, so
+ * ignored pixels and the image borders don't darken their neighbors.
  *
  */
 
 #include "parser.h"
+#include "parallel.h"
+#include <errno.h>
 
 #define DEFAULT_SIGMA 3.0
 
-Var* ff_gconvolve(vfuncptr func, Var* arg)
+#define VV_LANES 8         /* rows filtered together along x */
+#define VV_STRIP 512       /* columns filtered together along y and z */
+#define VV_MIN_WEIGHT 1e-3 /* below this the mask weight is treated as no data */
+
+/* These variables correspond to the van Vliet algorithm variables. */
+typedef struct vvcoef {
+	float B, b1, b2, b3;
+} vvcoef;
+
+typedef struct gconv {
+	float* data; /* [nz][ny][nx] */
+	float* mask; /* validity weights, NULL without ignore */
+	size_t nx, ny, nz;
+	vvcoef coef[3];
+	int axis;       /* axis of the current pass */
+	size_t nstrips; /* VV_STRIP wide column strips per row */
+	float* scratch; /* per-thread interleaved rows for the x pass */
+} gconv;
+
+static void vv_coefficients(float sigma, vvcoef* c)
 {
-	/* Function args. */
+	float q, qq, qqq, b0;
 
-	Var* obj    = NULL;
-	float sigma = DEFAULT_SIGMA;
-	Var* out    = NULL;
+	/* Compute gq based on sigma. */
 
-	/* Misc iterators and stuff. */
+	if (sigma >= 2.5) {
+		q = (0.98711 * sigma) - 0.96330;
+	} else {
+		q = 3.97156 - (4.14554 * sqrt((1 - (0.26891 * sigma))));
+	}
+	qq  = q * q;
+	qqq = q * q * q;
+
+	/* Compute filter coefficients based on gq. */
+
+	b0    = 1.57825 + (2.44413 * q) + (1.4281 * qq) + (0.422205 * qqq);
+	c->b1 = ((2.44413 * q) + (2.85619 * qq) + (1.26661 * qqq)) / b0;
+	c->b2 = (-(1.4281 * qq) - (1.26661 * qqq)) / b0;
+	c->b3 = (0.422205 * qqq) / b0;
+	c->B  = 1.0 - (c->b1 + c->b2 + c->b3);
+}
+
+/*
+** Run the forward and backward difference equations in place over len
+** positions step elements apart, each a run of width independent values.
+**
+**    w[n] = B*a[n] + (b1*w[n-1] + b2*w[n-2] + b3*w[n-3])/b0
+**    c[n] = B*w[n] + (b1*c[n+1] + b2*c[n+2] + b3*c[n+3])/b0
+**
+** The "borders" are handled by assuming 0 for out-of-range values.
+*/
+static void vv_recurse(float* p, size_t len, size_t step, size_t width, const vvcoef* c)
+{
+	const float B = c->B, b1 = c->b1, b2 = c->b2, b3 = c->b3;
+	float *w, *w1, *w2, *w3;
+	size_t n, i;
+
+	for (n = 0; n < len; n++) {
+		w = p + n * step;
+		if (n > 2) {
+			w1 = w - step;
+			w2 = w1 - step;
+			w3 = w2 - step;
+			for (i = 0; i < width; i++) {
+				w[i] = B * w[i];
+				w[i] += b1 * w1[i];
+				w[i] += b2 * w2[i];
+				w[i] += b3 * w3[i];
+			}
+			continue;
+		}
+		for (i = 0; i < width; i++) w[i] = B * w[i];
+		if (n > 0) {
+			w1 = w - step;
+			for (i = 0; i < width; i++) w[i] += b1 * w1[i];
+		}
+		if (n > 1) {
+			w2 = w - 2 * step;
+			for (i = 0; i < width; i++) w[i] += b2 * w2[i];
+		}
+	}
+
+	for (n = len; n-- > 0;) {
+		w = p + n * step;
+		if (n + 3 < len) {
+			w1 = w + step;
+			w2 = w1 + step;
+			w3 = w2 + step;
+			for (i = 0; i < width; i++) {
+				w[i] = B * w[i];
+				w[i] += b1 * w1[i];
+				w[i] += b2 * w2[i];
+				w[i] += b3 * w3[i];
+			}
+			continue;
+		}
+		for (i = 0; i < width; i++) w[i] = B * w[i];
+		if (n + 1 < len) {
+			w1 = w + step;
+			for (i = 0; i < width; i++) w[i] += b1 * w1[i];
+		}
+		if (n + 2 < len) {
+			w2 = w + 2 * step;
+			for (i = 0; i < width; i++) w[i] += b2 * w2[i];
+		}
+	}
+}
+
+/* filter VV_LANES rows along x at a time, interleaved so the lanes run together */
+static void gconv_x_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	gconv* g   = (gconv*)ctx;
+	float* t   = g->scratch + (size_t)tid * g->nx * VV_LANES;
+	size_t nr  = g->ny * g->nz;
+	float* bufs[2];
+	size_t u, r0, nl, i, l;
+	int b;
+
+	bufs[0] = g->data;
+	bufs[1] = g->mask;
+
+	for (u = begin; u < end; u++) {
+		r0 = u * VV_LANES;
+		nl = min(nr - r0, (size_t)VV_LANES);
+
+		for (b = 0; b < 2 && bufs[b] != NULL; b++) {
+			float* rows = bufs[b] + r0 * g->nx;
+
+			memset(t, 0, g->nx * VV_LANES * sizeof(float));
+			for (l = 0; l < nl; l++) {
+				for (i = 0; i < g->nx; i++) t[i * VV_LANES + l] = rows[l * g->nx + i];
+			}
+
+			vv_recurse(t, g->nx, VV_LANES, VV_LANES, &g->coef[0]);
+
+			for (l = 0; l < nl; l++) {
+				for (i = 0; i < g->nx; i++) rows[l * g->nx + i] = t[i * VV_LANES + l];
+			}
+		}
+	}
+}
+
+/* filter strips of columns along y (a band each) or z (a line each) */
+static void gconv_yz_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	gconv* g = (gconv*)ctx;
+	size_t u, outer, i0, width, off, len, step;
+
+	if (g->axis == 1) {
+		len  = g->ny;
+		step = g->nx;
+	} else {
+		len  = g->nz;
+		step = g->nx * g->ny;
+	}
 
-	unsigned int dsize, x, y, z;
-	int i, j, band, pos;
+	for (u = begin; u < end; u++) {
+		outer = u / g->nstrips;
+		i0    = (u % g->nstrips) * VV_STRIP;
+		width = min(g->nx - i0, (size_t)VV_STRIP);
+		off   = (g->axis == 1 ? outer * g->nx * g->ny : outer * g->nx) + i0;
 
-	float* data;          /* Output data. */
-	float *w, *c;         /* Temp buffers for Gaussian algorithm. */
-	unsigned int wc_size; /* Size of temp buffers. */
+		vv_recurse(g->data + off, len, step, width, &g->coef[g->axis]);
+		if (g->mask) vv_recurse(g->mask + off, len, step, width, &g->coef[g->axis]);
+	}
+}
 
-	/* These variables correspond to the van Vliet algorithm variables. */
+#define GCONV_LOAD(type)                                                         \
+	{                                                                            \
+		const type* d = (const type*)V_DATA(obj) + base;                         \
+		for (i = 0; i < nx; i++) row[i] = d[i * stride[0]];                      \
+	}                                                                            \
+	break
 
-	float q, qq, qqq, b0, b1, b2, b3, B;
-	float a;
+Var* ff_gconvolve(vfuncptr func, Var* arg)
+{
+	/* Function args. */
+
+	Var* obj     = NULL;
+	float sigma  = DEFAULT_SIGMA;
+	float xsigma = 0;
+	float ysigma = 0;
+	float zsigma = 0;
+	Var* ignore  = NULL;
+	Var* out     = NULL;
+
+	/* Misc iterators and stuff. */
+
+	size_t dsize, nx, ny, nz;
+	size_t stride[3];
+	size_t i, j, k, p, base;
+	float sigmas[3];
+	float ig = 0;
+	float* data; /* Output data. */
+	float* row;
+	float* odata;
+	double value;
+	gconv g;
+	int axis;
 
 	/* Setup input args. */
 
-	Alist alist[3];
+	Alist alist[7];
 
 	alist[0]      = make_alist("obj", ID_VAL, NULL, &obj);
 	alist[1]      = make_alist("sigma", DV_FLOAT, NULL, &sigma);
-	alist[2].name = NULL;
+	alist[2]      = make_alist("xsigma", DV_FLOAT, NULL, &xsigma);
+	alist[3]      = make_alist("ysigma", DV_FLOAT, NULL, &ysigma);
+	alist[4]      = make_alist("zsigma", DV_FLOAT, NULL, &zsigma);
+	alist[5]      = make_alist("ignore", ID_VAL, NULL, &ignore);
+	alist[6].name = NULL;
 
 	/* Parse & validate input args. */
 
@@ -66,133 +255,144 @@ Var* ff_gconvolve(vfuncptr func, Var* arg)
 		return NULL;
 	}
 
-	if (sigma < 0.5) {
-		parse_error("%s: sigma must be >= 0.5\n", func->name);
-		return NULL;
+	/* sigma applies to x and y unless they are given separately; z is off by default */
+	sigmas[0] = (xsigma != 0) ? xsigma : sigma;
+	sigmas[1] = (ysigma != 0) ? ysigma : sigma;
+	sigmas[2] = zsigma;
+
+	for (axis = 0; axis < 3; axis++) {
+		if (sigmas[axis] < 0.5 && (axis == 2 ? sigmas[axis] != 0 : 1)) {
+			parse_error("%s: sigma must be >= 0.5\n", func->name);
+			return NULL;
+		}
 	}
 
 	dsize = V_DSIZE(obj);
-	x     = GetX(obj);
-	y     = GetY(obj);
-	z     = GetZ(obj);
+	nx    = GetX(obj);
+	ny    = GetY(obj);
+	nz    = GetZ(obj);
+	cstrides(obj, stride);
 
 	data = (float*)malloc(sizeof(float) * dsize);
 	if (data == NULL) {
-		parse_error("%s: unable to allocate %u bytes for output\n", func->name, dsize);
+		parse_error("%s: unable to allocate %zu bytes for output\n", func->name, sizeof(float) * dsize);
 		return NULL;
 	}
 
-	/* Compute gq based on sigma. */
-
-	if (sigma >= 2.5) {
-		q = (0.98711 * sigma) - 0.96330;
-	} else {
-		q = 3.97156 - (4.14554 * sqrt((1 - (0.26891 * sigma))));
+	memset(&g, 0, sizeof(g));
+	g.data = data;
+	g.nx   = nx;
+	g.ny   = ny;
+	g.nz   = nz;
+
+	if (ignore != NULL) {
+		ig     = extract_float(ignore, 0);
+		g.mask = (float*)malloc(sizeof(float) * dsize);
+		if (g.mask == NULL) {
+			parse_error("%s: unable to allocate %zu bytes for mask\n", func->name, sizeof(float) * dsize);
+			free(data);
+			return NULL;
+		}
 	}
-	qq  = q * q;
-	qqq = q * q * q;
 
-	/* Compute filter coefficients based on gq. */
-
-	b0 = 1.57825 + (2.44413 * q) + (1.4281 * qq) + (0.422205 * qqq);
-	b1 = ((2.44413 * q) + (2.85619 * qq) + (1.26661 * qqq)) / b0;
-	b2 = (-(1.4281 * qq) - (1.26661 * qqq)) / b0;
-	b3 = (0.422205 * qqq) / b0;
-	B  = 1.0 - (b1 + b2 + b3);
-
-	/* Allocate reusable row/column buffers. */
-
-	wc_size = max(x, y);
-	w       = (float*)malloc(sizeof(float) * wc_size);
+	/* Load the data as float, in bsq order */
+
+	for (k = 0; k < nz; k++) {
+		for (j = 0; j < ny; j++) {
+			base = j * stride[1] + k * stride[2];
+			row  = data + (k * ny + j) * nx;
+
+			switch (V_FORMAT(obj)) {
+			case DV_UINT8: GCONV_LOAD(u8);
+			case DV_UINT16: GCONV_LOAD(u16);
+			case DV_UINT32: GCONV_LOAD(u32);
+			case DV_UINT64: GCONV_LOAD(u64);
+			case DV_INT8: GCONV_LOAD(i8);
+			case DV_INT16: GCONV_LOAD(i16);
+			case DV_INT32: GCONV_LOAD(i32);
+			case DV_INT64: GCONV_LOAD(i64);
+			case DV_FLOAT: GCONV_LOAD(float);
+			case DV_DOUBLE: GCONV_LOAD(double);
+			}
 
-	if (w == NULL) {
-		parse_error("%s: unable to allocate %u bytes for row/column buffer\n", func->name, wc_size);
-		free(out);
-		return NULL;
+			if (g.mask) {
+				float* m = g.mask + (k * ny + j) * nx;
+				for (i = 0; i < nx; i++) {
+					m[i] = (row[i] != ig);
+					if (!m[i]) row[i] = 0;
+				}
+			}
+		}
 	}
 
-	c = (float*)malloc(sizeof(float) * wc_size);
+	/* Do rows, then columns, then (optionally) across bands. */
 
-	if (c == NULL) {
-		parse_error("%s: unable to allocate %u bytes for row/column buffer\n", func->name, wc_size);
-		free(out);
-		free(w);
-		return NULL;
-	}
+	g.nstrips = (nx + VV_STRIP - 1) / VV_STRIP;
 
-	/* Iterate over each band.. */
+	for (axis = 0; axis < 3; axis++) {
+		if (sigmas[axis] == 0) continue;
+		if (axis == 1 && ny < 2) continue;
+		if (axis == 2 && nz < 2) continue;
 
-	for (band = 0; band < z; band++) {
-		for (j = 0; j < y; j++) { /* Do rows. */
-			for (i = 0; i < x; i++) {
+		vv_coefficients(sigmas[axis], &g.coef[axis]);
+		g.axis = axis;
 
-				/* Handle forward difference equation. */
-				/* w[n] = B*a[n] + (b1*w[n-1] + b2*w[n-2] + b3*w[n-3])/b0 */
-				/* Handle the "borders" by assuming 0 for out-of-range values. */
-				pos = cpos(i, j, band, obj);
-				a   = extract_float(obj, pos);
+		if (axis == 0) {
+			size_t nblocks = (ny * nz + VV_LANES - 1) / VV_LANES;
+			int nchunks    = dv_parallel_chunks(nblocks, 1);
 
-				w[i] = B * a;
-				if (i > 0) w[i] += b1 * w[i - 1];
-				if (i > 1) w[i] += b2 * w[i - 2];
-				if (i > 2) w[i] += b3 * w[i - 3];
+			g.scratch = (float*)malloc(sizeof(float) * nchunks * nx * VV_LANES);
+			if (g.scratch == NULL) {
+				memory_error(errno, sizeof(float) * nchunks * nx * VV_LANES);
+				free(g.mask);
+				free(data);
+				return NULL;
 			}
+			dv_parallel_for(nblocks, 1, gconv_x_kernel, &g);
+			free(g.scratch);
+			g.scratch = NULL;
+		} else {
+			dv_parallel_for((axis == 1 ? nz : ny) * g.nstrips, 1, gconv_yz_kernel, &g);
+		}
+	}
 
-			for (i = x - 1; i >= 0; i--) {
-				/* Handle backward difference equation. */
-				/* c[n] = B*w[n] + (b1*c[n+1] + b2*c[n+2] + b3*c[n+3])/b0 */
-				/* Handle the "borders" by assuming 0 for out-of-range values. */
-				c[i] = B * w[i];
-				if (i < x - 1) c[i] += b1 * c[i + 1];
-				if (i < x - 2) c[i] += b2 * c[i + 2];
-				if (i < x - 3) c[i] += b3 * c[i + 3];
-			}
-			/* Copy c values into out buffer. */
-			for (i = 0; i < x; i++) {
-				pos       = cpos(i, j, band, obj);
-				data[pos] = c[i];
-			}
-		} /* row */
-		if (y > 1) {
-			for (i = 0; i < x; i++) {
-				for (j = 0; j < y; j++) { /* Do cols. */
-
-					/* Handle forward difference equation. */
-					/* w[n] = B*a[n] + (b1*w[n-1] + b2*w[n-2] + b3*w[n-3])/b0 */
-					/* Handle the "borders" by assuming 0 for out-of-range values. */
-					pos = cpos(i, j, band, obj);
-					a   = data[pos];
-
-					w[j] = B * a;
-					if (j > 0) w[j] += b1 * w[j - 1];
-					if (j > 1) w[j] += b2 * w[j - 2];
-					if (j > 2) w[j] += b3 * w[j - 3];
-				}
+	/* Normalize by the mask weights and restore the original org. */
 
-				for (j = y - 1; j >= 0; j--) {
-					/* Handle backward difference equation. */
-					/* c[n] = B*w[n] + (b1*c[n+1] + b2*c[n+2] + b3*c[n+3])/b0 */
-					/* Handle the "borders" by assuming 0 for out-of-range values. */
-					c[j] = B * w[j];
-					if (j < y - 1) c[j] += b1 * c[j + 1];
-					if (j < y - 2) c[j] += b2 * c[j + 2];
-					if (j < y - 3) c[j] += b3 * c[j + 3];
-				}
-				/* Copy c values into out buffer. */
-				for (j = 0; j < y; j++) {
-					pos       = cpos(i, j, band, obj);
-					data[pos] = c[j];
+	odata = data;
+	if (V_ORG(obj) != BSQ) {
+		odata = (float*)malloc(sizeof(float) * dsize);
+		if (odata == NULL) {
+			parse_error("%s: unable to allocate %zu bytes for output\n", func->name, sizeof(float) * dsize);
+			free(g.mask);
+			free(data);
+			return NULL;
+		}
+	}
+
+	if (g.mask != NULL || odata != data) {
+		for (k = 0; k < nz; k++) {
+			for (j = 0; j < ny; j++) {
+				for (i = 0; i < nx; i++) {
+					p     = (k * ny + j) * nx + i;
+					value = data[p];
+					if (g.mask != NULL) {
+						if (extract_float(obj, i * stride[0] + j * stride[1] + k * stride[2]) == ig ||
+						    g.mask[p] < VV_MIN_WEIGHT) {
+							value = ig;
+						} else {
+							value /= g.mask[p];
+						}
+					}
+					odata[i * stride[0] + j * stride[1] + k * stride[2]] = value;
 				}
-			} /* col */
+			}
 		}
 	}
 
-	/* Done with convolution. */
-	/* Free temporary buffers. */
+	free(g.mask);
+	if (odata != data) free(data);
 
-	free(w);
-	free(c);
 	/* Construct return value. */
-	out = newVal(V_ORG(obj), V_SIZE(obj)[0], V_SIZE(obj)[1], V_SIZE(obj)[2], DV_FLOAT, data);
+	out = newVal(V_ORG(obj), V_SIZE(obj)[0], V_SIZE(obj)[1], V_SIZE(obj)[2], DV_FLOAT, odata);
 	return (out);
 }
@@ -6,6 +6,8 @@
 #include <unistd.h>
 #endif /* _WIN32 */
 #include "parser.h"
+#include "parallel.h"
+#include "rng.h"
 
 /**
  ** gnoise(x=N,y=N,z=N,seed=N)
@@ -17,12 +19,34 @@
  ** This function was written for Gregg Swayze on 1/11/95.
  **/
 
+typedef struct {
+	unsigned char* out;
+	const float* u;
+	size_t plane;
+	int z;
+} gnoise_job;
+
+static void gnoise_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	gnoise_job* job = (gnoise_job*)ctx;
+	size_t i;
+	int d;
+
+	for (i = begin; i < end; i++) {
+		d = (int)((double)job->z * job->u[i]);
+		if (d >= job->z) d = job->z - 1;
+		job->out[d * job->plane + i] = 255;
+	}
+}
+
 Var* ff_gnoise(vfuncptr func, Var* arg)
 {
-	Var* s;
 	int x = 512, y = 512, z = 10;
 	int seed = 0;
-	int i, j, d;
+	size_t plane;
+	float* u;
+	unsigned char* data;
+	gnoise_job job;
 
 	Alist alist[5];
 	alist[0]      = make_alist("x", DV_INT32, NULL, &x);
@@ -33,25 +57,31 @@ Var* ff_gnoise(vfuncptr func, Var* arg)
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
-	s         = newVar();
-	V_TYPE(s) = ID_VAL;
+	if (x <= 0 || y <= 0 || z <= 0) {
+		parse_error("%s(): Invalid dimensions", func->name);
+		return (NULL);
+	}
 
-	V_DATA(s)    = calloc(1, x * y * z);
-	V_DSIZE(s)   = x * y * z;
-	V_SIZE(s)[0] = x;
-	V_SIZE(s)[1] = y;
-	V_SIZE(s)[2] = z;
-	V_ORG(s)     = BSQ;
-	V_FORMAT(s)  = DV_UINT8;
+	plane = (size_t)x * (size_t)y;
+	data  = (unsigned char*)calloc(plane, z);
+	u     = (float*)malloc(plane * sizeof(float));
+	if (data == NULL || u == NULL) {
+		free(data);
+		free(u);
+		parse_error("%s(): Unable to allocate memory", func->name);
+		return (NULL);
+	}
 
+	/* one uniform per pixel picks its plane */
 	if (seed == 0) seed = time(0) * getpid();
-	srand48(seed);
+	rng_fill(u, DV_FLOAT, plane, RNG_UNIFORM, 0, (uint64_t)(unsigned int)seed, 0);
 
-	for (j = 0; j < y; j++) {
-		for (i = 0; i < x; i++) {
-			d                                                = (int)((float)z * drand48());
-			((unsigned char*)V_DATA(s))[(d * y + j) * x + i] = 255;
-		}
-	}
-	return (s);
+	job.out   = data;
+	job.u     = u;
+	job.plane = plane;
+	job.z     = z;
+	dv_parallel_for(plane, 16384, gnoise_kernel, &job);
+
+	free(u);
+	return (newVal(BSQ, x, y, z, DV_UINT8, data));
 }
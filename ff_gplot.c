@@ -1,31 +1,121 @@
 #include "parser.h"
+#include "parallel.h"
 
 // This is probably overriden in config.h
 #ifndef GPLOT_CMD
 #define GPLOT_CMD "gnuplot"
 #endif
 
+// gplot() series longer than this are cut down to min/max pairs
+#define GPLOT_POINTS 2048
+
 FILE* gplot_pfp = NULL;
 
+/*
+** Data is handed to gnuplot in its binary file format, as the raw
+** array where possible, instead of one line of text per value.
+*/
+static const char* gplot_binary_format(int format)
+{
+	switch (format) {
+	case DV_UINT8: return "%uint8";
+	case DV_UINT16: return "%uint16";
+	case DV_UINT32: return "%uint32";
+	case DV_UINT64: return "%uint64";
+	case DV_INT8: return "%int8";
+	case DV_INT16: return "%int16";
+	case DV_INT32: return "%int32";
+	case DV_INT64: return "%int64";
+	case DV_FLOAT: return "%float";
+	default: return "%double";
+	}
+}
+
+static char* gplot_write_binary(const char* name, const void* data, size_t n, size_t size)
+{
+	char* fname = make_temp_file_path();
+	FILE* fp;
+
+	if (fname == NULL || (fp = fopen(fname, "wb")) == NULL) {
+		parse_error("%s: unable to open temp file", name);
+		free(fname);
+		return (NULL);
+	}
+	if (fwrite(data, size, n, fp) != n) {
+		parse_error("%s: unable to write temp file", name);
+		fclose(fp);
+		unlink(fname);
+		free(fname);
+		return (NULL);
+	}
+	fclose(fp);
+	return (fname);
+}
+
+/*
+** Split the series into buckets and keep the smallest and largest
+** value of each, in the order they occur, so peaks and dropouts still
+** show once there are more values than the plot has pixels.
+*/
+typedef struct {
+	Var* v;
+	size_t n, nbucket;
+	double* xy;
+} gplot_decimate_job;
+
+static void gplot_decimate_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	gplot_decimate_job* job = (gplot_decimate_job*)ctx;
+	size_t b, i, lo, hi, imin, imax, first, second;
+	double y, ymin, ymax;
+	double* xy;
+
+	for (b = begin; b < end; b++) {
+		lo   = b * job->n / job->nbucket;
+		hi   = (b + 1) * job->n / job->nbucket;
+		xy   = job->xy + 4 * b;
+		imin = imax = hi;
+		ymin = ymax = 0;
+		for (i = lo; i < hi; i++) {
+			y = extract_double(job->v, i);
+			if (isnan(y)) continue;
+			if (imin == hi || y < ymin) ymin = y, imin = i;
+			if (imax == hi || y > ymax) ymax = y, imax = i;
+		}
+		if (imin == hi) {
+			xy[0] = xy[2] = lo;
+			xy[1] = xy[3] = NAN;
+			continue;
+		}
+		first  = imin < imax ? imin : imax;
+		second = imin < imax ? imax : imin;
+		xy[0]  = first;
+		xy[1]  = first == imin ? ymin : ymax;
+		xy[2]  = second;
+		xy[3]  = second == imin ? ymin : ymax;
+	}
+}
+
 Var* ff_gplot(vfuncptr func, Var* arg)
 {
 	char* gplot_cmd;
 	Var* object = NULL;
-	int i;
-	FILE* fp      = NULL;
 	char* fname   = NULL;
 	float g_xlow  = FLT_MAX;
 	float g_xhigh = FLT_MAX;
 	float g_ylow  = FLT_MAX;
 	float g_yhigh = FLT_MAX;
+	int points    = GPLOT_POINTS;
+	size_t n, nbucket = 0;
 
-	Alist alist[6];
+	Alist alist[7];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &object);
 	alist[1]      = make_alist("xlow", DV_FLOAT, NULL, &g_xlow);
 	alist[2]      = make_alist("xhigh", DV_FLOAT, NULL, &g_xhigh);
 	alist[3]      = make_alist("ylow", DV_FLOAT, NULL, &g_ylow);
 	alist[4]      = make_alist("yhigh", DV_FLOAT, NULL, &g_yhigh);
-	alist[5].name = NULL;
+	alist[5]      = make_alist("points", DV_INT32, NULL, &points);
+	alist[6].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -45,24 +135,26 @@ Var* ff_gplot(vfuncptr func, Var* arg)
 			return (0);
 		}
 	}
-	fname = make_temp_file_path();
-	if (fname == NULL || (fp = fopen(fname, "w")) == NULL) {
-		parse_error("%s: unable to open temp file", func->name);
-		if (fname) free(fname);
-		return (NULL);
-	}
-
-	// NOTE(rswinkle): Assuming it's a valid type simplifies checking
-	// and we never handled invalid types before anyway
-	if (V_FORMAT(object) <= DV_INT64) {
-		for (i = 0; i < V_DSIZE(object); i++)
-			fprintf(fp, "%d\n", extract_int(object, i));
+	n = V_DSIZE(object);
+	if (points > 1 && n > (size_t)points) {
+		gplot_decimate_job job;
+
+		nbucket     = points / 2;
+		job.v       = object;
+		job.n       = n;
+		job.nbucket = nbucket;
+		job.xy      = (double*)malloc(4 * nbucket * sizeof(double));
+		if (job.xy == NULL) {
+			parse_error("%s: unable to allocate memory", func->name);
+			return (NULL);
+		}
+		dv_parallel_for(nbucket, 64, gplot_decimate_kernel, &job);
+		fname = gplot_write_binary(func->name, job.xy, 4 * nbucket, sizeof(double));
+		free(job.xy);
 	} else {
-		for (i = 0; i < V_DSIZE(object); i++)
-			fprintf(fp, "%g\n", extract_double(object, i));
+		fname = gplot_write_binary(func->name, V_DATA(object), n, NBYTES(V_FORMAT(object)));
 	}
-
-	fclose(fp);
+	if (fname == NULL) return (NULL);
 
 	fprintf(gplot_pfp, "plot ");
 	fprintf(gplot_pfp, "[ ");
@@ -75,7 +167,13 @@ Var* ff_gplot(vfuncptr func, Var* arg)
 	if (g_ylow != FLT_MAX) fprintf(gplot_pfp, "%g", g_ylow);
 	fprintf(gplot_pfp, ":");
 	if (g_yhigh != FLT_MAX) fprintf(gplot_pfp, "%g", g_yhigh);
-	fprintf(gplot_pfp, "] '%s' with linespoints\n", fname);
+	if (nbucket) {
+		fprintf(gplot_pfp, "] '%s' binary record=%zu format='%%double%%double' using 1:2 with lines\n", fname,
+		        2 * nbucket);
+	} else {
+		fprintf(gplot_pfp, "] '%s' binary array=%zu format='%s' with linespoints\n", fname, n,
+		        gplot_binary_format(V_FORMAT(object)));
+	}
 	fflush(gplot_pfp);
 
 	free(fname);
@@ -86,12 +184,11 @@ Var* ff_splot(vfuncptr func, Var* arg)
 {
 #ifdef HAVE_LIBX11
 	Var *s = NULL, *v = NULL;
-	FILE* fp;
 	char* fname = NULL;
-	size_t i, j;
-	int s0, s1;
+	size_t j;
 	int type;
-	char buf[512];
+	double xs, ys;
+	char buf[2048];
 	int count   = 0;
 	int pm3d    = 0;
 	char* label = NULL;
@@ -156,44 +253,25 @@ Var* ff_splot(vfuncptr func, Var* arg)
 			} else {
 
 				if ((v = eval(s)) == NULL) v = s;
-
-				type = V_FORMAT(v);
-
-				fname = make_temp_file_path();
-				if (fname == NULL || (fp = fopen(fname, "w")) == NULL) {
-					parse_error("%s: unable to open temp file", func->name);
-					if (fname) free(fname);
+				if (V_TYPE(v) != ID_VAL) {
+					parse_error("%s: expected a value", func->name);
 					return (NULL);
 				}
 
-				s0 = V_SIZE(v)[0];
-				s1 = V_SIZE(v)[1] * V_SIZE(v)[0];
-				for (i = 0; i < V_DSIZE(v); i++) {
-					if ((i && (i % s0) == 0) || s0 == 1) fputc('\n', fp);
-
-					// NOTE(rswinkle): technically a high enough u64 could produce negative extracted as i64
-					// but I think i64 max is sufficient and we could alway break the unsigned types out if
-					// we wanted
-					if (type <= DV_INT64) {
-						if (xscale != 0 && yscale != 0) {
-							fprintf(fp, "%ld %ld %ld\n", ((i % s0) + 1) * (i64)xscale,
-							        ((i / s0) + 1) * (i64)yscale, extract_i64(v, i));
-						} else {
-							fprintf(fp, "%zu %zu %ld\n", (i % s0) + 1, (i / s0) + 1, extract_i64(v, i));
-						}
-					} else {
-						if (xscale != 0 && yscale != 0) {
-							fprintf(fp, "%g %g %.12g\n", (int)((i % s0) + 1) * xscale,
-							        (int)((i / s0) + 1) * yscale, extract_float(v, i));
-						} else {
-							fprintf(fp, "%zu %zu %.12g\n", (i % s0) + 1, (i / s0) + 1, extract_float(v, i));
-						}
-					}
+				/* rows of V_SIZE[0] in memory order, at 1, 2, ... times the scale */
+				type = V_FORMAT(v);
+				xs = ys = 1;
+				if (xscale != 0 && yscale != 0) {
+					xs = (type <= DV_INT64) ? (i64)xscale : xscale;
+					ys = (type <= DV_INT64) ? (i64)yscale : yscale;
 				}
-				fclose(fp);
+				fname = gplot_write_binary(func->name, V_DATA(v), V_DSIZE(v), NBYTES(type));
+				if (fname == NULL) return (NULL);
+
 				if (count++) strcat(buf, ",");
-				sprintf(buf + strlen(buf), "\"%s\"", fname);
-				if (label != NULL) sprintf(buf + strlen(buf), "title '%s'", label);
+				sprintf(buf + strlen(buf), "\"%s\" binary array=(%zu,%zu) format='%s' origin=(%g,%g) dx=%g dy=%g",
+				        fname, V_SIZE(v)[0], V_DSIZE(v) / V_SIZE(v)[0], gplot_binary_format(type), xs, ys, xs, ys);
+				if (label != NULL) sprintf(buf + strlen(buf), " title '%s'", label);
 				if (pm3d != 0) sprintf(buf + strlen(buf), " with pm3d");
 				free(fname);
 			}
@@ -1,275 +1,240 @@
-/** sedt : SEDT  in linear time
- *
- * David Coeurjolly (david.coeurjolly@liris.cnrs.fr) - Sept. 2004
- *
- * Version 0.3 : Feb. 2005
- *
- **/
-
 /**
-  =================================================
- * @file   sedt.cc
- * @author David COEURJOLLY <David Coeurjolly <dcoeurjo@liris.cnrs.fr>>
- * @date   Wed Sep 29 17:05:31 2004
- *
- * @brief  The Euclidean distance transform in linear time using the
- * Saito and Toriwaki algorithm with the Meijster/Roerdnik/Hesselink's
- * optimization
- *
- * Computational cost : O(n^3) if the input volume is nxnxn
- *
- * Memory requirement : O(n^3).
- *
- * More precisely : if nxnxn*(size of a char) is the size of the input volume,
- * the SDT requires  nxnxn*(size of a long int). Furthermore a temporary  nxnxn*(size of a long int)
- * is needed all along the process. Two vectors with size  n*(size of an int) (arrays s and q) are
- also used.
- *
- =================================================*/
+ ** Exact Euclidean distance transform.
+ **
+ ** Separable, linear time passes in the style of Meijster et al. and
+ ** Felzenszwalb & Huttenlocher:
+ **
+ **    x: for every row, the distance to (and position of) the nearest
+ **       feature pixel in that row, by a forward and a backward scan
+ **
+ **    y: for every column, the lower envelope of the parabolas
+ **       (sy*(y - p))^2 + (sx*g(p))^2, where g is the result of the x pass
+ **
+ ** Rows are independent in the first pass and columns in the second, so
+ ** both run in parallel.  The y pass works on blocks of EDT_BLOCK adjacent
+ ** columns so each row it touches is read a cache line at a time.
+ **
+ ** Feature pixels are the ones equal to ignore.  Each band is transformed
+ ** separately.
+ **/
 #include "parser.h"
-
-#define INFTY 100000001
-
-/* operators : Basic arithmetic operation using INFTY numbers */
-/* David Coeurjolly (david.coeurjolly@liris.cnrs.fr) - Sept. 2004 */
-
-/////////Basic functions to handle operations with INFTY
-/**
- **************************************************
- * @b sum
- * @param a Long number with INFTY
- * @param b Long number with INFTY
- * @return The sum of a and b handling INFTY
- **************************************************/
-static long sum(long a, long b)
-{
-	if ((a == INFTY) || (b == INFTY))
-		return INFTY;
-	else
-		return a + b;
-}
-
-/**
- **************************************************
- * @b prod
- * @param a Long number with INFTY
- * @param b Long number with INFTY
- * @return The product of a and b handling INFTY
- **************************************************/
-static long prod(long a, long b)
-{
-	if ((a == INFTY) || (b == INFTY))
-		return INFTY;
-	else
-		return a * b;
-}
-/**
- **************************************************
- * @b opp
- * @param a Long number with INFTY
- * @return The opposite of a  handling INFTY
- **************************************************/
-static long opp(long a)
+#include "parallel.h"
+#include <errno.h>
+
+#define INFTY 100000001 /* squared distance reported when a band has no features */
+#define EDT_NONE -1      /* no feature in the row */
+#define EDT_BLOCK 16
+
+typedef struct edt {
+	Var* obj;
+	int ignore;
+	size_t nx, ny, nz;
+	size_t stride[3];
+	double sx2, sy2; /* squared pixel spacing */
+	int as_float;
+	i32* dist; /* [nz][ny][nx] row distance, then the result (i32 or float) */
+	i32* fx;   /* nearest feature x, or NULL */
+	i32* fy;   /* nearest feature y, or NULL */
+	char* scratch;
+	size_t scratch_size; /* bytes per thread */
+} edt;
+
+#define EDT_LOAD_ROW(type)                                                       \
+	{                                                                            \
+		const type* d = (const type*)V_DATA(e->obj) + base;                      \
+		for (i = 0; i < nx; i++) g[i] = ((i32)d[i * e->stride[0]] == e->ignore); \
+	}                                                                            \
+	break
+
+/* distance along the row to the nearest feature pixel */
+static void edt_x_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	if (a == INFTY) {
-		return INFTY;
-	} else {
-		return -a;
-	}
-}
-
-/**
- **************************************************
- * @b intdivint
- * @param divid Long number with INFTY
- * @param divis Long number with INFTY
- * @return The division (integer) of divid out of divis handling INFTY
- **************************************************/
-static long intdivint(long divid, long divis)
-{
-	if (divis == 0) return INFTY;
-	if (divid == INFTY)
-		return INFTY;
-	else
-		return divid / divis;
-}
-//////////
+	edt* e    = (edt*)ctx;
+	long nx   = e->nx;
+	size_t r, base;
+	long i, last;
+	i32 *g, *fx;
+
+	for (r = begin; r < end; r++) {
+		base = (r % e->ny) * e->stride[1] + (r / e->ny) * e->stride[2];
+		g    = e->dist + r * nx;
+		fx   = e->fx ? e->fx + r * nx : NULL;
+
+		switch (V_FORMAT(e->obj)) {
+		case DV_UINT8: EDT_LOAD_ROW(u8);
+		case DV_UINT16: EDT_LOAD_ROW(u16);
+		case DV_UINT32: EDT_LOAD_ROW(u32);
+		case DV_UINT64: EDT_LOAD_ROW(u64);
+		case DV_INT8: EDT_LOAD_ROW(i8);
+		case DV_INT16: EDT_LOAD_ROW(i16);
+		case DV_INT32: EDT_LOAD_ROW(i32);
+		case DV_INT64: EDT_LOAD_ROW(i64);
+		case DV_FLOAT: EDT_LOAD_ROW(float);
+		case DV_DOUBLE: EDT_LOAD_ROW(double);
+		}
 
-/**
-  =================================================
- * @file   operators.cc
- * @author David COEURJOLLY <David Coeurjolly <dcoeurjo@liris.cnrs.fr>>
- * @date   Thu Sep 30 09:22:19 2004
- *
- * @brief  Basic implementation of arithmetical operations using INFTY numbers.
- *
- *
- =================================================*/
-
-////////// Functions F and Sep for the SDT labelling
+		// Forward scan: g[i] becomes the position of the last feature at or before i
+		for (i = 0, last = EDT_NONE; i < nx; i++) {
+			if (g[i]) last = i;
+			g[i] = last;
+		}
 
-/*
- * @return Definition of a parabola
- */
-static long F(int x, int i, long gi2)
-{
-	return sum((x - i) * (x - i), gi2);
+		// Backward scan: keep whichever of the last and next feature is closer
+		for (i = nx - 1, last = EDT_NONE; i >= 0; i--) {
+			if (g[i] == i) last = i;
+			if (last != EDT_NONE && (g[i] == EDT_NONE || last - i < i - g[i])) g[i] = last;
+			if (fx) fx[i] = g[i];
+			if (g[i] != EDT_NONE) g[i] = labs(i - g[i]);
+		}
+	}
 }
 
 /*
- * @return The abscissa of the intersection point between two parabolas
- */
-static long Sep(int i, int u, long gi2, long gu2)
+** Lower envelope of the parabolas s2*(q - p)^2 + f[p] over q = 0..n-1,
+** skipping p with f[p] < 0 (no feature).  d[q] gets the minimum and
+** arg[q] the p it came from (-1 if every f[p] < 0).
+*/
+static void edt_1d(const double* f, long n, double s2, double* d, i32* arg, long* v, double* z)
 {
-	return intdivint(sum(sum((long)(u * u - i * i), gu2), opp(gi2)), 2 * (u - i));
-}
+	long q, k = -1;
+	double s;
 
-/**
- **************************************************
- * @b phaseSaitoX
- * @param V Input volume
- * @param sdt_x SDT along the x-direction
- **************************************************/
-// First step of  the saito  algorithm
-// (Warning   : we  store the  EDT instead of the SDT)
-
-void phaseSaitoX(Var* v, int ignore, Var* vx)
-{
-	int dx = GetX(vx);
-	int dy = GetY(vx);
-	int x, y;
+	for (q = 0; q < n; q++) {
+		if (f[q] < 0) continue;
 
-	int* sdt_x = V_DATA(vx);
-
-	for (y = 0; y < dy; y++) {
-		if (extract_int(v, cpos(0, y, 0, v)) == ignore) {
-			sdt_x[cpos(0, y, 0, vx)] = 0;
+		while (k >= 0) {
+			s = ((f[q] + s2 * q * q) - (f[v[k]] + s2 * v[k] * v[k])) / (2 * s2 * (q - v[k]));
+			if (s > z[k]) break;
+			k--;
+		}
+		if (k < 0) {
+			k    = 0;
+			v[0] = q;
+			z[0] = -HUGE_VAL;
 		} else {
-			sdt_x[cpos(0, y, 0, vx)] = INFTY;
+			k++;
+			v[k] = q;
+			z[k] = s;
 		}
+		z[k + 1] = HUGE_VAL;
+	}
 
-		// Forward scan
-		for (x = 1; x < dx; x++) {
-			if (extract_int(v, cpos(x, y, 0, v)) == ignore) {
-				sdt_x[cpos(x, y, 0, vx)] = 0;
-			} else {
-				sdt_x[cpos(x, y, 0, vx)] = sum(1, sdt_x[cpos(x - 1, y, 0, vx)]);
-			}
+	if (k < 0) {
+		for (q = 0; q < n; q++) {
+			d[q]   = INFTY;
+			arg[q] = -1;
 		}
+		return;
+	}
 
-		// Backward scan
-		for (x = dx - 2; x >= 0; x--) {
-			if (sdt_x[cpos(x + 1, y, 0, vx)] < sdt_x[cpos(x, y, 0, vx)]) {
-				sdt_x[cpos(x, y, 0, vx)] = sum(1, sdt_x[cpos(x + 1, y, 0, vx)]);
-			}
-		}
+	for (q = 0, k = 0; q < n; q++) {
+		while (z[k + 1] < q) k++;
+		d[q]   = s2 * (q - v[k]) * (q - v[k]) + f[v[k]];
+		arg[q] = v[k];
 	}
 }
 
-/**
- **************************************************
- * @b phaseSaitoY
- * @param sdt_x the SDT along the x-direction
- * @param sdt_xy the SDT in the xy-slices
- **************************************************/
-// Second      Step   of    the       saito   algorithm    using    the
-//[Meijster/Roerdnik/Hesselink] optimization
-void phaseSaitoY(Var* vx, Var* vxy)
+/* EDT_BLOCK columns at a time: gather, transform each along y, scatter */
+static void edt_y_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	int dx = GetX(vx);
-	int dy = GetY(vx);
-	int s[dy]; // Center of the upper envelope parabolas
-	int t[dy]; // Separating index between 2 upper envelope parabolas
-	int q;
-	int w;
-	int x, u;
-
-	int* sdt_x  = V_DATA(vx);
-	int* sdt_xy = V_DATA(vxy);
-
-	for (x = 0; x < dx; x++) {
-		q    = 0;
-		s[0] = 0;
-		t[0] = 0;
-
-		// Forward Scan
-		for (u = 1; u < dy; u++) {
-			while ((q >= 0) &&
-			       (F(t[q], s[q], prod(sdt_x[cpos(x, s[q], 0, vx)], sdt_x[cpos(x, s[q], 0, vx)])) >
-			        F(t[q], u, prod(sdt_x[cpos(x, u, 0, vx)], sdt_x[cpos(x, u, 0, vx)]))))
-				q--;
-
-			if (q < 0) {
-				q    = 0;
-				s[0] = u;
-			} else {
-				w = 1 + Sep(s[q], u, prod(sdt_x[cpos(x, s[q], 0, vx)], sdt_x[cpos(x, s[q], 0, vx)]),
-				            prod(sdt_x[cpos(x, u, 0, vx)], sdt_x[cpos(x, u, 0, vx)]));
-
-				if (w < dy) {
-					q++;
-					s[q] = u;
-					t[q] = w;
-				}
+	edt* e      = (edt*)ctx;
+	size_t nx   = e->nx, ny = e->ny;
+	size_t nblk = (nx + EDT_BLOCK - 1) / EDT_BLOCK;
+	char* mem   = e->scratch + tid * e->scratch_size;
+	double* f   = (double*)mem;              /* [EDT_BLOCK][ny] */
+	double* d   = f + EDT_BLOCK * ny;        /* [ny] */
+	double* z   = d + ny;                    /* [ny + 1] */
+	long* v     = (long*)(z + ny + 1);       /* [ny] */
+	i32* arg    = (i32*)(v + ny);            /* [ny] */
+	i32* gx     = arg + ny;                  /* [EDT_BLOCK][ny] */
+	size_t u, k, i0, w, i, j, p;
+	i32 g;
+
+	for (u = begin; u < end; u++) {
+		k  = u / nblk;
+		i0 = (u % nblk) * EDT_BLOCK;
+		w  = min(nx - i0, (size_t)EDT_BLOCK);
+
+		for (j = 0; j < ny; j++) {
+			p = (k * ny + j) * nx + i0;
+			for (i = 0; i < w; i++) {
+				g                = e->dist[p + i];
+				f[i * ny + j]    = (g == EDT_NONE) ? -1 : e->sx2 * g * g;
+				if (e->fx) gx[i * ny + j] = e->fx[p + i];
 			}
 		}
 
-		// Backward Scan
-		for (u = dy - 1; u >= 0; --u) {
-			sdt_xy[cpos(x, u, 0, vxy)] =
-			    F(u, s[q], prod(sdt_x[cpos(x, s[q], 0, vx)], sdt_x[cpos(x, s[q], 0, vx)]));
-			if (u == t[q]) q--;
-		}
-	}
-}
+		for (i = 0; i < w; i++) {
+			edt_1d(f + i * ny, ny, e->sy2, d, arg, v, z);
 
-/**
- **************************************************
- * @b phaseSaitoZ
- * @param sdt_xy the SDT in the xy-slices
- * @param sdt_xyz the final SDT
- **************************************************/
-// Third   Step      of     the    saito   algorithm     using      the
-//[Meijster/Roerdnik/Hesselink] optimization
-void phaseSaitoZ(Var* vxy, Var* vxyz)
-{
-	int dx       = GetX(vxy);
-	int dy       = GetY(vxy);
-	int* sdt_xy  = V_DATA(vxy);
-	int* sdt_xyz = V_DATA(vxyz);
-	int x, y;
-	for (y = 0; y < dy; y++) {
-		for (x = 0; x < dx; x++) {
-			sdt_xyz[cpos(x, y, 0, vxyz)] = sqrt(F(0, 0, sdt_xy[cpos(x, y, 0, vxy)]));
+			for (j = 0; j < ny; j++) {
+				p = (k * ny + j) * nx + i0 + i;
+				if (e->as_float) {
+					((float*)e->dist)[p] = sqrt(d[j]);
+				} else {
+					e->dist[p] = sqrt(d[j]);
+				}
+				if (e->fx) {
+					e->fy[p] = arg[j] + 1;
+					e->fx[p] = (arg[j] < 0) ? 0 : gx[i * ny + arg[j]] + 1;
+				}
+			}
 		}
 	}
 }
 
-Var* saito_grassfire(Var* input, int ignore)
+/*
+** Distance from every pixel of obj to the nearest pixel equal to ignore,
+** with pixels sx by sy apart.  If fx and fy are not NULL they get the
+** (1-based) coordinates of that nearest pixel, or 0 if there is none.
+** The result is float if as_float, otherwise truncated to int.
+*/
+Var* euclidean_grassfire(Var* obj, int ignore, double sx, double sy, int as_float, Var** fx, Var** fy)
 {
-	// Euclidian distance computation
-	size_t dx = GetX(input);
-	size_t dy = GetY(input);
-
-	Var* sdt_x = newVal(BSQ, dx, dy, 1, DV_INT32, calloc(dx * dy, sizeof(int)));
-	if (sdt_x == NULL) {
-		parse_error("Unable to allocate memory.");
-		return (NULL);
+	edt e;
+	size_t n, nblk;
+	int nchunks;
+
+	memset(&e, 0, sizeof(e));
+	e.obj      = obj;
+	e.ignore   = ignore;
+	e.nx       = GetX(obj);
+	e.ny       = GetY(obj);
+	e.nz       = GetZ(obj);
+	e.sx2      = sx * sx;
+	e.sy2      = sy * sy;
+	e.as_float = as_float;
+	cstrides(obj, e.stride);
+
+	n      = e.nx * e.ny * e.nz;
+	e.dist = (i32*)calloc(n, sizeof(i32));
+	if (fx != NULL) {
+		e.fx = (i32*)calloc(n, sizeof(i32));
+		e.fy = (i32*)calloc(n, sizeof(i32));
 	}
-	Var* sdt_xy = newVal(BSQ, dx, dy, 1, DV_INT32, calloc(dx * dy, sizeof(int)));
-	if (sdt_xy == NULL) {
-		parse_error("Unable to allocate memory.");
-		free(sdt_x);
+
+	nblk            = (e.nx + EDT_BLOCK - 1) / EDT_BLOCK;
+	nchunks         = dv_parallel_chunks(e.nz * nblk, 1);
+	e.scratch_size  = (2 * EDT_BLOCK + 3) * e.ny * sizeof(double) + sizeof(double);
+	e.scratch       = malloc(nchunks * e.scratch_size);
+	if (e.dist == NULL || (fx != NULL && (e.fx == NULL || e.fy == NULL)) || e.scratch == NULL) {
+		memory_error(errno, n * sizeof(i32));
+		free(e.dist);
+		free(e.fx);
+		free(e.fy);
+		free(e.scratch);
 		return (NULL);
 	}
 
-	phaseSaitoX(input, ignore, sdt_x);
-	phaseSaitoY(sdt_x, sdt_xy);
-	phaseSaitoZ(sdt_xy, sdt_x); // We reuse sdt_x to store the final result!!
+	dv_parallel_for(e.ny * e.nz, 16, edt_x_kernel, &e);
+	dv_parallel_for(e.nz * nblk, 1, edt_y_kernel, &e);
+	free(e.scratch);
 
-	mem_claim(sdt_xy);
-	free_var(sdt_xy);
-	return (sdt_x);
+	if (fx != NULL) {
+		*fx = newVal(BSQ, e.nx, e.ny, e.nz, DV_INT32, e.fx);
+		*fy = newVal(BSQ, e.nx, e.ny, e.nz, DV_INT32, e.fy);
+	}
+	return newVal(BSQ, e.nx, e.ny, e.nz, as_float ? DV_FLOAT : DV_INT32, e.dist);
 }
 
 Var* vw_grassfire(Var* vsrc, int ignore)
@@ -377,12 +342,19 @@ Var* ff_grassfire(vfuncptr func, Var* arg)
 	int ignore            = INT_MAX;
 	const char* options[] = {"euclidian", "manhattan", "bounding", NULL};
 	char* type            = (char*)options[0];
+	float xspacing        = 0;
+	float yspacing        = 0;
+	int index             = 0;
+	Var *out, *fx, *fy, *s;
 
-	Alist alist[4];
+	Alist alist[7];
 	alist[0]      = make_alist("obj", ID_VAL, NULL, &obj);
 	alist[1]      = make_alist("ignore", DV_INT32, NULL, &ignore);
 	alist[2]      = make_alist("type", ID_ENUM, options, &type);
-	alist[3].name = NULL;
+	alist[3]      = make_alist("xspacing", DV_FLOAT, NULL, &xspacing);
+	alist[4]      = make_alist("yspacing", DV_FLOAT, NULL, &yspacing);
+	alist[5]      = make_alist("index", DV_INT32, NULL, &index);
+	alist[6].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -392,7 +364,21 @@ Var* ff_grassfire(vfuncptr func, Var* arg)
 	}
 
 	if (!strcmp(type, "euclidian")) {
-		return (saito_grassfire(obj, ignore));
+		if (xspacing < 0 || yspacing < 0) {
+			parse_error("%s: spacing must be positive.", func->name);
+			return (NULL);
+		}
+
+		/* distances are only fractional once a spacing is given */
+		out = euclidean_grassfire(obj, ignore, xspacing ? xspacing : 1.0, yspacing ? yspacing : 1.0,
+		                          xspacing != 0 || yspacing != 0, index ? &fx : NULL, &fy);
+		if (out == NULL || !index) return (out);
+
+		s = new_struct(3);
+		add_struct(s, "distance", out);
+		add_struct(s, "x", fx);
+		add_struct(s, "y", fy);
+		return (s);
 	} else if (!strcmp(type, "manhattan")) {
 		return (vw_grassfire(obj, ignore));
 	} else if (!strcmp(type, "bounding")) {
@@ -1,39 +1,130 @@
 #include "parser.h"
+#include "parallel.h"
 
 /**
+ ** The fill passes read the input as floats in its own memory order,
+ ** addressed through cstrides(), and run in parallel over the lines
+ ** (rows, columns or diagonals) of every band, or the rows of every
+ ** band for jfjll().
  **/
 #define ycorner(c, v) ((c) < 4 ? -(v) : ((c) > 6 ? (v) : 0))
 #define xcorner(c, v) \
 	((c) == 1 || (c) == 4 || (c) == 7 ? -(v) : ((c) == 3 || (c) == 6 || (c) == 9 ? (v) : 0))
 
-void jfill_x(Var*, int, int, int, float*, float, int);
-void jfill_y(Var*, int, int, int, float*, float, int);
+enum { FILL_LR, FILL_TB, FILL_TR, FILL_TL };
+
+typedef struct {
+	const float* in;
+	float* out;
+	size_t stride[3];
+	int width, height, depth;
+	float fill;
+	int radius, wrap, neighbors;
+	int dir;
+	float* buf; /* a line for each chunk */
+	const unsigned char* skip;
+} fill_job;
+
 void jfill_merge(float*, float*, float, int);
-void jfill_lr(Var*, int, int, int, float*, float, int, int);
-void jfill_tb(Var*, int, int, int, float*, float, int);
-void jfill_tr(Var*, int, int, int, float*, float, int);
-void jfill_tl(Var*, int, int, int, float*, float, int);
 void jfill(float* data, int n, float fill, int radius, int wrap);
+static unsigned char* fill_skip_mask(const float* in, const size_t stride[3], int width, int height,
+                                     int depth, float fill, int maxgap);
 
-Var* ff_jfill(vfuncptr func, Var* arg)
+/* the input as floats; *copy is set if it has to be freed */
+static float* fill_input(Var* obj, int* copy);
+
+static void jfjll_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	Var *v = NULL, *obj = NULL;
+	fill_job* job = (fill_job*)ctx;
+	const float* in = job->in;
+	float* data     = job->out;
 	float val[10], dist[10];
-	int ecount, xpos[10], ypos[10], width, height, depth;
-	int i, j, k, e, x, y, band, pos;
-	float *data   = NULL, d;
+	int ecount, width = job->width, height = job->height;
+	int i, j, k, e, x, y, band, radius = job->radius;
+	float fill = job->fill, d;
+	size_t line, pos, sx = job->stride[0], sy = job->stride[1], sz = job->stride[2];
+
+	for (line = begin; line < end; line++) {
+		band = line / height;
+		j    = line % height;
+		for (i = 0; i < width; i++) {
+			pos       = i * sx + j * sy + band * sz;
+			d         = in[pos];
+			data[pos] = d;
+			if (d != fill) {
+				continue;
+			}
+			if (job->skip && job->skip[line * width + i]) {
+				continue;
+			}
+			ecount = 0;
+			for (k = 1; k < radius; k++) {
+				for (e = 1; e <= 9; e++) {
+					if (k == 1) val[e] = fill;
+					if (val[e] == fill) {
+						x = i + xcorner(e, k);
+						y = j + ycorner(e, k);
+						if (x < 0 || x >= width) {
+							if (job->wrap) {
+								x = (x + width) % width;
+							} else {
+								continue;
+							}
+						}
+
+						if (y < 0 || y >= height) {
+							continue;
+						}
+
+						val[e]  = in[x * sx + y * sy + band * sz];
+						dist[e] = 1.0 / (k * k);
+						if (val[e] != fill) ecount++;
+					}
+				}
+				if (ecount >= job->neighbors) {
+					d = 0;
+					for (e = 1; e <= 9; e++) {
+						/**
+						 ** compute weighted average
+						 **/
+						if (e == 5) continue;
+						if (val[e] != fill) {
+							val[5] += val[e] * dist[e];
+							d += dist[e];
+						}
+					}
+					data[pos] = val[5] / d;
+					/**
+					 ** stop everything.
+					 **/
+					e = 10;
+					k = radius;
+				}
+			}
+		}
+	}
+}
+
+Var* ff_jfill(vfuncptr func, Var* arg)
+{
+	Var* obj = NULL;
+	int width, height, depth, copy;
+	float* data   = NULL;
 	int wrap      = 0;   /* left to right wrap around */
 	int radius    = 3;   /* distance to search */
 	int neighbors = 5;   /* minimum number of neighbors */
 	float fill    = 0.0; /* fill value */
+	int maxgap    = 0;   /* skip holes wider than this across and down */
+	fill_job job;
 
-	Alist alist[6];
+	Alist alist[7];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
 	alist[1]      = make_alist("fill", DV_FLOAT, NULL, &fill);
 	alist[2]      = make_alist("radius", DV_INT32, NULL, &radius);
 	alist[3]      = make_alist("wrap", DV_INT32, NULL, &wrap);
 	alist[4]      = make_alist("neighbors", DV_INT32, NULL, &neighbors);
-	alist[5].name = NULL;
+	alist[5]      = make_alist("maxgap", DV_INT32, NULL, &maxgap);
+	alist[6].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -45,91 +136,134 @@ Var* ff_jfill(vfuncptr func, Var* arg)
 	width  = GetSamples(V_SIZE(obj), V_ORG(obj));
 	height = GetLines(V_SIZE(obj), V_ORG(obj));
 	depth  = GetBands(V_SIZE(obj), V_ORG(obj));
-	data   = (float*)calloc(sizeof(float), width * height * depth);
+	data   = (float*)calloc(sizeof(float), V_DSIZE(obj));
+
+	memset(&job, 0, sizeof(job));
+	job.in = fill_input(obj, &copy);
+	if (data == NULL || job.in == NULL) {
+		parse_error("%s: Unable to allocate memory", func->name);
+		free(data);
+		if (copy) free((float*)job.in);
+		return (NULL);
+	}
+	cstrides(obj, job.stride);
+	job.out       = data;
+	job.width     = width;
+	job.height    = height;
+	job.depth     = depth;
+	job.fill      = fill;
+	job.radius    = radius;
+	job.wrap      = wrap;
+	job.neighbors = neighbors;
+	if (maxgap > 0) {
+		job.skip = fill_skip_mask(job.in, job.stride, width, height, depth, fill, maxgap);
+		if (job.skip == NULL) {
+			parse_error("%s: Unable to allocate memory", func->name);
+			free(data);
+			if (copy) free((float*)job.in);
+			return (NULL);
+		}
+	}
+
+	dv_parallel_for((size_t)depth * height, 16, jfjll_kernel, &job);
+
+	free((unsigned char*)job.skip);
+	if (copy) free((float*)job.in);
 
 	/**
 	 ** Put together return value
 	 **/
+	return (newVal(V_ORG(obj), V_SIZE(obj)[0], V_SIZE(obj)[1], V_SIZE(obj)[2], DV_FLOAT, data));
+}
 
-	v            = newVar();
-	V_TYPE(v)    = ID_VAL;
-	V_ORG(v)     = V_ORG(obj);
-	V_DSIZE(v)   = V_DSIZE(obj);
-	V_SIZE(v)[0] = V_SIZE(obj)[0];
-	V_SIZE(v)[1] = V_SIZE(obj)[1];
-	V_SIZE(v)[2] = V_SIZE(obj)[2];
-	V_FORMAT(v)  = DV_FLOAT;
-	V_DATA(v)    = data;
-
-	for (band = 0; band < depth; band++) {
-		for (j = 0; j < height; j++) {
-			for (i = 0; i < width; i++) {
-				pos       = cpos(i, j, band, obj);
-				d         = extract_double(obj, pos);
-				data[pos] = d;
-				if (d != fill) {
-					continue;
-				}
-				ecount = 0;
-				for (k = 1; k < radius; k++) {
-					for (e = 1; e <= 9; e++) {
-						if (k == 1) val[e] = fill;
-						if (val[e] == fill) {
-							x = i + xcorner(e, k);
-							y = j + ycorner(e, k);
-							if (x < 0 || x >= width) {
-								if (wrap) {
-									x = (x + width) % width;
-								} else {
-									continue;
-								}
-							}
+/*
+** Line n of a band in direction dir: where it starts, how far apart its
+** pixels are and how many there are.  The diagonals start along the top
+** row and then down the first (TR) or last (TL) column.
+*/
+static int fill_line(const fill_job* job, size_t n, int* x0, int* y0, int* dx)
+{
+	int x = job->width, y = job->height;
+
+	switch (job->dir) {
+	case FILL_LR: *x0 = 0, *y0 = n, *dx = 1; return x;
+	case FILL_TB: *x0 = n, *y0 = 0, *dx = 0; return y;
+	case FILL_TR:
+		*dx = 1;
+		if (n < (size_t)x) {
+			*x0 = n, *y0 = 0;
+			return min(x - (int)n, y);
+		}
+		*x0 = 0, *y0 = n - x + 1;
+		return min(x, y - *y0);
+	default:
+		*dx = -1;
+		if (n < (size_t)x) {
+			*x0 = n, *y0 = 0;
+			return min((int)n + 1, y);
+		}
+		*x0 = x - 1, *y0 = n - x + 1;
+		return min(x, y - *y0);
+	}
+}
 
-							if (y < 0 || y >= height) {
-								continue;
-							}
+static size_t fill_nlines(const fill_job* job)
+{
+	switch (job->dir) {
+	case FILL_LR: return job->height;
+	case FILL_TB: return job->width;
+	default: return job->width + job->height - 1;
+	}
+}
 
-							val[e]  = extract_float(obj, cpos(x, y, band, obj));
-							xpos[e] = x;
-							ypos[e] = y;
-							dist[e] = 1.0 / (k * k);
-							if (val[e] != fill) ecount++;
-						}
-					}
-					if (ecount >= neighbors) {
-						d = 0;
-						for (e = 1; e <= 9; e++) {
-							/**
-							 ** compute weighted average
-							 **/
-							if (e == 5) continue;
-							if (val[e] != fill) {
-								val[5] += val[e] * dist[e];
-								d += dist[e];
-							}
-						}
-						data[pos] = val[5] / d;
-						/**
-						 ** stop everything.
-						 **/
-						e = 10;
-						k = radius;
-					}
-				}
-			}
+static void jfill_pass_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	fill_job* job = (fill_job*)ctx;
+	size_t nlines = fill_nlines(job), line, pos;
+	ptrdiff_t step;
+	int x0, y0, dx, len, l, band;
+	float* d = job->buf + (size_t)tid * max(job->width, job->height);
+
+	for (line = begin; line < end; line++) {
+		band = line / nlines;
+		len  = fill_line(job, line % nlines, &x0, &y0, &dx);
+		pos  = x0 * job->stride[0] + y0 * job->stride[1] + band * job->stride[2];
+		step = dx * (ptrdiff_t)job->stride[0] + (job->dir == FILL_LR ? 0 : (ptrdiff_t)job->stride[1]);
+
+		for (l = 0; l < len; l++) {
+			d[l] = job->in[pos + l * step];
+		}
+		jfill(d, len, job->fill, job->radius, job->dir == FILL_LR ? job->wrap : 0);
+		for (l = 0; l < len; l++) {
+			job->out[pos + l * step] = d[l];
 		}
 	}
-	return (v);
+}
+
+static int jfill_pass(fill_job* job, int dir, float* out)
+{
+	size_t n;
+
+	job->dir = dir;
+	job->out = out;
+	n        = job->depth * fill_nlines(job);
+	job->buf = (float*)malloc(dv_parallel_chunks(n, 16) * max(job->width, job->height) * sizeof(float));
+	if (job->buf == NULL) return (0);
+
+	dv_parallel_for(n, 16, jfill_pass_kernel, job);
+	free(job->buf);
+	return (1);
 }
 
 Var* ff_ifill(vfuncptr func, Var* arg)
 {
-	Var *v = NULL, *obj = NULL;
+	Var* obj   = NULL;
 	int radius = 3, wrap = 0;
 	float fill   = 0.0;
 	float *data1 = NULL, *data2 = NULL, *data3 = NULL;
-	int width, height, depth, dsize;
+	int width, height, depth, dsize, copy, ok;
 	char* pass = (char*)"1234";
+	fill_job job;
 
 	Alist alist[6];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
@@ -154,28 +288,54 @@ Var* ff_ifill(vfuncptr func, Var* arg)
 	data2  = (float*)calloc(sizeof(float), dsize);
 	data3  = (float*)calloc(sizeof(float), dsize);
 
+	memset(&job, 0, sizeof(job));
+	job.in = fill_input(obj, &copy);
+	if (data1 == NULL || data2 == NULL || data3 == NULL || job.in == NULL) {
+		parse_error("%s: Unable to allocate memory", func->name);
+		free(data1);
+		free(data2);
+		free(data3);
+		if (copy) free((float*)job.in);
+		return (NULL);
+	}
+	cstrides(obj, job.stride);
+	job.width  = width;
+	job.height = height;
+	job.depth  = depth;
+	job.fill   = fill;
+	job.radius = radius;
+	job.wrap   = wrap;
+
 	/**
 	 ** Put together return value
 	 **/
 
+	ok = 1;
 	if (strchr(pass, '3') && strchr(pass, '4')) {
-		jfill_tl(obj, width, height, depth, data1, fill, radius);
-		jfill_tr(obj, width, height, depth, data2, fill, radius);
+		ok = jfill_pass(&job, FILL_TL, data1) && jfill_pass(&job, FILL_TR, data2);
 		jfill_merge(data1, data2, fill, dsize);
 	} else if (strchr(pass, '4')) {
-		jfill_tl(obj, width, height, depth, data1, fill, radius);
+		ok = jfill_pass(&job, FILL_TL, data1);
 	} else if (strchr(pass, '3')) {
-		jfill_tr(obj, width, height, depth, data1, fill, radius);
+		ok = jfill_pass(&job, FILL_TR, data1);
 	}
 
 	if (strchr(pass, '1') && strchr(pass, '2')) {
-		jfill_tb(obj, width, height, depth, data2, fill, radius);
-		jfill_lr(obj, width, height, depth, data3, fill, radius, wrap);
+		ok = ok && jfill_pass(&job, FILL_TB, data2) && jfill_pass(&job, FILL_LR, data3);
 		jfill_merge(data2, data3, fill, dsize);
 	} else if (strchr(pass, '1')) {
-		jfill_tb(obj, width, height, depth, data2, fill, radius);
+		ok = ok && jfill_pass(&job, FILL_TB, data2);
 	} else if (strchr(pass, '2')) {
-		jfill_lr(obj, width, height, depth, data2, fill, radius, wrap);
+		ok = ok && jfill_pass(&job, FILL_LR, data2);
+	}
+
+	if (copy) free((float*)job.in);
+	if (!ok) {
+		parse_error("%s: Unable to allocate memory", func->name);
+		free(data1);
+		free(data2);
+		free(data3);
+		return (NULL);
 	}
 
 	if ((strchr(pass, '3') || strchr(pass, '4')) && (strchr(pass, '1') || strchr(pass, '2'))) {
@@ -186,250 +346,23 @@ Var* ff_ifill(vfuncptr func, Var* arg)
 		data1    = t;
 	}
 
-	v            = newVar();
-	V_TYPE(v)    = ID_VAL;
-	V_ORG(v)     = V_ORG(obj);
-	V_DSIZE(v)   = V_DSIZE(obj);
-	V_SIZE(v)[0] = V_SIZE(obj)[0];
-	V_SIZE(v)[1] = V_SIZE(obj)[1];
-	V_SIZE(v)[2] = V_SIZE(obj)[2];
-	V_FORMAT(v)  = DV_FLOAT;
-	V_DATA(v)    = data1;
-
 	free(data2);
 	free(data3);
-	return (v);
-}
-
-void jfill_x(Var* obj, int width, int height, int depth, float* data, float fill, int radius)
-{
-	int i, j, band, pos, x1, x2, y1, y2;
-	float m, d;
-	int state = 0;
-
-	for (band = 0; band < depth; band++) {
-		for (i = 0; i < width; i++) {
-			state = 0;
-			for (j = 0; j < height; j++) {
-				pos       = cpos(i, j, band, obj);
-				d         = extract_float(obj, pos);
-				data[pos] = d;
-				if (state == 0 && d != fill) {
-					y1    = d;
-					x1    = j;
-					state = 1;
-				} else if (state == 1) {
-					if (d == fill) {
-						state = 2;
-					} else {
-						y1 = d;
-						x1 = j;
-					}
-				} else if (state == 2 && d != fill) {
-					y2 = d;
-					x2 = j;
-					if (x2 - x1 > radius) {
-						state = 0;
-						continue;
-					}
-					m = (y2 - y1) / (x2 - x1);
-					for (j = x1 + 1; j < x2; j++) {
-						pos       = cpos(i, j, band, obj);
-						data[pos] = y1 + m * (j - x1);
-					}
-					x1    = x2;
-					y1    = y2;
-					state = 1;
-				}
-			}
-		}
-	}
+	return (newVal(V_ORG(obj), V_SIZE(obj)[0], V_SIZE(obj)[1], V_SIZE(obj)[2], DV_FLOAT, data1));
 }
 
-void jfill_y(Var* obj, int width, int height, int depth, float* data, float fill, int radius)
-{
-	int i, j, band, pos, x1, x2, y1, y2;
-	float m, d;
-	int state = 0;
-
-	for (band = 0; band < depth; band++) {
-		for (i = 0; i < height; i++) {
-			state = 0;
-			for (j = 0; j < width; j++) {
-				pos       = cpos(j, i, band, obj);
-				d         = extract_float(obj, pos);
-				data[pos] = d;
-				if (state == 0 && d != fill) {
-					y1    = d;
-					x1    = j;
-					state = 1;
-				} else if (state == 1) {
-					if (d == fill) {
-						state = 2;
-					} else {
-						y1 = d;
-						x1 = j;
-					}
-				} else if (state == 2 && d != fill) {
-					y2 = d;
-					x2 = j;
-					if (x2 - x1 > radius) {
-						state = 0;
-						continue;
-					}
-					m = (y2 - y1) / (x2 - x1);
-					for (j = x1 + 1; j < x2; j++) {
-						pos       = cpos(j, i, band, obj);
-						data[pos] = y1 + m * (j - x1);
-					}
-					x1    = x2;
-					y1    = y2;
-					state = 1;
-				}
-			}
-		}
-	}
-}
-
-void jfill_lr(Var* obj, int x, int y, int z, float* data, float fill, int radius, int wrap)
-{
-	int i, j, k, *p;
-	float* d;
-
-	/**
-	 ** do across
-	 **/
-	d = (float*)calloc(x, sizeof(float));
-	p = (int*)calloc(x, sizeof(int));
-
-	for (k = 0; k < z; k++) {
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				p[i] = cpos(i, j, k, obj);
-				d[i] = extract_float(obj, p[i]);
-			}
-			jfill(d, x, fill, radius, wrap);
-			for (i = 0; i < x; i++) {
-				data[p[i]] = d[i];
-			}
-		}
-	}
-	free(d);
-	free(p);
-}
-
-void jfill_tb(Var* obj, int x, int y, int z, float* data, float fill, int radius)
-{
-	int i, j, k, *p;
-	float* d;
-
-	d = (float*)calloc(y, sizeof(float));
-	p = (int*)calloc(y, sizeof(int));
-
-	for (k = 0; k < z; k++) {
-		for (i = 0; i < x; i++) {
-			for (j = 0; j < y; j++) {
-				p[j] = cpos(i, j, k, obj);
-				d[j] = extract_float(obj, p[j]);
-			}
-			jfill(d, y, fill, radius, 0);
-			for (j = 0; j < y; j++) {
-				data[p[j]] = d[j];
-			}
-		}
-	}
-	free(d);
-	free(p);
-}
+typedef struct {
+	float *d1, *d2;
+	float fill;
+} merge_job;
 
-void jfill_tr(Var* obj, int x, int y, int z, float* data, float fill, int radius)
+static void jfill_merge_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	int n, i, j, k, l, *p;
-	float* d;
+	merge_job* job = (merge_job*)ctx;
+	float *d1 = job->d1, *d2 = job->d2, fill = job->fill;
+	size_t i;
 
-	/**
-	 ** do top to right
-	 **/
-	n = max(x, y);
-	d = (float*)calloc(n, sizeof(float));
-	p = (int*)calloc(n, sizeof(int));
-
-	for (k = 0; k < z; k++) {
-		for (i = 0; i < x; i++) {
-			for (j = 0; j < y; j++) {
-				if (i + j >= x) break;
-				p[j] = cpos(i + j, j, k, obj);
-				d[j] = extract_float(obj, p[j]);
-			}
-			jfill(d, j, fill, radius, 0);
-			for (l = 0; l < j; l++) {
-				data[p[l]] = d[l];
-			}
-		}
-		/* we've already done the zero stripe, start at 1 */
-		for (j = 1; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				if (i + j >= y) break;
-				p[i] = cpos(i, j + i, k, obj);
-				d[i] = extract_float(obj, p[i]);
-			}
-			jfill(d, i, fill, radius, 0);
-			for (l = 0; l < i; l++) {
-				data[p[l]] = d[l];
-			}
-		}
-	}
-	free(d);
-	free(p);
-}
-
-void jfill_tl(Var* obj, int x, int y, int z, float* data, float fill, int radius)
-{
-	int n, i, j, k, l, *p;
-	float* d;
-
-	/**
-	 ** do top to right
-	 **/
-	n = max(x, y);
-	d = (float*)calloc(n, sizeof(float));
-	p = (int*)calloc(n, sizeof(int));
-
-	for (k = 0; k < z; k++) {
-		for (i = 0; i < x; i++) {
-			for (j = 0; j < y; j++) {
-				if (i - j < 0) break;
-				p[j] = cpos(i - j, j, k, obj);
-				d[j] = extract_float(obj, p[j]);
-			}
-			jfill(d, j, fill, radius, 0);
-			for (l = 0; l < j; l++) {
-				data[p[l]] = d[l];
-			}
-		}
-		/* we've already done the zero stripe, start at 1 */
-
-		for (j = 1; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				if (x - i - 1 < 0 || j + i >= y) break;
-				p[i] = cpos(x - i - 1, j + i, k, obj);
-				d[i] = extract_float(obj, p[i]);
-			}
-			jfill(d, i, fill, radius, 0);
-			for (l = 0; l < i; l++) {
-				data[p[l]] = d[l];
-			}
-		}
-	}
-	free(d);
-	free(p);
-}
-
-void jfill_merge(float* d1, float* d2, float fill, int dsize)
-{
-	int i;
-
-	for (i = 0; i < dsize; i++) {
+	for (i = begin; i < end; i++) {
 		if (d1[i] == fill) {
 			if (d2[i] != fill) {
 				d1[i] = d2[i];
@@ -443,6 +376,12 @@ void jfill_merge(float* d1, float* d2, float fill, int dsize)
 	}
 }
 
+void jfill_merge(float* d1, float* d2, float fill, int dsize)
+{
+	merge_job job = {d1, d2, fill};
+	dv_parallel_for(dsize, 65536, jfill_merge_kernel, &job);
+}
+
 void jfill(float* data, int n, float fill, int radius, int wrap)
 {
 	int i, j, x1, x2, state = 0;
@@ -482,6 +421,111 @@ void jfill(float* data, int n, float fill, int radius, int wrap)
 	}
 }
 
+typedef struct {
+	Var* obj;
+	float* out;
+} input_job;
+
+static void fill_input_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	input_job* job = (input_job*)ctx;
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		job->out[i] = extract_float(job->obj, i);
+	}
+}
+
+static float* fill_input(Var* obj, int* copy)
+{
+	input_job job;
+
+	*copy = 0;
+	if (V_FORMAT(obj) == DV_FLOAT) return ((float*)V_DATA(obj));
+
+	job.obj = obj;
+	job.out = (float*)malloc(V_DSIZE(obj) * sizeof(float));
+	if (job.out == NULL) return (NULL);
+	*copy = 1;
+	dv_parallel_for(V_DSIZE(obj), 65536, fill_input_kernel, &job);
+	return (job.out);
+}
+
+/*
+** Mark the holes that are more than maxgap pixels wide both across and
+** down (bit 1 for the row, bit 2 for the column), so the fills can pass
+** over the inside of big voids without searching around every pixel.
+** The mask is indexed (band * height + y) * width + x.
+*/
+typedef struct {
+	const float* in;
+	const size_t* stride;
+	unsigned char* mask;
+	int width, height, maxgap;
+	float fill;
+	int across;
+} skip_job;
+
+static void fill_skip_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	skip_job* job = (skip_job*)ctx;
+	int n         = job->across ? job->width : job->height;
+	int lines     = job->across ? job->height : job->width;
+	unsigned char bit = job->across ? 1 : 2;
+	size_t line, pos, step, m, mstep;
+	int band, l, run;
+
+	step  = job->stride[job->across ? 0 : 1];
+	mstep = job->across ? 1 : job->width;
+
+	for (line = begin; line < end; line++) {
+		band = line / lines;
+		if (job->across) {
+			pos = (line % lines) * job->stride[1] + band * job->stride[2];
+			m   = line * job->width;
+		} else {
+			pos = (line % lines) * job->stride[0] + band * job->stride[2];
+			m   = (size_t)band * job->height * job->width + line % lines;
+		}
+		for (l = 0; l < n; l += run) {
+			run = 1;
+			if (job->in[pos + l * step] != job->fill) continue;
+			while (l + run < n && job->in[pos + (l + run) * step] == job->fill) run++;
+			if (run > job->maxgap) {
+				int r;
+				for (r = 0; r < run; r++) job->mask[m + (l + r) * mstep] |= bit;
+			}
+		}
+	}
+}
+
+static unsigned char* fill_skip_mask(const float* in, const size_t stride[3], int width, int height,
+                                     int depth, float fill, int maxgap)
+{
+	size_t i, n = (size_t)width * height * depth;
+	skip_job job;
+
+	job.mask = (unsigned char*)calloc(n, 1);
+	if (job.mask == NULL) return (NULL);
+
+	job.in     = in;
+	job.stride = stride;
+	job.width  = width;
+	job.height = height;
+	job.maxgap = maxgap;
+	job.fill   = fill;
+
+	job.across = 1;
+	dv_parallel_for((size_t)depth * height, 64, fill_skip_kernel, &job);
+	job.across = 0;
+	dv_parallel_for((size_t)depth * width, 64, fill_skip_kernel, &job);
+
+	for (i = 0; i < n; i++) {
+		job.mask[i] = (job.mask[i] == 3);
+	}
+	return (job.mask);
+}
+
 /**
 ***
 *** This computes the weighted average of all pixels within a neighborhood,
@@ -495,6 +539,87 @@ void jfill(float* data, int n, float fill, int radius, int wrap)
 *** with an extra kernel/2 border.
 **/
 
+typedef struct {
+	const float* pic;
+	const float* wgt;
+	int w, wth, pic_x;
+	const size_t* todo;
+	float* val;
+	unsigned char* done;
+} kfill_job;
+
+/* one iteration for the holes todo[begin .. end), into val and done */
+static void kfill_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	kfill_job* job   = (kfill_job*)ctx;
+	const float* pic = job->pic;
+	const float* wgt = job->wgt;
+	int w = job->w, wth = job->wth, pic_x = job->pic_x;
+	int i, j, mi, mj;
+	int pl, pr, pu, pd, r, pave, nn;
+	float pixel, sum_non_zero_mask;
+	size_t idx, pi;
+
+	for (idx = begin; idx < end; idx++) {
+		pi = job->todo[idx];
+		i  = pi % pic_x - wth;
+		j  = pi / pic_x - wth;
+
+		pl   = 0;
+		pr   = 0;
+		pu   = 0;
+		pd   = 0;
+		r    = 1;
+		pave = 0;
+		nn   = 0;
+
+		/* loop through the data to find the nearest neighbors in the 4 cardinal
+		 * directions */
+		while (r <= wth) {
+			pl = (pl == 0 && pic[pi - r] > 0) ? r : pl;
+			pr = (pr == 0 && pic[pi + r] > 0) ? r : pr;
+			pu = (pu == 0 && pic[pi - r * pic_x] > 0) ? r : pu;
+			pd = (pd == 0 && pic[pi + r * pic_x] > 0) ? r : pd;
+
+			/* in the case that we don't have any near neighbors, set values to ave p */
+			if (r == wth) {
+				nn = ((pl > 0) ? 1 : 0) + ((pr > 0) ? 1 : 0) + ((pu > 0) ? 1 : 0) + ((pd > 0) ? 1 : 0);
+				if (nn > 0) {
+					pave = (pl + pr + pu + pd) / nn;
+					pl   = (pl == 0) ? pave : pl;
+					pr   = (pr == 0) ? pave : pr;
+					pu   = (pu == 0) ? pave : pu;
+					pd   = (pd == 0) ? pave : pd;
+				}
+			}
+
+			r += 1;
+		}
+
+		job->done[idx] = (nn > 1);
+		if (nn > 1) {
+			pixel             = 0.0;
+			sum_non_zero_mask = 0.0;
+
+			for (mj = wth - pu; mj <= wth + pd; mj++) {
+				for (mi = wth - pl; mi <= wth + pr; mi++) {
+					pixel += pic[(j + mj) * pic_x + (i + mi)] * wgt[mj * w + mi];
+					if (pic[(j + mj) * pic_x + (i + mi)] > 0.0) {
+						sum_non_zero_mask += wgt[mj * w + mi];
+					}
+				}
+			}
+
+			if (sum_non_zero_mask == 0.0) {
+				sum_non_zero_mask = 1.0;
+			} /* sanity */
+
+			/* divide by weight */
+			job->val[idx] = pixel / sum_non_zero_mask;
+		}
+	}
+}
+
 Var* ff_kfill(vfuncptr func, Var* arg)
 {
 	Var* pic_v = NULL; /* the picture */
@@ -506,24 +631,26 @@ Var* ff_kfill(vfuncptr func, Var* arg)
 	float* wgt = NULL;   /* storage location of the weight array */
 	int c;               /* general array counter */
 	int n;               /* number of elements - generally */
-	int i, j, k, mi, mj; /* general array counters */
+	int i, j, k;         /* general array counters */
 	float min_wgt;       /* minimum value of weight */
-	float *pic = NULL, *pic2 = NULL, *tpic = NULL;
-	float pixel;      /* working var */
+	float *pic = NULL, *pic2 = NULL;
 	int wth;          /* (w-1)/2 */
 	int pic_x, pic_y; /* dims of the expanded picture */
-	int px, py, pi;
-	int pl, pr, pu, pd, r, pave; /* the nearest neighbor positions */
-	float sum_non_zero_mask;
-	int nn;
+	size_t pi;
+	size_t* todo = NULL;        /* padded positions of the open holes */
+	size_t ntodo, h, nopen;     /* number of them */
+	unsigned char* skip = NULL; /* holes inside voids wider than maxgap */
+	kfill_job job;
 	int niter   = 0;
 	int nzeroes = 0;
+	int maxgap  = 0;
 
-	Alist alist[4];
+	Alist alist[5];
 	alist[0]      = make_alist("picture", ID_VAL, NULL, &pic_v);
 	alist[1]      = make_alist("weight", ID_VAL, NULL, &wgt_v);
 	alist[2]      = make_alist("iterations", ID_VAL, NULL, &itr_v);
-	alist[3].name = NULL;
+	alist[3]      = make_alist("maxgap", DV_INT32, NULL, &maxgap);
+	alist[4].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -600,14 +727,6 @@ Var* ff_kfill(vfuncptr func, Var* arg)
 		return NULL;
 	}
 
-	pic2 = (float*)calloc(sizeof(float), pic_x * pic_y);
-	if (pic2 == NULL) {
-		parse_error("ERROR! Unable to alloc %d bytes.\n", sizeof(float) * pic_x * pic_y);
-		free(wgt); /* cleanup before exit */
-		free(pic);
-		return NULL;
-	}
-
 	for (j = 0; j < y; j++) {
 		for (i = 0; i < x; i++) {
 			pic[(j + wth) * pic_x + (i + wth)] = extract_float(pic_v, cpos(i, j, 0, pic_v));
@@ -632,98 +751,81 @@ Var* ff_kfill(vfuncptr func, Var* arg)
 		wgt[i] = wgt[i] / min_wgt;
 	}
 
+	/*
+	** The holes are listed once, skipping any inside voids wider than
+	** maxgap, and each iteration only visits the ones still open.  New
+	** values are set after every hole has been looked at, as before.
+	*/
+	ntodo = 0;
+	for (j = 0; j < y; j++) {
+		for (i = 0; i < x; i++) {
+			if (pic[(j + wth) * pic_x + (i + wth)] == 0.0) ntodo++;
+		}
+	}
+	if (maxgap > 0) {
+		size_t stride[3] = {1, pic_x, 0};
+		skip = fill_skip_mask(pic + wth * pic_x + wth, stride, x, y, 1, 0.0, maxgap);
+	}
+	job.todo = todo = (size_t*)malloc((ntodo + 1) * sizeof(size_t));
+	job.val  = (float*)malloc((ntodo + 1) * sizeof(float));
+	job.done = (unsigned char*)malloc(ntodo + 1);
+	if (todo == NULL || job.val == NULL || job.done == NULL || (maxgap > 0 && skip == NULL)) {
+		parse_error("ERROR! Unable to alloc memory.\n");
+		free(wgt);
+		free(pic);
+		free(todo);
+		free(job.val);
+		free(job.done);
+		free(skip);
+		return NULL;
+	}
+	ntodo = 0;
+	for (j = 0; j < y; j++) {
+		for (i = 0; i < x; i++) {
+			pi = (j + wth) * pic_x + (i + wth);
+			if (pic[pi] == 0.0 && !(skip && skip[j * x + i])) todo[ntodo++] = pi;
+		}
+	}
+	free(skip);
+
+	job.pic   = pic;
+	job.wgt   = wgt;
+	job.w     = w;
+	job.wth   = wth;
+	job.pic_x = pic_x;
+
 	/* iterate through data */
 	for (k = 1; (k <= niter) || (niter == 0); k++) {
+		dv_parallel_for(ntodo, 256, kfill_kernel, &job);
 
-		/* copy pic onto pic2 */
-		memcpy(pic2, pic, sizeof(float) * pic_x * pic_y);
+		/* assign the new values and drop the filled holes */
 		nzeroes = 0;
-
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-
-				py = j + wth;
-				px = i + wth;
-				pi = py * pic_x + px;
-
-				if (pic[pi] == 0.0) {
-
-					pl   = 0;
-					pr   = 0;
-					pu   = 0;
-					pd   = 0;
-					r    = 1;
-					pave = 0;
-					nn   = 0;
-
-					/* loop through the data to find the nearest neighbors in the 4 cardinal
-					 * directions */
-					while (r <= wth) {
-						pl = (pl == 0 && pic[pi - r] > 0) ? r : pl;
-						pr = (pr == 0 && pic[pi + r] > 0) ? r : pr;
-						pu = (pu == 0 && pic[pi - r * pic_x] > 0) ? r : pu;
-						pd = (pd == 0 && pic[pi + r * pic_x] > 0) ? r : pd;
-
-						/* in the case that we don't have any near neighbors, set values to ave p */
-						if (r == wth) {
-							nn = ((pl > 0) ? 1 : 0) + ((pr > 0) ? 1 : 0) + ((pu > 0) ? 1 : 0) +
-							     ((pd > 0) ? 1 : 0);
-							if (nn > 0) {
-								pave = (pl + pr + pu + pd) / nn;
-								pl   = (pl == 0) ? pave : pl;
-								pr   = (pr == 0) ? pave : pr;
-								pu   = (pu == 0) ? pave : pu;
-								pd   = (pd == 0) ? pave : pd;
-							}
-						}
-
-						r += 1;
-					}
-
-					if (nn > 1) {
-						nzeroes++;
-						pixel             = 0.0;
-						sum_non_zero_mask = 0.0;
-
-						for (mj = wth - pu; mj <= wth + pd; mj++) {
-							for (mi = wth - pl; mi <= wth + pr; mi++) {
-								pixel += pic[(j + mj) * pic_x + (i + mi)] * wgt[mj * w + mi];
-								if (pic[(j + mj) * pic_x + (i + mi)] > 0.0) {
-									sum_non_zero_mask += wgt[mj * w + mi];
-								}
-							}
-						}
-
-						if (sum_non_zero_mask == 0.0) {
-							sum_non_zero_mask = 1.0;
-						} /* sanity */
-
-						/* divide by weight */
-						/* assign pixel to location */
-						pic2[pi] = pixel / sum_non_zero_mask;
-					}
-				}
+		nopen   = 0;
+		for (h = 0; h < ntodo; h++) {
+			if (job.done[h]) {
+				nzeroes++;
+				pic[todo[h]] = job.val[h];
 			}
+			if (pic[todo[h]] == 0.0) todo[nopen++] = todo[h];
 		}
-
-		/* swap pic & pic2 arrays */
-		tpic = pic;
-		pic  = pic2;
-		pic2 = tpic;
+		ntodo = nopen;
 
 		if (nzeroes == 0) {
 			break;
 		}
 	}
+	free(todo);
+	free(job.val);
+	free(job.done);
 
 	if (niter == 0) {
 		parse_error("Done in %d iterations.\n", k);
 	}
 
 	/* construct return value */
-	pic2 = (float*)realloc(pic2, sizeof(float) * x * y);
+	pic2 = (float*)malloc(sizeof(float) * x * y);
 	if (pic2 == NULL) {
-		parse_error("blah");
+		parse_error("ERROR! Unable to alloc %d bytes.\n", sizeof(float) * x * y);
 		free(wgt);
 		free(pic);
 		return NULL;
@@ -1,4 +1,19 @@
 #include "parser.h"
+#include "parallel.h"
+
+/*
+** What to do with points outside the range of the lookup table
+*/
+enum { OUTSIDE_EXTRAPOLATE, OUTSIDE_CLAMP, OUTSIDE_IGNORE, OUTSIDE_ERROR };
+
+static int outside_policy(const char* s, int dflt)
+{
+	if (s == NULL || *s == '\0') return dflt;
+	if (!strcasecmp(s, "extrapolate")) return OUTSIDE_EXTRAPOLATE;
+	if (!strcasecmp(s, "clamp")) return OUTSIDE_CLAMP;
+	if (!strcasecmp(s, "ignore")) return OUTSIDE_IGNORE;
+	return OUTSIDE_ERROR;
+}
 
 int is_deleted(float f)
 {
@@ -6,19 +21,21 @@ int is_deleted(float f)
 }
 
 void cakima(size_t n, float x[], float y[], float** yd);
-Var* linear_interp(Var* v0, Var* v1, Var* v2, float ignore);
+Var* linear_interp(Var* v0, Var* v1, Var* v2, float ignore, int outside);
 Var* cubic_interp(Var* v0, Var* v1, Var* v2, char* type, float ignore);
 
 Var* ff_interp(vfuncptr func, Var* arg)
 {
 	Var* v[3]           = {NULL, NULL, NULL};
 	float ignore        = FLT_MIN;
-	const char* usage   = "usage: %s(y1,x1,x2,[type={'linear'|'cubic'}]";
+	const char* usage   = "usage: %s(y1,x1,x2,[type={'linear'|'cubic'}] [,outside={'extrapolate'|'clamp'|'ignore'}]";
 	char* type          = (char*)"";
 	const char* types[] = {"linear", "cubic", NULL};
-	Var* out;
+	char* outside       = NULL;
+	const char* sides[] = {"extrapolate", "clamp", "ignore", NULL};
+	Var* out            = NULL;
 
-	Alist alist[9];
+	Alist alist[10];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &v[0]);
 	alist[1]      = make_alist("from", ID_VAL, NULL, &v[1]);
 	alist[2]      = make_alist("to", ID_VAL, NULL, &v[2]);
@@ -27,7 +44,8 @@ Var* ff_interp(vfuncptr func, Var* arg)
 	alist[5]      = make_alist("y1", ID_VAL, NULL, &v[0]);
 	alist[6]      = make_alist("x1", ID_VAL, NULL, &v[1]);
 	alist[7]      = make_alist("x2", ID_VAL, NULL, &v[2]);
-	alist[8].name = NULL;
+	alist[8]      = make_alist("outside", ID_ENUM, sides, &outside);
+	alist[9].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -52,7 +70,7 @@ Var* ff_interp(vfuncptr func, Var* arg)
 	}
 
 	if (type == NULL || strlen(type) == 0 || !strcasecmp(type, "linear")) {
-		out = linear_interp(v[0], v[1], v[2], ignore);
+		out = linear_interp(v[0], v[1], v[2], ignore, outside_policy(outside, OUTSIDE_EXTRAPOLATE));
 	} else if (!strncasecmp(type, "cubic", 5)) {
 		out = cubic_interp(v[0], v[1], v[2], type, ignore);
 	} else {
@@ -61,20 +79,115 @@ Var* ff_interp(vfuncptr func, Var* arg)
 	return (out);
 }
 
-Var* linear_interp(Var* v0, Var* v1, Var* v2, float ignore)
+/*
+** The segments of linear_interp() are found by indexing straight into
+** the table when the x values are evenly spaced (to within a part in
+** 10^4, then nudged onto the right segment), and by bisection otherwise.
+** The queries are independent, so they're split across threads.
+*/
+typedef struct lerp_job {
+	const float *x, *y; /* the n valid table points */
+	const float *m, *c; /* slope and intercept of each segment */
+	size_t n;
+	int uniform;
+	double x0, scale; /* segment = (w - x0) * scale, when uniform */
+	Var* to;
+	float* out;
+	float ignore;
+	int outside;
+} lerp_job;
+
+static size_t lerp_segment(const lerp_job* job, float w)
+{
+	const float* x = job->x;
+	size_t last    = job->n - 2; /* last segment */
+	size_t st, ed, mid;
+	double g;
+
+	if (job->uniform) {
+		g  = (w - job->x0) * job->scale;
+		st = g <= 0 ? 0 : (g >= last ? last : (size_t)g);
+		while (st > 0 && w < x[st]) st--;
+		while (st < last && w > x[st + 1]) st++;
+		return st;
+	}
+
+	st = 0;
+	ed = job->n - 1;
+	while ((ed - st) > 1) {
+		mid = (st + ed) / 2;
+		if (w >= x[mid]) {
+			st = mid;
+		} else {
+			ed = mid;
+		}
+	}
+	return st;
+}
+
+static void lerp_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	lerp_job* job = (lerp_job*)ctx;
+	const float *x = job->x, *y = job->y;
+	size_t i, st, n = job->n;
+	float w;
+
+	for (i = begin; i < end; i++) {
+		w = extract_float(job->to, i); /* output wavelength */
+		if (is_deleted(w)) {
+			job->out[i] = -1.23e34;
+			continue;
+		} else if (w == job->ignore) {
+			job->out[i] = job->ignore;
+			continue;
+		}
+
+		if (n == 1) {
+			job->out[i] = y[0];
+			continue;
+		}
+		if (w < x[0] || w > x[n - 1]) {
+			if (job->outside == OUTSIDE_CLAMP) {
+				job->out[i] = w < x[0] ? y[0] : y[n - 1];
+				continue;
+			} else if (job->outside == OUTSIDE_IGNORE) {
+				job->out[i] = job->ignore;
+				continue;
+			}
+		}
+
+		st = lerp_segment(job, w);
+		if (w == x[st]) {
+			job->out[i] = y[st];
+		} else if (w == x[st + 1] || y[st + 1] == y[st]) {
+			job->out[i] = y[st + 1];
+		} else {
+			job->out[i] = job->m[st] * w + job->c[st];
+		}
+	}
+}
+
+Var* linear_interp(Var* v0, Var* v1, Var* v2, float ignore, int outside)
 {
-	Var* s   = NULL;
+	lerp_job job;
 	float *x = NULL, *y = NULL, *fdata = NULL;
-	size_t i, count = 0;
-	float x1, y1, x2, y2, w;
 	float *m = NULL, *c = NULL; /* slopes and y-intercepts */
-	size_t fromsz, tosz;        /* number of elements in from & to arrays */
+	size_t i, count = 0;
+	size_t fromsz, tosz; /* number of elements in from & to arrays */
+	double dx;
 
 	fromsz = V_DSIZE(v0);
 	tosz   = V_DSIZE(v2);
 
-	x = (float*)calloc(fromsz, sizeof(float));
-	y = (float*)calloc(fromsz, sizeof(float));
+	x     = (float*)calloc(fromsz + 1, sizeof(float));
+	y     = (float*)calloc(fromsz + 1, sizeof(float));
+	m     = (float*)calloc(fromsz + 1, sizeof(float));
+	c     = (float*)calloc(fromsz + 1, sizeof(float));
+	fdata = (float*)calloc(tosz + 1, sizeof(float));
+	if (x == NULL || y == NULL || m == NULL || c == NULL || fdata == NULL) {
+		parse_error("interp: unable to allocate memory");
+		goto fail;
+	}
 
 	count = 0;
 	for (i = 0; i < fromsz; i++) {
@@ -83,78 +196,58 @@ Var* linear_interp(Var* v0, Var* v1, Var* v2, float ignore)
 		if (is_deleted(x[count]) || is_deleted(y[count]) || x[count] == ignore || y[count] == ignore)
 			continue;
 		if (count && x[count] <= x[count - 1]) {
-			parse_error("Error: data is not monotonically increasing x1[%d] = %f", i, x[count]);
-			free(fdata);
-			free(x);
-			free(y);
-			return (NULL);
+			parse_error("Error: data is not monotonically increasing x1[%zu] = %f", i, x[count]);
+			goto fail;
 		}
 		count++;
 	}
-
-	fdata = (float*)calloc(tosz, sizeof(float));
-	m     = (float*)calloc(fromsz - 1, sizeof(float));
-	c     = (float*)calloc(fromsz - 1, sizeof(float));
+	if (count == 0) {
+		parse_error("interp: no valid points to interpolate from");
+		goto fail;
+	}
 
 	/* evaluate & cache slopes & y-intercepts */
-	for (i = 1; i < fromsz; i++) {
+	for (i = 1; i < count; i++) {
 		m[i - 1] = (y[i] - y[i - 1]) / (x[i] - x[i - 1]);
 		c[i - 1] = y[i - 1] - m[i - 1] * x[i - 1];
 	}
 
-	for (i = 0; i < tosz; i++) {
-		w = extract_float(v2, i); /* output wavelength */
-		if (is_deleted(w)) {
-			fdata[i] = -1.23e34;
-		} else if (w == ignore) {
-			fdata[i] = ignore;
-		} else {
-
-			/*
-			** Locate the segment containing the x-value of "w".
-			** Assume that x-values are monotonically increasing.
-			*/
-			size_t st = 0, ed = fromsz - 1, mid;
-
-			while ((ed - st) > 1) {
-				mid = (st + ed) / 2;
-				if (w > x[mid]) {
-					st = mid;
-				} else if (w < x[mid]) {
-					ed = mid;
-				} else {
-					st = ed = mid;
-				}
-			}
-			x2 = x[ed];
-			y2 = y[ed];
-			x1 = x[st];
-			y1 = y[st];
-
-			if (y2 == y1) {
-				fdata[i] = y1;
-			} else {
-				/* m = (y2-y1)/(x2-x1); */
-				/* fdata[i] = m[st]*w + (y1 - m[st]*x1); */
-				fdata[i] = m[st] * w + c[st];
-			}
+	memset(&job, 0, sizeof(job));
+	job.x       = x;
+	job.y       = y;
+	job.m       = m;
+	job.c       = c;
+	job.n       = count;
+	job.to      = v2;
+	job.out     = fdata;
+	job.ignore  = (outside == OUTSIDE_IGNORE && ignore == FLT_MIN) ? -32768 : ignore;
+	job.outside = outside;
+
+	if (count > 2) {
+		dx          = ((double)x[count - 1] - x[0]) / (count - 1);
+		job.uniform = 1;
+		for (i = 1; i < count && job.uniform; i++) {
+			job.uniform = fabs(x[i] - (x[0] + i * dx)) <= 1e-4 * dx;
 		}
+		job.x0    = x[0];
+		job.scale = 1 / dx;
 	}
 
-	s         = newVar();
-	V_TYPE(s) = ID_VAL;
+	dv_parallel_for(tosz, 4096, lerp_kernel, &job);
 
-	V_DATA(s)    = (void*)fdata;
-	V_DSIZE(s)   = V_DSIZE(v2);
-	V_SIZE(s)[0] = V_SIZE(v2)[0];
-	V_SIZE(s)[1] = V_SIZE(v2)[1];
-	V_SIZE(s)[2] = V_SIZE(v2)[2];
-	V_ORG(s)     = V_ORG(v2);
-	V_FORMAT(s)  = DV_FLOAT;
+	free(x);
+	free(y);
+	free(m);
+	free(c);
+	return newVal(V_ORG(v2), V_SIZE(v2)[0], V_SIZE(v2)[1], V_SIZE(v2)[2], DV_FLOAT, fdata);
 
+fail:
+	free(fdata);
 	free(x);
 	free(y);
-	return (s);
+	free(m);
+	free(c);
+	return (NULL);
 }
 
 Var* ff_cinterp(vfuncptr func, Var* arg)
@@ -214,7 +307,7 @@ Var* cubic_interp(Var* v0, Var* v1, Var* v2, char* type, float ignore)
 			continue;
 		}
 		if (count && xp[count] <= xp[count - 1]) {
-			parse_error("Error: data is not monotonically increasing x1[%ld] = %f", i, xp[count]);
+			parse_error("Error: data is not monotonically increasing x1[%zu] = %f", i, xp[count]);
 			error = 1;
 			break;
 		}
@@ -797,23 +890,109 @@ y(x) = yd[i][0]+h*(yd[i][1]+h*(yd[i][2]/2.0+h*yd[i][3]/6.0))
 	}
 }
 
+/*
+** interp2d() packs the table into contiguous floats, one [ty][tx] plane
+** per band, and looks the points up in blocks: the cell and weights of a
+** block of points are worked out first and then applied to every band of
+** the table that the points belong to.  Blocks are split across threads.
+*/
+#define LUT2D_BLOCK 256
+
+typedef struct lut2d_job {
+	const float* table; /* [nb][ty][tx] */
+	size_t tx, ty, nb;
+	Var *xdata, *ydata;
+	size_t w, h, nq;    /* points per plane, planes of points */
+	size_t xs[3], ys[3]; /* element strides of xdata, ydata */
+	double sx, dx, sy, dy;
+	int outside;
+	int hasign;
+	float ignore;
+	float* out; /* [nb][h][w] */
+	int failed; /* a point fell outside the table */
+} lut2d_job;
+
+/* cell and fraction along one axis of the table; 0 if outside */
+static int lut2d_locate(double t, size_t n, int outside, size_t* i, float* p)
+{
+	if (!(t >= 0 && t <= n - 1)) {
+		if (outside != OUTSIDE_CLAMP || t != t) return 0;
+		t = t < 0 ? 0 : n - 1;
+	}
+	*i = (size_t)t;
+	if (*i + 1 >= n) *i = n > 1 ? n - 2 : 0;
+	*p = n > 1 ? t - *i : 0;
+	return 1;
+}
+
+static void lut2d_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	lut2d_job* job = (lut2d_job*)ctx;
+	size_t plane   = job->w * job->h;
+	size_t cell[LUT2D_BLOCK];
+	float p1[LUT2D_BLOCK], p2[LUT2D_BLOCK];
+	char ok[LUT2D_BLOCK];
+	size_t b0, n, k, q, b, first, last, xi, yi, i, j;
+	size_t dx1 = job->tx > 1 ? 1 : 0, dy1 = job->ty > 1 ? job->tx : 0;
+	double tvx, tvy;
+	const float* t;
+	float* o;
+
+	for (b0 = begin; b0 < end; b0 += LUT2D_BLOCK) {
+		n = min(LUT2D_BLOCK, end - b0);
+
+		for (q = 0; q < job->nq; q++) {
+			for (k = 0; k < n; k++) {
+				i   = (b0 + k) % job->w;
+				j   = (b0 + k) / job->w;
+				tvx = extract_double(job->xdata, i * job->xs[0] + j * job->xs[1] + q * job->xs[2]);
+				tvy = extract_double(job->ydata, i * job->ys[0] + j * job->ys[1] + q * job->ys[2]);
+
+				ok[k] = !(job->hasign && (tvx == job->ignore || tvy == job->ignore)) &&
+				        lut2d_locate((tvx - job->sx) / job->dx, job->tx, job->outside, &xi, &p1[k]) &&
+				        lut2d_locate((tvy - job->sy) / job->dy, job->ty, job->outside, &yi, &p2[k]);
+				if (!ok[k] && job->outside == OUTSIDE_ERROR &&
+				    !(job->hasign && (tvx == job->ignore || tvy == job->ignore))) {
+					job->failed = 1;
+				}
+				cell[k] = ok[k] ? yi * job->tx + xi : 0;
+			}
+
+			/* one band of points goes with each band of the table, or one with all of them */
+			first = job->nq > 1 ? q : 0;
+			last  = job->nq > 1 ? q + 1 : job->nb;
+			for (b = first; b < last; b++) {
+				t = job->table + b * job->tx * job->ty;
+				o = job->out + b * plane + b0;
+				for (k = 0; k < n; k++) {
+					/*   apply the bilinear interpolation algorithm                  **
+					**   val=(f(1,1)*(1-p1)+f(2,1)*p1)*(1-p2)+(f(1,2)*(1-p1)+f(2,2)*p1)*p2    **
+					*/
+					const float* f = t + cell[k];
+					float v        = (f[0] * (1 - p1[k]) + f[dx1] * p1[k]) * (1 - p2[k]) +
+					          (f[dy1] * (1 - p1[k]) + f[dy1 + dx1] * p1[k]) * p2[k];
+					o[k] = ok[k] ? v : job->ignore;
+				}
+			}
+		}
+	}
+}
+
 Var* ff_interp2d(vfuncptr func, Var* arg)
 {
 
 	Var* xdata = NULL;                    /* the orignial data */
 	Var* ydata = NULL;                    /* the orignial data */
 	Var* table = NULL;                    /* look up table */
-	Var* out   = NULL;                    /* the output struture */
-	int i, j;                             /* loop indices */
-	float p1, p2;                         /* percentages */
-	int xx, xy, xz, yx, yy, yz;           /* data size */
-	float* wdata = NULL;                  /* working data */
 	float sx = 1, dx = 1, sy = 1, dy = 1; /* start and delta values */
-	float tvx, tvy;                       /* data values */
-	int xi, yi;                           /* new x and y positions */
-	float tv1, tv2;                       /* temporary values */
-
-	Alist alist[8];
+	float ignore          = FLT_MIN;
+	char* outside         = NULL;
+	const char* sides[]   = {"error", "clamp", "ignore", NULL};
+	float* packed         = NULL;
+	lut2d_job job;
+	size_t i, j, b, xz;
+
+	Alist alist[10];
 	alist[0]      = make_alist("table", ID_VAL, NULL, &table);
 	alist[1]      = make_alist("xdata", ID_VAL, NULL, &xdata);
 	alist[2]      = make_alist("ydata", ID_VAL, NULL, &ydata);
@@ -821,11 +1000,13 @@ Var* ff_interp2d(vfuncptr func, Var* arg)
 	alist[4]      = make_alist("deltax", DV_FLOAT, NULL, &dx);
 	alist[5]      = make_alist("starty", DV_FLOAT, NULL, &sy);
 	alist[6]      = make_alist("deltay", DV_FLOAT, NULL, &dy);
-	alist[7].name = NULL;
+	alist[7]      = make_alist("outside", ID_ENUM, sides, &outside);
+	alist[8]      = make_alist("ignore", DV_FLOAT, NULL, &ignore);
+	alist[9].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
-	if (table == NULL) {
+	if (table == NULL || xdata == NULL || ydata == NULL) {
 		parse_error("\ninterp2d()- Thu Apr 27 16:20:31 MST 2006");
 		parse_error("Bilinear interpolation algorithm");
 		parse_error("\nInputs and Outputs:");
@@ -836,65 +1017,76 @@ Var* ff_interp2d(vfuncptr func, Var* arg)
 		parse_error("deltax - delta  x value for the table");
 		parse_error("starty - starting y value for the table");
 		parse_error("deltay - delta y value for the table");
-		parse_error("Returns a 1 d, array the size of x and y data\n");
+		parse_error("outside - 'error', 'clamp' or 'ignore' points outside the table");
+		parse_error("ignore - value of missing points, and of ignored ones");
+		parse_error("Returns an array the size of x and y data, with a band for each band of table\n");
 		parse_error("c.edwards");
 		return (NULL);
 	}
 
+	memset(&job, 0, sizeof(job));
+	job.outside = outside_policy(outside, OUTSIDE_ERROR);
+	job.hasign  = (ignore != FLT_MIN);
+	job.ignore  = job.hasign ? ignore : -32768;
+
+	/*size of the table*/
+	job.tx = GetX(table);
+	job.ty = GetY(table);
+	job.nb = GetZ(table);
+
 	/*size of xdata*/
-	xx = GetX(xdata);
-	xy = GetY(xdata);
-	xz = GetZ(xdata);
-
-	/*size of ydata*/
-	yx = GetX(ydata);
-	yy = GetY(ydata);
-	yz = GetZ(ydata);
-
-	/*error handling, they must be the same size and one band*/
-	if (xx != yx || xy != yy || xz != 1 || yz != 1) {
-		parse_error("\nThe x and y data must have the same dimensions and only one band\n");
+	job.w = GetX(xdata);
+	job.h = GetY(xdata);
+	xz    = GetZ(xdata);
+
+	/*error handling, they must be the same size, and one band or one for each band of the table*/
+	if (GetX(ydata) != job.w || GetY(ydata) != job.h || GetZ(ydata) != xz || (xz != 1 && xz != job.nb)) {
+		parse_error("\nThe x and y data must have the same dimensions and one band, or one per band of the table\n");
+		return NULL;
+	}
+	if (dx == 0 || dy == 0) {
+		parse_error("%s: deltax and deltay must not be 0\n", func->name);
 		return NULL;
 	}
 
 	/*memory allocation*/
-	wdata = (float*)calloc((size_t)xx * (size_t)xy * 1, sizeof(float));
-
-	for (i = 0; i < xx; i += 1) {
-		for (j = 0; j < xy; j += 1) {
-
-			/*extract values from original data*/
-			tvx = extract_float(xdata, cpos(i, j, 0, xdata));
-			tvy = extract_float(ydata, cpos(i, j, 0, ydata));
-
-			/*apply start and delta to the extracted values*/
-			tvx = (tvx - sx) / dx;
-			tvy = (tvy - sy) / dy;
-
-			/*calculate percentages */
-			p1 = (float)(tvx - floor(tvx));
-			p2 = (float)(tvy - floor(tvy));
-			xi = (int)floor(tvx);
-			yi = (int)floor(tvy);
+	packed  = (float*)calloc(job.tx * job.ty * job.nb + 1, sizeof(float));
+	job.out = (float*)calloc(job.w * job.h * job.nb + 1, sizeof(float));
+	if (packed == NULL || job.out == NULL) {
+		free(packed);
+		free(job.out);
+		parse_error("%s: unable to allocate memory", func->name);
+		return NULL;
+	}
 
-			if (xi > GetX(table) || yi > GetY(table) || xi < 0 || yi < 0) {
-				parse_error("Your interpolation values fall outside the range of the table\n");
-				return (NULL);
+	for (b = 0; b < job.nb; b++) {
+		for (j = 0; j < job.ty; j++) {
+			for (i = 0; i < job.tx; i++) {
+				packed[(b * job.ty + j) * job.tx + i] = extract_float(table, cpos(i, j, b, table));
 			}
-
-			/*   apply the bilinear interpolation algorithm                  **
-			**   val=(f(1,1)*(1-p1)+f(2,1)*p1)*(1-p2)+(f(1,2)*(1-p1)+f(2,2)*p1)*p2    **
-			*/
-
-			tv1 = (extract_float(table, cpos(xi, yi, 0, table)) * (1 - p1) +
-			       extract_float(table, cpos(xi + 1, yi, 0, table)) * (p1)) *
-			      (1 - p2);
-			tv2 = (extract_float(table, cpos(xi, yi + 1, 0, table)) * (1 - p1) +
-			       extract_float(table, cpos(xi + 1, yi + 1, 0, table)) * (p1)) *
-			      (p2);
-			wdata[(size_t)xx * (size_t)j + (size_t)i] = (float)(tv1 + tv2);
 		}
 	}
-	out = newVal(BSQ, xx, xy, 1, DV_FLOAT, wdata);
-	return out;
+
+	job.table = packed;
+	job.xdata = xdata;
+	job.ydata = ydata;
+	job.nq    = xz;
+	job.sx    = sx;
+	job.dx    = dx;
+	job.sy    = sy;
+	job.dy    = dy;
+	cstrides(xdata, job.xs);
+	cstrides(ydata, job.ys);
+
+	if (job.tx && job.ty) {
+		dv_parallel_for(job.w * job.h, 16 * LUT2D_BLOCK, lut2d_kernel, &job);
+	}
+	free(packed);
+
+	if (job.failed) {
+		parse_error("Your interpolation values fall outside the range of the table\n");
+		free(job.out);
+		return (NULL);
+	}
+	return newVal(BSQ, job.w, job.h, job.nb, DV_FLOAT, job.out);
 }
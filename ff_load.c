@@ -38,7 +38,7 @@ Var* ff_load(vfuncptr func, Var* arg)
 
 	/* Set data extraction ranges for iom_read_qube_data(). */
 
-	Alist alist[13];
+	Alist alist[14];
 
 	iom_init_iheader(&h);
 
@@ -54,7 +54,8 @@ Var* ff_load(vfuncptr func, Var* arg)
 	alist[9]       = make_alist("zhigh", DV_INT32, NULL, &h.s_hi[2]);
 	alist[10]      = make_alist("zskip", DV_INT32, NULL, &h.s_skip[2]);
 	alist[11]      = make_alist("hdf_old", DV_INT32, NULL, &hdf_old);
-	alist[12].name = NULL;
+	alist[12]      = make_alist("image", DV_INT32, NULL, &h.image);
+	alist[13].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -63,6 +64,11 @@ Var* ff_load(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
+	if (h.image < 0) {
+		parse_error("%s(): image must be at least 0", func->name);
+		return (NULL);
+	}
+
 	/* this is a hack only used by specpr files */
 	if (record != -1) h.s_lo[2] = h.s_hi[2] = record;
 
@@ -108,6 +114,14 @@ Var* do_load(char* filename, struct iom_iheader* h, int hdf_old)
 			fname = iom_uncompress_with_name(fname);
 			fp    = fopen(fname, "rb");
 		}
+		/* only TIFF files hold more than one image */
+		if (h->image > 0 && !iom_isTIFF(fp)) {
+			parse_error("image=%d only applies to TIFF files: %s", h->image, filename);
+			fclose(fp);
+			free(fname);
+			return (NULL);
+		}
+		rewind(fp);
 /* IO module support will now take priority over built-ins */
 #ifdef BUILD_MODULE_SUPPORT
 		if (input == NULL) input = read_from_io_module(fp, fname);
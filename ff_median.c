@@ -1,18 +1,88 @@
 #include "func.h"
 #include "parser.h"
+#include "parallel.h"
 #include "window.h"
 
-float local_maximum(Window* w, float threshold, float ignore);
+/*
+** local_max() keeps a pixel if nothing in the size x size window around
+** it is bigger, counting only values that are not <ignore> and are at
+** least <threshold>.
+**
+** The window maximum is separable: a running max across each row of a
+** tile, then down each column of that.  Each running max is van Herk /
+** Gil-Werman, a few compares per pixel whatever the window size.
+*/
+
+typedef struct {
+	float *line, *g, *h; /* a row or column of the tile and its block maxima */
+	float* hmax;         /* running max across each row of the tile */
+	float* col;          /* running max down one column */
+} lmax_scratch;
+
+typedef struct {
+	float* out;
+	int x, size;
+	float threshold, ignore;
+	lmax_scratch* scratch; /* one for each thread */
+} lmax_job;
+
+/* out[i] = max(in[i .. i+k-1]) for i < n, given n+k-1 values of in[] */
+static void running_max(const float* in, float* out, int n, int k, float* g, float* h)
+{
+	int len = n + k - 1, i;
+
+	for (i = 0; i < len; i++) {
+		g[i] = (i % k == 0 || in[i] > g[i - 1]) ? in[i] : g[i - 1];
+	}
+	for (i = len - 1; i >= 0; i--) {
+		h[i] = (i % k == k - 1 || i == len - 1 || in[i] > h[i + 1]) ? in[i] : h[i + 1];
+	}
+	for (i = 0; i < n; i++) {
+		out[i] = h[i] > g[i + k - 1] ? h[i] : g[i + k - 1];
+	}
+}
+
+static void local_maximum_tile(void* ctx, Tile* t, int x0, int y0, int nx, int ny, int tid)
+{
+	lmax_job* job   = (lmax_job*)ctx;
+	lmax_scratch* s = &job->scratch[tid];
+	int k           = job->size;
+	int i, j;
+	float v, *d;
+
+	/* running max across each row, leaving out the values that don't count */
+	for (j = 0; j < ny + k - 1; j++) {
+		d = t->data + (size_t)j * t->bw;
+		for (i = 0; i < nx + k - 1; i++) {
+			v          = d[i];
+			s->line[i] = (v == job->ignore || v < job->threshold || isnan(v)) ? -HUGE_VAL : v;
+		}
+		running_max(s->line, s->hmax + (size_t)j * WINDOW_TILE, nx, k, s->g, s->h);
+	}
+
+	/* then down each column, and compare with the center */
+	for (i = 0; i < nx; i++) {
+		for (j = 0; j < ny + k - 1; j++) {
+			s->line[j] = s->hmax[(size_t)j * WINDOW_TILE + i];
+		}
+		running_max(s->line, s->col, ny, k, s->g, s->h);
+		for (j = 0; j < ny; j++) {
+			v = t->data[(size_t)(j + k / 2) * t->bw + i + k / 2];
+			job->out[(size_t)(y0 + j) * job->x + x0 + i] = (v == job->ignore || s->col[j] > v) ? job->ignore : v;
+		}
+	}
+}
 
 Var* ff_local_maximum(vfuncptr func, Var* arg)
 {
 	Var *obj = NULL, *rval = NULL;
 	float ignore = FLT_MIN;
 	float* out;
-	int x, y, i, j;
+	int x, y, i, nt, ok;
 	int size        = 3;
 	float threshold = FLT_MIN;
-	Window* w;
+	size_t n;
+	lmax_job job;
 
 	Alist alist[9];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
@@ -28,44 +98,57 @@ Var* ff_local_maximum(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
+	if (size <= 0) {
+		parse_error("%s: Invalid size specified\n", func->name);
+		return (NULL);
+	}
+
 	x = GetX(obj);
 	y = GetY(obj);
-	w = create_window(size, size, DV_FLOAT);
 
-	out  = calloc(x * y, sizeof(float));
-	rval = newVal(BSQ, x, y, 1, DV_FLOAT, out);
-
-	for (i = 0; i < x; i += 1) {
-		load_window(w, obj, i, 0, ignore);
-		for (j = 0; j < y; j += 1) {
-			if (j) roll_window(w, obj, i, j, ignore);
+	out = calloc((size_t)x * (size_t)y, sizeof(float));
+	if (out == NULL) {
+		parse_error("%s: Unable to alloc %zu bytes", func->name, (size_t)x * y * sizeof(float));
+		return (NULL);
+	}
 
-			out[cpos(i, j, 0, rval)] = local_maximum(w, threshold, ignore);
+	/* line, g and h take WINDOW_TILE+size-1 values, hmax that many rows */
+	n             = WINDOW_TILE + size - 1;
+	nt            = dv_num_threads();
+	job.out       = out;
+	job.x         = x;
+	job.size      = size;
+	job.threshold = threshold;
+	job.ignore    = ignore;
+	job.scratch   = calloc(nt, sizeof(lmax_scratch));
+	ok            = (job.scratch != NULL);
+	for (i = 0; ok && i < nt; i++) {
+		job.scratch[i].line = malloc((3 * n + (n + 1) * WINDOW_TILE) * sizeof(float));
+		if (job.scratch[i].line == NULL) {
+			ok = 0;
+			break;
 		}
+		job.scratch[i].g    = job.scratch[i].line + n;
+		job.scratch[i].h    = job.scratch[i].g + n;
+		job.scratch[i].hmax = job.scratch[i].h + n;
+		job.scratch[i].col  = job.scratch[i].hmax + n * WINDOW_TILE;
 	}
 
-	free_window(w);
-	return (rval);
-}
+	if (ok) ok = window_tiles(obj, size, size, ignore, local_maximum_tile, &job);
 
-float local_maximum(Window* w, float threshold, float ignore)
-{
-	float v;
-	int i, j;
-	float max;
-
-	v = ((float*)w->row[w->height / 2])[w->width / 2];
-	if (v == ignore) return (ignore);
-	max = v;
+	for (i = 0; job.scratch && i < nt; i++) {
+		free(job.scratch[i].line);
+	}
+	free(job.scratch);
 
-	for (i = 0; i < w->width; i += 1) {
-		for (j = 0; j < w->height; j += 1) {
-			v = ((float*)w->row[j])[i];
-			if (v == ignore || v < threshold) continue;
-			if (v > max) return (ignore);
-		}
+	if (!ok) {
+		free(out);
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
 	}
-	return (max);
+
+	rval = newVal(BSQ, x, y, 1, DV_FLOAT, out);
+	return (rval);
 }
 
 /*
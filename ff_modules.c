@@ -591,6 +591,7 @@ static int uninit_dv_module(dvModule* m /* module to be uninitialized */
 static void free_module_function(vfuncptr fptr)
 {
 	/* free(fptr->name); */
+	free_bindings(fptr);
 	free(fptr);
 }
 
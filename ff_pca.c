@@ -35,6 +35,8 @@
 /*********************************************************************/
 
 #include "parser.h"
+#include "parallel.h"
+#include <errno.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
@@ -58,17 +60,12 @@ float** eval_dstmat(float** gain, /* gain factors matrix [nxn] */
                     float** evec, /* eigen vectors matrix [nxn]*/
                     int n, int biggest_processing);
 
-void corcol();
-void covcol();
-void scpcol();
 float* vector();
 float** matrix();
 void free_vector();
 void free_matrix();
-void scpcol();
 void tred2();
 int tqli();
-void stddev(float** data, int n, int m, float* stddev);
 
 static float** mxm(float** m1, int r1, int c1, float** m2, int r2, int c2, float** result);
 
@@ -123,59 +120,306 @@ static float** xpose(float** m, int r, int c, float** result)
 }
 
 /*
-** pca() - Principal Component Analysis
+** Streaming covariance accumulation
+**
+** The m variables are the values along the chosen axis and every position
+** in the other two axes is one observation vector.  Vectors are gathered a
+** tile at a time straight out of the Var, shifted by a reference vector to
+** keep the double precision sums well conditioned, and accumulated into
+** per-thread sums and cross products, so the data is never copied.
+**
+** Vector p lives at (p / d2, p % d2) in the two non-axis dimensions.
+*/
+
+#define COV_TILE 64
+#define COV_GRAIN 4096 /* minimum vectors per thread */
+
+typedef struct covacc {
+	Var* obj;
+	int m;            /* number of variables */
+	size_t n;         /* number of vectors */
+	size_t d2;        /* size of the second non-axis dimension */
+	size_t vstride;   /* element stride between variables */
+	size_t stride1;   /* element stride of the first non-axis dimension */
+	size_t stride2;   /* element stride of the second non-axis dimension */
+	size_t* sample;   /* sorted vector indices to use, or NULL for all */
+	size_t nsample;
+	int use_ignore;
+	float ignore;
+	double* shift;    /* [m] reference vector */
+	double* tiles;    /* [nchunks][m][COV_TILE] gather space */
+	double* sums;     /* [nchunks][m] */
+	double* cross;    /* [nchunks][m][m], upper triangle */
+	size_t* counts;   /* [nchunks] */
+} covacc;
+
+/*
+** Set up an accumulator over obj with the variables along axis (0, 1, 2
+** for x, y, z).  ignore may be NULL.
 */
-float* pca(float** data,   /* n x m matrix of input data */
-           int n,          /* n-rows (or n-vectors, each of length m) */
-           int m,          /* m-columns (or m-variables) */
-           char opt,       /* processing option:
-                                   'v' - use covariance matrix
-                                   'r' - use correlation matrix
-                                   's' - use SSCP matrix
-                           */
-           float* evals,   /* Eigen Values 1 x m vector */
-           float** symmat, /* Eigen Vectors m x m matrix */
-           int niter       /* Max no. of iterations during tqli convergence */
-           )
+static void covacc_init(covacc* a, Var* obj, int axis, Var* ignore)
 {
-	float* interm;
-	int success;
+	size_t dim[3], stride[3];
+	int ref[3], i;
 
-	/* Look at analysis option; branch in accordance with this. */
-	switch (opt) {
-	case 'R': /* Output correlation matrix - symmat[m][m]. */
-	case 'r': corcol(data, n, m, symmat); break;
+	dim[0] = GetSamples(V_SIZE(obj), V_ORG(obj));
+	dim[1] = GetLines(V_SIZE(obj), V_ORG(obj));
+	dim[2] = GetBands(V_SIZE(obj), V_ORG(obj));
+	cstrides(obj, stride);
 
-	case 'V': /* Output variance-covariance matrix - symmat[m][m]. */
-	case 'v': covcol(data, n, m, symmat); break;
+	for (i = 0; i < 3; i++) {
+		ref[i] = (i + axis) % 3;
+	}
 
-	case 'S': /* Output SSCP matrix - symmat[m][m]. */
-	case 's': scpcol(data, n, m, symmat); break;
+	memset(a, 0, sizeof(covacc));
+	a->obj     = obj;
+	a->m       = dim[ref[0]];
+	a->n       = dim[ref[1]] * dim[ref[2]];
+	a->d2      = dim[ref[2]];
+	a->vstride = stride[ref[0]];
+	a->stride1 = stride[ref[1]];
+	a->stride2 = stride[ref[2]];
+
+	if (ignore != NULL) {
+		a->use_ignore = 1;
+		a->ignore     = extract_float(ignore, 0);
+	}
+}
 
-	default:
-		fprintf(stderr, "pca(): Invalid processing option %c\n", opt);
-		free_matrix(symmat, m, m);
-		free_vector(evals, m);
-		return NULL;
+/*
+** Restrict the accumulator to a random subset of nsample vectors
+** (Knuth's selection sampling, so the indices come out sorted).
+*/
+static void covacc_subsample(covacc* a, size_t nsample)
+{
+	size_t i, k;
+
+	if (nsample == 0 || nsample >= a->n) return;
+
+	a->sample  = (size_t*)malloc(nsample * sizeof(size_t));
+	a->nsample = nsample;
+
+	for (i = 0, k = 0; k < nsample; i++) {
+		if ((a->n - i) * drand48() < nsample - k) {
+			a->sample[k++] = i;
+		}
 	}
+}
 
-	/* Allocate storage for dummy and new vectors. */
-	interm = vector(m); /* Storage alloc. for 'intermediate' vector */
+static void covacc_free(covacc* a)
+{
+	free(a->sample);
+	free(a->shift);
+	free(a->tiles);
+	free(a->sums);
+	free(a->cross);
+	free(a->counts);
+}
 
-	/* Calculate Eigen values and vectors */
-	tred2(symmat, m, evals, interm);                 /* Triangular decomposition */
-	success = tqli(evals, interm, m, symmat, niter); /* Reduction of sym. trid. matrix */
-	if (!success) {
-		free_vector(interm, m);
-		return NULL;
+#define GATHER_VECTOR(type)                                                  \
+	{                                                                        \
+		const type* d = (const type*)V_DATA(a->obj) + base;                  \
+		for (k = 0; k < a->m; k++) out[k * ostride] = d[k * a->vstride];     \
+	}                                                                        \
+	break
+
+/*
+** Copy vector p into out[0], out[ostride], ... out[(m-1)*ostride].
+** Returns 0 if any of its values is the ignore value.
+*/
+static int gather_vector(const covacc* a, size_t p, double* out, size_t ostride)
+{
+	size_t base = (p / a->d2) * a->stride1 + (p % a->d2) * a->stride2;
+	int k;
+
+	switch (V_FORMAT(a->obj)) {
+	case DV_UINT8: GATHER_VECTOR(u8);
+	case DV_UINT16: GATHER_VECTOR(u16);
+	case DV_UINT32: GATHER_VECTOR(u32);
+	case DV_UINT64: GATHER_VECTOR(u64);
+	case DV_INT8: GATHER_VECTOR(i8);
+	case DV_INT16: GATHER_VECTOR(i16);
+	case DV_INT32: GATHER_VECTOR(i32);
+	case DV_INT64: GATHER_VECTOR(i64);
+	case DV_FLOAT: GATHER_VECTOR(float);
+	case DV_DOUBLE: GATHER_VECTOR(double);
 	}
 
-	/* evals now contains the eigenvalues,
-	    columns of symmat now contain the associated eigenvectors. */
+	if (a->use_ignore) {
+		for (k = 0; k < a->m; k++) {
+			if ((float)out[k * ostride] == a->ignore) return 0;
+		}
+	}
+	return 1;
+}
 
-	free_vector(interm, m);
+static void covacc_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	covacc* a    = (covacc*)ctx;
+	int m        = a->m;
+	double* tile = a->tiles + (size_t)tid * m * COV_TILE;
+	double* sums = a->sums + (size_t)tid * m;
+	double* crs  = a->cross + (size_t)tid * m * m;
+	size_t count = 0;
+	size_t i, p;
+	int nv, t, j1, j2;
+	double s, *r1, *r2;
+
+	for (i = begin; i < end;) {
+		for (nv = 0; nv < COV_TILE && i < end; i++) {
+			p = a->sample ? a->sample[i] : i;
+			if (gather_vector(a, p, tile + nv, COV_TILE)) nv++;
+		}
+		if (nv == 0) continue;
+
+		for (j1 = 0; j1 < m; j1++) {
+			r1 = tile + j1 * COV_TILE;
+			s  = 0;
+			for (t = 0; t < nv; t++) {
+				r1[t] -= a->shift[j1];
+				s += r1[t];
+			}
+			sums[j1] += s;
+		}
+
+		/* rank-nv update of the upper triangle, one dot product per pair */
+		for (j1 = 0; j1 < m; j1++) {
+			r1 = tile + j1 * COV_TILE;
+			for (j2 = j1; j2 < m; j2++) {
+				r2 = tile + j2 * COV_TILE;
+				s  = 0;
+				for (t = 0; t < nv; t++) s += r1[t] * r2[t];
+				crs[j1 * m + j2] += s;
+			}
+		}
+		count += nv;
+	}
+
+	a->counts[tid] = count;
+}
+
+/*
+** Accumulate over every (sampled, non-ignored) vector.  On return mean[m]
+** holds the variable means and cprod[m*m] the centered cross products
+** sum((x - mean) * (x - mean)').  Returns the number of vectors used.
+*/
+static size_t covacc_run(covacc* a, double* mean, double* cprod)
+{
+	size_t total = a->sample ? a->nsample : a->n;
+	size_t i, count, m = a->m;
+	int nchunks = dv_parallel_chunks(total, COV_GRAIN);
+	int t, j1, j2;
+	double *sy, *syy;
+
+	if (nchunks == 0) return 0;
+
+	/* the first usable vector is the shift */
+	a->shift = (double*)calloc(m, sizeof(double));
+	for (i = 0; i < total; i++) {
+		if (gather_vector(a, a->sample ? a->sample[i] : i, a->shift, 1)) break;
+	}
+	if (i == total) return 0;
+
+	a->tiles  = (double*)malloc(sizeof(double) * nchunks * m * COV_TILE);
+	a->sums   = (double*)calloc(nchunks * m, sizeof(double));
+	a->cross  = (double*)calloc(nchunks * m * m, sizeof(double));
+	a->counts = (size_t*)calloc(nchunks, sizeof(size_t));
+	if (a->tiles == NULL || a->sums == NULL || a->cross == NULL || a->counts == NULL) {
+		memory_error(errno, sizeof(double) * nchunks * m * m);
+		return 0;
+	}
+
+	dv_parallel_for(total, COV_GRAIN, covacc_kernel, a);
+
+	/* combine the per-thread partials in order, into chunk 0 */
+	sy    = a->sums;
+	syy   = a->cross;
+	count = a->counts[0];
+	for (t = 1; t < nchunks; t++) {
+		count += a->counts[t];
+		for (i = 0; i < m; i++) sy[i] += a->sums[t * m + i];
+		for (i = 0; i < m * m; i++) syy[i] += a->cross[t * m * m + i];
+	}
+	if (count == 0) return 0;
+
+	for (j1 = 0; j1 < m; j1++) {
+		mean[j1] = a->shift[j1] + sy[j1] / count;
+		for (j2 = j1; j2 < m; j2++) {
+			cprod[j1 * m + j2] = cprod[j2 * m + j1] = syy[j1 * m + j2] - sy[j1] * sy[j2] / count;
+		}
+	}
+
+	return count;
+}
+
+/*
+** Turn the accumulated statistics into the requested m x m matrix
+** (1-based, as used by tred2()/tqli()):
+**   'v' - variance-covariance
+**   'r' - correlation
+**   's' - sums of squares and cross products
+*/
+static void cov_symmat(char opt, size_t n, int m, const double* mean, const double* cprod,
+                       float** symmat)
+{
+	double eps = 0.005;
+	double* sd;
+	int j1, j2;
+
+	switch (tolower(opt)) {
+	case 'r':
+		sd = (double*)malloc(m * sizeof(double));
+		for (j1 = 0; j1 < m; j1++) {
+			sd[j1] = sqrt(cprod[j1 * m + j1] / n);
+			/* The usual inelegant way to handle near-zero std. dev. values */
+			if (sd[j1] <= eps) sd[j1] = 1.0;
+		}
+		for (j1 = 0; j1 < m; j1++) {
+			for (j2 = 0; j2 < m; j2++) {
+				symmat[j1 + 1][j2 + 1] =
+				    (j1 == j2) ? 1.0 : cprod[j1 * m + j2] / (n * sd[j1] * sd[j2]);
+			}
+		}
+		free(sd);
+		break;
+
+	case 's':
+		for (j1 = 0; j1 < m; j1++) {
+			for (j2 = 0; j2 < m; j2++) {
+				symmat[j1 + 1][j2 + 1] = cprod[j1 * m + j2] + n * mean[j1] * mean[j2];
+			}
+		}
+		break;
 
-	return evals;
+	case 'v':
+	default:
+		for (j1 = 0; j1 < m; j1++) {
+			for (j2 = 0; j2 < m; j2++) {
+				symmat[j1 + 1][j2 + 1] = cprod[j1 * m + j2] / (double)(n - 1);
+			}
+		}
+		break;
+	}
+}
+
+/*
+** Fill symmat (1-based m x m) with the opt matrix of a.
+** Returns the number of vectors used, 0 if there were none.
+*/
+static size_t cov_matrix(covacc* a, char opt, float** symmat)
+{
+	int m = a->m;
+	double* mean  = (double*)calloc(m, sizeof(double));
+	double* cprod = (double*)calloc((size_t)m * m, sizeof(double));
+	size_t n;
+
+	if ((n = covacc_run(a, mean, cprod)) != 0) {
+		cov_symmat(opt, n, m, mean, cprod, symmat);
+	}
+
+	free(mean);
+	free(cprod);
+	return n;
 }
 
 /*
@@ -238,70 +482,40 @@ float** eval_stretch_matrix(float* evals,        /* m Eigen Values */
 }
 
 /*
-**	data[][] is replaced with the stretched data
+** Apply the m x m stretch matrix to every vector of a, writing the
+** result to the same position in out.
 */
-float** pcs(float** data, int n, int m, char opt,
-            float* scale, /* scaling vector (m scaling values) or
-                                  NULL for scaling of 1.0 (i.e. no scaling) */
-            int niter     /* max number of iterations during tqli convergence */
-            )
+typedef struct pcs_apply {
+	covacc* a;
+	const double* dstmat; /* [m][m], 0-based */
+	double* vecs;         /* [nchunks][m] */
+	float* out;
+} pcs_apply;
+
+static void pcs_apply_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	float *evals, **evecs, *v;
-	float** dstmat;
-	int i, j, k;
-
-	/* Allocate storage for Eigen Vectors */
-	evecs = matrix(m, m);
-
-	/* Allocate storage for vector of eigenvalues */
-	evals = vector(m);
-
-	if (pca(data, n, m, opt, evals, evecs, niter) == NULL) {
-		free_matrix(evecs, m, m);
-		free_vector(evals, m);
-		return NULL;
-	}
-
-	/* allocate space for m x m decorrelation stretch matrix */
-	dstmat = matrix(m, m);
-
-	eval_stretch_matrix(evals, evecs, m, scale, dstmat);
-
-	/* free unused space */
-	free_vector(evals, m);
-	free_matrix(evecs, m, m);
-
-	/*
-	** apply stretch matrix to the input data:
-	**
-	**          data x dstmat
-	**
-	** I am not using mxm() here so that I can do the multiplication
-	** in place
-	*/
-
-	/* allocate space for a row of data matrix */
-	v = vector(m);
+	pcs_apply* s = (pcs_apply*)ctx;
+	covacc* a    = s->a;
+	int m        = a->m;
+	double* v    = s->vecs + (size_t)tid * m;
+	size_t p, base;
+	int i, k;
+	double d;
 
-	for (j = 1; j <= n; j++) {
+	for (p = begin; p < end; p++) {
+		base = (p / a->d2) * a->stride1 + (p % a->d2) * a->stride2;
 
-		/* evaluate a single row of data matrix */
-		for (i = 1; i <= m; i++) {
-			v[i] = 0;
-			for (k = 1; k <= m; k++) {
-				v[i] += data[j][k] * dstmat[k][i];
-			}
+		if (!gather_vector(a, p, v, 1)) {
+			for (i = 0; i < m; i++) s->out[base + i * a->vstride] = a->ignore;
+			continue;
 		}
 
-		/* replace the original row with the computed data */
-		for (i = 1; i <= m; i++) {
-			data[j][i] = v[i];
+		for (i = 0; i < m; i++) {
+			d = 0;
+			for (k = 0; k < m; k++) d += v[k] * s->dstmat[k * m + i];
+			s->out[base + i * a->vstride] = d;
 		}
 	}
-
-	free_vector(v, m);
-
-	return data;
 }
 
 /***************************************************************************/
@@ -311,31 +525,37 @@ Var* ff_pcs(vfuncptr func, Var* args)
 {
 	Var *obj = NULL, *axis_arg = NULL;
 	Var *scale_arg = NULL, *opt_arg = NULL;
-	Var* v_return;
+	Var* ignore = NULL;
 	const char* axis_enums[] = {/* values that axis can take */
 	                            "x", "X", "y", "Y", "z", "Z", NULL};
-	const char* opt_enums[] = {          /* values taken by "opt"; see pca() */
+	const char* opt_enums[] = {          /* values taken by "opt"; see cov_symmat() */
 	                           "v", "V", /* use covariance matrix -  default */
 	                           "r", "R", /* use correlation matrix */
 	                           "s", "S", /* use sum of squares matrix */
 	                           NULL};
 	char opt = 'v'; /* default processing option (value of "opt" arg) */
 
-	float **data, *scale = NULL;
+	covacc acc;
+	pcs_apply apply;
+	float *scale = NULL, *evals, *interm;
+	float **symmat, **dstmat;
+	double* ddstmat;
 	float* fdata = NULL;
-	int dim[3], indices[3];
-	int ref[3] = {0, 1, 2};
-	int n, m, offset;
-	int i, j, k, index;
-	int niter = DEFAULT_MAX_TQLI_ITER;
+	int m, offset;
+	int i, j, index;
+	int niter  = DEFAULT_MAX_TQLI_ITER;
+	int sample = 0;
+	int nchunks;
 
-	Alist alist[6];
+	Alist alist[8];
 	alist[0]      = make_alist("obj", ID_VAL, NULL, &obj);
 	alist[1]      = make_alist("opt", ID_ENUM, opt_enums, &opt_arg);
 	alist[2]      = make_alist("axis", ID_ENUM, axis_enums, &axis_arg);
 	alist[3]      = make_alist("scale", ID_VAL, NULL, &scale_arg);
 	alist[4]      = make_alist("niter", DV_INT32, NULL, &niter);
-	alist[5].name = NULL;
+	alist[5]      = make_alist("ignore", ID_VAL, NULL, &ignore);
+	alist[6]      = make_alist("sample", DV_INT32, NULL, &sample);
+	alist[7].name = NULL;
 
 	if (parse_args(func, args, alist) == 0) return (NULL);
 
@@ -358,35 +578,14 @@ Var* ff_pcs(vfuncptr func, Var* args)
 		return (NULL);
 	}
 
-	/* Get dimensions of input data */
-	dim[0] = GetSamples(V_SIZE(obj), V_ORG(obj)); /* x */
-	dim[1] = GetLines(V_SIZE(obj), V_ORG(obj));   /* y */
-	dim[2] = GetBands(V_SIZE(obj), V_ORG(obj));   /* z */
-
 	/*
 	** If axis is not specified, use the default, i.e. Z
 	*/
 	offset = (axis_arg != NULL) ? toupper(*(char*)axis_arg) - 'X' : 'Z' - 'X';
 
-	/*
-	** ref[0] contains the index of the "axis" passed in by the user
-	** ref[1-2] contains the indices of the other two axes
-	*/
-	for (i = 0; i < 3; i++) {
-		ref[i] = (i + offset) % 3;
-	}
-
-	/*
-	** number of columns (or variables) is along the "axis"
-	** specified by the user
-	*/
-	m = dim[ref[0]];
-
-	/*
-	** number of rows is the rest of the two (out of three)
-	** dimensions
-	*/
-	n = dim[ref[1]] * dim[ref[2]];
+	covacc_init(&acc, obj, offset, ignore);
+	covacc_subsample(&acc, sample);
+	m = acc.m;
 
 	/*
 	** If scale[] is specified, do some sanity checks on its dimensions
@@ -408,6 +607,7 @@ Var* ff_pcs(vfuncptr func, Var* args)
 
 		default:
 			parse_error("%s(): \"%s\" is of invalid format.\n", func->name, alist[3].name);
+			covacc_free(&acc);
 			return (NULL);
 		}
 
@@ -417,6 +617,7 @@ Var* ff_pcs(vfuncptr func, Var* args)
 
 		if (sm != m || sn != 1 || sw != 1) {
 			parse_error("%s(): \"%s\" must be [%d, 1, 1].\n", func->name, alist[3].name, m);
+			covacc_free(&acc);
 			return NULL;
 		}
 
@@ -437,74 +638,69 @@ Var* ff_pcs(vfuncptr func, Var* args)
 		opt = *(char*)opt_arg;
 	}
 
-	/* allocate data space for n-rows, and m-columns */
-	data = matrix(n, m);
-
-	/* extract data */
-	for (j = 0; j < dim[ref[1]]; j++) {
-		for (i = 0; i < dim[ref[2]]; i++) {
+	/* Principal component analysis of the covariance/correlation/SSCP matrix */
+	symmat = matrix(m, m);
+	if (cov_matrix(&acc, opt, symmat) == 0) {
+		parse_error("%s(): no valid data in \"%s\".\n", func->name, alist[0].name);
+		free_matrix(symmat, m, m);
+		if (scale) free_vector(scale, m);
+		covacc_free(&acc);
+		return NULL;
+	}
 
-			for (k = 0; k < dim[ref[0]]; k++) { /* "axis" or "m" dimension */
+	evals  = vector(m);
+	interm = vector(m);
+	tred2(symmat, m, evals, interm);
+	if (!tqli(evals, interm, m, symmat, niter)) {
+		free_vector(interm, m);
+		free_vector(evals, m);
+		free_matrix(symmat, m, m);
+		if (scale) free_vector(scale, m);
+		covacc_free(&acc);
+		return NULL;
+	}
+	free_vector(interm, m);
 
-				indices[ref[1]] = j;
-				indices[ref[2]] = i;
-				indices[ref[0]] = k;
+	/* m x m decorrelation stretch matrix */
+	dstmat = matrix(m, m);
+	eval_stretch_matrix(evals, symmat, m, scale, dstmat);
 
-				/*
-				** here indices[0], indices[1], indices[2] are
-				** x, y, & z indices respectively
-				*/
-				index = cpos(indices[0], indices[1], indices[2], obj);
+	free_vector(evals, m);
+	free_matrix(symmat, m, m);
+	if (scale) free_vector(scale, m);
 
-				/* data[][] has 1-based indices */
-				data[j * dim[ref[2]] + i + 1][k + 1] = extract_float(obj, index);
-			}
+	ddstmat = (double*)malloc(sizeof(double) * m * m);
+	for (j = 0; j < m; j++) {
+		for (i = 0; i < m; i++) {
+			ddstmat[j * m + i] = dstmat[j + 1][i + 1];
 		}
 	}
+	free_matrix(dstmat, m, m);
 
-	/* perform the Principal Component Stretch */
-	if (pcs(data, n, m, (strcmp(func->name, "pcsx") ? tolower(opt) : toupper(opt)), scale, niter) == NULL) {
-		free_matrix(data, n, m);
-		if (scale) {
-			free_vector(scale, m);
-		}
+	/*
+	** apply stretch matrix to the input data, every vector of the
+	** output is the corresponding input vector times dstmat
+	*/
+	fdata = (float*)calloc(V_DSIZE(obj), sizeof(float));
+	if (fdata == NULL) {
+		memory_error(errno, V_DSIZE(obj) * sizeof(float));
+		free(ddstmat);
+		covacc_free(&acc);
 		return NULL;
 	}
 
-	if (scale) {
-		free_vector(scale, m);
-	}
-
-	/* collect, package, and return results */
-	fdata = (float*)calloc(dim[0] * dim[1] * dim[2], sizeof(float));
+	nchunks        = dv_parallel_chunks(acc.n, COV_GRAIN);
+	apply.a        = &acc;
+	apply.dstmat   = ddstmat;
+	apply.out      = fdata;
+	apply.vecs     = (double*)malloc(sizeof(double) * max(nchunks, 1) * m);
+	dv_parallel_for(acc.n, COV_GRAIN, pcs_apply_kernel, &apply);
 
-	/* store data */
-	for (j = 0; j < dim[ref[1]]; j++) {
-		for (i = 0; i < dim[ref[2]]; i++) {
-
-			for (k = 0; k < dim[ref[0]]; k++) { /* "axis" or "m" dimension */
-
-				indices[ref[1]] = j;
-				indices[ref[2]] = i;
-				indices[ref[0]] = k;
-
-				/*
-				** here indices[0], indices[1], indices[2] are
-				** x, y, & z indices respectively
-				*/
-				index = cpos(indices[0], indices[1], indices[2], obj);
-
-				/* data[][] has 1-based indices */
-				fdata[index] = data[j * dim[ref[2]] + i + 1][k + 1];
-			}
-		}
-	}
-
-	/* cleanup temporary matrix */
-	free_matrix(data, n, m);
+	free(apply.vecs);
+	free(ddstmat);
+	covacc_free(&acc);
 
-	v_return = newVal(V_ORG(obj), dim[0], dim[1], dim[2], DV_FLOAT, fdata);
-	return v_return;
+	return newVal(V_ORG(obj), V_SIZE(obj)[0], V_SIZE(obj)[1], V_SIZE(obj)[2], DV_FLOAT, fdata);
 }
 
 /***************************************************************************/
@@ -519,19 +715,21 @@ Var* ff_covar(vfuncptr func, Var* args)
 	const char* axis_enums[] = {/* values that axis can take */
 	                            "x", "X", "y", "Y", "z", "Z", NULL};
 
-	float **data, **symmat;
+	covacc acc;
+	float** symmat;
 	float* fdata = NULL;
-	int dim[3], indices[3];
-	int ref[3] = {0, 1, 2};
-	int n, m, offset;
-	int i, j, k, index;
+	int m, offset;
+	int i, j;
+	char opt;
+	int sample  = 0;
 	Var* ignore = NULL;
 
-	Alist alist[4];
+	Alist alist[5];
 	alist[0]      = make_alist("obj", ID_VAL, NULL, &obj);
 	alist[1]      = make_alist("axis", ID_ENUM, axis_enums, &axis_arg);
 	alist[2]      = make_alist("ignore", ID_VAL, NULL, &ignore);
-	alist[3].name = NULL;
+	alist[3]      = make_alist("sample", DV_INT32, NULL, &sample);
+	alist[4].name = NULL;
 
 	if (parse_args(func, args, alist) == 0) return (NULL);
 
@@ -540,103 +738,37 @@ Var* ff_covar(vfuncptr func, Var* args)
 		return (NULL);
 	}
 
-	/*
-	 ** If axis is not specified, use the default, i.e. Z
-	 */
-	offset = (axis_arg != NULL) ? toupper(*(char*)axis_arg) - 'X' : 'Z' - 'X';
-
-	/*
-	 ** ref[0] contains the index of the "axis" passed in by the user
-	 ** ref[1-2] contains the indices of the other two axes
-	 */
-	for (i = 0; i < 3; i++) {
-		ref[i] = (i + offset) % 3;
+	if (strcmp(func->name, "covar") == 0) {
+		opt = 'v';
+	} else if (strcmp(func->name, "corr") == 0) {
+		opt = 'r';
+	} else if (strcmp(func->name, "scp") == 0) {
+		opt = 's';
+	} else {
+		/* should be fairly unreachable - an uncommon occurrance */
+		parse_error("%s() <-- NOT IMPLEMENTED.\n", func->name);
+		return NULL;
 	}
 
-	dim[0] = GetSamples(V_SIZE(obj), V_ORG(obj)); /* x */
-	dim[1] = GetLines(V_SIZE(obj), V_ORG(obj));   /* y */
-	dim[2] = GetBands(V_SIZE(obj), V_ORG(obj));   /* z */
-
 	/*
-	 ** number of columns (or variables) is along the "axis"
-	 ** specified by the user
-	 */
-	m = dim[ref[0]];
-
-	/*
-	 ** number of rows is the rest of the two (out of three)
-	 ** dimensions
+	 ** If axis is not specified, use the default, i.e. Z
 	 */
-	n = dim[ref[1]] * dim[ref[2]];
-
-	/* allocate data space for n-rows, and m-columns */
-	data = matrix(n, m);
-
-	/* extract data */
-	for (j = 0; j < dim[ref[1]]; j++) {
-		for (i = 0; i < dim[ref[2]]; i++) {
-
-			for (k = 0; k < dim[ref[0]]; k++) { /* "axis" or "m" dimension */
-
-				indices[ref[1]] = j;
-				indices[ref[2]] = i;
-				indices[ref[0]] = k;
-
-				/*
-				 ** here indices[0], indices[1], indices[2] are
-				 ** x, y, & z indices respectively
-				 */
-				index = cpos(indices[0], indices[1], indices[2], obj);
-
-				/* data[][] has 1-based indices */
-				data[j * dim[ref[2]] + i + 1][k + 1] = extract_float(obj, index);
-			}
-		}
-	}
-
-	/* handle ignore cases */
+	offset = (axis_arg != NULL) ? toupper(*(char*)axis_arg) - 'X' : 'Z' - 'X';
 
-	if (ignore) {
-		float ign_val = extract_float(ignore, 0);
-		int i2        = 1;
-		int flag;
-
-		for (i = 1; i <= n; i++) {
-			flag = 0;
-			for (j = 1; j <= m; j++) {
-				if (data[i][j] == ign_val) {
-					flag++;
-					break;
-				}
-				data[i2][j] = data[i][j];
-			}
-			if (!flag) i2++;
-		}
-		n = i2 - 1;
-	}
+	covacc_init(&acc, obj, offset, ignore);
+	covacc_subsample(&acc, sample);
+	m = acc.m;
 
 	/* allocate space for resultant matrix */
 	symmat = matrix(m, m);
 
-	/* apply processing function */
-
-	if (strcmp(func->name, "covar") == 0) {
-		/* evaluate covariance */
-		covcol(data, n, m, symmat);
-	} else if (strcmp(func->name, "corr") == 0) {
-		/* evaluate correlation */
-		corcol(data, n, m, symmat);
-	} else if (strcmp(func->name, "scp") == 0) {
-		/* evaluate sum of squares and cross products matrix */
-		scpcol(data, n, m, symmat);
-	} else {
-		/* should be fairly unreachable - an uncommon occurrance */
-		parse_error("%s() <-- NOT IMPLEMENTED.\n", func->name);
+	if (cov_matrix(&acc, opt, symmat) == 0) {
+		parse_error("%s(): no valid data in \"%s\".\n", func->name, alist[0].name);
+		free_matrix(symmat, m, m);
+		covacc_free(&acc);
 		return NULL;
 	}
-
-	/* cleanup original data */
-	free_matrix(data, n, m);
+	covacc_free(&acc);
 
 	/* collect, package, and return results */
 	fdata = (float*)calloc(m * m, sizeof(float));
@@ -654,212 +786,6 @@ Var* ff_covar(vfuncptr func, Var* args)
 	return v_return;
 }
 
-void stddev(float** data, int n, int m, float* stddev)
-{
-	float eps = 0.005;
-	float *mean, *vector();
-	int i, j;
-
-	/* Allocate storage for mean vector */
-	mean = vector(m);
-
-	/* Determine mean of column vectors of input data matrix */
-
-	for (j = 1; j <= m; j++) {
-		mean[j] = 0.0;
-		for (i = 1; i <= n; i++) {
-			mean[j] += data[i][j];
-		}
-		mean[j] /= (float)n;
-	}
-
-	/* Determine standard deviations of column vectors of data matrix. */
-
-	for (j = 1; j <= m; j++) {
-		stddev[j] = 0.0;
-		for (i = 1; i <= n; i++) {
-			stddev[j] += ((data[i][j] - mean[j]) * (data[i][j] - mean[j]));
-		}
-		stddev[j] /= (float)n;
-		stddev[j] = sqrt(stddev[j]);
-		/* The following in an inelegant but usual way to handle
-		   near-zero std. dev. values, which below would cause a zero-
-		   divide. */
-		if (stddev[j] <= eps) stddev[j] = 1.0;
-	}
-
-	free_vector(mean, m);
-}
-
-/**  Correlation matrix: creation  ***********************************/
-
-/* Create m * m correlation matrix from given n * m data matrix. */
-
-void corcol(data, n, m, symmat) float **data, **symmat;
-int n, m;
-{
-	float eps = 0.005, sqn;
-	float *mean, *stddev, *vector();
-	int i, j, j1, j2;
-
-	/* Allocate storage for mean and std. dev. vectors */
-	mean   = vector(m);
-	stddev = vector(m);
-
-	/* Determine mean of column vectors of input data matrix */
-
-	for (j = 1; j <= m; j++) {
-		mean[j] = 0.0;
-		for (i = 1; i <= n; i++) {
-			mean[j] += data[i][j];
-		}
-		mean[j] /= (float)n;
-	}
-
-	/* Determine standard deviations of column vectors of data matrix. */
-
-	for (j = 1; j <= m; j++) {
-		stddev[j] = 0.0;
-		for (i = 1; i <= n; i++) {
-			stddev[j] += ((data[i][j] - mean[j]) * (data[i][j] - mean[j]));
-		}
-		stddev[j] /= (float)n;
-		stddev[j] = sqrt(stddev[j]);
-		/* The following in an inelegant but usual way to handle
-		   near-zero std. dev. values, which below would cause a zero-
-		   divide. */
-		if (stddev[j] <= eps) stddev[j] = 1.0;
-	}
-
-#if 0
-/* Center and reduce the column vectors. */
-	for (i = 1; i <= n; i++) {
-		for (j = 1; j <= m; j++) {
-			data[i][j] -= mean[j];
-			x = sqrt((float) n);
-			x *= stddev[j];
-			data[i][j] /= x;
-		}
-	}
-
-/* Calculate the m * m correlation matrix. */
-	for (j1 = 1; j1 <= m - 1; j1++) {
-		symmat[j1][j1] = 1.0;
-		for (j2 = j1 + 1; j2 <= m; j2++) {
-			symmat[j1][j2] = 0.0;
-			for (i = 1; i <= n; i++) {
-				symmat[j1][j2] += (data[i][j1] * data[i][j2]);
-			}
-			symmat[j2][j1] = symmat[j1][j2];
-		}
-	}
-	symmat[m][m] = 1.0;
-#else
-	/* Saadat - Make this routine non-destructive for data[][] */
-
-	/* Calculate the m * m correlation matrix. */
-	sqn = sqrt((float)n);
-
-	for (j1 = 1; j1 <= m - 1; j1++) {
-		symmat[j1][j1] = 1.0;
-		for (j2 = j1 + 1; j2 <= m; j2++) {
-			symmat[j1][j2] = 0.0;
-			for (i = 1; i <= n; i++) {
-				symmat[j1][j2] += ((data[i][j1] - mean[j1]) / (stddev[j1] * sqn)) *
-				                  ((data[i][j2] - mean[j2]) / (stddev[j2] * sqn));
-			}
-			symmat[j2][j1] = symmat[j1][j2];
-		}
-	}
-	symmat[m][m] = 1.0;
-
-#endif
-
-	return;
-}
-
-/**  Variance-covariance matrix: creation  *****************************/
-
-void covcol(data, n, m, symmat) float **data, **symmat;
-int n, m;
-/* Create m * m covariance matrix from given n * m data matrix. */
-{
-	float *mean, *vector();
-	int i, j, j1, j2;
-
-	/* Allocate storage for mean vector */
-
-	mean = vector(m);
-
-	/* Determine mean of column vectors of input data matrix */
-
-	for (j = 1; j <= m; j++) {
-		mean[j] = 0.0;
-		for (i = 1; i <= n; i++) {
-			mean[j] += data[i][j];
-		}
-		mean[j] /= (float)n;
-	}
-
-#if 0
-/* Center the column vectors. */
-	for (i = 1; i <= n; i++) {
-		for (j = 1; j <= m; j++) {
-			data[i][j] -= mean[j];
-		}
-	}
-
-/* Calculate the m * m covariance matrix. */
-	for (j1 = 1; j1 <= m; j1++) {
-		for (j2 = j1; j2 <= m; j2++) {
-			symmat[j1][j2] = 0.0;
-			for (i = 1; i <= n; i++) {
-				symmat[j1][j2] += data[i][j1] * data[i][j2];
-			}
-			symmat[j2][j1] = (symmat[j1][j2] /= (n-1));
-		}
-	}
-#else
-	/* Saadat - Make this routine non-destructive for data[][] */
-
-	/* Calculate the m * m covariance matrix. */
-	for (j1 = 1; j1 <= m; j1++) {
-		for (j2 = j1; j2 <= m; j2++) {
-			symmat[j1][j2] = 0.0;
-			for (i = 1; i <= n; i++) {
-				symmat[j1][j2] += (data[i][j1] - mean[j1]) * (data[i][j2] - mean[j2]);
-			}
-			symmat[j2][j1] = (symmat[j1][j2] /= ((float)(n - 1)));
-		}
-	}
-#endif
-
-	return;
-}
-
-/**  Sums-of-squares-and-cross-products matrix: creation  **************/
-
-void scpcol(data, n, m, symmat) float **data, **symmat;
-int n, m;
-/* Create m * m sums-of-cross-products matrix from n * m data matrix. */
-{
-	int i, j1, j2;
-
-	/* Calculate the m * m sums-of-squares-and-cross-products matrix. */
-
-	for (j1 = 1; j1 <= m; j1++) {
-		for (j2 = j1; j2 <= m; j2++) {
-			symmat[j1][j2] = 0.0;
-			for (i = 1; i <= n; i++) {
-				symmat[j1][j2] += data[i][j1] * data[i][j2];
-			}
-			symmat[j2][j1] = symmat[j1][j2];
-		}
-	}
-
-	return;
-}
-
 /**  Allocation of vector storage  ***********************************/
 
 float* vector(n) int n;
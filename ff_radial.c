@@ -1,5 +1,6 @@
 #include "func.h"
 #include "parser.h"
+#include "parallel.h"
 #include "window.h"
 
 float radial_symmetry(void** data, int width, int height, float ignore, int delta_x, int delta_y,
@@ -7,24 +8,54 @@ float radial_symmetry(void** data, int width, int height, float ignore, int delt
 float radial_symmetry2(void** data_in, int width, int height, float ignore);
 
 /*
-** Extract a 2-D array of values from the input.
-**
-** This currently re-extracts the entire array each time, since
-** this process is tightly-coupled with traversal order.
+** The window around each pixel comes from a Tile (see window.h), and
+** the tiles are done in parallel.  Each output pixel only depends on
+** its own window, so the result doesn't depend on the thread count.
 */
 
+typedef struct {
+	float* out;
+	size_t plane; /* x*y */
+	int x;
+	float ignore;
+	int size, xdelta, ydelta;
+	int all, first;
+	float* line; /* size+1 values for each thread, with all */
+} radial_job;
+
+static void radial_symmetry_tile(void* ctx, Tile* t, int x0, int y0, int nx, int ny, int tid)
+{
+	radial_job* job = (radial_job*)ctx;
+	float* line     = job->all ? job->line + (size_t)tid * (job->size + 1) : NULL;
+	int i, j, k;
+	size_t p;
+
+	for (j = 0; j < ny; j++) {
+		for (i = 0; i < nx; i++) {
+			p = (size_t)(y0 + j) * job->x + x0 + i;
+			job->out[p] = radial_symmetry((void**)tile_window(t, i, j), t->width, t->height, job->ignore,
+			                              job->xdelta, job->ydelta, job->size, line);
+			if (line) {
+				for (k = job->first; k <= job->size; k++) {
+					job->out[p + (k - job->first) * job->plane] = line[k];
+				}
+			}
+		}
+	}
+}
+
 Var* ff_radial_symmetry(vfuncptr func, Var* arg)
 {
-	Var *obj = NULL, *rval = NULL;
+	Var* obj     = NULL;
 	float ignore = FLT_MIN;
 	float* out   = NULL;
-	int x, y, z, i, j, k;
+	int x, y, nz;
 	int size   = 10;
 	int xdelta = 0.0, ydelta = 0.0;
-	float* line = NULL;
-	int all     = 0;
-	int first   = 1;
-	Window* w;
+	int all    = 0;
+	int first  = 1;
+	int ok;
+	radial_job job;
 
 	Alist alist[9];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
@@ -48,51 +79,69 @@ Var* ff_radial_symmetry(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
-	x = GetX(obj);
-	y = GetY(obj);
-	z = GetZ(obj);
-	w = create_window(size, size, DV_FLOAT);
-
-	if (all) {
-		size_t n = (size_t)x * (size_t)y * (size_t)(size - first + 1);
-		out      = (float*)calloc(n, sizeof(float));
-		rval     = newVal(BSQ, x, y, (size - first + 1), DV_FLOAT, out);
-		line     = (float*)calloc(size, sizeof(float));
-	} else {
-		size_t n = (size_t)x * (size_t)y;
-		out      = (float*)calloc(n, sizeof(float));
-		rval     = newVal(BSQ, x, y, 1, DV_FLOAT, out);
-		line     = NULL;
+	if (all && (first < 0 || first > size)) {
+		parse_error("%s: first must be between 0 and size\n", func->name);
+		return (NULL);
 	}
 
-	for (i = 0; i < x; i += 1) {
-		load_window(w, obj, i, 0, ignore);
-		for (j = 0; j < y; j += 1) {
-			if (j) roll_window(w, obj, i, j, ignore);
+	x  = GetX(obj);
+	y  = GetY(obj);
+	nz = all ? size - first + 1 : 1;
 
-			out[cpos(i, j, 0, rval)] =
-			    radial_symmetry(w->row, size, size, ignore, xdelta, ydelta, size, line);
-			if (all) {
-				for (k = first; k <= size; k++) {
-					out[cpos(i, j, k - first, rval)] = line[k];
-				}
-			}
-		}
+	out      = (float*)calloc((size_t)x * (size_t)y * (size_t)nz, sizeof(float));
+	job.line = all ? (float*)calloc((size_t)dv_num_threads() * (size + 1), sizeof(float)) : NULL;
+	if (out == NULL || (all && job.line == NULL)) {
+		free(out);
+		free(job.line);
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
+	}
+
+	job.out    = out;
+	job.plane  = (size_t)x * y;
+	job.x      = x;
+	job.ignore = ignore;
+	job.size   = size;
+	job.xdelta = xdelta;
+	job.ydelta = ydelta;
+	job.all    = all;
+	job.first  = first;
+
+	/* just big enough for the points radial_symmetry() looks at */
+	ok = window_tiles(obj, 2 * abs(xdelta) * (size / 2) + 1, 2 * abs(ydelta) * (size / 2) + 1, ignore,
+	                  radial_symmetry_tile, &job);
+	free(job.line);
+
+	if (!ok) {
+		free(out);
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
 	}
+	return (newVal(BSQ, x, y, nz, DV_FLOAT, out));
+}
+
+static void radial_symmetry2_tile(void* ctx, Tile* t, int x0, int y0, int nx, int ny, int tid)
+{
+	radial_job* job = (radial_job*)ctx;
+	int i, j;
 
-	free_window(w);
-	return (rval);
+	for (j = 0; j < ny; j++) {
+		for (i = 0; i < nx; i++) {
+			job->out[(size_t)(y0 + j) * job->x + x0 + i] =
+			    radial_symmetry2((void**)tile_window(t, i, j), t->width, t->height, job->ignore);
+		}
+	}
 }
 
 Var* ff_radial_symmetry2(vfuncptr func, Var* arg)
 {
-	Var *obj = NULL, *rval = NULL;
+	Var* obj     = NULL;
 	float ignore = FLT_MIN;
 	float* out;
-	int x, y, z, i, j;
+	int x, y;
 	int size  = 0;
 	int width = 0, height = 0;
-	Window* w;
+	radial_job job;
 
 	Alist alist[9];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
@@ -121,23 +170,22 @@ Var* ff_radial_symmetry2(vfuncptr func, Var* arg)
 
 	x = GetX(obj);
 	y = GetY(obj);
-	z = GetZ(obj);
-	w = create_window(width, height, DV_FLOAT);
-
-	out  = calloc((size_t)x * (size_t)y, sizeof(float));
-	rval = newVal(BSQ, x, y, 1, DV_FLOAT, out);
 
-	for (i = 0; i < x; i += 1) {
-		load_window(w, obj, i, 0, ignore);
-		for (j = 0; j < y; j += 1) {
-			if (j) roll_window(w, obj, i, j, ignore);
-
-			out[cpos(i, j, 0, rval)] = radial_symmetry2(w->row, width, height, ignore);
-		}
+	out = calloc((size_t)x * (size_t)y, sizeof(float));
+	if (out == NULL) {
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
 	}
 
-	free_window(w);
-	return (rval);
+	job.out    = out;
+	job.x      = x;
+	job.ignore = ignore;
+	if (!window_tiles(obj, width, height, ignore, radial_symmetry2_tile, &job)) {
+		free(out);
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
+	}
+	return (newVal(BSQ, x, y, 1, DV_FLOAT, out));
 }
 
 /*
@@ -160,7 +208,7 @@ float radial_symmetry(void** data_in, int width, int height,  /* dimensions of w
 	double sumx[2] = {0, 0}, sumy[2] = {0, 0}, sumxx[2] = {0, 0}, sumyy[2] = {0, 0}, sumxy[2] = {0, 0};
 	double n[2] = {0, 0};
 
-	if (out != NULL) memset(out, size * sizeof(float), 0);
+	if (out != NULL) memset(out, 0, size * sizeof(float));
 
 	for (i = 2; i <= size; i++) {
 		odd = i % 2;
@@ -291,104 +339,46 @@ float radial_symmetry2(void** data_in, int width, int height, /* dimensions of w
 **
 */
 
-Var* ff_radial_symmetry3(vfuncptr func, Var* arg)
-{
-	Var* obj     = NULL;
-	float ignore = FLT_MIN;
-	int width = 0, height = 0;
-	int end   = 1;
-	Var* rval = NULL;
-	int x, y;
-	float* out;
-	Window* w;
+struct dstore {
+	double sumx;
+	double sumy;
+	double sumxx;
+	double sumyy;
+	double sumxy;
+	int count;
+};
 
-	int *distance, d;
-	int dx, dy;
+typedef struct {
+	float* out;
+	size_t plane; /* x*y */
+	int x;
+	float ignore;
+	int end, start, step;
+	int* distance;        /* of each window point from the center, 0 beyond end */
+	struct dstore* accum; /* end+1 for each thread */
+} radial3_job;
+
+static void radial_symmetry3_tile(void* ctx, Tile* t, int x0, int y0, int nx, int ny, int tid)
+{
+	radial3_job* job     = (radial3_job*)ctx;
+	struct dstore* accum = job->accum + (size_t)tid * (job->end + 1);
+	struct dstore *a1, *a2;
+	int width = t->width, height = t->height;
+	int h2 = height / 2, w2 = width / 2;
+	int i, j, p, q, r, d;
+	float v1, v2, *r1, *r2, **row;
 	double ssxx, ssyy, ssxy;
-	int i, j, p, q, r;
-	int h2, w2;
-	float v1, v2;
-	int total;
-	float *r1, *r2;
-	int start = 0, step = 1;
 
-	struct dstore {
-		double sumx;
-		double sumy;
-		double sumxx;
-		double sumyy;
-		double sumxy;
-		int count;
-	} * accum, *a1, *a2;
+	for (j = 0; j < ny; j++) {
+		for (i = 0; i < nx; i++) {
+			row = tile_window(t, i, j);
+			v1  = row[h2][w2];
 
-	Alist alist[6];
-	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
-	alist[1]      = make_alist("size", DV_INT32, NULL, &end);
-	alist[2]      = make_alist("ignore", DV_FLOAT, NULL, &ignore);
-	alist[3]      = make_alist("start", DV_INT32, NULL, &start);
-	alist[4]      = make_alist("step", DV_INT32, NULL, &step);
-	alist[5].name = NULL;
-
-	if (parse_args(func, arg, alist) == 0) return (NULL);
-
-	if (obj == NULL) {
-		parse_error("%s: No object specified\n", func->name);
-		return (NULL);
-	}
-
-	if (end <= 0) {
-		parse_error("%s: Invalid end value specified\n", func->name);
-		return (NULL);
-	}
-
-	x = GetX(obj);
-	y = GetY(obj);
-
-	width  = end * 2 + 1;
-	height = end * 2 + 1;
-	// width = end;
-	// height = end;
-	w = create_window(width, height, DV_FLOAT);
-
-	/* cache some frequently used computed values */
-	h2    = height / 2;
-	w2    = width / 2;
-	total = width * height;
-
-	/* precompute the distance of every point in a given sized window
-	** to the center of the window.
-	**
-	** In theory, this only needs to be 1 quadrant of the window, but that's
-	** too hard to bookkeep, and doesn't save much.
-	*/
-	distance = calloc(total, sizeof(int));
-	for (i = 0; i < width; i++) {
-		dx = i - w2;
-		for (j = 0; j < height; j++) {
-			dy                      = j - h2;
-			distance[i + j * width] = floor(sqrt(dx * dx + dy * dy));
-			/* precheck for values outside the largest circle */
-			if (distance[i + j * width] > end) distance[i + j * width] = 0;
-		}
-	}
-
-	out   = calloc((size_t)x * (size_t)y * (size_t)((end - start) / step + 1), sizeof(float));
-	rval  = newVal(BSQ, x, y, ((end - start) / step + 1), DV_FLOAT, out);
-	accum = calloc(end + 1, sizeof(struct dstore));
-
-	/* run a window over every pixel and do the math */
-	for (i = 0; i < x; i += 1) {
-		load_window(w, obj, i, 0, ignore);
-		for (j = 0; j < y; j += 1) {
-			if (j) roll_window(w, obj, i, j, ignore);
-
-			v1 = ((float**)w->row)[h2][w2];
-
-			if (v1 == ignore) {
+			if (v1 == job->ignore) {
 				continue;
 			}
 
-			memset(accum, 0, (end + 1) * sizeof(struct dstore));
+			memset(accum, 0, (job->end + 1) * sizeof(struct dstore));
 
 			/*
 			** pick a pair of opposing points, and add them to the
@@ -398,8 +388,8 @@ Var* ff_radial_symmetry3(vfuncptr func, Var* arg)
 
 			for (q = 0; q <= h2; q++) {
 				/* one of the double-derefs moved to here for speed */
-				r1 = ((float**)w->row)[q];
-				r2 = ((float**)w->row)[(height - 1) - q];
+				r1 = row[q];
+				r2 = row[(height - 1) - q];
 				for (p = 0; p < width; p++) {
 					if (q == h2 && p == w2) {
 						/* We only run the window up to the center point  */
@@ -409,9 +399,9 @@ Var* ff_radial_symmetry3(vfuncptr func, Var* arg)
 					v1 = r1[p];
 					v2 = r2[(width - 1) - p];
 
-					if (v1 == ignore || v2 == ignore) continue;
+					if (v1 == job->ignore || v2 == job->ignore) continue;
 
-					if ((d = distance[p + q * width]) != 0) {
+					if ((d = job->distance[p + q * width]) != 0) {
 						a1 = &(accum[d]);
 						a1->sumx += v1;
 						a1->sumy += v2;
@@ -424,7 +414,7 @@ Var* ff_radial_symmetry3(vfuncptr func, Var* arg)
 			}
 
 			/* now compute correlation from per-radii accumulators */
-			for (r = 1; r <= end; r++) {
+			for (r = 1; r <= job->end; r++) {
 				/* sum the values in preceeding bins */
 				a1 = &accum[r - 1];
 				a2 = &accum[r];
@@ -439,29 +429,124 @@ Var* ff_radial_symmetry3(vfuncptr func, Var* arg)
 				// Don't bother if at least 1/2 the box isn't ignore values
 				// this is M_PI_4 because we're only counting half the pixels
 				// to begin with.
-				if ((r - start) % step == 0) {
+				if (r >= job->start && (r - job->start) % job->step == 0) {
 					if (a2->count > r * r * M_PI_4) {
 						double c = a2->count;
 						ssxx     = a2->sumxx - a2->sumx * a2->sumx / c;
 						ssyy     = a2->sumyy - a2->sumy * a2->sumy / c;
 						ssxy     = a2->sumxy - a2->sumx * a2->sumy / c;
 						if (ssxx != 0 && ssyy != 0) {
-							out[cpos(i, j, ((r - start) / step), rval)] =
+							job->out[(size_t)(y0 + j) * job->x + x0 + i +
+							         ((r - job->start) / job->step) * job->plane] =
 							    sqrt(ssxy * ssxy / (ssxx * ssyy));
 						}
 					}
 				}
 			}
 		}
-		printf("%d/%d\r", i, x);
-		fflush(stdout);
+	}
+}
+
+Var* ff_radial_symmetry3(vfuncptr func, Var* arg)
+{
+	Var* obj     = NULL;
+	float ignore = FLT_MIN;
+	int width = 0, height = 0;
+	int end   = 1;
+	int x, y, nz;
+	float* out;
+
+	int dx, dy;
+	int i, j, ok;
+	int h2, w2;
+	int total;
+	int start = 0, step = 1;
+	radial3_job job;
+
+	Alist alist[6];
+	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
+	alist[1]      = make_alist("size", DV_INT32, NULL, &end);
+	alist[2]      = make_alist("ignore", DV_FLOAT, NULL, &ignore);
+	alist[3]      = make_alist("start", DV_INT32, NULL, &start);
+	alist[4]      = make_alist("step", DV_INT32, NULL, &step);
+	alist[5].name = NULL;
+
+	if (parse_args(func, arg, alist) == 0) return (NULL);
+
+	if (obj == NULL) {
+		parse_error("%s: No object specified\n", func->name);
+		return (NULL);
+	}
+
+	if (end <= 0) {
+		parse_error("%s: Invalid end value specified\n", func->name);
+		return (NULL);
+	}
+
+	if (start < 0 || start > end || step <= 0) {
+		parse_error("%s: Invalid start or step specified\n", func->name);
+		return (NULL);
+	}
+
+	x = GetX(obj);
+	y = GetY(obj);
+
+	width  = end * 2 + 1;
+	height = end * 2 + 1;
+
+	/* cache some frequently used computed values */
+	h2    = height / 2;
+	w2    = width / 2;
+	total = width * height;
+	nz    = (end - start) / step + 1;
+
+	out          = calloc((size_t)x * (size_t)y * (size_t)nz, sizeof(float));
+	job.distance = calloc(total, sizeof(int));
+	job.accum    = calloc((size_t)dv_num_threads() * (end + 1), sizeof(struct dstore));
+	if (out == NULL || job.distance == NULL || job.accum == NULL) {
+		free(out);
+		free(job.distance);
+		free(job.accum);
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
+	}
+
+	/* precompute the distance of every point in a given sized window
+	** to the center of the window.
+	**
+	** In theory, this only needs to be 1 quadrant of the window, but that's
+	** too hard to bookkeep, and doesn't save much.
+	*/
+	for (i = 0; i < width; i++) {
+		dx = i - w2;
+		for (j = 0; j < height; j++) {
+			dy                          = j - h2;
+			job.distance[i + j * width] = floor(sqrt(dx * dx + dy * dy));
+			/* precheck for values outside the largest circle */
+			if (job.distance[i + j * width] > end) job.distance[i + j * width] = 0;
+		}
 	}
 
-	free_window(w);
-	free(distance);
-	free(accum);
+	job.out    = out;
+	job.plane  = (size_t)x * y;
+	job.x      = x;
+	job.ignore = ignore;
+	job.end    = end;
+	job.start  = start;
+	job.step   = step;
 
-	return (rval);
+	/* run a window over every pixel and do the math */
+	ok = window_tiles(obj, width, height, ignore, radial_symmetry3_tile, &job);
+
+	free(job.distance);
+	free(job.accum);
+
+	if (!ok) {
+		free(out);
+		parse_error("%s: Unable to allocate memory", func->name);
+		return (NULL);
+	}
+	return (newVal(BSQ, x, y, nz, DV_FLOAT, out));
 }
 
 void draw_cross(Var* obj, int x, int y, float ignore, char* out);
@@ -1,40 +1,56 @@
 #include "parser.h"
+#include "rng.h"
 #include <stdlib.h>
 
 /**
  ** This function generates a cube of noise.
  ** The user specifies the X, Y and Z dimensions of the cube.
- ** The noise is generated using a normal distribution function, which
- ** produces a standard deviation of 0.5
+ **
+ ** The uniform, normal and poisson types are counter-based (see rng.h):
+ ** a seed names a stream, and the cube is filled in parallel with the
+ ** same values whatever the number of threads.  The libc types are
+ ** kept as they were, and filled serially.
  **/
 
-float g_random();
-void g_srandom(int);
+/* stream for unseeded calls; each call takes the next dsize values */
+#define RNG_DEFAULT_KEY 0x9E3779B97F4A7C15ULL
+static uint64_t rng_offset = 0;
 
 Var* ff_random(vfuncptr func, Var* arg)
 {
-	int x = 1, y = 1, z = 1, seed = INT_MAX;
-	float* fdata;
+	int x = 1, y = 1, z = 1;
+	int format   = DV_FLOAT;
+	double lambda = 1.0;
+	uint64_t key = RNG_DEFAULT_KEY, first = 0;
+	int seed     = 0;
+	void* data;
 	size_t dsize;
 	size_t i;
-	char* ptr = NULL;
+	char* ptr        = NULL;
+	char* format_str = NULL;
+	double v;
 
-	const char* options[] = {"normal",  "gaussian", "rand",   "random", "mrand48",
-	                         "drand48", "uniform",  "rnoise", NULL};
-	Var* seedvar = NULL;
-	Alist alist[6];
+	const char* options[] = {"normal",  "gaussian", "rand",   "random",  "mrand48",
+	                         "drand48", "uniform",  "rnoise", "poisson", NULL};
+	const char* formats[] = {"float", "double", NULL};
+	Var* seedvar          = NULL;
+	Alist alist[8];
 	alist[0]      = make_alist("x", DV_INT32, NULL, &x);
 	alist[1]      = make_alist("y", DV_INT32, NULL, &y);
 	alist[2]      = make_alist("z", DV_INT32, NULL, &z);
 	alist[3]      = make_alist("seed", ID_VAL, NULL, &seedvar);
 	alist[4]      = make_alist("type", ID_ENUM, options, &ptr);
-	alist[5].name = NULL;
+	alist[5]      = make_alist("format", ID_ENUM, formats, &format_str);
+	alist[6]      = make_alist("lambda", DV_DOUBLE, NULL, &lambda);
+	alist[7].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
 	if (func->fdata != NULL) {
 		if (ptr == NULL) ptr = (char*)func->fdata;
 	}
+	if (ptr == NULL) ptr = "uniform";
+	if (format_str != NULL) format = dv_str_to_format(format_str);
 
 	if (x <= 0) {
 		parse_error("%s(): Invalid value for \"x\"", func->name);
@@ -48,65 +64,58 @@ Var* ff_random(vfuncptr func, Var* arg)
 		parse_error("%s(): Invalid value for \"z\"", func->name);
 		return (NULL);
 	}
-
-	if (seedvar != NULL) seed = extract_int(seedvar, 0);
+	if (lambda < 0) {
+		parse_error("%s(): Invalid value for \"lambda\"", func->name);
+		return (NULL);
+	}
 
 	dsize = (size_t)x * (size_t)y * (size_t)z;
-	fdata = (float*)calloc(dsize, sizeof(float));
+	data  = calloc(dsize, NBYTES(format));
+	if (data == NULL) {
+		parse_error("%s(): Unable to allocate %zu bytes", func->name, dsize * NBYTES(format));
+		return (NULL);
+	}
 
-	if (ptr == NULL || !strcasecmp(ptr, "uniform") || !strcasecmp(ptr, "drand48")) {
-		if (seedvar != NULL) srand48(seed);
-		for (i = 0; i < dsize; i++) {
-			fdata[i] = drand48();
+	if (!strcasecmp(ptr, "uniform") || !strcasecmp(ptr, "normal") || !strncasecmp(ptr, "gauss", 5) ||
+	    !strcasecmp(ptr, "rnoise") || !strcasecmp(ptr, "poisson")) {
+		int dist = RNG_NORMAL;
+		if (!strcasecmp(ptr, "uniform")) dist = RNG_UNIFORM;
+		if (!strcasecmp(ptr, "poisson")) dist = RNG_POISSON;
+
+		if (seedvar != NULL) {
+			key = (uint64_t)extract_i64(seedvar, 0);
+		} else {
+			first = rng_offset;
+			rng_offset += dsize;
 		}
-	} else if (!strcasecmp(ptr, "rand")) {
+		rng_fill(data, format, dsize, dist, lambda, key, first);
+		return (newVal(BSQ, x, y, z, format, data));
+	}
+
+	if (seedvar != NULL) seed = extract_int(seedvar, 0);
+
+	if (!strcasecmp(ptr, "rand")) {
 		if (seedvar != NULL) srand(seed);
 		for (i = 0; i < dsize; i++) {
-			fdata[i] = rand();
+			v = rand();
+			if (format == DV_FLOAT) ((float*)data)[i] = v;
+			else ((double*)data)[i] = v;
 		}
 	} else if (!strcasecmp(ptr, "random")) {
 		if (seedvar != NULL) srandom(seed);
 		for (i = 0; i < dsize; i++) {
-			fdata[i] = random();
+			v = random();
+			if (format == DV_FLOAT) ((float*)data)[i] = v;
+			else ((double*)data)[i] = v;
 		}
-	} else if (!strcasecmp(ptr, "mrand48")) {
+	} else {
+		int mrand = !strcasecmp(ptr, "mrand48");
 		if (seedvar != NULL) srand48(seed);
 		for (i = 0; i < dsize; i++) {
-			fdata[i] = mrand48();
-		}
-	} else if (!strcasecmp(ptr, "normal") || !strncasecmp(ptr, "gauss", 5) ||
-	           !strcasecmp(ptr, "rnoise")) {
-		if (seedvar != NULL) g_srandom(seed);
-		for (i = 0; i < dsize; i++) {
-			fdata[i] = g_random();
+			v = mrand ? mrand48() : drand48();
+			if (format == DV_FLOAT) ((float*)data)[i] = v;
+			else ((double*)data)[i] = v;
 		}
 	}
-	return (newVal(BSQ, x, y, z, DV_FLOAT, fdata));
-}
-
-void g_srandom(int seed)
-{
-	srand48(seed);
-}
-
-float g_random()
-{
-	static int iset = 0;
-	static float gset;
-	float r = 3, fac, v1, v2;
-
-	if (iset == 0) {
-		iset = 1;
-		while (r >= 1) {
-			v1 = 2.0 * drand48() - 1.0;
-			v2 = 2.0 * drand48() - 1.0;
-			r  = v1 * v1 + v2 * v2;
-		}
-		fac  = sqrt(-2.0 * log(r) / r);
-		gset = v1 * fac;
-		return (v2 * fac);
-	} else {
-		iset = 0;
-		return (gset);
-	}
+	return (newVal(BSQ, x, y, z, format, data));
 }
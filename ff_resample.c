@@ -1,9 +1,330 @@
 #include "dvio.h"
 #include "parser.h"
+#include "parallel.h"
+
+/*
+** resample() is linear in the spectrum, so with one old axis for every
+** pixel the whole mapping is worked out once, as a sparse matrix: a run
+** of weights over neighbouring old bands for each new band.  Applying it
+** is then a short dot product per band, done for many pixels in parallel.
+** Cubic weights are the natural spline's response to each old band,
+** dropped where they fall below RSP_TRIM of the largest.
+**
+** Spectra whose spline doesn't span the whole axis (leading and trailing
+** zeros are left out of it), and pixels that have their own old axis, are
+** resampled directly.
+*/
+
+enum { RSP_CUBIC, RSP_LINEAR, RSP_SRF };
+
+#define RSP_TRIM 1e-9
+#define RSP_FWHM_SIGMA 2.3548200450309493 /* fwhm / sigma of a gaussian */
+
+typedef struct spw {
+	size_t* first; /* [m] first old band of each run */
+	size_t* start; /* [m+1] offset of each run in w */
+	double* w;
+} spw;
+
+typedef struct rsp_job {
+	Var* data;
+	Var* xaxis; /* per pixel old axis, or NULL */
+	size_t xi, yi, n, m;
+	size_t ds[3], xs[3]; /* element strides of data and xaxis */
+	const double* x;     /* shared old axis */
+	const double* xnew;
+	const double* fwhm;
+	int type;
+	spw w;           /* shared weights */
+	double* scratch; /* per-thread spectrum, axis and spline buffers */
+	size_t scratch_size;
+	float* out; /* [m][yi][xi] */
+} rsp_job;
+
+static size_t lower_index(const double* x, size_t n, double v)
+{
+	size_t lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (x[mid] < v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* the old samples bracketing v */
+static void bracket(const double* x, size_t n, double v, size_t* lo, size_t* hi)
+{
+	size_t samp_new;
+
+	*hi = n - 1;
+	*lo = 0;
+	while (*hi - *lo > 1) {
+		samp_new = (*hi + *lo) / 2;
+		if (x[samp_new] > v) {
+			*hi = samp_new;
+		} else {
+			*lo = samp_new;
+		}
+	}
+}
+
+/*
+** Natural cubic spline through the knots s-1 .. e, with straight lines
+** between the knots outside that run, evaluated at the m new samples.
+** New samples outside the old axis are 0.  scratch holds 2n doubles.
+*/
+static void spline_eval(const double* x, const double* y, size_t n, size_t s, size_t e, const double* xnew,
+                        size_t m, double* out, double* scratch)
+{
+	double* y2d = scratch; // second derivative array
+	double* u   = scratch + n;
+	double sig, p, h, a, b;
+	double min = x[0], max = x[n - 1];
+	size_t i, lo, hi;
+	long k;
+
+	for (i = 0; i < n; i++) {
+		if (x[i] < min) min = x[i];
+		if (x[i] > max) max = x[i];
+		y2d[i] = u[i] = 0;
+	}
+
+	/* Do the decomposition loop of the tridiagonal algorithm */
+	for (i = s; i + 1 <= e; i++) {
+		sig    = (x[i] - x[i - 1]) / (x[i + 1] - x[i - 1]);
+		p      = sig * y2d[i - 1] + 2.;
+		y2d[i] = (sig - 1.) / p;
+		if (x[i + 1] - x[i] != 0) {
+			u[i] = (y[i + 1] - y[i]) / (x[i + 1] - x[i]);
+		}
+		if (x[i] - x[i - 1] != 0) {
+			u[i] = u[i] - (y[i] - y[i - 1]) / (x[i] - x[i - 1]);
+		}
+		if (x[i + 1] - x[i - 1] != 0) {
+			u[i] = (6. * u[i] / (x[i + 1] - x[i - 1]) - sig * u[i - 1]) / p;
+		}
+	}
+	for (k = (long)e - 1; k >= (long)s; k--) {
+		y2d[k] = y2d[k] * y2d[k + 1] + u[k];
+	}
+
+	for (i = 0; i < m; i++) {
+		out[i] = 0;
+		if (xnew[i] > max || xnew[i] < min) continue;
+
+		bracket(x, n, xnew[i], &lo, &hi);
+		h      = x[hi] - x[lo];
+		a      = (x[hi] - xnew[i]) / h;
+		b      = (xnew[i] - x[lo]) / h;
+		out[i] = a * y[lo] + b * y[hi] + ((a * a * a - a) * y2d[lo] + (b * b * b - b) * y2d[hi]) * (h * h) / 6.;
+	}
+}
+
+/* weights of the old samples that make up new sample c; returns how many */
+static size_t linear_taps(const double* x, size_t n, double c, size_t* first, double* w)
+{
+	size_t lo, hi;
+	double h;
+
+	if (c < x[0] || c > x[n - 1]) return 0;
+
+	bracket(x, n, c, &lo, &hi);
+	h      = x[hi] - x[lo];
+	*first = lo;
+	w[0]   = h != 0 ? (x[hi] - c) / h : 1;
+	w[1]   = h != 0 ? (c - x[lo]) / h : 0;
+	return 2;
+}
+
+/* gaussian response of the given fwhm, over the old samples' widths */
+static size_t srf_taps(const double* x, size_t n, double c, double fwhm, size_t* first, double* w)
+{
+	double sigma = fwhm / RSP_FWHM_SIGMA;
+	double d, width, sum = 0;
+	size_t lo, hi, j;
+
+	if (c < x[0] || c > x[n - 1]) return 0;
+
+	lo = lower_index(x, n, c - 3 * sigma);
+	hi = lower_index(x, n, c + 3 * sigma + DBL_EPSILON * fabs(c));
+	if (hi > n) hi = n;
+	if (!(sigma > 0) || hi < lo + 2) return linear_taps(x, n, c, first, w);
+
+	for (j = lo; j < hi; j++) {
+		width = x[j + 1 < n ? j + 1 : j] - x[j > 0 ? j - 1 : j];
+		if (j > 0 && j + 1 < n) width /= 2;
+		d          = (x[j] - c) / sigma;
+		w[j - lo]  = exp(-0.5 * d * d) * width;
+		sum       += w[j - lo];
+	}
+	if (sum <= 0) return linear_taps(x, n, c, first, w);
+	for (j = lo; j < hi; j++) w[j - lo] /= sum;
+
+	*first = lo;
+	return hi - lo;
+}
+
+static void spw_free(spw* w)
+{
+	free(w->first);
+	free(w->start);
+	free(w->w);
+}
+
+typedef struct impulse_job {
+	const double* x;
+	const double* xnew;
+	size_t n, m;
+	double* dense; /* [m][n] */
+	double* scratch;
+} impulse_job;
+
+/* column k of the cubic weights is the spline through a unit impulse at k */
+static void impulse_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	impulse_job* job = (impulse_job*)ctx;
+	double* y        = job->scratch + tid * (4 * job->n + job->m);
+	double* col      = y + job->n;
+	double* tmp      = col + job->m;
+	size_t i, k;
+
+	memset(y, 0, job->n * sizeof(double));
+	for (k = begin; k < end; k++) {
+		y[k] = 1;
+		spline_eval(job->x, y, job->n, 1, job->n - 1, job->xnew, job->m, col, tmp);
+		y[k] = 0;
+		for (i = 0; i < job->m; i++) job->dense[i * job->n + k] = col[i];
+	}
+}
+
+/* the sparse weights for a shared old axis; 0 if out of memory */
+static int spw_build(spw* sw, int type, const double* x, size_t n, const double* xnew, const double* fwhm,
+                     size_t m)
+{
+	impulse_job ij;
+	double *dense = NULL, *row, big;
+	size_t i, j, first, count, lo, hi;
+	int nthreads;
+
+	memset(sw, 0, sizeof(*sw));
+	sw->first = calloc(m, sizeof(size_t));
+	sw->start = calloc(m + 1, sizeof(size_t));
+	sw->w     = calloc(m * n + 1, sizeof(double));
+	if (sw->first == NULL || sw->start == NULL || sw->w == NULL) goto nomem;
+
+	if (type == RSP_CUBIC) {
+		if ((dense = calloc(m * n, sizeof(double))) == NULL) goto nomem;
+
+		nthreads = dv_parallel_chunks(n, 8);
+		ij.x     = x;
+		ij.xnew  = xnew;
+		ij.n     = n;
+		ij.m     = m;
+		ij.dense = dense;
+		if ((ij.scratch = calloc(nthreads * (4 * n + m), sizeof(double))) == NULL) goto nomem;
+		dv_parallel_for(n, 8, impulse_kernel, &ij);
+		free(ij.scratch);
+	}
+
+	for (i = 0; i < m; i++) {
+		row = sw->w + sw->start[i];
+		if (type == RSP_CUBIC) {
+			big = 0;
+			for (j = 0; j < n; j++) big = max(big, fabs(dense[i * n + j]));
+			for (lo = 0; lo < n && fabs(dense[i * n + lo]) <= RSP_TRIM * big; lo++)
+				;
+			for (hi = n; hi > lo && fabs(dense[i * n + hi - 1]) <= RSP_TRIM * big; hi--)
+				;
+			first = lo;
+			count = hi - lo;
+			memcpy(row, dense + i * n + lo, count * sizeof(double));
+		} else if (type == RSP_LINEAR) {
+			count = linear_taps(x, n, xnew[i], &first, row);
+		} else {
+			count = srf_taps(x, n, xnew[i], fwhm[i], &first, row);
+		}
+		sw->first[i]     = count ? first : 0;
+		sw->start[i + 1] = sw->start[i] + count;
+	}
+	free(dense);
+	return 1;
+
+nomem:
+	free(dense);
+	spw_free(sw);
+	return 0;
+}
+
+static void rsp_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	rsp_job* job = (rsp_job*)ctx;
+	size_t n = job->n, m = job->m, plane = job->xi * job->yi;
+	double* y   = job->scratch + tid * job->scratch_size;
+	double* x   = y + n;
+	double* out = x + n;
+	double* tmp = out + m;
+	const double* w;
+	size_t p, i, j, k, t, s, e, first, count, base;
+	double v;
+
+	for (p = begin; p < end; p++) {
+		i    = p % job->xi;
+		j    = p / job->xi;
+		base = i * job->ds[0] + j * job->ds[1];
+		for (k = 0; k < n; k++) y[k] = extract_double(job->data, base + k * job->ds[2]);
+
+		if (job->xaxis == NULL) {
+			s = e = 0;
+			if (job->type == RSP_CUBIC) {
+				/* leading and trailing zeros aren't part of the spline */
+				for (s = 1; s < n && y[s] == 0; s++)
+					;
+				for (e = n - 1; e > 0 && y[e] == 0; e--)
+					;
+			}
+			if (job->type != RSP_CUBIC || (s == 1 && e == n - 1)) {
+				for (k = 0; k < m; k++) {
+					w     = job->w.w + job->w.start[k];
+					count = job->w.start[k + 1] - job->w.start[k];
+					first = job->w.first[k];
+					v     = 0;
+					for (t = 0; t < count; t++) v += w[t] * y[first + t];
+					job->out[k * plane + p] = v;
+				}
+				continue;
+			}
+			spline_eval(job->x, y, n, s, e, job->xnew, m, out, tmp);
+		} else {
+			base = i * job->xs[0] + j * job->xs[1];
+			for (k = 0; k < n; k++) x[k] = extract_double(job->xaxis, base + k * job->xs[2]);
+
+			if (job->type == RSP_CUBIC) {
+				for (s = 1; s < n && y[s] == 0; s++)
+					;
+				for (e = n - 1; e > 0 && y[e] == 0; e--)
+					;
+				spline_eval(x, y, n, s, e, job->xnew, m, out, tmp);
+			} else {
+				for (k = 0; k < m; k++) {
+					if (job->type == RSP_LINEAR) {
+						count = linear_taps(x, n, job->xnew[k], &first, tmp);
+					} else {
+						count = srf_taps(x, n, job->xnew[k], job->fwhm[k], &first, tmp);
+					}
+					out[k] = 0;
+					for (t = 0; t < count; t++) out[k] += tmp[t] * y[first + t];
+				}
+			}
+		}
+		for (k = 0; k < m; k++) job->out[k * plane + p] = out[k];
+	}
+}
 
-static float* do_resample(float* y, float* xold, float* xnew, int npts, int new_npts);
-static int extract_zline_float(int i, int j, Var* inarray, float* outarray);
-static int replace_zline_float(int i, int j, int z, int xi, int yi, float* subarray, float* outarray);
 Var* ff_resample(vfuncptr func, Var* arg)
 {
 
@@ -11,33 +332,49 @@ Var* ff_resample(vfuncptr func, Var* arg)
 	Var* oldx_var     = NULL; // old x
 	Var* oldy_var     = NULL; // old y
 	Var* newx_var     = NULL; // new x
+	Var* fwhm_var     = NULL; // band pass widths
 	float* newy_float = NULL; // new y array
 
 	Var* out     = NULL; // output array
 	Var* v_label = NULL; // label var
 	Var** av;            // argument values
 	Var* st = NULL;      // structure
-	Alist alist[4];      // argument list
-	int ac;              // argument count
+	Alist alist[6];      // argument list
+	int ac, n;           // argument counts
 
 	// arrays and indices
-	Var* label        = NULL; // label char
-	float* oldx_float = NULL; // old x array
-	float* newx_float = NULL; // old y array
-	float* newy_tmp   = NULL;
-	float* oldy_tmp   = NULL;
-	int i, j, k, npts, new_npts; // indices and sizes
-	int xi, yi;                  // dimensions
+	Var* label          = NULL; // label char
+	float* oldx_float   = NULL; // old x array
+	float* newx_float   = NULL; // old y array
+	double* oldx_double = NULL;
+	double* newx_double = NULL;
+	double* fwhm        = NULL;
+	size_t i, k, npts, new_npts; // indices and sizes
+	size_t xi, yi;               // dimensions
 	int l_type = 0;              // label type (sample_name or label)
+	char* type          = NULL;
+	const char* types[] = {"cubic", "linear", "srf", NULL};
+	rsp_job job;
+	int nthreads;
 
 	/*input handing....yuck*/
 	make_args(&ac, &av, func, arg);
+	n = ac;
 	ac = ac - 1;
+	for (i = 1; i < (size_t)n; i++) {
+		if (V_TYPE(av[i]) == ID_KEYWORD && V_NAME(av[i]) != NULL &&
+		    (!strcmp(V_NAME(av[i]), "type") || !strcmp(V_NAME(av[i]), "fwhm"))) {
+			ac--;
+		}
+	}
+	free(av);
 
 	if (ac == 2) {
 		alist[0]      = make_alist("object", ID_STRUCT, NULL, &st);
 		alist[1]      = make_alist("newx", ID_VAL, NULL, &newx_var);
-		alist[2].name = NULL;
+		alist[2]      = make_alist("type", ID_ENUM, types, &type);
+		alist[3]      = make_alist("fwhm", ID_VAL, NULL, &fwhm_var);
+		alist[4].name = NULL;
 		if (parse_args(func, arg, alist) == 0) return (NULL);
 
 		find_struct(st, "data", &oldy_var);
@@ -62,18 +399,16 @@ Var* ff_resample(vfuncptr func, Var* arg)
 			return (NULL);
 		}
 
-		label = V_DUP(v_label);
-
 	} else if (ac == 3) {
 		alist[0]      = make_alist("oldy", ID_VAL, NULL, &oldy_var);
 		alist[1]      = make_alist("oldx", ID_VAL, NULL, &oldx_var);
 		alist[2]      = make_alist("newx", ID_VAL, NULL, &newx_var);
-		alist[3].name = NULL;
+		alist[3]      = make_alist("type", ID_ENUM, types, &type);
+		alist[4]      = make_alist("fwhm", ID_VAL, NULL, &fwhm_var);
+		alist[5].name = NULL;
 
 		if (parse_args(func, arg, alist) == 0) return (NULL);
 
-		label = newString(strdup("(null)"));
-
 	} else {
 		printf("\n resample() - 12/1/2007\n");
 		printf(" Resample a spectrum to a given scale using cubic spline interpolation \n");
@@ -81,83 +416,108 @@ Var* ff_resample(vfuncptr func, Var* arg)
 		    " Takes a one dimensional xaxis, and upto a 3d data cube with bands in the "
 		    "z-direction\n");
 		printf(" oldy = spectrum to be resampled \n");
-		printf(" oldx = old scale \n");
+		printf(" oldx = old scale, or one for each spectrum \n");
 		printf(" newx = new scale \n");
 		printf("\nOR\n\n");
 		printf(" object = standard spectral structure with .data, .xaxis, .label \n");
 		printf(" newx = new scale \n");
+		printf("\n type = 'cubic' (default), 'linear' or 'srf' (gaussian band passes)\n");
+		printf(" fwhm = band pass widths for 'srf', one or one per new band\n");
+		printf("        (default is the new band spacing)\n");
 		printf(" \n");
 		printf(" c.edwards\n\n");
 		return (NULL);
 	}
 
-	/* get dimensions of arrays and allocate memory*/
+	if (oldy_var == NULL || oldx_var == NULL || newx_var == NULL) {
+		parse_error("%s: oldy, oldx and newx are required", func->name);
+		return (NULL);
+	}
+
+	/* get dimensions of arrays */
 	xi       = GetX(oldy_var);
 	yi       = GetY(oldy_var);
 	npts     = GetZ(oldx_var);
 	new_npts = GetZ(newx_var);
 
-	/* allocate memory for the input data */
-	oldx_float = (float*)calloc(sizeof(float), npts);
-	newx_float = (float*)calloc(sizeof(float), new_npts);
-
-	/* allocate memory for the temporart arrays */
-	oldy_tmp = (float*)calloc(sizeof(float), npts);
-	newy_tmp = (float*)calloc(sizeof(float), new_npts);
-
-	/* allocate memory for the output data */
-	newy_float = (float*)calloc(sizeof(float), xi * yi * new_npts);
-
 	if (GetZ(oldx_var) != GetZ(oldy_var)) {
-
-		free(oldx_float);
-		free(newx_float);
-		free(oldy_tmp);
-		free(newy_tmp);
 		parse_error("data and old scale must have same z size");
 		return (NULL);
 	}
 
-	if (GetX(oldx_var) > 1 || GetY(oldx_var) > 1 || GetZ(oldx_var) == 1) {
-
-		free(oldx_float);
-		free(newx_float);
-		free(oldy_tmp);
-		free(newy_tmp);
-
+	if (!(GetX(oldx_var) == 1 && GetY(oldx_var) == 1) && !(GetX(oldx_var) == xi && GetY(oldx_var) == yi)) {
+		parse_error("Not a valid old scale.  It must be one spectrum, or one for each pixel");
+		return (NULL);
+	}
+	if (GetZ(oldx_var) == 1) {
 		parse_error("Not a valid old scale.  Data must be in z direction");
 		return (NULL);
 	}
 	if (GetX(newx_var) > 1 || GetY(newx_var) > 1 || GetZ(newx_var) == 1) {
-		free(oldx_float);
-		free(newx_float);
-		free(oldy_tmp);
-		free(newy_tmp);
-
 		parse_error("Not a valid new scale.  Data must be in z direction");
 		return (NULL);
 	}
+	if (fwhm_var != NULL && V_DSIZE(fwhm_var) != 1 && V_DSIZE(fwhm_var) != new_npts) {
+		parse_error("%s: fwhm must have one value, or one for each new band", func->name);
+		return (NULL);
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.type = RSP_CUBIC;
+	if (type != NULL && !strcasecmp(type, "linear")) job.type = RSP_LINEAR;
+	if (type != NULL && !strcasecmp(type, "srf")) job.type = RSP_SRF;
+
+	if (l_type == 0 && st == NULL) {
+		label = newString(strdup("(null)"));
+	} else {
+		label = V_DUP(v_label);
+	}
+
+	/* allocate memory for the input and output data */
+	oldx_float  = (float*)calloc(sizeof(float), npts);
+	newx_float  = (float*)calloc(sizeof(float), new_npts);
+	oldx_double = (double*)calloc(sizeof(double), npts);
+	newx_double = (double*)calloc(sizeof(double), new_npts);
+	fwhm        = (double*)calloc(sizeof(double), new_npts);
+	newy_float  = (float*)calloc(sizeof(float), xi * yi * max(new_npts, npts) + 1);
+	if (oldx_float == NULL || newx_float == NULL || oldx_double == NULL || newx_double == NULL ||
+	    fwhm == NULL || newy_float == NULL) {
+		parse_error("%s: unable to allocate memory", func->name);
+		goto fail;
+	}
 
 	// extract oldx
 	for (k = 0; k < npts; k++) {
-		oldx_float[k] = extract_float(oldx_var, cpos(0, 0, k, oldx_var));
+		oldx_double[k] = extract_double(oldx_var, cpos(0, 0, k, oldx_var));
+		oldx_float[k]  = oldx_double[k];
 	}
 
 	// extract newx
 	for (i = 0; i < new_npts; i++) {
-		newx_float[i] = extract_float(newx_var, cpos(0, 0, i, newx_var));
+		newx_double[i] = extract_double(newx_var, cpos(0, 0, i, newx_var));
+		newx_float[i]  = newx_double[i];
+	}
+
+	// band pass widths default to the new band spacing
+	for (i = 0; i < new_npts; i++) {
+		if (fwhm_var != NULL) {
+			fwhm[i] = extract_double(fwhm_var, V_DSIZE(fwhm_var) == 1 ? 0 : i);
+		} else {
+			fwhm[i] = newx_double[i + 1 < new_npts ? i + 1 : i] - newx_double[i > 0 ? i - 1 : i];
+			if (i > 0 && i + 1 < new_npts) fwhm[i] /= 2;
+		}
 	}
 
-	if (npts == new_npts) {
+	if (npts == new_npts && GetX(oldx_var) == 1 && GetY(oldx_var) == 1) {
 		if (memcmp(newx_float, oldx_float, sizeof(float) * npts) == 0) {
 			parse_error("Axis are the same, no need for resample");
-			// free stuff (check to make sure this is all)
-			free(newx_float);
-			free(oldy_tmp);
-			free(newy_tmp);
 			for (i = 0; i < xi * yi * npts; i += 1) {
-				newy_float[i] = extract_float(oldy_var, i);
+				newy_float[i] = extract_float(oldy_var, cpos(i % xi, (i / xi) % yi, i / (xi * yi), oldy_var));
 			}
+			free(newx_float);
+			free(oldx_double);
+			free(newx_double);
+			free(fwhm);
 
 			/* create the output structure */
 			out = new_struct(3);
@@ -174,19 +534,45 @@ Var* ff_resample(vfuncptr func, Var* arg)
 		}
 	}
 
-	// make copies of each array section and then resample and replace in to proper output array
-	for (i = 0; i < xi; i += 1) {
-		for (j = 0; j < yi; j += 1) {
-			extract_zline_float(i, j, oldy_var, oldy_tmp);
-			newy_tmp = do_resample(oldy_tmp, oldx_float, newx_float, npts, new_npts);
-			replace_zline_float(i, j, new_npts, xi, yi, newy_tmp, newy_float);
+	job.data = oldy_var;
+	job.xi   = xi;
+	job.yi   = yi;
+	job.n    = npts;
+	job.m    = new_npts;
+	job.x    = oldx_double;
+	job.xnew = newx_double;
+	job.fwhm = fwhm;
+	job.out  = newy_float;
+	cstrides(oldy_var, job.ds);
+
+	if (GetX(oldx_var) == 1 && GetY(oldx_var) == 1) {
+		if (!spw_build(&job.w, job.type, oldx_double, npts, newx_double, fwhm, new_npts)) {
+			parse_error("%s: unable to allocate memory", func->name);
+			goto fail;
 		}
+	} else {
+		job.xaxis = oldx_var;
+		cstrides(oldx_var, job.xs);
 	}
 
-	// free stuff (check to make sure this is all)
-	free(oldy_tmp);
-	free(newy_tmp);
+	// each thread keeps a spectrum, an old axis, a new spectrum and spline space
+	job.scratch_size = 2 * npts + new_npts + max(2 * npts, npts + new_npts);
+	nthreads         = dv_parallel_chunks(xi * yi, 64);
+	job.scratch      = (double*)calloc(nthreads * job.scratch_size + 1, sizeof(double));
+	if (job.scratch == NULL) {
+		spw_free(&job.w);
+		parse_error("%s: unable to allocate memory", func->name);
+		goto fail;
+	}
+
+	dv_parallel_for(xi * yi, 64, rsp_kernel, &job);
+
+	free(job.scratch);
+	spw_free(&job.w);
 	free(oldx_float);
+	free(oldx_double);
+	free(newx_double);
+	free(fwhm);
 
 	/* create the output structure */
 	out = new_struct(3);
@@ -201,122 +587,14 @@ Var* ff_resample(vfuncptr func, Var* arg)
 	add_struct(out, "xaxis", newVal(BSQ, 1, 1, new_npts, DV_FLOAT, newx_float));
 
 	return (out);
-}
-
-static int extract_zline_float(int i, int j, Var* inarray, float* outarray)
-{
-
-	int k;
-
-	if (i < 0 || j < 0 || i > GetX(inarray) || j > GetY(inarray)) return (1);
-	for (k = 0; k < GetZ(inarray); k++) {
-		outarray[k] = extract_float(inarray, cpos(i, j, k, inarray));
-	}
-	return (0);
-}
-
-static int replace_zline_float(int i, int j, int z, int xi, int yi, float* subarray, float* outarray)
-{
-
-	int k;
-
-	if (i < 0 || j < 0) return (1);
-	for (k = 0; k < z; k++) {
-		outarray[k * xi * yi + xi * j + i] = subarray[k];
-	}
-	return (0);
-}
-
-static float* do_resample(float* y, float* xold, float* xnew, int npts, int new_npts)
-{
-
-	float* ynew = NULL;             // new y array
-	float* y2d  = NULL;             // second derivative array
-	float* u    = NULL;             // u array
-	int start_count, stop_count;    // stop and start locations
-	float sig, p, h, a, b;          // cubic spline variables
-	int samp_hi, samp_lo, samp_new; // hi,lo,new samples
-	float min = 0, max = 0;         // min and max values
-	int i;
-
-	y2d = (float*)calloc(sizeof(float), npts);
-	u   = (float*)calloc(sizeof(float), npts - 1);
-
-	/*set boundary spline conditions; Second derivative is 0. */
-	min = xold[0];
-	max = xold[npts - 1];
-	for (i = 0; i < npts; i++) {
-		if (xold[i] < min) {
-			min = xold[i];
-		}
-		if (xold[i] > max) {
-			max = xold[i];
-		}
-		y2d[i] = y[i] - y[i];
-		if (i < npts - 1) {
-			u[i] = y2d[i];
-		}
-	}
-
-	/*Set start and end points in case many values are zeroed.*/
-	start_count = 1;
-	while (y[start_count] == 0. && start_count <= npts) {
-		start_count = start_count + 1;
-	}
-	stop_count = npts;
-	while (y[stop_count] == 0. && stop_count >= 1) {
-		stop_count = stop_count - 1;
-	}
 
-	/* Do the decomposition loop of the tridiagonal algorithm */
-	for (i = (start_count); i <= (stop_count - 1); i += 1) {
-		sig    = (xold[i] - xold[(i - 1)]) / (xold[(i + 1)] - xold[(i - 1)]);
-		p      = sig * y2d[(i - 1)] + 2.;
-		y2d[i] = (sig - 1.) / p;
-		if (xold[(i + 1)] - xold[i] != 0) {
-			u[i] = (y[(i + 1)] - y[i]) / (xold[(i + 1)] - xold[i]);
-		}
-		if (xold[i] - xold[(i - 1)] != 0) {
-			u[i] = u[i] - (y[i] - y[(i - 1)]) / (xold[i] - xold[(i - 1)]);
-		}
-		if (xold[(i + 1)] - xold[(i - 1)] != 0) {
-			u[i] = (6. * u[i] / (xold[(i + 1)] - xold[(i - 1)]) - sig * u[(i - 1)]) / p;
-		}
-	}
-
-	for (i = (stop_count - 1); i >= start_count; i -= 1) {
-		y2d[i] = y2d[i] * y2d[(i + 1)] + u[i];
-	}
-
-	/* Now that we have the second derivative //
-	// we can evaluate our y with respect to the new xaxis //
-	// get the size of the new xaxis and alloate the memory */
-	ynew = (float*)calloc(sizeof(float), new_npts);
-	for (i = 0; i < new_npts; i += 1) {
-		samp_hi = npts - 1;
-		samp_lo = 0;
-		while (samp_hi - samp_lo > 1) {
-			samp_new = (samp_hi + samp_lo) / 2;
-			if (xold[samp_new] > xnew[i]) {
-				samp_hi = samp_new;
-			}
-			if (xold[samp_new] <= xnew[i]) {
-				samp_lo = samp_new;
-			}
-		}
-		h = xold[samp_hi] - xold[samp_lo];
-		a = (xold[samp_hi] - xnew[i]) / h;
-		b = (xnew[i] - xold[samp_lo]) / h;
-		if (xnew[i] <= max && xnew[i] >= min) {
-			ynew[i] = a * y[samp_lo] + b * y[samp_hi] +
-			          ((a * a * a - a) * y2d[samp_lo] + (b * b * b - b) * y2d[samp_hi]) * (h * h) / 6.;
-		}
-	}
-	if (xnew[0] == xold[0]) {
-		ynew[0] = y[0];
-	}
-
-	free(y2d);
-	free(u);
-	return (ynew);
+fail:
+	free(oldx_float);
+	free(newx_float);
+	free(oldx_double);
+	free(newx_double);
+	free(fwhm);
+	free(newy_float);
+	if (label != NULL && mem_claim(label)) free_var(label);
+	return (NULL);
 }
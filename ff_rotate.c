@@ -1,8 +1,10 @@
 #include "parser.h"
+#include "resample.h"
 #include <math.h>
 
 static int rot_round(float numf);
 static Var* rotation(Var* obj, float angle, float ign);
+static Var* rotation_resample(Var* obj, float angle, float ign, int kernel);
 
 Var* ff_rotation(vfuncptr func, Var* arg)
 {
@@ -11,12 +13,15 @@ Var* ff_rotation(vfuncptr func, Var* arg)
 	Var* out    = NULL;
 	float ign   = 0.0;
 	float angle = 0.0;
+	char* interp          = NULL;
+	const char* options[] = {"nearest", "bilinear", "bicubic", "lanczos", NULL};
 
-	Alist alist[4];
+	Alist alist[5];
 	alist[0]      = make_alist("object", ID_VAL, NULL, &obj);
 	alist[1]      = make_alist("angle", DV_FLOAT, NULL, &angle);
 	alist[2]      = make_alist("ignore", DV_FLOAT, NULL, &ign);
-	alist[3].name = NULL;
+	alist[3]      = make_alist("interp", ID_ENUM, options, &interp);
+	alist[4].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return NULL;
 
@@ -25,10 +30,71 @@ Var* ff_rotation(vfuncptr func, Var* arg)
 		return NULL;
 	}
 
-	out = rotation(obj, angle, ign);
+	/* without interp the pixels are moved, not resampled */
+	if (interp == NULL) {
+		out = rotation(obj, angle, ign);
+	} else {
+		out = rotation_resample(obj, angle, ign, rs_kernel(interp));
+		if (out == NULL) parse_error("%s: unable to allocate memory", func->name);
+	}
 	return (out);
 }
 
+/*
+** Rotate by resampling with rs_warp().  Pixel (x,y) of the input goes to
+** (x cos + y sin, -x sin + y cos), as in the three-shear rotation(); the
+** output just covers the rotated centers of the corner pixels.
+*/
+static Var* rotation_resample(Var* obj, float angle, float ign, int kernel)
+{
+	double x = GetX(obj) - 1, y = GetY(obj) - 1;
+	double ang = angle * M_PI / 180.0;
+	double c = cos(ang), s = sin(ang);
+	double px[4], py[4], xmin, xmax, ymin, ymax;
+	double m[9];
+	int i;
+
+	/* keep exact right angles exact */
+	if (fabs(c) < 1e-12) c = 0;
+	if (fabs(s) < 1e-12) s = 0;
+
+	px[0] = 0;
+	py[0] = 0;
+	px[1] = x * c;
+	py[1] = -x * s;
+	px[2] = y * s;
+	py[2] = y * c;
+	px[3] = x * c + y * s;
+	py[3] = -x * s + y * c;
+
+	xmin = xmax = px[0];
+	ymin = ymax = py[0];
+	for (i = 1; i < 4; i++) {
+		xmin = min(xmin, px[i]);
+		xmax = max(xmax, px[i]);
+		ymin = min(ymin, py[i]);
+		ymax = max(ymax, py[i]);
+	}
+	xmin = floor(xmin + 0.5);
+	xmax = floor(xmax + 0.5);
+	ymin = floor(ymin + 0.5);
+	ymax = floor(ymax + 0.5);
+
+	/* output pixel centers back onto the input */
+	m[0] = c;
+	m[1] = s;
+	m[2] = 0;
+	m[3] = -s;
+	m[4] = c;
+	m[5] = 0;
+	m[6] = (xmin - 0.5) * c - (ymin - 0.5) * s + 0.5;
+	m[7] = (xmin - 0.5) * s + (ymin - 0.5) * c + 0.5;
+	m[8] = 1;
+
+	return rs_warp(obj, m, 0, 0, (size_t)(xmax - xmin) + 1, (size_t)(ymax - ymin) + 1, kernel, ign,
+	               V_FORMAT(obj));
+}
+
 union DATA {
 	char b;
 	short s;
@@ -1,4 +1,6 @@
 #include "parser.h"
+#include "parallel.h"
+#include "textout.h"
 #include <regex.h>
 
 #if defined(HAVE_LIBGEN_H) && !defined(_AIX)
@@ -25,6 +27,96 @@ Var* newText(int rows, char** text)
 	return (v);
 }
 
+/**
+ ** TextStore: the rows of a TEXT array in one block of chars.
+ **
+ ** A store is shared by reference count: V_DUP() and whole-row subsets
+ ** of a stored array take a reference instead of copying every row, and
+ ** text_unshare() gives an array its own, separately malloc()ed rows
+ ** before anything changes them.  The char** in V_TEXT() stays valid
+ ** either way, so code that only reads rows doesn't need to know.
+ **/
+
+/* a store with room for rows rows and nchars chars, or NULL */
+TextStore* new_text_store(int rows, size_t nchars)
+{
+	TextStore* s = (TextStore*)calloc(1, sizeof(TextStore));
+
+	if (s == NULL) return (NULL);
+	s->refs  = 1;
+	s->chars = (char*)malloc(nchars ? nchars : 1);
+	s->rows  = (char**)malloc((rows ? rows : 1) * sizeof(char*));
+	if (s->chars == NULL || s->rows == NULL) {
+		text_store_release(s);
+		return (NULL);
+	}
+	return (s);
+}
+
+/* a store holding a copy of text, or NULL */
+TextStore* text_store_copy(char** text, int rows)
+{
+	TextStore* s;
+	size_t nchars = 0, len;
+	char* p;
+	int i;
+
+	for (i = 0; i < rows; i++) {
+		nchars += strlen(text[i]) + 1;
+	}
+	if ((s = new_text_store(rows, nchars)) == NULL) return (NULL);
+
+	for (p = s->chars, i = 0; i < rows; i++) {
+		len        = strlen(text[i]) + 1;
+		s->rows[i] = memcpy(p, text[i], len);
+		p += len;
+	}
+	return (s);
+}
+
+void text_store_release(TextStore* s)
+{
+	if (s == NULL || --s->refs > 0) return;
+	free(s->chars);
+	free(s->rows);
+	free(s);
+}
+
+/* a TEXT of rows [row, row+rows) of s, which takes over a reference to s */
+Var* newTextView(TextStore* s, int row, int rows)
+{
+	Var* v          = newText(rows, s->rows + row);
+	V_TEXT(v).store = s;
+	return (v);
+}
+
+/*
+** Give v rows of its own, malloc()ed one by one, so they can be freed or
+** replaced.  Returns 0 if memory runs out, leaving v as it was.
+*/
+int text_unshare(Var* v)
+{
+	char** text;
+	int i;
+
+	if (V_TEXT(v).store == NULL) return (1);
+
+	if ((text = (char**)calloc(V_TEXT(v).Row ? V_TEXT(v).Row : 1, sizeof(char*))) == NULL) {
+		return (0);
+	}
+	for (i = 0; i < V_TEXT(v).Row; i++) {
+		if ((text[i] = strdup(V_TEXT(v).text[i])) == NULL) {
+			while (i) free(text[--i]);
+			free(text);
+			return (0);
+		}
+	}
+	text_store_release(V_TEXT(v).store);
+	V_TEXT(v).store = NULL;
+	V_TEXT(v).text  = text;
+	return (1);
+}
+
 /**
  ** read a text file into DV_UINT8 data
  **/
@@ -99,16 +191,17 @@ Var* ff_read_lines(vfuncptr func, Var* arg)
 	char* filename = NULL;
 	char* fname    = NULL;
 	FILE* fp       = NULL;
-	char* ptr      = NULL;
-	int rlen;
-	char** t = NULL;
-	int size;
+	char *buf, *p, *end, *nl;
+	size_t len, size, n;
+	TextStore* s;
 	Var* o = NULL;
 	int count;
+	int cache = 0;
 
-	Alist alist[2];
+	Alist alist[3];
 	alist[0]      = make_alist("filename", ID_STRING, NULL, &filename);
-	alist[1].name = NULL;
+	alist[1]      = make_alist("cache", DV_INT32, NULL, &cache);
+	alist[2].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -122,39 +215,72 @@ Var* ff_read_lines(vfuncptr func, Var* arg)
 		parse_error(NULL);
 		return (NULL);
 	}
+	if (cache && (o = dv_tcache_load(fname, "read_lines", "")) != NULL) {
+		free(fname);
+		return (o);
+	}
 	if ((fp = fopen(fname, "rb")) == NULL) {
 		sprintf(error_buf, "Cannot open file: %s\n", fname);
 		parse_error(NULL);
 		return (NULL);
 	}
 
-	count = 0;
-	size  = 64;
-	t     = calloc(size, sizeof(char*));
-
-	while ((rlen = dv_getline(&ptr, fp)) != EOF) {
-		if (ptr[rlen - 1] == '\n') ptr[rlen - 1] = '\0';
-		if (ptr[rlen - 2] == '\r') ptr[rlen - 2] = '\0';
-
-		if (size == count) {
-			t = realloc(t, size * 2 * sizeof(char*));
+	/*
+	** The whole file goes into one block, which is split into rows in
+	** place (a \r before a \n is dropped) and becomes the chars of the
+	** TEXT's store.
+	*/
+	len  = 0;
+	size = 65536;
+	buf  = (char*)malloc(size + 1);
+	while (buf != NULL && (n = fread(buf + len, 1, size - len, fp)) > 0) {
+		len += n;
+		if (len == size) {
 			size *= 2;
+			if ((p = (char*)realloc(buf, size + 1)) == NULL) free(buf);
+			buf = p;
 		}
-		t[count++] = strdup(ptr);
 	}
 	fclose(fp);
+	if (buf == NULL) {
+		parse_error("%s: Unable to alloc %zu bytes", func->name, size + 1);
+		free(fname);
+		return (NULL);
+	}
+	buf[len] = '\0';
+
+	count = 0;
+	for (p = buf, end = buf + len; p < end && (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1) {
+		count++;
+	}
+	if (p < end) count++;
 
-	t = realloc(t, count * sizeof(char*));
+	if ((s = (TextStore*)calloc(1, sizeof(TextStore))) == NULL ||
+	    (s->rows = (char**)malloc((count ? count : 1) * sizeof(char*))) == NULL) {
+		free(s);
+		free(buf);
+		parse_error("%s: Unable to alloc %zu bytes", func->name, count * sizeof(char*));
+		free(fname);
+		return (NULL);
+	}
+	s->refs  = 1;
+	s->chars = buf;
+
+	for (count = 0, p = buf; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL) nl = end;
+		*nl = '\0';
+		if (nl > p && nl[-1] == '\r') nl[-1] = '\0';
+		s->rows[count++] = p;
+	}
 
-	o              = newVar();
-	V_TEXT(o).Row  = count;
-	V_TEXT(o).text = t;
+	o = newTextView(s, 0, count);
 
 	if (VERBOSE > 1) {
 		fprintf(stderr, "Read TEXT file: %d lines\n", count);
 	}
 
-	V_TYPE(o) = ID_TEXT;
+	if (cache) dv_tcache_save(fname, "read_lines", "", o);
+	free(fname);
 
 	return (o);
 }
@@ -331,6 +457,25 @@ Var* textarray_subset(Var* v, Var* range)
 		return (NULL);
 	}
 
+	/* whole rows, one after another: share v's store */
+	if (lo[0] == 0 && hi[0] == INT_MAX - 1 && step[1] == 1 && hi[1] > lo[1]) {
+		if (V_TEXT(v).store == NULL) {
+			if ((V_TEXT(v).store = text_store_copy(V_TEXT(v).text, V_TEXT(v).Row)) == NULL) {
+				parse_error("Unable to alloc text array");
+				return (NULL);
+			}
+			for (i = 0; i < V_TEXT(v).Row; i++) {
+				free(V_TEXT(v).text[i]);
+			}
+			free(V_TEXT(v).text);
+			V_TEXT(v).text = V_TEXT(v).store->rows;
+		}
+		/* v may itself be a view, so count from its first row in the store */
+		V_TEXT(v).store->refs++;
+		return (newTextView(V_TEXT(v).store, (int)(V_TEXT(v).text - V_TEXT(v).store->rows) + lo[1],
+		                    hi[1] - lo[1] + 1));
+	}
+
 	o = newVar();
 
 	V_TEXT(o).Row = ((hi[1] - lo[1]) / step[1]) + 1;
@@ -508,61 +653,162 @@ Var* ff_filename(vfuncptr func, Var* arg)
 	}
 }
 
-int list_contains(char* str, Var* S)
+/**
+ ** Compiled patterns for grep(), strsub() and strstr(), most recently
+ ** used first, so that a script calling them in a loop compiles each
+ ** pattern once.  glibc's regexec() locks the regex_t it is given, so a
+ ** regex is compiled once for each thread matching with it.  KMP tables
+ ** (cflags -1) are shared.
+ **/
+
+#define PATTERN_CACHE 16
+#define TEXT_GRAIN 1024 /* rows per thread, at least */
+
+typedef struct {
+	char* pattern; /* NULL for an empty slot */
+	int cflags;    /* regcomp() flags, or -1 for a KMP table */
+	int n;         /* compiled copies of the regex */
+	regex_t* rx;
+	int* align;
+} pattern_entry;
+
+static pattern_entry pattern_cache[PATTERN_CACHE];
+
+static void pattern_free(pattern_entry* e)
 {
 	int i;
 
-	for (i = 0; i < V_TEXT(S).Row; i++)
-		if (strcmp(str, V_TEXT(S).text[i]) == 0) return 1;
+	for (i = 0; i < e->n; i++) regfree(&e->rx[i]);
+	free(e->rx);
+	free(e->align);
+	free(e->pattern);
+	memset(e, 0, sizeof(pattern_entry));
+}
 
-	return 0;
+/* the entry for pattern and cflags, made if need be and moved to the front */
+static pattern_entry* pattern_lookup(const char* pattern, int cflags)
+{
+	pattern_entry e;
+	int i;
+
+	for (i = 0; i < PATTERN_CACHE && pattern_cache[i].pattern != NULL; i++) {
+		if (pattern_cache[i].cflags == cflags && !strcmp(pattern_cache[i].pattern, pattern)) break;
+	}
+	if (i == PATTERN_CACHE) pattern_free(&pattern_cache[--i]);
+
+	e = pattern_cache[i];
+	if (e.pattern == NULL) {
+		e.pattern = strdup(pattern);
+		e.cflags  = cflags;
+	}
+	memmove(pattern_cache + 1, pattern_cache, i * sizeof(pattern_entry));
+	pattern_cache[0] = e;
+	return (&pattern_cache[0]);
 }
 
-Var* minus(Var* ob1, Var* S)
+/*
+** pattern compiled with cflags, once for each of n threads.  Returns
+** NULL if it doesn't compile.  Good until the next call.
+*/
+static regex_t* regex_cached(const char* pattern, int cflags, int n)
 {
-	Var* ob1_minus_S;
-	int i, j, count;
-	i = j = count = 0;
+	pattern_entry* e = pattern_lookup(pattern, cflags);
+	regex_t* rx;
+	char msg[256];
+	int rc;
 
-	// Obtain the number of elements...
-	for (i = 0; i < V_TEXT(ob1).Row; i++)
-		if (list_contains(V_TEXT(ob1).text[i], S) == 0) count++;
+	if (e->pattern == NULL) {
+		parse_error("Unable to alloc %zu bytes", strlen(pattern) + 1);
+		return (NULL);
+	}
+	if (e->n < n) {
+		if ((rx = (regex_t*)realloc(e->rx, n * sizeof(regex_t))) == NULL) {
+			parse_error("Unable to alloc %zu bytes", n * sizeof(regex_t));
+			return (NULL);
+		}
+		e->rx = rx;
+		for (; e->n < n; e->n++) {
+			if ((rc = regcomp(&e->rx[e->n], pattern, cflags)) != 0) {
+				regerror(rc, &e->rx[e->n], msg, sizeof(msg));
+				parse_error("Bad regular expression \"%s\": %s", pattern, msg);
+				return (NULL);
+			}
+		}
+	}
+	return (e->rx);
+}
 
-	ob1_minus_S              = newVar();
-	V_TYPE(ob1_minus_S)      = ID_TEXT;
-	V_TEXT(ob1_minus_S).Row  = count;
-	V_TEXT(ob1_minus_S).text = (char**)calloc(count, sizeof(char*));
+int* kmp_compile(char* s2);
+int kmp(char* s1, char* s2, int* align);
 
-	count = 0;
+/* the KMP table for pattern, good until the next call */
+static int* kmp_cached(char* pattern)
+{
+	pattern_entry* e = pattern_lookup(pattern, -1);
+
+	if (e->pattern != NULL && e->align == NULL) e->align = kmp_compile(pattern);
+	if (e->align == NULL) parse_error("Unable to alloc %zu bytes", (strlen(pattern) + 1) * sizeof(int));
+	return (e->align);
+}
 
-	for (i = 0; i < V_TEXT(ob1).Row; i++)
-		if (list_contains(V_TEXT(ob1).text[i], S) == 0)
-			V_TEXT(ob1_minus_S).text[count++] = strdup(V_TEXT(ob1).text[i]);
+typedef struct {
+	char** text;
+	regex_t* rx; /* one for each tid */
+	int invert;
+	char* hit;   /* grep: 1 for each row selected */
+	int* rows;   /* grep: the selected rows */
+	char** out;  /* grep: their copies; strsub: the result */
+	char* pattern;
+	int* align;
+	int* pos;    /* strstr */
+	char* subst;
+} text_job;
+
+static void grep_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	text_job* job = (text_job*)ctx;
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		job->hit[i] = (regexec(&job->rx[tid], job->text[i], 0, NULL, 0) == 0) != job->invert;
+	}
+}
+
+static void grep_copy_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	text_job* job = (text_job*)ctx;
+	size_t i;
 
-	return ob1_minus_S;
+	for (i = begin; i < end; i++) {
+		job->out[i] = strdup(job->text[job->rows[i]]);
+	}
 }
 
+/**
+ ** grep(obj=TEXT, pattern=STRING [, icase=1] [, invert=1] [, index=1])
+ **
+ ** The rows of obj that match pattern (or don't, with invert), or with
+ ** index=1 their row numbers.
+ **/
 Var* ff_grep(vfuncptr func, Var* arg)
 {
 	Var* ob1;
-	Var* S;
-	char* s1      = NULL;
-	int newcursor = 0;
-	int count     = 0;
-	int index     = 0;
-	int i;
+	char* s1        = NULL;
 	int ignore_case = 0;
 	int invert      = 0;
+	int index       = 0;
+	int cflags      = REG_EXTENDED;
+	size_t i, n, count;
+	text_job job;
+	int* rows;
 
-	int cflags = REG_EXTENDED;
-
-	regex_t compiled;
-	Alist alist[5];
+	Alist alist[6];
 	alist[0]      = make_alist("obj", ID_UNK, NULL, &ob1);
 	alist[1]      = make_alist("pattern", ID_STRING, NULL, &s1);
 	alist[2]      = make_alist("icase", DV_INT32, NULL, &ignore_case);
 	alist[3]      = make_alist("invert", DV_INT32, NULL, &invert);
-	alist[4].name = NULL;
+	alist[4]      = make_alist("index", DV_INT32, NULL, &index);
+	alist[5].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -579,37 +825,51 @@ Var* ff_grep(vfuncptr func, Var* arg)
 		cflags |= REG_ICASE;
 	}
 
-	/* Compile expression space */
-	regcomp(&compiled, s1, cflags);
+	n = V_TEXT(ob1).Row;
+	memset(&job, 0, sizeof(job));
+	job.text   = V_TEXT(ob1).text;
+	job.invert = (invert != 0);
+	if ((job.rx = regex_cached(s1, cflags, dv_parallel_chunks(n, TEXT_GRAIN))) == NULL) return (NULL);
 
-	for (i = 0; i < V_TEXT(ob1).Row; i++) {
-		newcursor = regexec(&compiled, V_TEXT(ob1).text[i], 0, NULL, 0);
-		if (newcursor == 0) count++;
+	if ((job.hit = (char*)malloc(n + 1)) == NULL) {
+		parse_error("Unable to alloc %zu bytes", n + 1);
+		return (NULL);
 	}
+	dv_parallel_for(n, TEXT_GRAIN, grep_kernel, &job);
 
+	for (count = 0, i = 0; i < n; i++) count += job.hit[i];
 	if (count == 0) {
 		parse_error("No Match");
-		regfree(&compiled);
+		free(job.hit);
 		return (NULL);
 	}
 
-	S              = newVar();
-	V_TYPE(S)      = ID_TEXT;
-	V_TEXT(S).Row  = count;
-	V_TEXT(S).text = (char**)calloc(count, sizeof(char*));
-	for (i = 0; i < V_TEXT(ob1).Row; i++) {
-		newcursor = regexec(&compiled, V_TEXT(ob1).text[i], 0, NULL, 0);
-		if (newcursor == 0) {
-			V_TEXT(S).text[index++] = strdup(V_TEXT(ob1).text[i]);
-		}
+	rows = (int*)malloc(count * sizeof(int));
+	if (rows == NULL) {
+		parse_error("Unable to alloc %zu bytes", count * sizeof(int));
+		free(job.hit);
+		return (NULL);
 	}
-	regfree(&compiled);
+	for (count = 0, i = 0; i < n; i++) {
+		if (job.hit[i]) rows[count++] = i;
+	}
+	free(job.hit);
 
-	if (invert == 0)
-		return (S);
+	if (index) {
+		for (i = 0; i < count; i++) rows[i]++;
+		return (newVal(BSQ, 1, count, 1, DV_INT32, rows));
+	}
 
-	else
-		return (minus(ob1, S));
+	job.rows = rows;
+	job.out  = (char**)calloc(count, sizeof(char*));
+	if (job.out == NULL) {
+		parse_error("Unable to alloc %zu bytes", count * sizeof(char*));
+		free(rows);
+		return (NULL);
+	}
+	dv_parallel_for(count, TEXT_GRAIN, grep_copy_kernel, &job);
+	free(rows);
+	return (newText(count, job.out));
 }
 
 /**
@@ -672,19 +932,32 @@ int kmp(char* s1, char* s2, int* align)
 	return (-1); /* return NULL */
 }
 
-Var* ff_text_strstr(Var* ob1, char* s1)
+static void strstr_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
-	int i;
-	int* data  = calloc(V_TEXT(ob1).Row, sizeof(int));
-	int* align = kmp_compile(s1);
+	text_job* job = (text_job*)ctx;
+	size_t i;
 
-	for (i = 0; i < V_TEXT(ob1).Row; i++) {
-		data[i] = kmp(V_TEXT(ob1).text[i], s1, align) + 1;
+	for (i = begin; i < end; i++) {
+		job->pos[i] = kmp(job->text[i], job->pattern, job->align) + 1;
 	}
+}
 
-	free(align);
+Var* ff_text_strstr(Var* ob1, char* s1)
+{
+	text_job job;
+	size_t n = V_TEXT(ob1).Row;
+
+	memset(&job, 0, sizeof(job));
+	if ((job.align = kmp_cached(s1)) == NULL) return (NULL);
+	if ((job.pos = (int*)calloc(n, sizeof(int))) == NULL) {
+		parse_error("Unable to alloc %zu bytes", n * sizeof(int));
+		return (NULL);
+	}
+	job.text    = V_TEXT(ob1).text;
+	job.pattern = s1;
+	dv_parallel_for(n, TEXT_GRAIN, strstr_kernel, &job);
 
-	return (newVal(BSQ, 1, V_TEXT(ob1).Row, 1, DV_INT32, data));
+	return (newVal(BSQ, 1, n, 1, DV_INT32, job.pos));
 }
 
 Var* ff_strstr(vfuncptr func, Var* arg)
@@ -709,9 +982,12 @@ Var* ff_strstr(vfuncptr func, Var* arg)
 
 	if (V_TYPE(ob1) == ID_STRING) {
 		int* v     = calloc(1, sizeof(int));
-		int* align = kmp_compile(s1);
-		*v         = kmp(V_STRING(ob1), s1, align) + 1;
-		free(align);
+		int* align = kmp_cached(s1);
+		if (align == NULL) {
+			free(v);
+			return (NULL);
+		}
+		*v = kmp(V_STRING(ob1), s1, align) + 1;
 		return (newVal(BSQ, 1, 1, 1, DV_INT32, v));
 	}
 
@@ -779,6 +1055,10 @@ Var* set_text(Var* to, Range* r, Var* from)
 
 	height = (hi[1] - lo[1]) / step[1] + 1;
 
+	if (!text_unshare(to)) {
+		parse_error("Unable to alloc text array");
+		return (NULL);
+	}
 	dest = V_DUP(to);
 	src  = V_DUP(from);
 
@@ -825,7 +1105,6 @@ Var* set_text(Var* to, Range* r, Var* from)
 Var* where_text(Var* id, Var* where, Var* exp)
 {
 	int i;
-	Var* temp;
 	int len = 0;
 	char* text;
 
@@ -834,10 +1113,18 @@ Var* where_text(Var* id, Var* where, Var* exp)
 		return (NULL);
 	}
 
-	if (V_TYPE(exp) == ID_STRING) len = 0;
-
-	temp = V_DUP(exp);
+	if (V_TYPE(exp) == ID_TEXT) {
+		if (V_TEXT(exp).Row != V_TEXT(id).Row) {
+			parse_error("Target and source need to have the same number of rows");
+			return (NULL);
+		}
+		len = 1;
+	}
 
+	if (!text_unshare(id)) {
+		parse_error("Unable to alloc text array");
+		return (NULL);
+	}
 	for (i = 0; i < V_TEXT(id).Row; i++) {
 		if (extract_int(where, i)) {
 			text = (len ? V_TEXT(exp).text[i] : V_STRING(exp));
@@ -849,92 +1136,77 @@ Var* where_text(Var* id, Var* where, Var* exp)
 	return (exp);
 }
 
+/*
+** line with every match of preg replaced by replace, in which & is the
+** match and \N its Nth subexpression.  NULL if memory runs out.
+*/
 char* single_replace(char* line, regex_t* preg, char* replace)
 {
 	regmatch_t pmatch[10];
-	int nmatch = 10;
+	dv_text out   = {NULL, 0, 0, 0};
+	char* marker  = line;
+	size_t len    = strlen(replace);
+	size_t i;
 	int eflags = 0;
-	char* newtext;
-	char* Marker;
-	int result;
-	int index = 0;
-	int Max   = strlen(line) + strlen(replace) + 1;
-	int i;
-	int len = strlen(replace);
 	int numeral;
-	int delta;
-
-	newtext = malloc(Max);
-
-	result = regexec(preg, line, nmatch, pmatch, eflags);
-	Marker = line;
 
 	/*search string for every occurence of preg */
-	while (!(result)) {
-
-		/*Check size limitation on newtext, extend if needed */
-		if (index >= (Max - (Max / 10))) { /*Keep a 10% margin of safty */
-			Max += Max;
-			newtext = realloc(newtext, Max);
-		}
-
+	while (regexec(preg, marker, 10, pmatch, eflags) == 0) {
 		/*Copy everything over, upto the occurence */
-		memcpy((newtext + index), Marker, pmatch[0].rm_so);
-		index += pmatch[0].rm_so;
+		dv_text_add(&out, marker, pmatch[0].rm_so);
 
 		/*copy replacement string into newtext */
-
-		i = 0;
-		while (i < len) {
-			/*look for special characters */
+		for (i = 0; i < len; i++) {
 			if (replace[i] == '&') {
 				/*insert whole match pattern */
-				delta = pmatch[0].rm_eo - pmatch[0].rm_so;
-				memcpy((newtext + index), Marker + pmatch[0].rm_so, delta);
-				index += delta;
+				dv_text_add(&out, marker + pmatch[0].rm_so, pmatch[0].rm_eo - pmatch[0].rm_so);
 			} else if (replace[i] == '\\') {
-				if (i < (len - 1)) {
+				if (i + 1 < len) {
 					i++;
 					if (replace[i] >= '0' && replace[i] <= '9') { /*substring */
 						numeral = replace[i] - '0';
 						if (pmatch[numeral].rm_so >= 0) { /*requested valid substring */
-							delta = pmatch[numeral].rm_eo - pmatch[numeral].rm_so;
-							memcpy((newtext + index), Marker + pmatch[numeral].rm_so, delta);
-							index += delta;
+							dv_text_add(&out, marker + pmatch[numeral].rm_so,
+							            pmatch[numeral].rm_eo - pmatch[numeral].rm_so);
 						}
 					} else { /*Otherwise just copy it over */
-						newtext[index] = replace[i];
-						index++;
+						dv_text_add(&out, replace + i, 1);
 					}
 				}
+			} else {
+				dv_text_add(&out, replace + i, 1);
 			}
-
-			else {
-				newtext[index] = replace[i];
-				index++;
-			}
-
-			i++;
 		}
 
 		/*Set marker to end of match */
-		Marker += pmatch[0].rm_eo;
-		/* repeat as necessary */
-		result = regexec(preg, Marker, nmatch, pmatch, eflags);
+		marker += pmatch[0].rm_eo;
+		if (pmatch[0].rm_eo == pmatch[0].rm_so) {
+			/* an empty match: step over a char so the next search moves on */
+			if (*marker == '\0') break;
+			dv_text_add(&out, marker++, 1);
+		}
+		/* later matches aren't at the start of the line */
+		eflags = REG_NOTBOL;
 	}
 
 	/*copy over any trailing chars after last match */
-	if (strlen(Marker)) {
-		memcpy((newtext + index), Marker, strlen(Marker));
-		index += strlen(Marker);
-	}
+	dv_text_add(&out, marker, strlen(marker) + 1);
 
-	newtext[index] = '\0';
+	if (out.error) {
+		dv_text_free(&out);
+		return (NULL);
+	}
+	return (out.s);
+}
 
-	/*Shrink to fit */
-	newtext = realloc(newtext, index + 1);
+static void subst_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	text_job* job = (text_job*)ctx;
+	size_t i;
 
-	return (newtext);
+	for (i = begin; i < end; i++) {
+		job->out[i] = single_replace(job->text[i], &job->rx[tid], job->subst);
+	}
 }
 
 Var* ff_stringsubst(vfuncptr func, Var* arg)
@@ -943,11 +1215,9 @@ Var* ff_stringsubst(vfuncptr func, Var* arg)
 	char* match = NULL;
 	char* subst = NULL;
 
-	int i, n;
-	char *r, **rows;
-	Var* result;
-
-	regex_t preg;
+	size_t i, n;
+	char* r;
+	text_job job;
 	int cflags = REG_EXTENDED;
 
 	Alist alist[4];
@@ -973,40 +1243,35 @@ Var* ff_stringsubst(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
-	/*Compile expression */
-	if (regcomp(&preg, match, cflags)) {
-		parse_error("error compiling regular expression");
-		return (NULL);
-	}
-
 	/*If our object is just a string, run the single line replace function
 	  and return it in the result object
 	*/
 
-	result = NULL;
-
 	if (V_TYPE(ob) == ID_STRING) {
-		r = single_replace(V_STRING(ob), &preg, subst);
-		if (r == NULL) {
-			result = newString(strdup(""));
-		} else {
-			result = newString(strdup(r));
-		}
-	} else if (V_TYPE(ob) == ID_TEXT) {
-		/*If our object is a text array, run the single line replace function
-		  for each Row in the array and store each replacement in the result
-		  object
-		*/
-		n    = V_TEXT(ob).Row;
-		rows = (char**)calloc(n, sizeof(char*));
-		for (i = 0; i < n; i++) {
-			rows[i]                      = single_replace(V_TEXT(ob).text[i], &preg, subst);
-			if (rows[i] == NULL) rows[i] = strdup("");
-		}
-		result = newText(n, rows);
+		if ((job.rx = regex_cached(match, cflags, 1)) == NULL) return (NULL);
+		r = single_replace(V_STRING(ob), &job.rx[0], subst);
+		return (newString(r == NULL ? strdup("") : r));
+	}
+
+	/*If our object is a text array, run the single line replace function
+	  for each Row in the array and store each replacement in the result
+	  object
+	*/
+	n = V_TEXT(ob).Row;
+	memset(&job, 0, sizeof(job));
+	if ((job.rx = regex_cached(match, cflags, dv_parallel_chunks(n, TEXT_GRAIN))) == NULL) return (NULL);
+	if ((job.out = (char**)calloc(n, sizeof(char*))) == NULL) {
+		parse_error("Unable to alloc %zu bytes", n * sizeof(char*));
+		return (NULL);
+	}
+	job.text  = V_TEXT(ob).text;
+	job.subst = subst;
+	dv_parallel_for(n, TEXT_GRAIN, subst_kernel, &job);
+
+	for (i = 0; i < n; i++) {
+		if (job.out[i] == NULL) job.out[i] = strdup("");
 	}
-	regfree(&preg);
-	return (result);
+	return (newText(n, job.out));
 }
 
 char* rtrim_string(char* string, char* trim)
@@ -1,4 +1,5 @@
 #include "endian_norm.h"
+#include "parallel.h"
 #include "parser.h"
 #include <errno.h>
 #include <fcntl.h>
@@ -9,6 +10,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 //#define FF_UNPACK_DEBUG 1
 
@@ -17,6 +21,8 @@
 #define ARG_SKIP "skip"
 #define ARG_COUNT "count"
 #define ARG_COL_NAMES "col_names"
+#define ARG_START "start"
+#define ARG_STEP "step"
 
 #define ARG_STRUCT "struct"
 #define ARG_FORCE "force"
@@ -39,6 +45,10 @@
 
 #define MAX_ATTRIBUTES 500
 
+#define UNPACK_BLOCK_BYTES (8 << 20) // records per read()/write() when not mmapped, in bytes
+#define UNPACK_SLICE_ROWS 4096       // rows below which a column isn't split up
+#define PACK_GRAIN 1024              // rows per thread when packing
+
 // filled in parse_template()
 typedef struct {
 	char type;                 // type constant from above defines
@@ -62,15 +72,16 @@ typedef struct {
 	u8* array;                // array to actually store the column data, NULL if type is string
 	char** strarray;          // array to store column data if type is string, NULL otherwise
 	short numbytes;           // set equal to adj_bytesize
+	int rows;                 // number of rows in the column when packing
 	char type;                // set equal to final type
 } data;
 
 static int convert_types(data* thedata, int num_items);
 
-static data* unpack(char*, char*, Var*, int, int*, int*);
+static data* unpack(char*, char*, Var*, int, int, int, int*, int*);
 static unpack_digest* parse_template(char* template, column_attributes* input, Var* column_names, int*);
 static int validate_template(unpack_digest* input);
-static int read_data(u8*, data*, unpack_digest*, int);
+static int read_rows(data*, unpack_digest*, FILE*, off_t, int, int);
 static int calc_rows(char*, int, unpack_digest*, int);
 static data* allocate_arrays(unpack_digest*);
 static void compute_adj_bytes(unpack_digest*);
@@ -88,6 +99,17 @@ static data* parse_struct(Var*, Var*, int*, int*);
 static void cleanup_data(data*, int);
 static int pack_row(data* the_data, unpack_digest* digest, int row, u8* buffer);
 
+typedef struct {
+	data* the_data;
+	unpack_digest* digest;
+	u8* buffer; // records row .. row + n - 1
+	int rec_length;
+	size_t row;
+	int failed;
+} pack_block;
+
+static void pack_kernel(void* ctx, size_t begin, size_t end, int tid);
+
 /*premade calls for testing:
 
 //unpack("U4U2U2*38U2U2R4I2*9R4R4R4x6a4", "atm05555.dat", 390)
@@ -107,16 +129,20 @@ Var* ff_unpack(vfuncptr func, Var* arg)
 	Var* result       = NULL;
 	int rows          = -1;
 	Var* column_names = NULL;
+	int start         = 1;
+	int step          = 1;
 
 	int i = 0;
 
-	Alist alist[6];
+	Alist alist[8];
 	alist[0]      = make_alist(ARG_TEMPLATE, ID_STRING, NULL, &template);
 	alist[1]      = make_alist(ARG_FILENAME, ID_STRING, NULL, &filename);
 	alist[2]      = make_alist(ARG_SKIP, DV_INT32, NULL, &hdr_length);
 	alist[3]      = make_alist(ARG_COUNT, DV_INT32, NULL, &rows);
 	alist[4]      = make_alist(ARG_COL_NAMES, ID_UNK, NULL, &column_names);
-	alist[5].name = NULL;
+	alist[5]      = make_alist(ARG_START, DV_INT32, NULL, &start);
+	alist[6]      = make_alist(ARG_STEP, DV_INT32, NULL, &step);
+	alist[7].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return NULL;
 
@@ -135,8 +161,18 @@ Var* ff_unpack(vfuncptr func, Var* arg)
 		return NULL;
 	}
 
+	if (start < 1) {
+		parse_error("%s < 1: %s()", ARG_START, func->name);
+		return NULL;
+	}
+
+	if (step < 1) {
+		parse_error("%s < 1: %s()", ARG_STEP, func->name);
+		return NULL;
+	}
+
 	int num_items  = 0;
-	data* reg_data = unpack(template, filename, column_names, hdr_length, &num_items, &rows);
+	data* reg_data = unpack(template, filename, column_names, hdr_length, start, step, &num_items, &rows);
 
 	if (reg_data == NULL || rows <= 0 || num_items <= 0) return NULL;
 
@@ -224,16 +260,16 @@ static int convert_types(data* thedata, int num_items)
 }
 
 /**** unpack implementation function ****/
-static data* unpack(char* template, char* filename, Var* column_names, int hdr_length,
-                    int* numitems, int* ret_rows)
+static data* unpack(char* template, char* filename, Var* column_names, int hdr_length, int start,
+                    int step, int* numitems, int* ret_rows)
 {
-	int i, k;
+	int i;
 	int rec_length;
+	int avail;
 
 	column_attributes* initial = NULL;
 	unpack_digest* input       = NULL;
 	FILE* file                 = NULL;
-	u8* buffer                 = NULL;
 	data* thedata              = NULL;
 
 	if (strlen(template) == 0) {
@@ -274,11 +310,6 @@ static data* unpack(char* template, char* filename, Var* column_names, int hdr_l
 		return NULL;
 	}
 
-	if (fseek(file, hdr_length, SEEK_SET)) {
-		parse_error("fseek error: %s", strerror(errno));
-		clean_up(0, input, NULL, NULL, file);
-		return NULL;
-	}
 #ifdef FF_UNPACK_DEBUG
 	fprintf(stderr, "record length: %d\n\n", rec_length);
 #endif
@@ -298,30 +329,34 @@ static data* unpack(char* template, char* filename, Var* column_names, int hdr_l
 		return NULL;
 	}
 
+	// rows left once start and step are taken into account
+	if (start > input->rows) {
+		parse_error("error processing file %s: start (%d) > computed file rows (%d)\n", filename,
+		            start, input->rows);
+		clean_up(1, input, NULL, NULL, file);
+		return NULL;
+	}
+	avail = (input->rows - (start - 1) + step - 1) / step;
+
 	if (*ret_rows >= 0) { /* user passed in the number of rows to convert */
-		if (*ret_rows > input->rows) {
+		if (*ret_rows > avail) {
 			parse_error("error processing file %s: requested rows (%d) > computed file rows (%d)\n",
-			            filename, *ret_rows, input->rows);
+			            filename, *ret_rows, avail);
 			clean_up(1, input, NULL, NULL, file);
 			return NULL;
 		} else {
 			/* set the number of rows to process to the value passed in */
 			input->rows = *ret_rows;
 		}
-	}
-
-	buffer = (u8*)calloc(rec_length + 2, sizeof(u8)); // not sure if extra 2 are needed but jic
-	if (buffer == NULL) {
-		memory_error(errno, rec_length * sizeof(u8));
-		clean_up(0, input, NULL, NULL, file);
-		return NULL;
+	} else {
+		input->rows = avail;
 	}
 
 	compute_adj_bytes(input);
 
 	thedata = allocate_arrays(input);
 	if (thedata == NULL) {
-		clean_up(1, input, buffer, NULL, file);
+		clean_up(1, input, NULL, NULL, file);
 		return NULL;
 	}
 
@@ -331,24 +366,17 @@ static data* unpack(char* template, char* filename, Var* column_names, int hdr_l
 		thedata[i].numbytes = input->attr[i].adj_bytesize;
 	}
 
-	for (k = 0; k < input->rows; k++) {
-		if (fread(buffer, 1, rec_length, file) != rec_length) {
-			parse_error("Error reading data: %s", strerror(errno));
-			clean_up(2, input, buffer, thedata, file);
-			return NULL;
-		}
-
-		if (!read_data(buffer, thedata, input, k)) {
-			clean_up(2, input, buffer, thedata, file);
-			return NULL;
-		}
+	if (!read_rows(thedata, input, file, (off_t)hdr_length + (off_t)(start - 1) * rec_length,
+	               rec_length, step)) {
+		clean_up(3, input, NULL, thedata, file);
+		return NULL;
 	}
 
 #if 0
 	// see comment above upgrade_types
 	// change types if necessary ie 3, 5-7 byte int types to appropriate
 	if (!upgrade_types(thedata, input)) {
-		clean_up(2, input, buffer, thedata, file);
+		clean_up(3, input, NULL, thedata, file);
 		return NULL;
 	}
 #endif
@@ -362,7 +390,6 @@ static data* unpack(char* template, char* filename, Var* column_names, int hdr_l
 	*ret_rows = input->rows;
 
 	// cleanup
-	free(buffer);
 	free(input);
 	fclose(file);
 
@@ -376,17 +403,10 @@ static void clean_up(int level, unpack_digest* input, u8* buffer, data* the_data
 	int num_items = input->num_items;
 	int rows      = input->rows;
 
-	if (level > 0) {
-		free(input->attr);
-		free(input);
-	}
-
-	if (level > 1) free(buffer);
-
 	if (level > 2) {
 		for (i = 0; i < num_items; i++) {
 
-			if (the_data->input->type == STRING) {
+			if (the_data[i].input->type == STRING) {
 				for (j = 0; j < rows; j++) free(the_data[i].strarray[j]);
 
 				free(the_data[i].strarray);
@@ -394,8 +414,16 @@ static void clean_up(int level, unpack_digest* input, u8* buffer, data* the_data
 			} else
 				free(the_data[i].array);
 		}
+		free(the_data);
 	}
 
+	if (level > 0) {
+		free(input->attr);
+		free(input);
+	}
+
+	if (level > 1) free(buffer);
+
 	if (file) fclose(file);
 }
 
@@ -721,7 +749,7 @@ static int calc_rows(char* filename, int hdr_length, unpack_digest* input, int r
 /* also pretty self explanatory */
 static data* allocate_arrays(unpack_digest* digest)
 {
-	int i, k = 0, mem_num = 0, err_num = 0;
+	int i, mem_num = 0, err_num = 0;
 	// char* err_str = "Error in allocate_arrays()";
 	int num_items            = digest->num_items;
 	int rows                 = digest->rows;
@@ -735,6 +763,7 @@ static data* allocate_arrays(unpack_digest* digest)
 
 	for (i = 0; i < num_items; i++) {
 
+		// the strings themselves are allocated as they're read
 		if (input[i].type == STRING) {
 			all_data[i].strarray = (char**)calloc(rows, sizeof(char*));
 			if (all_data[i].strarray == NULL) {
@@ -743,21 +772,10 @@ static data* allocate_arrays(unpack_digest* digest)
 				break;
 			}
 
-			for (k = 0; k < rows; k++) {
-				all_data[i].strarray[k] = (char*)calloc(input[i].adj_bytesize, sizeof(char));
-				if (all_data[i].strarray[k] == NULL) {
-					err_num = errno;
-					mem_num = input[i].adj_bytesize * sizeof(char);
-					break;
-				}
-			}
-			if (k < rows) break;
-
-			k                 = 0;
 			all_data[i].array = NULL;
 		} else {
 			all_data[i].array =
-			    (u8*)calloc(input[i].columns * input[i].adj_bytesize * rows, sizeof(u8));
+			    (u8*)calloc((size_t)input[i].columns * input[i].adj_bytesize * rows, sizeof(u8));
 			if (all_data[i].array == NULL) {
 				err_num = errno;
 				mem_num = input[i].columns * input[i].adj_bytesize * rows * sizeof(u8);
@@ -771,16 +789,8 @@ static data* allocate_arrays(unpack_digest* digest)
 	/* clean up code if necessary */
 	if (i < num_items) {
 		for (; i >= 0; i--) {
-
-			if (input[i].type == STRING) {
-				for (--k; k >= 0; k--) free(all_data[i].strarray[k]);
-
-				if (all_data[i].strarray != NULL) free(all_data[i].strarray);
-
-				k = rows;
-			} else {
-				if (all_data[i].array != NULL) free(all_data[i].array);
-			}
+			free(all_data[i].strarray);
+			free(all_data[i].array);
 		}
 
 		free(all_data);
@@ -891,144 +901,223 @@ static int print_data(data* the_data, unpack_digest* input)
 }
 #endif
 
-/*
-    reads data into buf, performs necessary manipulations (like byteswapping)
-    then stores into correct location (loc) in the_data->array
-*/
-static int read_data(u8* buffer, data* the_data, unpack_digest* input, int row)
-{
-	i64 tmp_i64 = 0;
-	u64 tmp_u64 = 0;
-
-	u8* mybyte = NULL;
-	u8* loc    = NULL;
-	u8* buf    = NULL;
+/**
+ ** Row decoding.
+ **
+ ** The parsed template is the column program: every column knows where it
+ ** starts in the record, how wide it is on disk and in memory and what
+ ** byte order it's in.  read_rows() maps the file (or reads it in blocks
+ ** where it can't be mapped) and decodes a run of records at a time, one
+ ** unit of work per column and row slice, straight into the arrays that
+ ** end up in the davinci struct.  Integers are assembled from their bytes,
+ ** so the swap is the same on either endian host and needs no scratch
+ ** copy of the record.
+ **/
 
-	int i, j, k;
-
-	char letter;
-	int numbytes;
-	int al_bytes;
-	int columns;
-
-	for (j = 0; j < input->num_items; j++) {
-		letter   = input->attr[j].type;
-		numbytes = input->attr[j].bytesize;
-		al_bytes = input->attr[j].adj_bytesize;
-		columns  = input->attr[j].columns;
-
-		buf = &buffer[input->attr[j].start_byte]; // skip to offset
-
-		for (k = 0; k < columns; k++) {
-
-			if (letter != STRING) loc = &the_data[j].array[(row * columns + k) * al_bytes];
-
-			switch (letter) {
-			case STRING: // ASCII string space padded
-				memcpy(the_data[j].strarray[row], buf, numbytes);
-				the_data[j].strarray[row][numbytes] = '\0';
-
-				break;
-
-			case LSB_DOUBLE:
-			case LSB_FLOAT:
-				LSB(buf, 1, numbytes);
-				memcpy(loc, buf, al_bytes);
-
-				break;
-
-			case MSB_DOUBLE:
-			case MSB_FLOAT:
-				MSB(buf, 1, numbytes);
-				memcpy(loc, buf, al_bytes);
+typedef struct {
+	data* the_data;
+	unpack_digest* digest;
+	const u8* base; // first record of the run
+	size_t stride;  // bytes from one record of the run to the next
+	size_t row;     // output row of the first record
+	size_t rows;    // records in the run
+	int nslices;
+	int failed; // 1 + the index of a column that could not be decoded
+} unpack_run;
+
+static inline u64 unpack_uint(const u8* p, int nbytes, int msb)
+{
+	u64 u = 0;
+	int i;
 
-				break;
+	if (msb) {
+		for (i = 0; i < nbytes; i++) u = (u << 8) | p[i];
+	} else {
+		for (i = nbytes - 1; i >= 0; i--) u = (u << 8) | p[i];
+	}
+	return u;
+}
 
-			case SIGNED_MSB_INT:
-			case SIGNED_LSB_INT: tmp_i64 = 0; mybyte = (u8*)&tmp_i64;
+#define UNPACK_ROWS(type, NBYTES)                                      \
+	for (i = 0; i < n; i++, src += stride) {                           \
+		p   = src + attr->start_byte;                                  \
+		out = (type*)d->array + (row + i) * attr->columns;             \
+		for (k = 0; k < attr->columns; k++, p += (NBYTES)) {           \
+			u = unpack_uint(p, (NBYTES), msb);                         \
+			if (sign && (NBYTES) < 8 && (u >> ((NBYTES)*8 - 1)) & 1) { \
+				u |= ~(u64)0 << ((NBYTES)*8 % 64);                     \
+			}                                                          \
+			((type*)out)[k] = (type)u;                                 \
+		}                                                              \
+	}
 
-#ifdef WORDS_BIGENDIAN
-				if (letter == SIGNED_LSB_INT) {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[7 - (8 - numbytes) - i] = buf[i];
-					}
-					tmp_i64 = tmp_i64 >> ((8 - numbytes) * 8);
-				} else {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[i] = buf[i];
-					}
-					tmp_i64 = tmp_i64 >> ((8 - numbytes) * 8);
-				}
+static int unpack_column(data* d, const u8* src, size_t stride, size_t row, size_t n)
+{
+	column_attributes* attr = d->input;
+	int nbytes              = attr->bytesize;
+	char letter             = attr->type;
+	int msb, sign;
+	const u8* p;
+	void* out;
+	size_t i;
+	int k;
+	u64 u;
+
+	if (letter == STRING) {
+		for (i = 0; i < n; i++, src += stride) {
+			if ((d->strarray[row + i] = (char*)calloc(attr->adj_bytesize, sizeof(char))) == NULL) {
+				return 0;
+			}
+			memcpy(d->strarray[row + i], src + attr->start_byte, nbytes);
+		}
+		return 1;
+	}
 
-				memcpy(loc, &mybyte[8 - al_bytes], al_bytes);
+	msb  = (letter == SIGNED_MSB_INT || letter == UNSIGNED_MSB_INT || letter == MSB_FLOAT ||
+	       letter == MSB_DOUBLE);
+	sign = (letter == SIGNED_MSB_INT || letter == SIGNED_LSB_INT);
 
-#else
-				if (letter == SIGNED_MSB_INT) {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[7 - i] = buf[i];
-					}
-					tmp_i64 = tmp_i64 >> ((8 - numbytes) * 8);
-				} else {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[7 - (numbytes - 1) + i] = buf[i];
-					}
-					tmp_i64 = tmp_i64 >> ((8 - numbytes) * 8);
-				}
-				memcpy(loc, mybyte, al_bytes);
+	// floats are just 4 and 8 byte patterns here
+	switch (attr->adj_bytesize) {
+	case 1: UNPACK_ROWS(u8, 1); break;
+	case 2: UNPACK_ROWS(u16, 2); break;
+	case 4:
+		if (nbytes == 4) {
+			UNPACK_ROWS(u32, 4);
+		} else {
+			UNPACK_ROWS(u32, nbytes);
+		}
+		break;
+	case 8:
+		if (nbytes == 8) {
+			UNPACK_ROWS(u64, 8);
+		} else {
+			UNPACK_ROWS(u64, nbytes);
+		}
+		break;
+	default: return 0;
+	}
+	return 1;
+}
 
-#endif
-				break;
+static void unpack_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	unpack_run* r = (unpack_run*)ctx;
+	int ncols     = r->digest->num_items;
+	size_t item, slice, r0, r1;
+
+	for (item = begin; item < end; item++) {
+		slice = item / ncols;
+		r0    = r->rows * slice / r->nslices;
+		r1    = r->rows * (slice + 1) / r->nslices;
+		if (!unpack_column(&r->the_data[item % ncols], r->base + r0 * r->stride, r->stride,
+		                   r->row + r0, r1 - r0)) {
+			r->failed = (int)(item % ncols) + 1;
+		}
+	}
+}
 
-			case UNSIGNED_MSB_INT:
-			case UNSIGNED_LSB_INT: tmp_u64 = 0; mybyte = (u8*)&tmp_u64;
+/* decode r->rows records into every column; reports its own errors */
+static int unpack_rows(unpack_run* r)
+{
+	int ncols    = r->digest->num_items;
+	int nthreads = dv_num_threads();
+	column_attributes* attr;
+	size_t items;
 
-#ifdef WORDS_BIGENDIAN
-				if (letter == UNSIGNED_LSB_INT) {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[7 - i] = buf[i];
-					}
-				} else {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[i + (8 - numbytes)] = buf[i];
-					}
-				}
+	r->nslices = 1;
+	if (ncols < nthreads && r->rows >= 2 * UNPACK_SLICE_ROWS) {
+		r->nslices = min((nthreads + ncols - 1) / ncols, (int)(r->rows / UNPACK_SLICE_ROWS));
+	}
+	items = (size_t)ncols * r->nslices;
 
-				memcpy(loc, &mybyte[8 - al_bytes], al_bytes);
+	r->failed = 0;
+	dv_parallel_for(items, (r->rows * ncols < UNPACK_SLICE_ROWS ? items : 1), unpack_kernel, r);
 
-#else
-				if (letter == UNSIGNED_MSB_INT) {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[numbytes - 1 - i] = buf[i];
-					}
-				} else {
-					for (i = 0; i < numbytes; i++) {
-						mybyte[i] = buf[i];
-					}
-				}
+	if (r->failed) {
+		attr = r->the_data[r->failed - 1].input;
+		if (attr->type == STRING) {
+			memory_error(ENOMEM, attr->adj_bytesize);
+		} else {
+			parse_error("Unable to unpack %d byte column %s", attr->adj_bytesize, attr->col_name);
+		}
+		return 0;
+	}
+	return 1;
+}
 
-				memcpy(loc, mybyte, al_bytes);
+/* decode input->rows records, step records apart, starting at byte first */
+static int read_rows(data* the_data, unpack_digest* input, FILE* file, off_t first, int rec_length,
+                     int step)
+{
+	unpack_run r;
+	struct stat sbuf;
+	size_t stride = (size_t)step * rec_length;
+	size_t rows   = input->rows;
+	size_t block_rows, n, i;
+	u8* buf;
+	int ok;
+
+	r.the_data = the_data;
+	r.digest   = input;
+
+#ifndef _WIN32
+	if (fstat(fileno(file), &sbuf) == 0) {
+		u8* map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (map != MAP_FAILED) {
+			r.base = map + first;
+			r.stride = stride;
+			r.row    = 0;
+			r.rows   = rows;
+			ok       = unpack_rows(&r);
+			munmap(map, sbuf.st_size);
+			return ok;
+		}
+	}
+#endif /* _WIN32 */
 
-#endif
+	block_rows = max(UNPACK_BLOCK_BYTES / rec_length, 1);
+	block_rows = min(block_rows, rows);
+	if ((buf = (u8*)malloc(block_rows * rec_length)) == NULL) {
+		memory_error(errno, block_rows * rec_length);
+		return 0;
+	}
 
-				break;
+	r.base   = buf;
+	r.stride = rec_length;
+	for (r.row = 0; r.row < rows; r.row += n) {
+		n = min(block_rows, rows - r.row);
 
-			default:
-				parse_error("read_data(): Unknown type: %c\n", letter);
+		if (step == 1) {
+			if (fseek(file, first + (off_t)r.row * rec_length, SEEK_SET) ||
+			    fread(buf, rec_length, n, file) != n) {
+				parse_error("Error reading data: %s", strerror(errno));
+				free(buf);
 				return 0;
-				break;
-
-			} // end switch type
-
-			buf = &buf[numbytes]; // skip forward for multiplicity if necessary
+			}
+		} else {
+			for (i = 0; i < n; i++) {
+				if (fseek(file, first + (off_t)(r.row + i) * stride, SEEK_SET) ||
+				    fread(buf + i * rec_length, rec_length, 1, file) != 1) {
+					parse_error("Error reading data: %s", strerror(errno));
+					free(buf);
+					return 0;
+				}
+			}
+		}
 
-		} // end for columns
-	}     // end for num_items
+		r.rows = n;
+		if (!unpack_rows(&r)) {
+			free(buf);
+			return 0;
+		}
+	}
 
+	free(buf);
 	return 1;
 }
 
 
-
 // upgrade_types() is now a no-op function since Davinci now supports all types.
 // We could change this to try to fit the data in the smallest possible
 // type to try to save memory
@@ -1328,9 +1417,8 @@ static data* parse_struct(Var* toPack, Var* column_names, int* numData, int* gre
 			return NULL;
 		}
 
-		// some way to store size of strarray or array (i.e. y dimension of the element) for later
-		// use
-		reg_data[i].numbytes = rows;
+		// y dimension of the element, so shorter columns can be padded
+		reg_data[i].rows = rows;
 		*greatestNumRows     = rows > *greatestNumRows ? rows : *greatestNumRows;
 	}
 
@@ -1357,6 +1445,8 @@ static int pack(Var* struct_to_pack, data* thedata, char** template_in, char* fi
 	unpack_digest* digest      = NULL;
 	FILE* file                 = NULL;
 	u8* buffer               = NULL;
+	pack_block b;
+	size_t block_rows, n;
 
 	char* template = NULL;
 	char template_buf[1024] = { 0 };
@@ -1503,27 +1593,40 @@ static int pack(Var* struct_to_pack, data* thedata, char** template_in, char* fi
 		return 0;
 	}
 
-	buffer = (u8*)calloc(rec_length + 2, sizeof(u8)); // output buffer +2 (for '\0')
+	// records are packed a block at a time, in parallel, and written with one fwrite()
+	block_rows = max(UNPACK_BLOCK_BYTES / rec_length, 1);
+	block_rows = min(block_rows, rows);
+
+	buffer = (u8*)calloc(block_rows * rec_length + 2, sizeof(u8)); // output buffer +2 (for '\0')
 	if (buffer == NULL) {
-		memory_error(errno, rec_length * sizeof(u8));
+		memory_error(errno, block_rows * rec_length * sizeof(u8));
 		clean_up(0, digest, NULL, NULL, file);
 		return 0;
 	}
 
+	b.the_data   = thedata;
+	b.digest     = digest;
+	b.buffer     = buffer;
+	b.rec_length = rec_length;
+
 	// rows calculated before entering pack()
-	for (i = 0; i < rows; i++) {
+	for (b.row = 0; b.row < rows; b.row += n) {
+		n = min(block_rows, rows - b.row);
+
 		// clear the output record buffer
-		memset(buffer, 0, rec_length);
+		memset(buffer, 0, n * rec_length);
 
 		// write data into buffer
-		if (!pack_row(thedata, digest, i, buffer)) {
+		b.failed = 0;
+		dv_parallel_for(n, PACK_GRAIN, pack_kernel, &b);
+		if (b.failed) {
 			parse_error("Error in writing data to buffer");
 			clean_up(2, digest, buffer, thedata, file);
 			return 0;
 		}
 
 		// write data to file
-		if (!fwrite(buffer, rec_length, 1, file)) {
+		if (fwrite(buffer, rec_length, n, file) != n) {
 			parse_error("Error writing data: %s", strerror(errno));
 			clean_up(2, digest, buffer, thedata, file);
 			return 0;
@@ -1681,6 +1784,18 @@ static int convert_to_ext_fmt(void* from, int ffmt, char* to, int tfmt, int tole
 	return 1;
 }
 
+static void pack_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	pack_block* b = (pack_block*)ctx;
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		if (!pack_row(b->the_data, b->digest, b->row + i, b->buffer + i * b->rec_length)) {
+			b->failed = 1;
+		}
+	}
+}
+
 static int pack_row(data* the_data, unpack_digest* digest, int row, u8* buffer)
 {
 	int j, k, numbytes, al_bytes, columns, start_byte;
@@ -1699,6 +1814,9 @@ static int pack_row(data* the_data, unpack_digest* digest, int row, u8* buffer)
 		src_type    = the_data[j].type;
 		src_columns = the_data[j].input->columns;
 
+		// shorter columns are padded out with 0's
+		if (row >= the_data[j].rows) continue;
+
 		// loop through columns in column attributes
 		for (k = 0; k < columns; k++) {
 			if (k >= src_columns) // src data has fewer columns than specified
@@ -1,105 +1,11 @@
 #include "func.h"
 #include "parser.h"
-
-/**
-*** Cheezy bi-linear interpolation.
-*** Need something both faster and better
-**/
-
-float interp_nn(float x1, float y1, Var* obj, float ignore)
-{
-	int w    = GetX(obj);
-	int h    = GetY(obj);
-	float ix = floor(x1);
-	float iy = floor(y1);
-
-	if (x1 < 0 || x1 >= w || y1 < 0 || y1 >= h) return (ignore);
-	return (extract_float(obj, cpos(ix, iy, 0, obj)));
-}
-
-float interp_bilinear(float x1, float y1, Var* obj, float ignore)
-{
-	int w = GetX(obj);
-	int h = GetY(obj);
-	float ix1, iy1, ix2, iy2, px, py;
-	float xv;
-	float a1, a2, a3, a4;
-
-	if (x1 < 0 || x1 >= w || y1 < 0 || y1 >= h) return (ignore);
-
-	/* pixel centers are assumed to be on steps of 0.5 */
-	x1 = max(x1 - 0.5, 0);
-	y1 = max(y1 - 0.5, 0);
-
-	ix1 = floor(x1);
-	iy1 = floor(y1);
-
-	ix2 = min(ix1 + 1, w - 1);
-	iy2 = min(iy1 + 1, h - 1);
-
-	px = x1 - ix1;
-	py = y1 - iy1;
-
-	a1 = extract_float(obj, cpos(ix1, iy1, 0, obj));
-	a2 = extract_float(obj, cpos(ix2, iy1, 0, obj));
-	a3 = extract_float(obj, cpos(ix1, iy2, 0, obj));
-	a4 = extract_float(obj, cpos(ix2, iy2, 0, obj));
-
-	if (a1 == ignore) {
-		if (px < 0.5)
-			return (ignore);
-		else
-			a1 = a2;
-	}
-	if (a2 == ignore) {
-		if (px >= 0.5)
-			return (ignore);
-		else
-			a2 = a1;
-	}
-	if (a3 == ignore) {
-		if (px < 0.5)
-			return (ignore);
-		else
-			a3 = a4;
-	}
-	if (a4 == ignore) {
-		if (px >= 0.5)
-			return (ignore);
-		else
-			a4 = a3;
-	}
-	if (a1 == ignore) {
-		if (py < 0.5)
-			return (ignore);
-		else {
-			a1 = a3;
-			a2 = a4;
-		}
-	}
-	if (a3 == ignore) {
-		if (py >= 0.5)
-			return (ignore);
-		else {
-			a3 = a1;
-			a4 = a2;
-		}
-	}
-
-	xv = (1.0 - py) * (((1.0 - px) * a1) + ((px)*a2)) + (py) * (((1.0 - px) * a3) + ((px)*a4));
-	return (xv);
-}
-
-void kenel_interpolation()
-{
-}
+#include "resample.h"
 
 // compute inverse of 3x3 matrix.
-float* m_inverse(float* m)
+static void m_inverse(const double* m, double* o)
 {
 	// the inverse is the adjoint divided through the determinant
-	float* o = calloc(9, sizeof(float));
-
 	o[0] = m[4] * m[8] - m[5] * m[7];
 	o[1] = m[2] * m[7] - m[1] * m[8];
 	o[2] = m[1] * m[5] - m[2] * m[4];
@@ -111,31 +17,15 @@ float* m_inverse(float* m)
 	o[6] = m[3] * m[7] - m[4] * m[6];
 	o[7] = m[1] * m[6] - m[0] * m[7];
 	o[8] = m[0] * m[4] - m[1] * m[3];
-
-	return (o);
 }
 
-float* vxm(float* v, float* m)
+// map the point (x, y, 1) through m, as a row vector
+static void vxm(double x, double y, const double* m, double* out)
 {
-	float out[3];
-
-	out[0] = v[0] * m[0] + v[1] * m[3] + v[2] * m[6];
-	out[1] = v[0] * m[1] + v[1] * m[4] + v[2] * m[7];
-	out[2] = v[0] * m[2] + v[1] * m[5] + v[2] * m[8];
+	double w = x * m[2] + y * m[5] + m[8];
 
-	v[0] = out[0] / out[2];
-	v[1] = out[1] / out[2];
-	v[2] = out[2] / out[2];
-	return (v);
-}
-
-float* new_v(float x, float y)
-{
-	float* out = calloc(3, sizeof(float));
-	out[0]     = x;
-	out[1]     = y;
-	out[2]     = 1;
-	return (out);
+	out[0] = (x * m[0] + y * m[3] + m[6]) / w;
+	out[1] = (x * m[1] + y * m[4] + m[7]) / w;
 }
 
 /*
@@ -161,8 +51,8 @@ float* new_v(float x, float y)
 ** where the input corners end up in the output space, and then fit
 ** everything to the right limits.
 **
-** This function will eventually want something more than just my
-** cheap bilinear interpolation algorithm too.
+** The resampling is done by rs_warp(), every band of the object at
+** once.
 */
 
 Var* ff_warp(vfuncptr func, Var* arg)
@@ -170,18 +60,15 @@ Var* ff_warp(vfuncptr func, Var* arg)
 	Var *obj = NULL, *xm = NULL, *oval;
 	float ignore = FLT_MIN;
 	int i, j;
-	float* out;
-	int x, y, n;
+	int x, y;
 	int grow = 0;
-	float m[9];
-	float* minverse;
-	float xmax, xmin, ymax, ymin;
-	float v[3];
-	int dsize;
-	const char* options[] = {"nearest", "bilinear", 0};
+	double m[9];
+	double minverse[9];
+	double xmax, xmin, ymax, ymin;
+	double corner[4][2], v[2];
+	const char* options[] = {"nearest", "bilinear", "bicubic", "lanczos", 0};
 	char* interp          = NULL;
-
-	float (*interp_f)(float, float, Var*, float);
+	int kernel            = RS_NEAREST;
 
 	Alist alist[6];
 
@@ -198,15 +85,18 @@ Var* ff_warp(vfuncptr func, Var* arg)
 		parse_error("%s: No object specified\n", func->name);
 		return (NULL);
 	}
+	if (xm == NULL || V_DSIZE(xm) < 9) {
+		parse_error("%s: matrix must be 3x3\n", func->name);
+		return (NULL);
+	}
 	if (ignore == FLT_MIN) ignore = -32768;
 
 	x = GetX(obj);
 	y = GetY(obj);
-	n = V_SIZE(xm)[2];
 
 	for (j = 0; j < 3; j++) {
 		for (i = 0; i < 3; i++) {
-			m[i + j * 3] = extract_float(xm, cpos(i, j, 0, xm));
+			m[i + j * 3] = extract_double(xm, cpos(i, j, 0, xm));
 		}
 	}
 
@@ -216,36 +106,24 @@ Var* ff_warp(vfuncptr func, Var* arg)
 
 	if (grow) {
 		/* figure out the size of the output array */
-		float* out;
-		minverse = m_inverse(m);
-
-		out  = vxm(new_v(0, 0), minverse);
-		xmin = out[0];
-		xmax = out[0];
-		ymin = out[1];
-		ymax = out[1];
-		free(out);
-
-		out  = vxm(new_v(x, 0), minverse);
-		xmin = min(xmin, out[0]);
-		xmax = max(xmax, out[0]);
-		ymin = min(ymin, out[1]);
-		ymax = max(ymax, out[1]);
-		free(out);
-
-		out  = vxm(new_v(0, y), minverse);
-		xmin = min(xmin, out[0]);
-		xmax = max(xmax, out[0]);
-		ymin = min(ymin, out[1]);
-		ymax = max(ymax, out[1]);
-		free(out);
-
-		out  = vxm(new_v(x, y), minverse);
-		xmin = min(xmin, out[0]);
-		xmax = max(xmax, out[0]);
-		ymin = min(ymin, out[1]);
-		ymax = max(ymax, out[1]);
-		free(out);
+		m_inverse(m, minverse);
+
+		corner[0][0] = 0;
+		corner[0][1] = 0;
+		corner[1][0] = x;
+		corner[1][1] = 0;
+		corner[2][0] = 0;
+		corner[2][1] = y;
+		corner[3][0] = x;
+		corner[3][1] = y;
+
+		for (i = 0; i < 4; i++) {
+			vxm(corner[i][0], corner[i][1], minverse, v);
+			xmin = i ? min(xmin, v[0]) : v[0];
+			xmax = i ? max(xmax, v[0]) : v[0];
+			ymin = i ? min(ymin, v[1]) : v[1];
+			ymax = i ? max(ymax, v[1]) : v[1];
+		}
 
 		xmax = ceil(xmax);
 		xmin = floor(xmin);
@@ -256,27 +134,14 @@ Var* ff_warp(vfuncptr func, Var* arg)
 		printf("  %fx%f , %fx%f\n", xmin, ymin, xmax, ymax);
 	}
 
-	if (interp == NULL || !strcmp(interp, "nearest")) {
-		interp_f = interp_nn;
-	} else if (!strcmp(interp, "bilinear")) {
-		interp_f = interp_bilinear;
-	} else {
+	if (interp != NULL && (kernel = rs_kernel(interp)) < 0) {
 		parse_error("Invalid interpolation function\n");
 		return (NULL);
 	}
 
-	dsize = (xmax - xmin) * (ymax - ymin);
-	out   = calloc(dsize, sizeof(float));
-	oval  = newVal(BSQ, xmax - xmin, ymax - ymin, 1, DV_FLOAT, out);
-
-	for (j = ymin; j < ymax; j++) {
-		for (i = xmin; i < xmax; i++) {
-			v[0] = i + 0.5;
-			v[1] = j + 0.5;
-			v[2] = 1;
-			vxm(v, m);
-			out[cpos((int)(i - xmin), (int)(j - ymin), 0, oval)] = interp_f(v[0], v[1], obj, ignore);
-		}
+	oval = rs_warp(obj, m, xmin, ymin, (size_t)(xmax - xmin), (size_t)(ymax - ymin), kernel, ignore, DV_FLOAT);
+	if (oval == NULL) {
+		parse_error("%s: unable to allocate memory", func->name);
 	}
 	return (oval);
 }
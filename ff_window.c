@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "parallel.h"
 #include "window.h"
 
 /*
@@ -148,6 +149,124 @@ void free_window(Window* w)
 	free(w);
 }
 
+/*
+** Tiled window operations
+*/
+
+Tile* create_tile(int width, int height)
+{
+	Tile* t = calloc(1, sizeof(Tile));
+
+	if (t == NULL) return (NULL);
+	t->width  = width;
+	t->height = height;
+	t->bw     = WINDOW_TILE + width - 1;
+	t->bh     = WINDOW_TILE + height - 1;
+	t->data   = malloc((size_t)t->bw * t->bh * sizeof(float));
+	t->row    = calloc(height, sizeof(float*));
+	if (t->data == NULL || t->row == NULL) {
+		free_tile(t);
+		return (NULL);
+	}
+	return (t);
+}
+
+void load_tile(Tile* t, Var* obj, int x0, int y0, float ignore)
+{
+	int x = GetX(obj);
+	int y = GetY(obj);
+	int i, j, p, q;
+	size_t stride[3];
+	float* d;
+
+	cstrides(obj, stride);
+	for (j = 0; j < t->bh; j++) {
+		d = t->data + (size_t)j * t->bw;
+		q = y0 + j - t->height / 2;
+		for (i = 0; i < t->bw; i++) {
+			p = x0 + i - t->width / 2;
+			if (p < 0 || p >= x || q < 0 || q >= y) {
+				d[i] = ignore;
+			} else {
+				d[i] = extract_float(obj, p * stride[0] + q * stride[1]);
+			}
+		}
+	}
+}
+
+float** tile_window(Tile* t, int i, int j)
+{
+	int r;
+
+	for (r = 0; r < t->height; r++) {
+		t->row[r] = t->data + (size_t)(j + r) * t->bw + i;
+	}
+	return (t->row);
+}
+
+void free_tile(Tile* t)
+{
+	free(t->data);
+	free(t->row);
+	free(t);
+}
+
+typedef struct {
+	Var* obj;
+	float ignore;
+	tile_fn fn;
+	void* ctx;
+	Tile** tiles; /* one for each thread */
+	int ntx;      /* tiles across */
+} tile_job;
+
+static void window_tile_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	tile_job* job = (tile_job*)ctx;
+	Tile* t       = job->tiles[tid];
+	int x         = GetX(job->obj);
+	int y         = GetY(job->obj);
+	int x0, y0;
+	size_t n;
+
+	for (n = begin; n < end; n++) {
+		x0 = (n % job->ntx) * WINDOW_TILE;
+		y0 = (n / job->ntx) * WINDOW_TILE;
+		load_tile(t, job->obj, x0, y0, job->ignore);
+		job->fn(job->ctx, t, x0, y0, min(WINDOW_TILE, x - x0), min(WINDOW_TILE, y - y0), tid);
+	}
+}
+
+int window_tiles(Var* obj, int width, int height, float ignore, tile_fn fn, void* ctx)
+{
+	tile_job job;
+	size_t ntiles;
+	int i, nt, ok = 1;
+
+	job.obj    = obj;
+	job.ignore = ignore;
+	job.fn     = fn;
+	job.ctx    = ctx;
+	job.ntx    = (GetX(obj) + WINDOW_TILE - 1) / WINDOW_TILE;
+	ntiles     = (size_t)job.ntx * ((GetY(obj) + WINDOW_TILE - 1) / WINDOW_TILE);
+	if (ntiles == 0) return (1);
+
+	nt        = dv_parallel_chunks(ntiles, 1);
+	job.tiles = calloc(nt, sizeof(Tile*));
+	if (job.tiles == NULL) return (0);
+	for (i = 0; i < nt; i++) {
+		if ((job.tiles[i] = create_tile(width, height)) == NULL) ok = 0;
+	}
+
+	if (ok) dv_parallel_for(ntiles, 1, window_tile_kernel, &job);
+
+	for (i = 0; i < nt; i++) {
+		if (job.tiles[i]) free_tile(job.tiles[i]);
+	}
+	free(job.tiles);
+	return (ok);
+}
+
 /*
 ** Rolling window histogram operations
 */
@@ -25,18 +25,24 @@ Var* ff_write(vfuncptr func, Var* arg)
 	int header      = 0;    /* for csv */
 	int force       = 0;    /* Force file overwrite */
 	int hdf_old     = 0;    // write hdf file backward like davinci used to
+	int precision   = -1;   /* for csv and ascii */
 	unsigned short iom_type_idx, iom_type_found;
-
-	Alist alist[9];
-	alist[0]      = make_alist("object", ID_UNK, NULL, &ob);
-	alist[1]      = make_alist("filename", ID_STRING, NULL, &filename);
-	alist[2]      = make_alist("type", ID_ENUM, NULL, &type);
-	alist[3]      = make_alist("title", ID_STRING, NULL, &title);
-	alist[4]      = make_alist("force", DV_INT32, NULL, &force);
-	alist[5]      = make_alist("separator", ID_STRING, NULL, &separator);
-	alist[6]      = make_alist("header", DV_INT32, NULL, &header);
-	alist[7]      = make_alist("hdf_old", DV_INT32, NULL, &hdf_old);
-	alist[8].name = NULL;
+	struct iom_tiff_opts tiff = {0, 0, 0}; /* for tiff */
+
+	Alist alist[13];
+	alist[0]       = make_alist("object", ID_UNK, NULL, &ob);
+	alist[1]       = make_alist("filename", ID_STRING, NULL, &filename);
+	alist[2]       = make_alist("type", ID_ENUM, NULL, &type);
+	alist[3]       = make_alist("title", ID_STRING, NULL, &title);
+	alist[4]       = make_alist("force", DV_INT32, NULL, &force);
+	alist[5]       = make_alist("separator", ID_STRING, NULL, &separator);
+	alist[6]       = make_alist("header", DV_INT32, NULL, &header);
+	alist[7]       = make_alist("hdf_old", DV_INT32, NULL, &hdf_old);
+	alist[8]       = make_alist("tile", DV_INT32, NULL, &tiff.tile);
+	alist[9]       = make_alist("overviews", DV_INT32, NULL, &tiff.overviews);
+	alist[10]      = make_alist("bigtiff", DV_INT32, NULL, &tiff.bigtiff);
+	alist[11]      = make_alist("precision", DV_INT32, NULL, &precision);
+	alist[12].name = NULL;
 
 	if (parse_args(func, arg, alist) == 0) return (NULL);
 
@@ -48,6 +54,11 @@ Var* ff_write(vfuncptr func, Var* arg)
 		return (NULL);
 	}
 
+	if (precision < -1 || precision > 17) {
+		parse_error("%s: precision must be from 0 to 17", func->name);
+		return (NULL);
+	}
+
 	/**
 	** get filename.  Verify type
 	**/
@@ -69,6 +80,12 @@ Var* ff_write(vfuncptr func, Var* arg)
 		title = (char*)"DV data product";
 	}
 
+	if ((tiff.tile || tiff.overviews || tiff.bigtiff) && strncasecmp(type, "tif", 3)) {
+		parse_error("%s: tile, overviews and bigtiff only apply to TIFF files", func->name);
+		free(filename);
+		return (NULL);
+	}
+
 	/* Check type against list of types supported by iomedley. */
 
 	iom_type_idx = iom_type_found = 0;
@@ -81,7 +98,9 @@ Var* ff_write(vfuncptr func, Var* arg)
 		iom_type_idx++;
 	}
 
-	if (iom_type_found)
+	if (iom_type_found && !strncasecmp(type, "tif", 3))
+		dv_WriteTIFF(ob, filename, force, &tiff);
+	else if (iom_type_found)
 		dv_WriteIOM(ob, filename, type, force);
 	else if (!strcasecmp(type, "raw"))
 		dv_WriteRaw(ob, filename, force);
@@ -95,9 +114,9 @@ Var* ff_write(vfuncptr func, Var* arg)
 	else if (!strcasecmp(type, "ppm"))
 		dv_WritePPM(ob, filename, force);
 	else if (!strcasecmp(type, "ascii"))
-		WriteAscii(ob, filename, force);
+		WriteAscii(ob, filename, force, precision);
 	else if (!strcasecmp(type, "csv"))
-		dv_WriteCSV(ob, filename, separator, header, force);
+		dv_WriteCSV(ob, filename, separator, header, force, precision);
 	else if (!strcasecmp(type, "ers"))
 		dv_WriteERS(ob, filename, force);
 	else if (!strcasecmp(type, "imath"))
@@ -47,3 +47,9 @@ int rft(COMPLEX* in, unsigned n, COMPLEX* out);
 int realfft(double* in, unsigned n, double* out);
 int realrft(double* in, unsigned n, double* out);
 int Fourier(COMPLEX* in, unsigned n, COMPLEX* out);
+
+/*
+ * Threaded power-of-two 2-D transform of interleaved (re, im) data, in ff_fncc.c
+ */
+int FFT_2D_Size(int n);
+int FFT_2D_Transform(double* a, int rows, int cols, int inverse, int threaded);
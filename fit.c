@@ -1,4 +1,5 @@
 #include "fit.h"
+#include "parallel.h"
 #include "parser.h"
 
 /**
@@ -23,17 +24,26 @@
  **  provided, starting at 1.  If an array containing an dimension of 2xN
  **  is given, the subset 1xN is assumed to be the abscissa, and 2xN, the
  **  data values.
+ **
+ **  If object is a cube (bands, and more than one pixel), the spectrum of
+ **  every pixel is fit on its own, in parallel, and the result is a cube
+ **  with one band per output value.
  **/
 
 Var* lin_fit(Var* x, Var* y, int Row, int plot, double ignore);
-void first_guess(double*, char*, int);
-int fit(int, int);
+static int line_fit(const double* x, const double* y, int n, double* r);
+static void first_guess(fit_state*, const char*, int);
+static int fit(fit_state*, int, int);
 ifptr getfcnptr(const char*, int*, int*, int*, char*);
-int mrqfit(double**, struct data_order, int, int, int, double*, int, int, double**, double*, ifptr, int);
+int mrqfit(double**, struct data_order, int, int, int, double*, int, int, double**, double*, ifptr, int,
+           double*);
 int alpha_beta_chisq(double**, struct data_order, int, int, double*, int, int, double**, double*,
                      double*, ifptr);
-void gd(Var*, Var*, const char*, double);
+static int fit_state_init(fit_state*, const char*, int);
+static void fit_state_free(fit_state*);
+static void gd(fit_state*, Var*, Var*, double);
 int dfit(Var*, Var*, Var*, const char*, int, double**, int*, int, int, double);
+static Var* fit_cube(vfuncptr, Var*, Var*, Var*, const char*, int, double);
 
 Var* ff_fit(vfuncptr func, Var* arg)
 {
@@ -80,6 +90,10 @@ Var* ff_fit(vfuncptr func, Var* arg)
 	** }
 	*/
 
+	if (GetZ(y) > 1 && GetX(y) * GetY(y) > 1) {
+		return fit_cube(func, x, y, ip, ftype, iter, ignore);
+	}
+
 	if (x && (V_DSIZE(x) != V_DSIZE(y))) {
 		sprintf(error_buf, "%s: X axis for data [%ld points] not same size as Y axis [%ld points]",
 		        func->name, V_DSIZE(x), V_DSIZE(y));
@@ -105,6 +119,7 @@ Var* ff_fit(vfuncptr func, Var* arg)
 	}
 
 	if (ret != 0) {
+		free(op);
 		return NULL;
 	}
 
@@ -127,56 +142,35 @@ Var* lin_fit(Var* x, Var* y, int Row, int plot, double ignore)
 	char buf[256];
 	FILE* fp;
 	int i, count;
-	double **A, **Cov, *B, *r;
-	double x1, y1;
-
-	A   = dmatrix(2, 2);
-	Cov = dmatrix(2, 2);
-	B   = dvector(2);
-	r   = dvector(2);
+	double *xs, *ys, *r;
 
-	Cov[0][0] = A[0][0] = 0.0;
-	Cov[0][1] = A[0][1] = 0.0;
-	r[0] = B[0] = Cov[1][0] = A[1][0] = 0.0;
-	r[1] = B[1] = Cov[1][1] = A[1][1] = 0.0;
+	xs = dvector(Row);
+	ys = dvector(Row);
+	r  = dvector(2);
 
 	count = 0;
 	for (i = 0; i < Row; i++) {
-		x1 = ((x == NULL) ? i + 1 : extract_double(x, i)); /* a */
-		y1 = extract_double(y, i);                         /*b*/
-
-		if (x1 == ignore || y1 == ignore) continue;
+		xs[count] = ((x == NULL) ? i + 1 : extract_double(x, i)); /* a */
+		ys[count] = extract_double(y, i);                         /*b*/
 
+		if (xs[count] == ignore || ys[count] == ignore) continue;
 		count++;
-
-		A[0][1] += x1;
-		A[1][0] += x1;
-		A[1][1] += (x1 * x1);
-
-		B[0] += y1;
-		B[1] += (x1 * y1);
 	}
-	A[0][0] = (float)count;
-
-	solve_for_da(A, Cov, B, r, 2);
-
-	free_dmatrix(A, 2, 2);
-	free_dmatrix(Cov, 2, 2);
-	free(B);
+	if (line_fit(xs, ys, count, r)) myerror("GAUSSJ: Singular Matrix");
 
 	if (plot) {
 		tmp = make_temp_file_path();
 		if (tmp == NULL || (fp = fopen(tmp, "w")) == NULL) {
 			parse_error("unable to open temp file");
 			if (tmp) free(tmp);
+			free(xs);
+			free(ys);
+			free(r);
 			return NULL;
 		}
 
-		for (i = 0; i < Row; i++) {
-			x1 = ((x == NULL) ? i + 1 : extract_double(x, i)); /* a */
-			y1 = extract_double(y, i);                         /*b*/
-			if (x1 == ignore || y1 == ignore) continue;
-			fprintf(fp, "%g %g\n", x1, y1);
+		for (i = 0; i < count; i++) {
+			fprintf(fp, "%g %g\n", xs[i], ys[i]);
 		}
 
 		fclose(fp);
@@ -191,28 +185,90 @@ Var* lin_fit(Var* x, Var* y, int Row, int plot, double ignore)
 		free(tmp);
 		send_to_plot(buf);
 	}
+	free(xs);
+	free(ys);
 	return newVal(BSQ, 2, 1, 1, DV_DOUBLE, r);
 }
 
-static double* a      = NULL; /* array of parameters for fit */
-static double** covar = NULL; /* covariant matrix for fit */
+/* least squares line r[0] + r[1]*x through n points; nonzero if there isn't one */
+static int line_fit(const double* x, const double* y, int n, double* r)
+{
+	int i, status;
+	double **A, **Cov, *B;
+
+	A   = dmatrix(2, 2);
+	Cov = dmatrix(2, 2);
+	B   = dvector(2);
 
-static char comment[160];
-static int num_indep = 1; /* number of independent variables */
-static struct data_order order;
-static int ndata = 0; /* number of data points */
-static int ma;        /* number of parameters */
-static int mfit;      /* number of parameters being varied */
+	Cov[0][0] = A[0][0] = 0.0;
+	Cov[0][1] = A[0][1] = 0.0;
+	r[0] = B[0] = Cov[1][0] = A[1][0] = 0.0;
+	r[1] = B[1] = Cov[1][1] = A[1][1] = 0.0;
+
+	for (i = 0; i < n; i++) {
+		A[0][1] += x[i];
+		A[1][0] += x[i];
+		A[1][1] += (x[i] * x[i]);
+
+		B[0] += y[i];
+		B[1] += (x[i] * y[i]);
+	}
+	A[0][0] = (float)n;
+
+	status = solve_for_da(A, Cov, B, r, 2);
+
+	free_dmatrix(A, 2, 2);
+	free_dmatrix(Cov, 2, 2);
+	free(B);
+	return status;
+}
 
-static double chisq;     /* squared error for fit */
-static double alamda;    /* how much we change the fitting parameters */
-static double** data;    /* matrix which holds data */
-static int i;            /* indices for loops */
 static int datacols = 6; /* number of columns in the data matrix */
-static int linflag  = 0; /* is function linear */
-static int failed;       /* did function fail? */
-static int jmax;
-ifptr func = NULL;
+
+/*
+** Set up st for fitting up to npts points with the named function.
+** Returns nonzero if there is no such function.
+*/
+static int fit_state_init(fit_state* st, const char* fname, int npts)
+{
+	int i;
+
+	memset(st, 0, sizeof(fit_state));
+	if (!(st->func = getfcnptr(fname, &st->num_indep, &st->linflag, &st->ma, st->comment))) {
+		return 1;
+	}
+	st->mfit = st->ma;
+	st->data = dmatrix(datacols, npts);
+
+	st->order.nsig = 2; /* data column to be all ones: no weighting */
+	st->order.ssig = 4; /* data column used for statistical weighting */
+	st->order.yfit = 3; /* assign a data column for yfit */
+	st->order.sig  = 2;
+
+	st->order.x    = ivector(st->num_indep);
+	st->order.xsig = ivector(st->num_indep);
+
+	for (i = 0; i < st->num_indep; i++) { /* assign default values */
+		st->order.x[i]    = i;
+		st->order.xsig[i] = -1;
+	}
+	st->order.y = st->num_indep; /* dependent variable column */
+
+	st->a     = dvector(st->ma + 2);
+	st->covar = dmatrix(st->ma, st->ma);
+	return 0;
+}
+
+/* frees everything but the parameters, which dfit() hands back */
+static void fit_state_free(fit_state* st)
+{
+	if (st->data) free_dmatrix(st->data, datacols, 0);
+	if (st->covar) free_dmatrix(st->covar, st->ma, st->ma);
+	free(st->order.x);
+	free(st->order.xsig);
+	st->data  = NULL;
+	st->covar = NULL;
+}
 
 int dfit(Var* x, Var* y, Var* ip, const char* fname, int iter, double** op, int* nparam, int plot,
          int verbose, double ignore)
@@ -223,48 +279,55 @@ int dfit(Var* x, Var* y, Var* ip, const char* fname, int iter, double** op, int*
 	char* tmp;
 	int status;
 	int i;
+	fit_state st;
 
-	gd(x, y, fname, ignore); /* load data, and function */
+	if (fit_state_init(&st, fname, V_DSIZE(y))) {
+		printf("Function %s not found, try lf to list functions\n", fname);
+		*op = NULL;
+		return 1;
+	}
+	gd(&st, x, y, ignore); /* load data */
 
-	*op = a = dvector(ma + 2);
-	*nparam = ma;
+	*op     = st.a;
+	*nparam = st.ma;
 
-	for (i = 0; i < ma; i++) {
+	for (i = 0; i < st.ma; i++) {
 		if (ip && i < V_DSIZE(ip))
-			a[i] = extract_double(ip, i);
+			st.a[i] = extract_double(ip, i);
 		else
-			a[i] = 0.0;
+			st.a[i] = 0.0;
 	}
-	first_guess(a, (char*)fname, verbose);
+	first_guess(&st, fname, verbose);
 
-	if (ip && V_DSIZE(ip) == ma + 2) {
-		alamda = extract_double(ip, ma + 1);
+	if (ip && V_DSIZE(ip) == st.ma + 2) {
+		st.alamda = extract_double(ip, st.ma + 1);
 	} else {
 		/* start alamda small */
-		alamda = 1e-3;
+		st.alamda = 1e-3;
 	}
-	status = fit(iter, verbose); /* fit using the given number of iterations */
+	status = fit(&st, iter, verbose); /* fit using the given number of iterations */
 
 	/* put return values in place */
-	a[ma]     = chisq;
-	a[ma + 1] = alamda;
+	st.a[st.ma]     = st.chisq;
+	st.a[st.ma + 1] = st.alamda;
 
 	if (plot) {
 		tmp = make_temp_file_path();
 		if (tmp == NULL || (fp = fopen(tmp, "w")) == NULL) {
 			parse_error("unable to open temp file");
 			if (tmp) free(tmp);
+			fit_state_free(&st);
 			return 0;
 		}
-		for (i = 0; i < ndata; i++) {
-			fprintf(fp, "%g %g\n", data[0][i], data[1][i]);
+		for (i = 0; i < st.ndata; i++) {
+			fprintf(fp, "%g %g\n", st.data[0][i], st.data[1][i]);
 		}
 		fclose(fp);
-		for (i = 0; i < ma; i++) {
-			sprintf(buf, "a%d=%g\n", i, a[i]);
+		for (i = 0; i < st.ma; i++) {
+			sprintf(buf, "a%d=%g\n", i, st.a[i]);
 			send_to_plot(buf);
 		}
-		strcpy(buf2, comment);
+		strcpy(buf2, st.comment);
 		p = strchr(buf2, '=');
 		send_to_plot("set noparametric\n");
 		sprintf(buf, "plot \"%s\" using 1:2 with points, %s with lines\n", tmp, p + 1);
@@ -273,21 +336,22 @@ int dfit(Var* x, Var* y, Var* ip, const char* fname, int iter, double** op, int*
 		send_to_plot(buf);
 	}
 
-	free(data);
-
-	if (verbose) printf("%s\n", comment);
-	return failed;
+	if (verbose) printf("%s\n", st.comment);
+	fit_state_free(&st);
+	return status;
 }
 
-void first_guess(double* a, char* fname, int verbose)
+static void first_guess(fit_state* st, const char* fname, int verbose)
 {
 	int i;
 	int maxi = 0, mini = 0, left, right;
 	float avg = 0.0;
-	double *x, *y;
+	double *x, *y, *a;
+	int ndata = st->ndata;
 
-	x = data[0];
-	y = data[1];
+	x = st->data[0];
+	y = st->data[1];
+	a = st->a;
 
 	// find minimum and maximum.
 	for (i = 0; i < ndata; i++) {
@@ -305,7 +369,7 @@ void first_guess(double* a, char* fname, int verbose)
 		/* guess at left and right extents for width  */
 
 		left  = max(maxi - 1, 0);
-		right = min(maxi + 1, ndata);
+		right = min(maxi + 1, ndata - 1);
 		while (left > 0 && y[left] <= y[maxi]) left--;
 		while (right < (ndata - 1) && y[right] <= y[maxi]) right++;
 
@@ -336,66 +400,172 @@ void first_guess(double* a, char* fname, int verbose)
 	if (verbose) fprintf(stderr, "guess: %f %f %f\n", a[0], a[1], a[2]);
 }
 
-void gd(Var* x, Var* y, const char* fname, double ignore)
+static void gd(fit_state* st, Var* x, Var* y, double ignore)
 {
-	data  = dmatrix(datacols, V_DSIZE(y));
-	jmax  = 2;
-	ndata = 0;
+	size_t i;
+	double** data = st->data;
 
+	st->ndata = 0;
 	for (i = 0; i < V_DSIZE(y); i++) {
 		/* this supplies a fake x axis if one isn't present. */
 		/* also handles an ignore value */
-		data[0][ndata] = ((x == NULL) ? i + 1 : extract_double(x, i));
-		data[1][ndata] = extract_double(y, i);
-		if (data[0][ndata] == ignore || data[1][ndata] == ignore) continue;
+		data[0][st->ndata] = ((x == NULL) ? i + 1 : extract_double(x, i));
+		data[1][st->ndata] = extract_double(y, i);
+		if (data[0][st->ndata] == ignore || data[1][st->ndata] == ignore) continue;
 
-		data[jmax][ndata] = 1; /* weighting column of ones */
-		ndata++;
+		data[2][st->ndata] = 1; /* weighting column of ones */
+		st->ndata++;
 	}
+}
 
-	order.nsig = jmax + 0; /* data column to be all ones: no weighting */
-	order.ssig = jmax + 2; /* data column used for statistical weighting */
-	order.yfit = jmax + 1; /* assign a data column for yfit */
-
-	if (jmax == 2 && num_indep == 1) order.sig = 2;
-	if (jmax == 3 && num_indep == 2) order.sig = 3;
+static int fit(fit_state* st, int itmax, int verbose)
+{
+	int failed;
 
-	if (!(func = getfcnptr(fname, &num_indep, &linflag, &ma, comment))) {
-		printf("Function %s not found, try lf to list functions\n", fname);
-		return;
+	/* nonzero returns 1 if all sigma's are non-zero */
+	if (nonzero(st->data[st->order.sig], st->ndata)) {
+		failed = mrqfit(st->data, st->order, st->num_indep, st->ndata, itmax, st->a, st->ma, st->mfit,
+		                st->covar, &st->chisq, st->func, verbose, &st->alamda);
+	} else {
+		failed = 1;
+		printf("all sigmas must be non-zero, check weighting and order\n");
 	}
+	if (failed != 0) printf("fit failed\n");
+
+	return failed;
+}
+
+/*
+** Fitting a cube: the spectrum of each pixel is a separate fit.  Every
+** worker has its own fit_state, so the fits share nothing but the inputs.
+*/
+typedef struct {
+	Var *x, *y, *ip;
+	int xcube, ipcube; /* x, start given per pixel */
+	size_t nx, ny, nz, nip;
+	const char* fname;
+	int linear, iter, nout;
+	double ignore;
+	double* out; /* nx by ny by nout */
+} fit_job;
+
+static void fit_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	fit_job* job = (fit_job*)ctx;
+	size_t plane = job->nx * job->ny;
+	size_t p, k, px, py;
+	double xv, yv;
+	int i, bad;
+	fit_state st;
+
+	fit_state_init(&st, job->linear ? "linear" : job->fname, job->nz);
+
+	for (p = begin; p < end; p++) {
+		px = p % job->nx;
+		py = p / job->nx;
+
+		st.ndata = 0;
+		for (k = 0; k < job->nz; k++) {
+			if (job->x == NULL) {
+				xv = k + 1;
+			} else {
+				xv = extract_double(job->x, job->xcube ? cpos(px, py, k, job->x) : k);
+			}
+			yv = extract_double(job->y, cpos(px, py, k, job->y));
+			if (xv == job->ignore || yv == job->ignore) continue;
+
+			st.data[0][st.ndata] = xv;
+			st.data[1][st.ndata] = yv;
+			st.data[2][st.ndata] = 1;
+			st.ndata++;
+		}
 
-	order.x    = ivector(num_indep);
-	order.xsig = ivector(num_indep);
+		if (job->linear) {
+			bad = st.ndata < 3 || line_fit(st.data[0], st.data[1], st.ndata, st.a);
+		} else if (st.ndata < 3) {
+			bad = 1;
+		} else {
+			for (i = 0; i < st.ma; i++) {
+				if (job->ipcube && (size_t)i < job->nip)
+					st.a[i] = extract_double(job->ip, cpos(px, py, i, job->ip));
+				else if (job->ip && (size_t)i < job->nip)
+					st.a[i] = extract_double(job->ip, i);
+				else
+					st.a[i] = 0.0;
+			}
+			first_guess(&st, job->fname, 0);
 
-	for (i = 0; i < num_indep; i++) { /* assign default values */
-		order.x[i]    = i;
-		order.xsig[i] = -1;
+			st.alamda = 1e-3;
+			if (job->nip == (size_t)st.ma + 2) {
+				st.alamda = extract_double(job->ip, job->ipcube ? cpos(px, py, st.ma + 1, job->ip) : st.ma + 1);
+			}
+			bad = mrqfit(st.data, st.order, 1, st.ndata, job->iter, st.a, st.ma, st.mfit, st.covar,
+			             &st.chisq, st.func, 0, &st.alamda);
+			st.a[st.ma]     = st.chisq;
+			st.a[st.ma + 1] = st.alamda;
+		}
+
+		for (i = 0; i < job->nout; i++) {
+			job->out[i * plane + p] = bad ? job->ignore : st.a[i];
+		}
 	}
-	order.y = num_indep; /* dependent variable column */
 
-	covar = dmatrix(ma, ma);
-	mfit  = ma;
+	fit_state_free(&st);
+	free(st.a);
 }
 
-int fit(int itmax, int verbose)
+static Var* fit_cube(vfuncptr func, Var* x, Var* y, Var* ip, const char* ftype, int iter, double ignore)
 {
-	/* nonzero returns 1 if all sigma's are non-zero */
-	if (nonzero(data[order.sig], ndata)) {
-		failed = mrqfit(data, order, num_indep, ndata, itmax, a, ma, mfit, covar, &chisq, func, verbose);
-	} else {
-		failed = 1;
-		printf("all sigmas must be non-zero, check weighting and order\n");
+	fit_job job;
+	int num_indep, linflag, ma;
+	char comment[160];
+
+	memset(&job, 0, sizeof(job));
+	job.x      = x;
+	job.y      = y;
+	job.ip     = ip;
+	job.nx     = GetX(y);
+	job.ny     = GetY(y);
+	job.nz     = GetZ(y);
+	job.iter   = iter;
+	job.ignore = ignore;
+	job.linear = !strcmp(ftype, "linear");
+	job.fname  = strcmp(ftype, "linear_chi") ? ftype : "linear";
+
+	if (job.nz < 3) {
+		parse_error("Can not fit less than 3 points\n");
+		return NULL;
+	}
+	if (x) {
+		job.xcube = GetX(x) == job.nx && GetY(x) == job.ny && GetZ(x) == job.nz;
+		if (!job.xcube && V_DSIZE(x) != job.nz) {
+			parse_error("%s: X axis must have one value per band [%ld], or match Y", func->name,
+			            job.nz);
+			return NULL;
+		}
 	}
-	if (failed != 0) printf("fit failed\n");
 
-	/* free allocated arrays (except data, which is free'd later) */
+	getfcnptr(job.fname, &num_indep, &linflag, &ma, comment);
+	if (ma < 0 || num_indep != 1) {
+		parse_error("%s: type=%s can't be fit over a cube", func->name, ftype);
+		return NULL;
+	}
+	job.nout = job.linear ? 2 : ma + 2;
 
-	if (covar != NULL) free_dmatrix(covar, ma, ma);
-	free(order.x);
-	free(order.xsig);
+	if (ip) {
+		job.ipcube = GetX(ip) == job.nx && GetY(ip) == job.ny;
+		job.nip    = job.ipcube ? GetZ(ip) : V_DSIZE(ip);
+	}
 
-	return failed;
+	job.out = (double*)calloc(job.nx * job.ny * job.nout, sizeof(double));
+	if (job.out == NULL) {
+		parse_error("%s: unable to allocate %ld bytes", func->name,
+		            job.nx * job.ny * job.nout * sizeof(double));
+		return NULL;
+	}
+	dv_parallel_for(job.nx * job.ny, 16, fit_kernel, &job);
+
+	return newVal(BSQ, job.nx, job.ny, job.nout, DV_DOUBLE, job.out);
 }
 
 /* calculates alpha, beta, and chisq */
@@ -406,11 +576,8 @@ int fit(int itmax, int verbose)
 /* this function does this by gauss-jordan */
 /* elimination */
 
-/* declarations for data declared externally */
-void myerror(const char*);
-
 int mrqfit(double** data, struct data_order order, int num_indep, int ndata, int itmax, double* a,
-           int ma, int mfit, double** covar, double* chisq, ifptr func, int verbose)
+           int ma, int mfit, double** covar, double* chisq, ifptr func, int verbose, double* alamda)
 {
 	int i, j, k; /* indices for loops */
 	double** alpha;
@@ -446,9 +613,15 @@ int mrqfit(double** data, struct data_order order, int num_indep, int ndata, int
 			for (k = 0; k < mfit; k++) {
 				alpha_try[j][k] = alpha[j][k];
 			}
-			alpha_try[j][j] = alpha[j][j] + alamda;
+			alpha_try[j][j] = alpha[j][j] + *alamda;
+		}
+		if (solve_for_da(alpha_try, covar, beta, da, mfit)) {
+			/* singular: damp harder and try again */
+			*alamda *= 10;
+			if (*alamda > 1e15) *alamda /= 3e14;
+			i++;
+			continue;
 		}
-		solve_for_da(alpha_try, covar, beta, da, mfit);
 
 		for (j = 0; j < ma; j++) atry[j] = a[j];
 		for (j = 0; j < mfit; j++) atry[j] += da[j];
@@ -462,19 +635,19 @@ int mrqfit(double** data, struct data_order order, int num_indep, int ndata, int
 			return 0;
 		}
 		if (*chisq >= ochisq) {
-			alamda *= 10;
-			if (alamda > 1e15) alamda /= 3e14;
+			*alamda *= 10;
+			if (*alamda > 1e15) *alamda /= 3e14;
 			*chisq = ochisq;
 		} else {
-			alamda *= 0.1;
-			if (alamda < 1e-15) alamda *= 3e14;
+			*alamda *= 0.1;
+			if (*alamda < 1e-15) *alamda *= 3e14;
 			for (j = 0; j < mfit; j++) a[j] = atry[j];
 		}
 
 		if (verbose) {
 			for (j = 0; j < ma; j++) printf("a%d= %g\t", j, a[j]);
 			printf("\nchisqr = %g", *chisq);
-			printf("\nalamda = %g", alamda);
+			printf("\nalamda = %g", *alamda);
 			printf("\n");
 		} else if (verbose)
 			printf("iteration: %d chisqr: %g\n", i, *chisq);
@@ -574,11 +747,12 @@ int alpha_beta_chisq(double** data, struct data_order order, int num_indep, int
 /* the same operations on the matrix b */
 /* This function is very similar to the one in */
 /* Numerical Recipes of the same name. */
+/* Returns nonzero if a is singular */
 
-void gaussj(double** a, int n, double** b, int m)
+int gaussj(double** a, int n, double** b, int m)
 {
 	int *indxc, *indxr, *ipiv;
-	int i, icol, irow, j, k, l, ll;
+	int i, icol = 0, irow = 0, j, k, l, ll;
 	double big, dum, pivinv;
 
 	indxc = ivector(n);
@@ -597,7 +771,7 @@ void gaussj(double** a, int n, double** b, int m)
 							icol = k;
 						}
 					} else if (ipiv[k] > 1) {
-						myerror("GAUSSJ: Singular Matrix-1");
+						goto singular;
 					}
 				}
 			}
@@ -610,7 +784,7 @@ void gaussj(double** a, int n, double** b, int m)
 		indxr[i] = irow;
 		indxc[i] = icol;
 		if (a[icol][icol] == 0.0) {
-			myerror("GAUSSJ: Singular Matrix-2");
+			goto singular;
 		}
 		pivinv        = 1.0 / a[icol][icol];
 		a[icol][icol] = 1.0;
@@ -631,17 +805,25 @@ void gaussj(double** a, int n, double** b, int m)
 	free(ipiv);
 	free(indxr);
 	free(indxc);
+	return 0;
+
+singular:
+	free(ipiv);
+	free(indxr);
+	free(indxc);
+	return 1;
 }
 
 #undef SWAP
 
 /* This program solves the equation alpha*da = beta for da. */
+/* Returns nonzero if alpha is singular */
 /* alpha is a matrix and da and beta are vectors */
 /* covar is used for temporary space */
 
-void solve_for_da(double** alpha, double** covar, double* beta, double* da, int mfit)
+int solve_for_da(double** alpha, double** covar, double* beta, double* da, int mfit)
 {
-	int i, j;
+	int i, j, status;
 	double** mbeta;
 
 	mbeta = dmatrix(mfit, 1);
@@ -650,9 +832,10 @@ void solve_for_da(double** alpha, double** covar, double* beta, double* da, int
 		mbeta[i][0] = beta[i];
 		for (j = 0; j < mfit; j++) covar[i][j] = alpha[i][j];
 	}
-	gaussj(covar, mfit, mbeta, 1);
+	status = gaussj(covar, mfit, mbeta, 1);
 	for (i = 0; i < mfit; i++) da[i] = mbeta[i][0];
 	free_dmatrix(mbeta, mfit, 1);
+	return status;
 }
 
 /* This file contains a bunch of functions for allocating */
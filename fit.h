@@ -29,11 +29,29 @@ static double* dvector(int);           /* allocates a 1-D array of doubles */
 static int* ivector(int);              /* allocates a 1-D array of ints */
 void free_dmatrix(double**, int, int); /* frees a 2-D array of doubles */
 int listfcns(void);                    /* lists the functions available */
+void myerror(const char*);             /* prints an error message */
 
 typedef int (*ifptr)(double*, double*, double*, double*, int, int, int*, int*, double*, double);
 
-/* pointer to the fitting function */
-extern ifptr func;
+/*
+** Everything one fit works with.  Fits that don't share a fit_state
+** can run at the same time.
+*/
+typedef struct {
+	ifptr func;     /* the fitting function */
+	int num_indep;  /* number of independent variables */
+	int linflag;    /* is function linear */
+	int ma;         /* number of parameters */
+	int mfit;       /* number of parameters being varied */
+	int ndata;      /* number of data points */
+	struct data_order order;
+	double** data;  /* matrix which holds data */
+	double* a;      /* parameters, then chisq and alamda */
+	double** covar; /* covariant matrix for fit */
+	double chisq;   /* squared error for fit */
+	double alamda;  /* how much we change the fitting parameters */
+	char comment[160];
+} fit_state;
 
 /* returns pointer to the fitting function */
 ifptr getfuncptr(char* function_name, int* num_indep, int linflag, int* num_parameters, char* comment);
@@ -43,13 +61,13 @@ int get_data(double** data, struct data_order* order, char* filename, int maxrow
 
 /* does the nonlinear fit */
 int mrqfit(double** data, struct data_order order, int num_indep, int ndata, int itmax, double* a,
-           int ma, int mfit, double** covar, double* chisq, int (*func)(), int);
+           int ma, int mfit, double** covar, double* chisq, int (*func)(), int, double* alamda);
 
-void solve_for_da(double**, double**, double*, double*, int);
+int solve_for_da(double**, double**, double*, double*, int);
 int alpha_beta_chisq(double** data, struct data_order order, int num_indep, int ndata, double* a,
                      int ma, int mfit, double** alpha, double* beta, double* chisq, int (*funcs)());
 
-void gaussj(double**, int n, double**, int m);
+int gaussj(double**, int n, double**, int m);
 
 /* nonzero returns 1 if all elements of an array are non-zero */
 int nonzero(double*, int ndata);
@@ -128,8 +128,17 @@ size_t __BIP2BSQ(Var* s1, Var* s2, size_t i);
 size_t __BIP2BIL(Var* s1, Var* s2, size_t i);
 size_t __BIP2BIP(Var* s1, Var* s2, size_t i);
 size_t cpos(size_t x, size_t y, size_t z, Var* v);
+void cstrides(Var* v, size_t stride[3]);
 void xpos(size_t i, Var* v, int* x, int* y, int* z);
 
+/* pp_fuse.c */
+int pp_fuse(Var* n, Var** result); /* evaluate an element-wise tree in one pass */
+
+/* pp_where.c */
+int where_fill(Var* obj, Var* mask, const void* value);
+int where_copy(Var* obj, Var* mask, Var* src);
+Var* where_select(Var* obj, Var* mask, size_t* count);
+
 /* pp_math.c */
 #ifdef __cplusplus
 extern "C" {
@@ -148,6 +157,7 @@ extract_type_proto(double);
 }
 #endif
 
+int is_relop(int op);
 Var* pp_add_strings(Var* a, Var* b);
 Var* pp_math_strings(Var* a, int op, Var* b);
 
@@ -186,7 +196,7 @@ int WriteVicar(Var*, FILE*, char*);
 int WriteERS(Var*, FILE*, char*);
 int WriteIMath(Var* s, FILE* fp, char* filename);
 
-int WriteAscii(Var*, char*, int);
+int WriteAscii(Var*, char*, int, int);
 
 #ifdef HAVE_LIBHDF5
 void WriteHDF5(hid_t parent, char* name, Var* v, int hdf_old);
@@ -219,6 +229,7 @@ size_t rpos(size_t, Var*, Var*);
 /* Calls a davinci function programatically.
    See create_args() for creating and sending args. */
 Var* V_func(const char* name, Var* args);
+vfuncptr find_vfunc(const char* name);
 
 
 
@@ -244,6 +255,7 @@ char* unquote(char* name);
 char* unescape(char* str);
 
 int parse_args(vfuncptr func, Var* args, Alist* alist);
+void free_bindings(vfuncptr func);
 int make_args(int* ac, Var*** av, vfuncptr func, Var* args);
 Alist make_alist(const char* name, int type, void* limits, void* value);
 Var* append_arg(Var*, char*, Var*);
@@ -443,6 +455,8 @@ Var* ff_write_isis_cub(vfuncptr func, Var* args);
 
 double bbr(double, double);
 double btemp(double, double);
+void bbr_block(const double*, const double*, double*, size_t);
+void btemp_block(const double*, const double*, double*, size_t);
 #ifdef __cplusplus
 extern "C" Var* newVal(int org, int x, int y, int z, int format, void* data);
 #else
@@ -514,6 +528,11 @@ void free_struct(Var*);
 /* internal functions for text arrays */
 Var* newString(char* str);
 Var* newText(int rows, char** text);
+TextStore* new_text_store(int rows, size_t nchars);
+TextStore* text_store_copy(char** text, int rows);
+void text_store_release(TextStore* s);
+Var* newTextView(TextStore* s, int row, int rows);
+int text_unshare(Var* v);
 int get_struct_element(const Var* v, const int i, char** name, Var** data);
 int get_struct_count(const Var* v);
 #ifdef __cplusplus
@@ -580,6 +599,7 @@ Var* ff_bindct(vfuncptr func, Var* arg);
 Var* ff_deghost(vfuncptr func, Var* arg);
 Var* ff_deleted(vfuncptr func, Var* arg);
 Var* ff_set_deleted(vfuncptr func, Var* arg);
+Var* ff_compress(vfuncptr func, Var* arg);
 Var* ff_rice(vfuncptr func, Var* arg);
 Var* ff_unrice(vfuncptr func, Var* arg);
 Var* ff_contains(vfuncptr func, Var* arg);
@@ -624,6 +644,7 @@ void dump_version();
 double my_round(double);
 
 Var* ff_binary_op(const char* name, Var* a, Var* b, double (*)(double, double), int);
+Var* ff_binary_op_block(const char* name, Var* a, Var* b, bdfunc, int);
 char* try_remote_load(const char* filename);
 int array_replace(Var* dst, Var* src, Range* r);
 
@@ -637,3 +658,6 @@ int math_operable(Var* a, Var* b);
 int compare_struct(Var* a, Var* b);
 int get_struct_names(const Var* v, char*** names, const char* prefix);
 Var* ff_create_text(vfuncptr func, Var* arg);
+
+Var* dv_tcache_load(const char* fname, const char* func, const char* key);
+int dv_tcache_save(const char* fname, const char* func, const char* key, Var* v);
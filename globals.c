@@ -19,6 +19,9 @@ int SCALE   = 6;
 int VERBOSE = 2;
 int DEPTH   = 2;
 
+// worker threads for parallel kernels, 0 means one per CPU (see parallel.c)
+int NTHREADS = 0;
+
 int allocs = 0;
 Var* VZERO;
 
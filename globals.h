@@ -34,6 +34,7 @@ extern FILE* pfp;
 extern int SCALE;
 extern int VERBOSE;
 extern int DEPTH;
+extern int NTHREADS;
 
 extern int allocs;
 extern Var* VZERO;
@@ -71,7 +71,7 @@ LABEL* LoadLabelFromObjDesc(OBJDESC* tbl, const char* fname)
 	LABEL* l;
 	int i;
 	unsigned short scope;
-	int reclen, nfields, nrows;
+	int reclen, nfields, nrows, ncols;
 	char* name = NULL;
 
 	if ((kw = OdlFindKwd(tbl, "ROW_BYTES", NULL, 0, ODL_THIS_OBJECT)) != NULL) {
@@ -108,13 +108,15 @@ LABEL* LoadLabelFromObjDesc(OBJDESC* tbl, const char* fname)
 	l->nrows   = nrows;
 
 	// get all the column descriptions
-	cvec_init_voidptr(&l->fields, 0, 10, NULL, NULL);
+	cvec_voidptr(&l->fields, 0, 10, NULL, NULL);
 
 	scope = ODL_CHILDREN_ONLY;
 	col   = tbl;
+	ncols = 0;
 	while ((col = OdlNextObjDesc(col, 0, &scope)) != NULL) {
 		if ((f = MakeField(col, l)) != NULL) {
 			cvec_push_voidptr(&l->fields, (void**)&f);
+			ncols++;
 
 			// Fake up some additional fields for bit columns.
 			if (f->eformat == MSB_BIT_FIELD) {
@@ -123,10 +125,11 @@ LABEL* LoadLabelFromObjDesc(OBJDESC* tbl, const char* fname)
 		}
 	}
 
-	if (l->fields.size != nfields) {
+	// bit columns are in fields too, but not in COLUMNS
+	if (ncols != nfields) {
 		fprintf(stderr,
-		        "Wrong number of column definitions in table %s of  %s.  Expected %d, got %zu.\n",
-		        OdlGetObjDescClassName(tbl), fname, nfields, l->fields.size);
+		        "Wrong number of column definitions in table %s of  %s.  Expected %d, got %d.\n",
+		        OdlGetObjDescClassName(tbl), fname, nfields, ncols);
 	}
 
 	return l;
@@ -26,6 +26,10 @@
 #include <sys/types.h>
 #include <tiffio.h>
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 
 /* Photometric names. */
 
@@ -49,6 +53,8 @@ int iom_GetTIFFHeader(FILE*, char*, struct iom_iheader*);
 int iom_ReadTIFF(FILE*, char*, int*, int*, int*, int*, unsigned char**, int*, int*);
 int iom_WriteTIFF(char*, unsigned char*, struct iom_iheader*, int);
 
+static int tiff_read(FILE* fp, char* filename, struct iom_iheader* slice, int* xout, int* yout,
+                     int* zout, int* bits, unsigned char** dout, int* orgout, int* type);
 static int uchar_overflow(unsigned char* data, size_t size);
 static int int_overflow(unsigned char* data, size_t size);
 static int ushort_overflow(unsigned char* data, size_t size);
@@ -109,13 +115,27 @@ int iom_isTIFF(FILE* fp)
 /* iom_GetTIFFHeader() */
 
 int iom_GetTIFFHeader(FILE* fp, char* filename, struct iom_iheader* h)
+{
+	return iom_GetTIFFHeaderSlice(fp, filename, h, NULL);
+}
+
+/*
+** iom_GetTIFFHeaderSlice()
+**
+** Like iom_GetTIFFHeader() but only reads the window given by the s_lo
+** and s_hi of slice (in x, y, band order, 1 based and inclusive, 0 for
+** the whole axis).  The header describes the window; the caller still
+** has to apply any s_skip.
+*/
+
+int iom_GetTIFFHeaderSlice(FILE* fp, char* filename, struct iom_iheader* h, struct iom_iheader* slice)
 {
 
 	int x, y, z, bits, org, type;
 	unsigned char* data;
 	size_t i, dsize;
 
-	if (!iom_ReadTIFF(fp, filename, &x, &y, &z, &bits, &data, &org, &type)) return 0;
+	if (!tiff_read(fp, filename, slice, &x, &y, &z, &bits, &data, &org, &type)) return 0;
 
 	iom_init_iheader(h);
 
@@ -229,18 +249,41 @@ int iom_GetTIFFHeader(FILE* fp, char* filename, struct iom_iheader* h)
 int iom_ReadTIFF(FILE* fp, char* filename, int* xout, int* yout, int* zout, int* bits,
                  unsigned char** dout, int* orgout, int* type)
 {
+	return tiff_read(fp, filename, NULL, xout, yout, zout, bits, dout, orgout, type);
+}
+
+/* copy n pixels of out_pixel bytes from pixels in_pixel bytes apart */
+static void copy_pixels(unsigned char* dst, const unsigned char* src, size_t n, size_t in_pixel,
+                        size_t out_pixel)
+{
+	size_t i;
+
+	if (in_pixel == out_pixel) {
+		memcpy(dst, src, n * in_pixel);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		memcpy(dst + i * out_pixel, src + i * in_pixel, out_pixel);
+	}
+}
+
+/*
+** Read the window of the image selected by slice (see
+** iom_GetTIFFHeaderSlice()), or all of it if slice is NULL.  Only the
+** tiles or scanlines that cross the window are decoded.
+*/
+static int tiff_read(FILE* fp, char* filename, struct iom_iheader* slice, int* xout, int* yout,
+                     int* zout, int* bits, unsigned char** dout, int* orgout, int* type)
+{
 
 	TIFF* tifffp;
-	uint32 x, y, row, tile_width, tile_height, tile_x, tile_y, tile_z, i;
-	uint32 actual_tile_width, actual_tile_height;
+	uint32 x, y, row, tile_width, tile_height, tile_x, tile_y, c0, c1, r0, r1;
+	uint32 dims[3], lo[3], hi[3], nx, ny, nz, plane, first_plane, last_plane, rows_per_strip;
 	tdata_t buffer;
-	size_t row_stride, src_offset, dest_offset;
-	tsize_t tile_size; /* Bytes per tile. */
-	tsize_t tile_row_size, row_bytes;
-	ttile_t tiles_read;
-	unsigned char* data;
-	unsigned short z, bits_per_sample, planar_config, plane, photometric, orient;
-	int x_tile_idx, y_tile_idx, z_tile_idx, x_tiles, y_tiles, tiff_read_error;
+	size_t bytes_per_sample, in_pixel, out_pixel, band_offset, in_row;
+	unsigned char *data, *out;
+	unsigned short z, bits_per_sample, planar_config, photometric, orient;
+	int i, tiled, contig, tiff_read_error;
 
 	rewind(fp);
 
@@ -251,18 +294,18 @@ int iom_ReadTIFF(FILE* fp, char* filename, int* xout, int* yout, int* zout, int*
 	TIFFSetWarningHandler(tiff_warning_handler);
 	TIFFSetErrorHandler(tiff_error_handler);
 
-#if 0
-  if ((tifffp = TIFFFdOpen(fileno(fp), filename, "r")) == NULL) {
-      TIFFError(NULL, "ERROR: unable to open file %s", filename);
-    return 0;
-  }
-#endif
-
 	if ((tifffp = TIFFOpen(filename, "r")) == NULL) {
 		TIFFError(NULL, "ERROR: unable to open file %s", filename);
 		return 0;
 	}
 
+	/* later images are pages, or the overviews iom_WriteTIFFOpts() adds */
+	if (slice != NULL && slice->image > 0 && !TIFFSetDirectory(tifffp, slice->image)) {
+		TIFFError(NULL, "File %s has no image %d.", filename, slice->image);
+		TIFFClose(tifffp);
+		return 0;
+	}
+
 	/* FIX: check for multiple images per file? */
 
 	TIFFGetFieldDefaulted(tifffp, TIFFTAG_BITSPERSAMPLE,
@@ -283,26 +326,6 @@ int iom_ReadTIFF(FILE* fp, char* filename, int* xout, int* yout, int* zout, int*
 		return 0;
 	}
 
-#if 0
-  /* Flip orientation so that image comes in X order.
-     Taken from xv's xvtiff.c.  Why not both ORIENTATION_TOPLEFT? */
-
-  TIFFGetFieldDefaulted(tifffp, TIFFTAG_ORIENTATION, &orient);
-  switch (orient) {
-  case ORIENTATION_TOPLEFT:
-  case ORIENTATION_TOPRIGHT:
-  case ORIENTATION_LEFTTOP:
-  case ORIENTATION_RIGHTTOP:   orient = ORIENTATION_BOTLEFT;   break;
-
-  case ORIENTATION_BOTRIGHT:
-  case ORIENTATION_BOTLEFT:
-  case ORIENTATION_RIGHTBOT:
-  case ORIENTATION_LEFTBOT:    orient = ORIENTATION_TOPLEFT;   break;
-  }
-
-  TIFFSetField(tifffp, TIFFTAG_ORIENTATION, orient);
-#endif
-
 	if (!TIFFGetField(tifffp, TIFFTAG_IMAGEWIDTH, &x)) {
 		TIFFError(NULL, "TIFF image width tag missing.");
 		TIFFClose(tifffp);
@@ -345,127 +368,98 @@ int iom_ReadTIFF(FILE* fp, char* filename, int* xout, int* yout, int* zout, int*
 		// if (!TIFFGetField(tifffp, TIFFTAG_COLORMAP, &red, &green, &blue)) {}
 	}
 
-	// read in an entire tiled image
-	if (TIFFGetField(tifffp, TIFFTAG_TILEWIDTH, &tile_width) &&
-	    TIFFGetField(tifffp, TIFFTAG_TILELENGTH, &tile_height)) {
-
-		tile_size = TIFFTileSize(tifffp);
-		// tile_count = TIFFNumberOfTiles(tifffp);
-		tile_row_size = TIFFTileRowSize(tifffp);
-
-		x_tiles = (int)ceil(x / (double)tile_width);  // number of tiles in x-direction
-		y_tiles = (int)ceil(y / (double)tile_height); // number of tiles in y-direction
-
-		row_stride = x * bits_per_sample / 8;     // Assume BSQ: each band will be read separately
-		if (planar_config == PLANARCONFIG_CONTIG) // BIP: read all planes at once
-			row_stride *= z;
-
-		buffer = (tdata_t)_TIFFmalloc(tile_size);
-		data   = (unsigned char*)malloc((size_t)x * (size_t)y * (size_t)z * bits_per_sample / 8);
-
-		if (data == NULL || buffer == NULL) {
-			if (iom_is_ok2print_sys_errors())
-				fprintf(stderr, "Unable to allocate memory in io_tiff.c/io_ReadTIFF().\n");
-			if (buffer) _TIFFfree(buffer);
-			if (data) free(data);
+	/* The window, 0 based with hi one past the end */
+	dims[0] = x;
+	dims[1] = y;
+	dims[2] = z;
+	for (i = 0; i < 3; i++) {
+		lo[i] = (slice != NULL && slice->s_lo[i] > 0 ? slice->s_lo[i] - 1 : 0);
+		hi[i] = (slice != NULL && slice->s_hi[i] > 0 ? MIN(slice->s_hi[i], dims[i]) : dims[i]);
+		if (lo[i] >= hi[i]) {
+			TIFFError(NULL, "Subset is outside the %ux%ux%u image in %s.", x, y, z, filename);
 			TIFFClose(tifffp);
 			return 0;
 		}
+	}
+	nx = hi[0] - lo[0];
+	ny = hi[1] - lo[1];
+	nz = hi[2] - lo[2];
 
-		tiff_read_error = 0; // start with no-error condition
-		for (tile_y = 0; tiff_read_error > -1 && tile_y < y; tile_y += tile_height) {
-			y_tile_idx         = tile_y / tile_height;
-			actual_tile_height = MIN(y, tile_y + tile_height) - tile_y;
-
-			for (tile_x = 0; tiff_read_error > -1 && tile_x < x; tile_x += tile_width) {
-				x_tile_idx        = tile_x / tile_width;
-				actual_tile_width = MIN(x, tile_x + tile_width) - tile_x;
-
-				// BIP: read all bands at once
-				// BSQ: read one band at a time
-				for (tile_z = 0;
-				     tiff_read_error > -1 && tile_z < (planar_config == PLANARCONFIG_CONTIG ? 1 : z);
-				     tile_z++) {
-
-					tiff_read_error = TIFFReadTile(tifffp, buffer, tile_x, tile_y, /* slice */ 0,
-					                               /* sample */ tile_z);
-					///* sample */ planar_config == PLANARCONFIG_CONTIG? z: tile_z);
-
-					if (tiff_read_error > -1) {
-						for (i = 0; i < actual_tile_height; i++) {
-							src_offset = i * tile_row_size;
-
-							dest_offset = (row_stride * tile_y) + (x_tile_idx * tile_row_size) +
-							              (i * row_stride) + (tile_z * y * row_stride);
-
-							memcpy(data + dest_offset, buffer + src_offset,
-							       actual_tile_width * (tile_row_size / tile_width));
-						}
-					}
-				}
-			}
-		}
+	/*
+	** Contiguous (BIP) pixels are read whole and the wanted bands picked
+	** out of them; separate planes are only read for the wanted bands.
+	*/
+	contig           = (planar_config == PLANARCONFIG_CONTIG);
+	bytes_per_sample = bits_per_sample / 8;
+	in_pixel         = bytes_per_sample * (contig ? z : 1);
+	out_pixel        = bytes_per_sample * (contig ? nz : 1);
+	band_offset      = bytes_per_sample * (contig ? lo[2] : 0);
+	first_plane      = (contig ? 0 : lo[2]);
+	last_plane       = (contig ? 1 : hi[2]);
+
+	tiled = TIFFGetField(tifffp, TIFFTAG_TILEWIDTH, &tile_width) &&
+	        TIFFGetField(tifffp, TIFFTAG_TILELENGTH, &tile_height);
+
+	if (tiled) {
+		buffer = (tdata_t)_TIFFmalloc(TIFFTileSize(tifffp));
+		in_row = TIFFTileRowSize(tifffp);
+	} else {
+		TIFFGetFieldDefaulted(tifffp, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+		rows_per_strip = MAX(1, MIN(rows_per_strip, y));
+		buffer         = (tdata_t)_TIFFmalloc(TIFFScanlineSize(tifffp));
+		in_row         = TIFFScanlineSize(tifffp);
+	}
+	data = (unsigned char*)malloc((size_t)nx * (size_t)ny * (size_t)nz * bytes_per_sample);
 
+	if (data == NULL || buffer == NULL) {
+		if (iom_is_ok2print_sys_errors())
+			fprintf(stderr, "Unable to allocate memory in io_tiff.c/io_ReadTIFF().\n");
 		if (buffer) _TIFFfree(buffer);
+		if (data) free(data);
 		TIFFClose(tifffp);
+		return 0;
+	}
 
-		if (tiff_read_error < 0) {
-			if (data) free(data);
-			return 0;
-		}
-
-		*xout = x;
-		*yout = y;
-		*zout = z;
-		*bits = bits_per_sample;
-
-		if (photometric != PHOTOMETRIC_PALETTE) {
-			*dout = data;
-		}
-		*type = tiff_type;
+	tiff_read_error = 0; // start with no-error condition
+	for (plane = first_plane; tiff_read_error > -1 && plane < last_plane; plane++) {
+		out = data + (size_t)(plane - first_plane) * nx * ny * out_pixel;
 
-		if (planar_config == PLANARCONFIG_CONTIG) {
-			*orgout = iom_BIP;
-		} else if (planar_config == PLANARCONFIG_SEPARATE) {
-			*orgout = iom_BSQ;
-		} else {
-			TIFFError(NULL,
-			          "TIFF Input file %s is organized in Band-Interleaved-by-Line format. \
-            This organization is not currently supported for this tiled file type.",
-			          filename);
-			if (data) free(data);
-			return 0;
+		if (!tiled) {
+			/* Compressed strips can't be entered part way, so start at the top of one. */
+			for (row = lo[1] - lo[1] % rows_per_strip; tiff_read_error > -1 && row < hi[1]; row++) {
+				/* 4th arg ignored in the contiguous planar config. */
+				tiff_read_error = TIFFReadScanline(tifffp, buffer, row, plane);
+				if (tiff_read_error > -1 && row >= lo[1]) {
+					copy_pixels(out + (size_t)(row - lo[1]) * nx * out_pixel,
+					            (unsigned char*)buffer + lo[0] * in_pixel + band_offset, nx, in_pixel,
+					            out_pixel);
+				}
+			}
+			continue;
 		}
 
-		return 1;
-	}
-
-	/* Untiled read - read entire scanlines */
+		for (tile_y = lo[1] - lo[1] % tile_height; tiff_read_error > -1 && tile_y < hi[1];
+		     tile_y += tile_height) {
+			r0 = MAX(tile_y, lo[1]);
+			r1 = MIN(tile_y + tile_height, hi[1]);
 
-	/* read in gray scale image */
-	row_stride = TIFFScanlineSize(tifffp); /* Bytes per scanline. */
+			for (tile_x = lo[0] - lo[0] % tile_width; tiff_read_error > -1 && tile_x < hi[0];
+			     tile_x += tile_width) {
+				c0 = MAX(tile_x, lo[0]);
+				c1 = MIN(tile_x + tile_width, hi[0]);
 
-	buffer = (tdata_t)_TIFFmalloc(row_stride);
-	data   = (unsigned char*)malloc(((size_t)y) * row_stride);
+				tiff_read_error = TIFFReadTile(tifffp, buffer, tile_x, tile_y, /* slice */ 0, plane);
 
-	/* FIX: deal with endian issues? */
-
-	tiff_read_error = 0; // start with no-error condition
-	if (planar_config == PLANARCONFIG_CONTIG) {
-		for (row = 0; tiff_read_error > -1 && row < y; row++) {
-			tiff_read_error = TIFFReadScanline(tifffp, buffer, row,
-			                                   0); /* 4th arg ignored in this planar config. */
-			if (tiff_read_error > -1) memcpy(data + ((size_t)row) * row_stride, buffer, row_stride);
-		}
-	} else {
-		for (plane = 0; tiff_read_error > -1 && plane < z; plane++) {
-			for (row = 0; tiff_read_error > -1 && row < y; row++) {
-				tiff_read_error = TIFFReadScanline(tifffp, buffer, row, plane);
-				if (tiff_read_error > -1)
-					memcpy(data + ((size_t)row) * row_stride, buffer, row_stride);
+				for (row = r0; tiff_read_error > -1 && row < r1; row++) {
+					copy_pixels(out + ((size_t)(row - lo[1]) * nx + c0 - lo[0]) * out_pixel,
+					            (unsigned char*)buffer + (row - tile_y) * in_row + (c0 - tile_x) * in_pixel +
+					                band_offset,
+					            c1 - c0, in_pixel, out_pixel);
+				}
 			}
 		}
 	}
+
 	_TIFFfree(buffer);
 	TIFFClose(tifffp);
 
@@ -474,182 +468,428 @@ int iom_ReadTIFF(FILE* fp, char* filename, int* xout, int* yout, int* zout, int*
 		return 0;
 	}
 
-	if (iom_is_ok2print_progress()) {
+	if (!tiled && iom_is_ok2print_progress()) {
 		printf("TIFF photometric is %s\n", Photometrics[photometric]);
 	}
 
-	*xout = x;
-	*yout = y;
-	*zout = z;
+	*xout = nx;
+	*yout = ny;
+	*zout = nz;
 	*bits = bits_per_sample;
-	if (photometric != PHOTOMETRIC_PALETTE) {
-		*dout = data;
-	}
+	*dout = data;
 	*type = tiff_type;
 
-	if (z == 1)
-		*orgout = iom_BSQ;
-	else if (planar_config == PLANARCONFIG_CONTIG)
+	if (tiled && contig)
 		*orgout = iom_BIP;
+	else if (nz == 1 || !contig)
+		*orgout = iom_BSQ;
 	else
-		*orgout = iom_BIL;
+		*orgout = iom_BIP;
 
 	return 1;
 }
 
-int iom_WriteTIFF(char* filename, unsigned char* indata, struct iom_iheader* h, int force)
+/*
+** An image in memory, in any organization.  Sample (x, y, band) is at
+** data + (x * sx + y * sy + band * sz) * bps.
+*/
+struct tiff_raster {
+	const unsigned char* data;
+	int x, y, z, bps;
+	size_t sx, sy, sz;
+};
+
+/* copy the w x h block at (x0, y0) of r to out as BIP rows pitch bytes apart, zero padded */
+static void tiff_gather(const struct tiff_raster* r, int x0, int y0, int w, int h, unsigned char* out,
+                        size_t pitch)
 {
+	int i, j, k;
+	int n         = MIN(w, r->x - x0);
+	int m         = MIN(h, r->y - y0);
+	size_t pixel  = (size_t)r->z * r->bps;
+	unsigned char* dst;
+	const unsigned char* src;
+
+	if (n < w || m < h) memset(out, 0, pitch * h);
+
+	for (j = 0; j < m; j++) {
+		dst = out + j * pitch;
+		src = r->data + ((size_t)x0 * r->sx + (size_t)(y0 + j) * r->sy) * r->bps;
+		if (r->sz == 1 && r->sx == r->z) {
+			memcpy(dst, src, n * pixel);
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			for (k = 0; k < r->z; k++) {
+				memcpy(dst + i * pixel + k * r->bps, src + (i * r->sx + k * r->sz) * r->bps, r->bps);
+			}
+		}
+	}
+}
 
-	int i, x, y, z, out_size[3];
-	tstrile_t row;
-	tsize_t row_stride, rows_per_strip, strips_per_image;
-	size_t bytes_remaining, src_sample_idx, out_sample_idx;
-	TIFF* tifffp        = NULL;
-	unsigned char* data = NULL;
-	unsigned short bits_per_sample, bytes_per_sample;
-	tsample_t fillorder;
-	TIFFDataType sample_fmt = -1;
-	tstrip_t strip;
-	toff_t offset, offset2;
-	char writeMode[4] = "w";
+/*
+** The strips or tiles of one image, encoded a batch at a time so the
+** compression can run in parallel while the writes stay in order.
+*/
+struct tiff_blocks {
+	const struct tiff_raster* r;
+	int bw, bh, across; /* block size and blocks per row */
+	int tiled;
+	size_t first;       /* first block of the batch */
+	unsigned char** out;
+	size_t* len;
+};
+
+/* bytes in block i; only the last strip may be short */
+static size_t tiff_block_rows(const struct tiff_blocks* b, size_t i)
+{
+	int y0 = (i / b->across) * b->bh;
+	return (b->tiled ? b->bh : MIN(b->bh, b->r->y - y0));
+}
 
-	/* Check for file existence if force overwrite not set. */
+static void tiff_encode(void* ctx, size_t begin, size_t end, int tid)
+{
+	struct tiff_blocks* b = (struct tiff_blocks*)ctx;
+	size_t pitch          = (size_t)b->bw * b->r->z * b->r->bps;
+	size_t i, k, rows, n;
+	unsigned char* raw;
+
+#ifdef HAVE_LIBZ
+	uLongf len;
+	if ((raw = malloc(pitch * b->bh)) == NULL) return;
+#endif
 
-	if (!force && file_exists(filename)) {
-		if (iom_is_ok2print_errors()) {
-			fprintf(stderr, "File %s already exists.\n", filename);
+	for (i = begin; i < end; i++) {
+		k    = b->first + i;
+		rows = tiff_block_rows(b, k);
+		n    = rows * pitch;
+
+#ifdef HAVE_LIBZ
+		tiff_gather(b->r, (k % b->across) * b->bw, (k / b->across) * b->bh, b->bw, rows, raw, pitch);
+		len       = compressBound(n);
+		b->out[i] = malloc(len);
+		if (b->out[i] != NULL && compress2(b->out[i], &len, raw, n, Z_DEFAULT_COMPRESSION) != Z_OK) {
+			free(b->out[i]);
+			b->out[i] = NULL;
 		}
-		return 0;
+		b->len[i] = len;
+#else
+		/* libtiff compresses these as they are written */
+		if ((b->out[i] = malloc(n)) != NULL) {
+			tiff_gather(b->r, (k % b->across) * b->bw, (k / b->across) * b->bh, b->bw, rows, b->out[i],
+			            pitch);
+		}
+		b->len[i] = n;
+#endif
 	}
 
-	if (h->format == iom_BYTE) {
-		bits_per_sample = 8;
-		fillorder       = (h->eformat == iom_MSB_INT_1 ? FILLORDER_MSB2LSB : FILLORDER_LSB2MSB);
-		sample_fmt      = SAMPLEFORMAT_UINT;
-	} else if (h->format == iom_SHORT) {
-		bits_per_sample = 16;
-		fillorder       = (h->eformat == iom_MSB_INT_2 ? FILLORDER_MSB2LSB : FILLORDER_LSB2MSB);
-		sample_fmt      = SAMPLEFORMAT_INT;
-	} else if (h->format == iom_INT) {
-		bits_per_sample = 32;
-		fillorder       = (h->eformat == iom_MSB_INT_4 ? FILLORDER_MSB2LSB : FILLORDER_LSB2MSB);
-		sample_fmt      = SAMPLEFORMAT_INT;
-	} else if (h->format == iom_FLOAT) {
-		bits_per_sample = 32;
-		fillorder  = (h->eformat == iom_MSB_IEEE_REAL_4 ? FILLORDER_MSB2LSB : FILLORDER_LSB2MSB);
-		sample_fmt = SAMPLEFORMAT_IEEEFP;
-	} else if (h->format == iom_DOUBLE) {
-		bits_per_sample = 64;
-		fillorder  = (h->eformat == iom_MSB_IEEE_REAL_8 ? FILLORDER_MSB2LSB : FILLORDER_LSB2MSB);
-		sample_fmt = SAMPLEFORMAT_IEEEFP;
+#ifdef HAVE_LIBZ
+	free(raw);
+#endif
+}
+
+/* write r as the strips or tiles of the current directory */
+static int tiff_write_image(TIFF* tifffp, const struct tiff_raster* r, int tile)
+{
+	struct tiff_blocks b;
+	size_t nblocks, batch, n, i;
+	size_t row_stride = (size_t)r->x * r->z * r->bps;
+	int ok            = 1;
+
+	b.r     = r;
+	b.tiled = (tile > 0);
+	if (b.tiled) {
+		b.bw = b.bh = tile;
+		TIFFSetField(tifffp, TIFFTAG_TILEWIDTH, tile);
+		TIFFSetField(tifffp, TIFFTAG_TILELENGTH, tile);
 	} else {
-		if (iom_is_ok2print_errors()) {
-			fprintf(stderr, "Cannot write %s data in a TIFF file.\n", iom_ifmt_to_str(h->format));
-		}
+		b.bw = r->x;
+		b.bh = MAX(1, (int)ceil((8 * 1024) / (double)row_stride));
+		TIFFSetField(tifffp, TIFFTAG_ROWSPERSTRIP, b.bh);
+	}
+	b.across = (r->x + b.bw - 1) / b.bw;
+	nblocks  = (size_t)b.across * ((r->y + b.bh - 1) / b.bh);
+	batch    = MAX(b.across, 256);
+
+	b.out = (unsigned char**)malloc(batch * sizeof(unsigned char*));
+	b.len = (size_t*)malloc(batch * sizeof(size_t));
+	if (b.out == NULL || b.len == NULL) {
+		free(b.out);
+		free(b.len);
 		return 0;
 	}
 
-	z = iom_GetBands(h->size, h->org);
+	for (b.first = 0; ok && b.first < nblocks; b.first += n) {
+		n = MIN(batch, nblocks - b.first);
+		memset(b.out, 0, n * sizeof(unsigned char*));
 
-	TIFFSetWarningHandler(tiff_warning_handler);
-	TIFFSetErrorHandler(tiff_error_handler);
+		if (iom_PARALLEL_FOR != NULL) {
+			iom_PARALLEL_FOR(n, 1, tiff_encode, &b);
+		} else {
+			tiff_encode(&b, 0, n, 0);
+		}
 
-	/* write BigTiff if the data size is large */
-	if ((iom_iheaderDataSize(h) * iom_iheaderItemBytesI(h)) > FOUR_GIG) {
-		strcat(writeMode, "8");
+		for (i = 0; i < n; i++) {
+			if (ok && b.out[i] == NULL) {
+				if (iom_is_ok2print_sys_errors()) {
+					fprintf(stderr, "Unable to allocate memory in io_tiff.c/io_WriteTIFF().\n");
+				}
+				ok = 0;
+			}
+#ifdef HAVE_LIBZ
+			if (ok && (b.tiled ? TIFFWriteRawTile(tifffp, b.first + i, b.out[i], b.len[i])
+			                   : TIFFWriteRawStrip(tifffp, b.first + i, b.out[i], b.len[i])) < 0) {
+				ok = 0;
+			}
+#else
+			if (ok && (b.tiled ? TIFFWriteEncodedTile(tifffp, b.first + i, b.out[i], b.len[i])
+			                   : TIFFWriteEncodedStrip(tifffp, b.first + i, b.out[i], b.len[i])) < 0) {
+				ok = 0;
+			}
+#endif
+			free(b.out[i]);
+		}
 	}
 
-	if ((tifffp = TIFFOpen(filename, writeMode)) == NULL) {
-		if (iom_is_ok2print_sys_errors()) {
-			fprintf(stderr, "Unable to write file %s. Reason: %s.\n", filename, strerror(errno));
+	free(b.out);
+	free(b.len);
+	return ok;
+}
+
+/*
+** Overviews.  Each level averages 2x2 blocks of the one before into a
+** BIP image, a row at a time in parallel.
+*/
+struct tiff_reduce_job {
+	const struct tiff_raster* in;
+	struct tiff_raster* out;
+	int format;
+};
+
+static double tiff_get(const unsigned char* p, int format)
+{
+	switch (format) {
+	case iom_BYTE: return *p;
+	case iom_SHORT: return *(const short*)p;
+	case iom_INT: return *(const int*)p;
+	case iom_FLOAT: return *(const float*)p;
+	default: return *(const double*)p;
+	}
+}
+
+static void tiff_put(unsigned char* p, int format, double v)
+{
+	switch (format) {
+	case iom_BYTE: *p = (unsigned char)(v + 0.5); break;
+	case iom_SHORT: *(short*)p = (short)floor(v + 0.5); break;
+	case iom_INT: *(int*)p = (int)floor(v + 0.5); break;
+	case iom_FLOAT: *(float*)p = (float)v; break;
+	default: *(double*)p = v; break;
+	}
+}
+
+static void tiff_reduce_rows(void* ctx, size_t begin, size_t end, int tid)
+{
+	struct tiff_reduce_job* job   = (struct tiff_reduce_job*)ctx;
+	const struct tiff_raster* in  = job->in;
+	const struct tiff_raster* out = job->out;
+	unsigned char* dst;
+	size_t j;
+	int i, k, dx, dy, n;
+	double sum;
+
+	for (j = begin; j < end; j++) {
+		dst = (unsigned char*)out->data + j * out->sy * out->bps;
+		for (i = 0; i < out->x; i++) {
+			for (k = 0; k < out->z; k++, dst += out->bps) {
+				sum = 0;
+				n   = 0;
+				for (dy = 0; dy < 2 && 2 * j + dy < in->y; dy++) {
+					for (dx = 0; dx < 2 && 2 * i + dx < in->x; dx++, n++) {
+						sum += tiff_get(in->data + ((2 * i + dx) * in->sx + (2 * j + dy) * in->sy + k * in->sz) *
+						                               in->bps,
+						                job->format);
+					}
+				}
+				tiff_put(dst, job->format, sum / n);
+			}
 		}
-		return 0;
 	}
+}
 
-	/* Set TIFF image parameters. */
+static int tiff_reduce(const struct tiff_raster* in, struct tiff_raster* out, int format)
+{
+	struct tiff_reduce_job job;
+	unsigned char* data;
 
-	x = iom_GetSamples(h->size, h->org);
-	y = iom_GetLines(h->size, h->org);
+	out->x   = (in->x + 1) / 2;
+	out->y   = (in->y + 1) / 2;
+	out->z   = in->z;
+	out->bps = in->bps;
+	out->sz  = 1;
+	out->sx  = out->z;
+	out->sy  = (size_t)out->x * out->z;
+
+	if ((data = malloc((size_t)out->y * out->sy * out->bps)) == NULL) return 0;
+	out->data = data;
+
+	job.in     = in;
+	job.out    = out;
+	job.format = format;
+	if (iom_PARALLEL_FOR != NULL) {
+		iom_PARALLEL_FOR(out->y, 16, tiff_reduce_rows, &job);
+	} else {
+		tiff_reduce_rows(&job, 0, out->y, 0);
+	}
+	return 1;
+}
 
-	TIFFSetField(tifffp, TIFFTAG_IMAGEWIDTH, x);
-	TIFFSetField(tifffp, TIFFTAG_IMAGELENGTH, y);
+/* the tags of one image; reduced is set for an overview */
+static void tiff_set_fields(TIFF* tifffp, const struct tiff_raster* r, int format, int bits_per_sample,
+                            TIFFDataType sample_fmt, int reduced)
+{
+	TIFFSetField(tifffp, TIFFTAG_IMAGEWIDTH, r->x);
+	TIFFSetField(tifffp, TIFFTAG_IMAGELENGTH, r->y);
 	TIFFSetField(tifffp, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
-	TIFFSetField(tifffp, TIFFTAG_SAMPLESPERPIXEL, z);
+	TIFFSetField(tifffp, TIFFTAG_SAMPLESPERPIXEL, r->z);
 	TIFFSetField(tifffp, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
 	TIFFSetField(tifffp, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 	TIFFSetField(tifffp, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
 	TIFFSetField(tifffp, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
+	if (reduced) {
+		TIFFSetField(tifffp, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+	}
 
 	if (sample_fmt != -1) {
 		TIFFSetField(tifffp, TIFFTAG_SAMPLEFORMAT, sample_fmt);
 	}
-	if ((z == 3 || z == 4) && h->format == iom_BYTE) {
+	if ((r->z == 3 || r->z == 4) && format == iom_BYTE) {
 		TIFFSetField(tifffp, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
 	} else {
 		TIFFSetField(tifffp, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
 	}
 
-	if ((z == 2 || z == 4) && h->format == iom_BYTE) {
+	if ((r->z == 2 || r->z == 4) && format == iom_BYTE) {
 		// Identify that we have an alpha channel.
 		// This is a goofy way to pass an extra value, but everyone seems to do it.
 		unsigned short sample_info[1];
 		sample_info[0] = EXTRASAMPLE_ASSOCALPHA;
 		TIFFSetField(tifffp, TIFFTAG_EXTRASAMPLES, 1, &sample_info[0]);
 	}
+}
 
-	bytes_per_sample = bits_per_sample / 8;
+int iom_WriteTIFF(char* filename, unsigned char* indata, struct iom_iheader* h, int force)
+{
+	return iom_WriteTIFFOpts(filename, indata, h, force, NULL);
+}
 
-	row_stride = ((size_t)x) * ((size_t)z) * (bytes_per_sample);
+int iom_WriteTIFFOpts(char* filename, unsigned char* indata, struct iom_iheader* h, int force,
+                      const struct iom_tiff_opts* opts)
+{
 
-	rows_per_strip = MAX(1, (int)ceil((8 * 1024) / (double)row_stride));
-	TIFFSetField(tifffp, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
-	strips_per_image = TIFFNumberOfStrips(tifffp);
+	int level, ok;
+	struct tiff_raster image, reduced[2];
+	const struct tiff_raster* r;
+	struct iom_tiff_opts o  = {0, 0, 0};
+	TIFF* tifffp            = NULL;
+	unsigned short bits_per_sample;
+	TIFFDataType sample_fmt = -1;
+	size_t data_size;
+	char writeMode[4] = "w";
 
-	bytes_remaining = ((size_t)row_stride) * y;
+	if (opts != NULL) o = *opts;
 
-	/* we only allow BIP output */
-	out_size[0] = z;
-	out_size[1] = x;
-	out_size[2] = y;
+	/* Check for file existence if force overwrite not set. */
 
-	data = (unsigned char*)calloc(row_stride, rows_per_strip);
-	if (data == NULL) {
-		if (iom_is_ok2print_sys_errors()) {
-			fprintf(stderr, "Unable to allocate memory in io_tiff.c/io_WriteTIFF().\n");
+	if (!force && file_exists(filename)) {
+		if (iom_is_ok2print_errors()) {
+			fprintf(stderr, "File %s already exists.\n", filename);
+		}
+		return 0;
+	}
+
+	if (o.tile < 0 || o.tile % 16 != 0 || o.overviews < 0) {
+		if (iom_is_ok2print_errors()) {
+			fprintf(stderr, "TIFF tile size must be a multiple of 16 and overviews at least 0.\n");
+		}
+		return 0;
+	}
+
+	if (h->format == iom_BYTE) {
+		bits_per_sample = 8;
+		sample_fmt      = SAMPLEFORMAT_UINT;
+	} else if (h->format == iom_SHORT) {
+		bits_per_sample = 16;
+		sample_fmt      = SAMPLEFORMAT_INT;
+	} else if (h->format == iom_INT) {
+		bits_per_sample = 32;
+		sample_fmt      = SAMPLEFORMAT_INT;
+	} else if (h->format == iom_FLOAT) {
+		bits_per_sample = 32;
+		sample_fmt      = SAMPLEFORMAT_IEEEFP;
+	} else if (h->format == iom_DOUBLE) {
+		bits_per_sample = 64;
+		sample_fmt      = SAMPLEFORMAT_IEEEFP;
+	} else {
+		if (iom_is_ok2print_errors()) {
+			fprintf(stderr, "Cannot write %s data in a TIFF file.\n", iom_ifmt_to_str(h->format));
 		}
 		return 0;
 	}
 
-	/* keep track of where we are in the output file */
-	out_sample_idx = 0;
+	TIFFSetWarningHandler(tiff_warning_handler);
+	TIFFSetErrorHandler(tiff_error_handler);
 
-	// Write the file out one strip at a time.
-	for (strip = 0; strip < strips_per_image; strip++) {
-		tsize_t curr_strip_size = MIN(((size_t)row_stride) * rows_per_strip, bytes_remaining);
+	/* write BigTiff if asked to or if the data size is large; overviews add up to a third */
+	data_size = iom_iheaderDataSize(h) * iom_iheaderItemBytesI(h);
+	if (o.overviews > 0) data_size += data_size / 3;
+	if (o.bigtiff || data_size > FOUR_GIG) {
+		strcat(writeMode, "8");
+	}
 
-		for (i = 0; i < curr_strip_size; i += bytes_per_sample) {
-			iom_Xpos(out_sample_idx, iom_BIP, out_size, &x, &y,
-			         &z); // get x,y,z location of output pixel
-			src_sample_idx =
-			    iom_Cpos(x, y, z, h->org, h->size); // get linear offset of x,y,z in input org
-			memcpy(&data[i], indata + (src_sample_idx * bytes_per_sample), bytes_per_sample);
-			out_sample_idx++;
+	if ((tifffp = TIFFOpen(filename, writeMode)) == NULL) {
+		if (iom_is_ok2print_sys_errors()) {
+			fprintf(stderr, "Unable to write file %s. Reason: %s.\n", filename, strerror(errno));
 		}
-		if (TIFFWriteEncodedStrip(tifffp, strip, data, curr_strip_size) < 0) {
-			(void)TIFFClose(tifffp);
+		return 0;
+	}
 
-			free(data);
-			return 0;
+	/* The data is written as BIP, whatever its organization */
+
+	image.data = indata;
+	image.x    = iom_GetSamples(h->size, h->org);
+	image.y    = iom_GetLines(h->size, h->org);
+	image.z    = iom_GetBands(h->size, h->org);
+	image.bps  = bits_per_sample / 8;
+	image.sx   = iom_Cpos(1, 0, 0, h->org, h->size) - iom_Cpos(0, 0, 0, h->org, h->size);
+	image.sy   = iom_Cpos(0, 1, 0, h->org, h->size) - iom_Cpos(0, 0, 0, h->org, h->size);
+	image.sz   = iom_Cpos(0, 0, 1, h->org, h->size) - iom_Cpos(0, 0, 0, h->org, h->size);
+
+	tiff_set_fields(tifffp, &image, h->format, bits_per_sample, sample_fmt, 0);
+	ok = tiff_write_image(tifffp, &image, o.tile);
+
+	/* each overview is made from the one before, so only two are kept */
+	r                   = &image;
+	reduced[0].data     = reduced[1].data = NULL;
+	for (level = 1; ok && level <= o.overviews && (r->x > 1 || r->y > 1); level++) {
+		struct tiff_raster* next = &reduced[level % 2];
+
+		free((void*)next->data);
+		ok = TIFFWriteDirectory(tifffp) && tiff_reduce(r, next, h->format);
+		if (ok) {
+			tiff_set_fields(tifffp, next, h->format, bits_per_sample, sample_fmt, 1);
+			ok = tiff_write_image(tifffp, next, o.tile);
+		} else {
+			next->data = NULL;
 		}
-		bytes_remaining -= curr_strip_size;
-		memset(data, 0, ((size_t)row_stride) * rows_per_strip);
+		r = next;
 	}
+	free((void*)reduced[0].data);
+	free((void*)reduced[1].data);
 
 	(void)TIFFClose(tifffp);
 
-	free(data);
-
-	return 1;
+	return ok;
 }
 
 static int uchar_overflow(unsigned char* data, size_t size)
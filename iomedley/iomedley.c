@@ -981,6 +981,9 @@ void iom_ieee_vax_r(int* from, float* to)
 }
 
 
+// Codec loops run serially unless the application supplies a parallel loop.
+iom_parallel_fn iom_PARALLEL_FOR = NULL;
+
 // Stuff related to the verbosity of error messages.
 int iom_VERBOSITY = 5;
 
@@ -131,6 +131,7 @@ struct iom_iheader {
 	int s_lo[3];        /* subset lower range (pixels)             */
 	int s_hi[3];        /* subset upper range (pixels)             */
 	int s_skip[3];      /* subset skip interval (pixels)           */
+	int image;          /* image of a multi-image file, 0 is first */
 
 	/* Set by read_qube_data() once the data read is successful.   */
 	/* It is derived from sub-selects.                             */
@@ -271,6 +272,7 @@ int iom_GetBMPHeader(FILE *, char *, struct iom_iheader *);
 int iom_GetGIFHeader(FILE *, char *, struct iom_iheader *);
 int iom_GetJPEGHeader(FILE *, char *, struct iom_iheader *);
 int iom_GetTIFFHeader(FILE *, char *, struct iom_iheader *);
+int iom_GetTIFFHeaderSlice(FILE *, char *, struct iom_iheader *, struct iom_iheader *);
 int iom_GetPNMHeader(FILE *, char *, struct iom_iheader *);
 int iom_GetPNGHeader(FILE *, char *, struct iom_iheader *);
 
@@ -315,6 +317,19 @@ int iom_LoadHeader(FILE *fp, char *fname, struct iom_iheader *header);
 ** format and the current machine's endian-inclination.
 */
 
+/*
+** TIFF output options for iom_WriteTIFFOpts().  tile is the width and
+** height of square tiles (a multiple of 16), 0 for strips.  overviews
+** is the number of half resolution levels written after the image.
+** bigtiff forces BigTIFF output, which is otherwise only used when the
+** data needs it.
+*/
+struct iom_tiff_opts {
+	int tile;
+	int overviews;
+	int bigtiff;
+};
+
 int iom_WriteIMath(char *fname, void *data, struct iom_iheader *h, int force_write);
 int iom_WriteERS(char *fname, void *data, struct iom_iheader *h, int force_write);
 int iom_WriteVicar(char *filename, void *data, struct iom_iheader *h, int force_write);
@@ -324,6 +339,8 @@ int iom_WriteRaw(char *fname, void *data, struct iom_iheader *h, int force_write
 int iom_WriteJPEG(char *fname, unsigned char *data, struct iom_iheader *h, int force_write);
 int iom_WriteGIF(char *fname, unsigned char *data, struct iom_iheader *h, int force_write);
 int iom_WriteTIFF(char *fname, unsigned char *data, struct iom_iheader *h, int force_write);
+int iom_WriteTIFFOpts(char *fname, unsigned char *data, struct iom_iheader *h, int force_write,
+                      const struct iom_tiff_opts *opts);
 int iom_WriteBMP(char *fname, unsigned char *data, struct iom_iheader *h, int force_write);
 int iom_WritePNG(char *fname, unsigned char *data, struct iom_iheader *h, int force_write);
 int iom_WritePNM(char *fname, unsigned char *data, struct iom_iheader *h, int force_write);
@@ -464,6 +481,16 @@ int iom_Eformat2Iformat(iom_edf efmt);
 ** FILES ONCE THE MERGE WITH IOMEDLEY IS DONE.
 */
 
+/*
+** Data-parallel loop for the codecs, supplied by the application.  It
+** calls fn(ctx, begin, end, tid) over pieces of [0, n) of at least grain
+** items each, possibly concurrently, and returns when all are done.
+** NULL (the default) runs everything on the calling thread.
+*/
+typedef void (*iom_range_fn)(void *ctx, size_t begin, size_t end, int tid);
+typedef void (*iom_parallel_fn)(size_t n, size_t grain, iom_range_fn fn, void *ctx);
+extern iom_parallel_fn iom_PARALLEL_FOR;
+
 /*
 ** Message verbosity control in iomedley.
 */
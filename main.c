@@ -339,6 +339,7 @@ int main(int ac, char** av)
 		}
 	}
 	dv_set_iom_verbosity();
+	dv_init_iomedley();
 
 	env_vars();
 	fake_data();
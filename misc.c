@@ -332,47 +332,256 @@ char* unescape(char* str)
 // Moved from newfunc.c
 
 
+/**
+ ** Argument binding cache.
+ **
+ ** Builtins build the same Alist on every call, so the first time a
+ ** function is called parse_args() records its signature on the vfuncptr
+ ** (in the bind field), along with a hash of the keywords it has been
+ ** called with and the values its ID_ENUM arguments take.  Keywords can be
+ ** abbreviated, so they are only cached once they have matched exactly one
+ ** argument name; ID_ENUM values are all entered up front.  A function that
+ ** calls parse_args() with more than one Alist gets a binding for each.
+ **/
+
+#define ABIND_MAX 4 /* bindings kept for one function */
+
+enum { AKEY_KEYWORD, AKEY_ENUM };
+
+typedef struct {
+	char* key;         /* NULL if the entry is empty */
+	int kind;          /* AKEY_KEYWORD or AKEY_ENUM */
+	int slot;          /* the ID_ENUM argument a value is for */
+	int arg;           /* the argument a keyword names */
+	const char* value; /* the limits entry an ID_ENUM value matches */
+} Akey;
+
+typedef struct Abind {
+	struct Abind* next;
+	int n;              /* arguments */
+	const char** names; /* as they were in the Alist */
+	int* types;
+	char*** limits; /* copies of the ID_ENUM value lists */
+	Akey* table;
+	size_t size; /* entries in table, a power of 2 */
+	size_t used;
+} Abind;
+
+static size_t akey_hash(const char* s)
+{
+	size_t h = 2166136261u;
+	for (; *s; s++) h = (h ^ (unsigned char)tolower((unsigned char)*s)) * 16777619u;
+	return h;
+}
+
+static Akey* akey_find(Abind* b, int kind, int slot, const char* key)
+{
+	size_t i = akey_hash(key) & (b->size - 1);
+	Akey* k;
+
+	for (;; i = (i + 1) & (b->size - 1)) {
+		k = &b->table[i];
+		if (k->key == NULL) return k;
+		if (k->kind == kind && k->slot == slot && !strcasecmp(k->key, key)) return k;
+	}
+}
+
+static void akey_add(Abind* b, int kind, int slot, const char* key, int arg, const char* value)
+{
+	Akey *k, *old;
+	size_t i, size;
+
+	if (2 * (b->used + 1) > b->size) {
+		old  = b->table;
+		size = b->size;
+		b->size *= 2;
+		b->table = calloc(b->size, sizeof(Akey));
+		b->used  = 0;
+		for (i = 0; i < size; i++) {
+			if (old[i].key) {
+				*akey_find(b, old[i].kind, old[i].slot, old[i].key) = old[i];
+				b->used++;
+			}
+		}
+		free(old);
+	}
+	k = akey_find(b, kind, slot, key);
+	if (k->key != NULL) return; /* the first value in limits wins */
+	k->key   = strdup(key);
+	k->kind  = kind;
+	k->slot  = slot;
+	k->arg   = arg;
+	k->value = value;
+	b->used++;
+}
+
+static void abind_free(Abind* b)
+{
+	size_t i;
+
+	for (i = 0; i < b->size; i++) free(b->table[i].key);
+	free(b->table);
+	for (i = 0; i < (size_t)b->n; i++) free(b->limits[i]);
+	free(b->limits);
+	free(b->names);
+	free(b->types);
+	free(b);
+}
+
+/*
+** Is b the binding for alist?  Cached ID_ENUM values are handed back as
+** they are in limits, so those have to be the very same strings.
+*/
+static int abind_match(Abind* b, Alist* alist)
+{
+	char **p, **q;
+	int i;
+
+	for (i = 0; i < b->n && alist[i].name != NULL; i++) {
+		if (b->types[i] != alist[i].type) return 0;
+		if (b->names[i] != alist[i].name && strcmp(b->names[i], alist[i].name)) return 0;
+		if (b->limits[i] != NULL || (alist[i].type == ID_ENUM && alist[i].limits != NULL)) {
+			if ((p = b->limits[i]) == NULL || (q = alist[i].limits) == NULL) return 0;
+			for (; *p && *p == *q; p++, q++)
+				;
+			if (*p != *q) return 0;
+		}
+	}
+	return i == b->n && alist[i].name == NULL;
+}
+
+static Abind* abind_new(Alist* alist)
+{
+	Abind* b = calloc(1, sizeof(Abind));
+	char** p;
+	int i;
+
+	while (alist[b->n].name != NULL) b->n++;
+	b->names = malloc((b->n + 1) * sizeof(char*));
+	b->types  = malloc((b->n + 1) * sizeof(int));
+	b->limits = calloc(b->n + 1, sizeof(char**));
+	b->size   = 16;
+	b->table  = calloc(b->size, sizeof(Akey));
+	for (i = 0; i < b->n; i++) {
+		b->names[i] = alist[i].name;
+		b->types[i] = alist[i].type;
+		if (alist[i].type == ID_ENUM && alist[i].limits != NULL) {
+			for (p = (char**)alist[i].limits; *p; p++) akey_add(b, AKEY_ENUM, i, *p, i, *p);
+			b->limits[i] = malloc((p - (char**)alist[i].limits + 1) * sizeof(char*));
+			memcpy(b->limits[i], alist[i].limits, (p - (char**)alist[i].limits + 1) * sizeof(char*));
+		}
+	}
+	return b;
+}
+
+/* bindings for parse_args() calls without a function */
+static Abind* unbound;
+
+/* the binding of func for alist; the list is kept most recently used first */
+static Abind* abind_get(vfuncptr func, Alist* alist)
+{
+	Abind **list = (func ? (Abind**)&func->bind : &unbound), **pb, *b;
+	int n = 0;
+
+	for (pb = list; (b = *pb) != NULL; pb = &b->next, n++) {
+		if (abind_match(b, alist)) {
+			*pb     = b->next;
+			b->next = *list;
+			*list   = b;
+			return b;
+		}
+		if (n == ABIND_MAX - 1) {
+			/* forget the least recently used */
+			*pb = NULL;
+			abind_free(b);
+			break;
+		}
+	}
+	b       = abind_new(alist);
+	b->next = *list;
+	*list   = b;
+	return b;
+}
+
+/* drop the bindings of func, before it goes away */
+void free_bindings(vfuncptr func)
+{
+	Abind *b, *next;
+
+	for (b = func->bind; b != NULL; b = next) {
+		next = b->next;
+		abind_free(b);
+	}
+	func->bind = NULL;
+}
+
+/*
+** Which argument does keyword ptr name?  Any unique prefix of an
+** argument name will do.  Returns -1 after reporting the error.
+*/
+static int abind_keyword(Abind* b, Alist* alist, const char* fname, const char* ptr)
+{
+	Akey* key = akey_find(b, AKEY_KEYWORD, 0, ptr);
+	int len, count, j = -1, k;
+
+	if (key->key != NULL) return key->arg;
+
+	len = strlen(ptr);
+	for (count = k = 0; alist[k].name != NULL; k++) {
+		if (!strncasecmp(alist[k].name, ptr, len)) {
+			count++;
+			j = k;
+		}
+	}
+	if (count == 0) {
+		parse_error("Unknown keyword to function: %s(... %s= ...)", fname, ptr);
+		return -1;
+	}
+	if (count > 1) {
+		sprintf(error_buf, "Non-unique keyword match: %s(...%s=...)\nPossible matches:\n", fname, ptr);
+		for (k = 0; alist[k].name != NULL; k++) {
+			if (!strncasecmp(alist[k].name, ptr, len)) {
+				sprintf(error_buf + strlen(error_buf), "\t%s\n", alist[k].name);
+			}
+		}
+		parse_error(NULL);
+		return -1;
+	}
+	akey_add(b, AKEY_KEYWORD, 0, ptr, j, NULL);
+	return j;
+}
+
+/* the entry of ID_ENUM argument j's limits that str names, or NULL */
+static char* abind_enum(Abind* b, int j, const char* str)
+{
+	Akey* key;
+
+	if (str == NULL) return NULL;
+	key = akey_find(b, AKEY_ENUM, j, str);
+	return (char*)key->value;
+}
+
 // verify that the arguments are of the expected type
-// How do we get av[0] installed?
 int parse_args(vfuncptr name, Var* args, Alist* alist)
 {
-	int i, j, k, count;
+	int i, j, ac;
 	Var *v, *e;
-	char* fname;
-	char* ptr;
-	int len;
+	const char* fname;
+	Abind* bind;
 
-	int ac;
-	Var** av;
-
-	make_args(&ac, &av, name, args);
-	fname = (char*)av[0];
+	ac    = (args != NULL ? Narray_count(V_ARGS(args)) : 0) + 1;
+	fname = (name ? name->name : NULL);
+	bind  = abind_get(name, alist);
 
 	for (i = 1; i < ac; i++) {
-		v = av[i];
+		Narray_get(V_ARGS(args), i - 1, NULL, (void**)&v);
 		if (v == NULL) continue;
+		if (V_TYPE(v) == ID_KEYWORD && V_NAME(v) == NULL) {
+			v = V_KEYVAL(v);
+			if (v == NULL) continue;
+		}
 		if (V_TYPE(v) == ID_KEYWORD && V_NAME(v) != NULL) {
-			ptr = V_NAME(v);
-			len = strlen(ptr);
-			// set up error_buf, in case more than one keyword matches
-			sprintf(error_buf, "Non-unique keyword match: %s(...%s=...)\nPossible matches:\n", fname, ptr);
-
-			for (count = k = 0; alist[k].name != NULL; k++) {
-				if (!strncasecmp(alist[k].name, ptr, len)) {
-					// Append to error buf.  Again, just in case.
-					sprintf(error_buf + strlen(error_buf), "\t%s\n", alist[k].name);
-					count++;
-					j = k;
-				}
-			}
-			if (count == 0) {
-				parse_error("Unknown keyword to function: %s(... %s= ...)", fname, ptr);
-				free(av);
-				return 0;
-			}
-			if (count > 1) {
-				parse_error(NULL);
-				free(av);
+			if ((j = abind_keyword(bind, alist, fname, V_NAME(v))) < 0) {
 				return 0;
 			}
 			// Get just the argument part
@@ -393,7 +602,6 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			}
 			if (alist[j].name == NULL) {
 				parse_error("Too many arguments to function: %s()", fname);
-				free(av);
 				return 0;
 			}
 		}
@@ -408,13 +616,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			char** p;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_STRING) {
 				parse_error("Illegal argument to function %s(), expected STRING", fname);
-				free(av);
 				return 0;
 			}
 			p               = (char**)(alist[j].value);
@@ -426,13 +632,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			Var** vptr;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_TEXT && V_TYPE(v) != ID_STRING) {
 				parse_error("Illegal argument to function %s(), expected STRING", fname);
-				free(av);
 				return 0;
 			}
 
@@ -448,13 +652,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			Var** vptr;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_VAL) {
 				parse_error("Illegal argument %s(...%s=...), expected VAL", fname, alist[j].name);
-				free(av);
 				return 0;
 			}
 			vptr            = (Var**)(alist[j].value);
@@ -464,13 +666,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			Var** vptr;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_STRUCT) {
 				parse_error("Illegal argument %s(...%s=...), expected STRUCT", fname, alist[j].name);
-				free(av);
 				return 0;
 			}
 			vptr            = (Var**)(alist[j].value);
@@ -511,13 +711,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_VAL || V_FORMAT(v) > DV_INT64) {
 				parse_error("Illegal argument %s(...%s=...), expected integer type", fname, alist[j].name);
-				free(av);
 				return 0;
 			}
 
@@ -539,13 +737,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			float* fptr;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_VAL) {
 				parse_error("Illegal argument %s(...%s=...), expected DV_FLOAT", fname, alist[j].name);
-				free(av);
 				return 0;
 			}
 			fptr            = (float*)(alist[j].value);
@@ -555,13 +751,11 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			double* fptr;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v = e;
 			if (V_TYPE(v) != ID_VAL) {
 				parse_error("Illegal argument %s(...%s=...), expected DV_DOUBLE", fname, alist[j].name);
-				free(av);
 				return 0;
 			}
 			fptr            = (double*)(alist[j].value);
@@ -585,28 +779,16 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 				}
 			} else {
 				// try once with, hopefully, a passed string
-				for (p = values; p && *p; p++) {
-					if (ptr && !strcasecmp(ptr, *p)) {
-						q = *p;
-						break;
-					}
-				}
+				q = abind_enum(bind, j, ptr);
 				if (q == NULL) {
 					if ((e = eval(v)) != NULL) {
 						if (V_TYPE(e) == ID_STRING) {
-							ptr = V_STRING(e);
-							for (p = values; p && *p; p++) {
-								if (ptr && !strcasecmp(ptr, *p)) {
-									q = *p;
-									break;
-								}
-							}
+							q = abind_enum(bind, j, V_STRING(e));
 						}
 					}
 				}
 				if (q == NULL) {
 					parse_error("Illegal argument to function %s(...%s...)", fname, alist[j].name);
-					free(av);
 					return 0;
 				}
 
@@ -618,7 +800,6 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 			Var** vptr;
 			if ((e = eval(v)) == NULL) {
 				parse_error("%s: Variable not found: %s", fname, V_NAME(v));
-				free(av);
 				return 0;
 			}
 			v               = e;
@@ -653,7 +834,6 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 
 			if (q == NULL) {
 				parse_error("Illegal argument to function %s(...%s...)", fname, alist[j].name);
-				free(av);
 				return 0;
 			}
 
@@ -667,7 +847,6 @@ int parse_args(vfuncptr name, Var* args, Alist* alist)
 		}
 	}
 
-	free(av);
 	return ac;
 }
 
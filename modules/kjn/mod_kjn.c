@@ -26,7 +26,7 @@ static Var* do_ipi(Var* coords_array, Var* values_array);
 static float* column_fill(float* column, int y, int z, int csize, float ignore);
 
 static Var* kjn_y_shear(vfuncptr, Var*);
-static Var* kjn_kfill(vfuncptr, Var*);
+// static Var* kjn_kfill(vfuncptr, Var*); - same as ff_kfill() in ff_ifill.c
 static Var* kjn_smoothy(vfuncptr, Var*);
 static Var* kjn_ramp(vfuncptr, Var*);
 static Var* kjn_corners(vfuncptr, Var*);
@@ -50,7 +50,7 @@ static Var* kjn_deplaid2(vfuncptr func, Var* arg);
 
 static dvModuleFuncDesc exported_list[] = {
     {"y_shear", (void*)kjn_y_shear},
-    {"kfill", (void*)kjn_kfill},
+    {"kfill", (void*)ff_kfill},
     {"smoothy", (void*)kjn_smoothy},
     {"ramp", (void*)kjn_ramp},
     {"corners", (void*)kjn_corners},
@@ -265,255 +265,6 @@ Var* kjn_y_shear(vfuncptr func, Var* arg)
 	return out;
 }
 
-Var* kjn_kfill(vfuncptr func, Var* arg)
-{
-	Var* pic_v = NULL; /* the picture */
-	Var* wgt_v = NULL; /* the weighting array */
-	Var* itr_v = NULL; /* the number of iterations */
-	Var* out;          /* the output picture */
-	int w;             /* width of the weight matrix (= height) */
-	int x, y, z;
-	float* wgt = NULL;   /* storage location of the weight array */
-	int c;               /* general array counter */
-	int n;               /* number of elements - generally */
-	int i, j, k, mi, mj; /* general array counters */
-	float min_wgt;       /* minimum value of weight */
-	float *pic = NULL, *pic2 = NULL, *tpic = NULL;
-	float pixel;      /* working var */
-	int wth;          /* (w-1)/2 */
-	int pic_x, pic_y; /* dims of the expanded picture */
-	int px, py, pi;
-	int pl, pr, pu, pd, r, pave; /* the nearest neighbor positions */
-	float sum_non_zero_mask;
-	int nn;
-	int niter   = 0;
-	int nzeroes = 0;
-
-	Alist alist[4];
-	alist[0]      = make_alist("picture", ID_VAL, NULL, &pic_v);
-	alist[1]      = make_alist("weight", ID_VAL, NULL, &wgt_v);
-	alist[2]      = make_alist("iterations", ID_VAL, NULL, &itr_v);
-	alist[3].name = NULL;
-
-	if (parse_args(func, arg, alist) == 0) return (NULL);
-
-	if (pic_v == NULL && wgt_v == NULL) {
-		parse_error("kfill() - 4/25/04");
-		parse_error(
-		    "Fills in null points of a 2 dimensional float array by linear interpolation of "
-		    "nearest neighbors.");
-		parse_error("Will not handle 3-d arrays!\n");
-		parse_error("Syntax:  b = kjn.kfill(picture,weight,iterations)");
-		parse_error("example: b = kjn.kfill(b,wt)");
-		parse_error(
-		    "Set iterations to limit the maximum number of pixels away nearest neighbor must be to "
-		    "be valid.");
-		parse_error("The weight array is produced by weight_array() - written by Phil.\n");
-		return NULL;
-	}
-	if (pic_v == NULL) {
-		parse_error("ERROR! picture not specified.\n");
-		return NULL;
-	}
-
-	if (wgt_v == NULL) {
-		parse_error("ERROR! weight matrix not specified.\n");
-		return NULL;
-	}
-
-	x = GetX(pic_v); /* get the x dimension of the image */
-	y = GetY(pic_v); /* get the y dimension of the image */
-	z = GetZ(pic_v); /* get the z dimension of the image */
-	if (z > 1) {
-		parse_error("Will not handle 3D arrays.\n");
-		return NULL;
-	}
-
-	w = GetX(wgt_v); /* get the x dimension of the weighting array */
-	if (GetY(wgt_v) != w || GetZ(wgt_v) > 1) {
-		parse_error("Weight array must be the same dim in X & Y with a Z dim of 1.\n");
-		return NULL;
-	}
-
-	if ((w % 2) == 0 || w < 7) {
-		parse_error("Width should be an odd number greater than 5.\n");
-		return NULL;
-	}
-
-	if (itr_v != NULL) {
-		niter = extract_int(itr_v, cpos(0, 0, 0, itr_v));
-	}
-
-	/* extract weight data */
-	wgt = (float*)calloc(sizeof(float), w * w);
-	if (wgt == NULL) {
-		parse_error("ERROR! Unable to alloc %d bytes.\n", sizeof(float) * w * w);
-		return NULL;
-	}
-
-	c = 0;
-	for (j = 0; j < w; j++) {
-		for (i = 0; i < w; i++) {
-			wgt[c++] = extract_float(wgt_v, cpos(i, j, 0, wgt_v));
-		}
-	}
-
-	wth = (w - 1) / 2; /* the "radius" of the weighting array */
-
-	/* extract picture data */
-	pic_x = x + 2 * wth;
-	pic_y = y + 2 * wth;
-	pic   = (float*)calloc(sizeof(float), pic_x * pic_y);
-	if (pic == NULL) {
-		parse_error("ERROR! Unable to alloc %d bytes.\n", sizeof(float) * pic_x * pic_y);
-		free(wgt); /* cleanup before exit */
-		return NULL;
-	}
-
-	pic2 = (float*)calloc(sizeof(float), pic_x * pic_y);
-	if (pic2 == NULL) {
-		parse_error("ERROR! Unable to alloc %d bytes.\n", sizeof(float) * pic_x * pic_y);
-		free(wgt); /* cleanup before exit */
-		free(pic);
-		return NULL;
-	}
-
-	for (j = 0; j < y; j++) {
-		for (i = 0; i < x; i++) {
-			pic[(j + wth) * pic_x + (i + wth)] = extract_float(pic_v, cpos(i, j, 0, pic_v));
-		}
-	}
-
-	/* find min of the weight array */
-	n       = w * w;
-	min_wgt = wgt[0]; /* assume minimum */
-	for (i = 1; i < n; i++) {
-		if (wgt[i] < min_wgt) {
-			min_wgt = wgt[i];
-		}
-	}
-
-	if (min_wgt == 0.0) {
-		min_wgt = 1.0;
-	} /* sanity */
-
-	/* divide wgt array by the minimum */
-	for (i = 0; i < n; i++) {
-		wgt[i] = wgt[i] / min_wgt;
-	}
-
-	/* iterate through data */
-	for (k = 1; (k <= niter) || (niter == 0); k++) {
-
-		/* copy pic onto pic2 */
-		memcpy(pic2, pic, sizeof(float) * pic_x * pic_y);
-		nzeroes = 0;
-
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-
-				py = j + wth;
-				px = i + wth;
-				pi = py * pic_x + px;
-
-				if (pic[pi] == 0.0) {
-
-					pl   = 0;
-					pr   = 0;
-					pu   = 0;
-					pd   = 0;
-					r    = 1;
-					pave = 0;
-					nn   = 0;
-
-					/* loop through the data to find the nearest neighbors in the 4 cardinal
-					 * directions */
-					while (r <= wth) {
-						pl = (pl == 0 && pic[pi - r] > 0) ? r : pl;
-						pr = (pr == 0 && pic[pi + r] > 0) ? r : pr;
-						pu = (pu == 0 && pic[pi - r * pic_x] > 0) ? r : pu;
-						pd = (pd == 0 && pic[pi + r * pic_x] > 0) ? r : pd;
-
-						/* in the case that we don't have any near neighbors, set values to ave p */
-						if (r == wth) {
-							nn = ((pl > 0) ? 1 : 0) + ((pr > 0) ? 1 : 0) + ((pu > 0) ? 1 : 0) +
-							     ((pd > 0) ? 1 : 0);
-							if (nn > 0) {
-								pave = (pl + pr + pu + pd) / nn;
-								pl   = (pl == 0) ? pave : pl;
-								pr   = (pr == 0) ? pave : pr;
-								pu   = (pu == 0) ? pave : pu;
-								pd   = (pd == 0) ? pave : pd;
-							}
-						}
-
-						r += 1;
-					}
-
-					if (nn > 1) {
-						nzeroes++;
-						pixel             = 0.0;
-						sum_non_zero_mask = 0.0;
-
-						for (mj = wth - pu; mj <= wth + pd; mj++) {
-							for (mi = wth - pl; mi <= wth + pr; mi++) {
-								pixel += pic[(j + mj) * pic_x + (i + mi)] * wgt[mj * w + mi];
-								if (pic[(j + mj) * pic_x + (i + mi)] > 0.0) {
-									sum_non_zero_mask += wgt[mj * w + mi];
-								}
-							}
-						}
-
-						if (sum_non_zero_mask == 0.0) {
-							sum_non_zero_mask = 1.0;
-						} /* sanity */
-
-						/* divide by weight */
-						/* assign pixel to location */
-						pic2[pi] = pixel / sum_non_zero_mask;
-					}
-				}
-			}
-		}
-
-		/* swap pic & pic2 arrays */
-		tpic = pic;
-		pic  = pic2;
-		pic2 = tpic;
-
-		if (nzeroes == 0) {
-			break;
-		}
-	}
-
-	if (niter == 0) {
-		parse_error("Done in %d iterations.\n", k);
-	}
-
-	/* construct return value */
-	pic2 = (float*)realloc(pic2, sizeof(float) * x * y);
-	if (pic2 == NULL) {
-		parse_error("blah");
-		free(wgt);
-		free(pic);
-		return NULL;
-	}
-
-	/* copy data out */
-	for (j = 0; j < y; j++) {
-		for (i = 0; i < x; i++) {
-			pic2[j * x + i] = pic[(j + wth) * pic_x + (i + wth)];
-		}
-	}
-	out = newVal(BSQ, x, y, 1, DV_FLOAT, pic2);
-
-	/* cleanup before exit */
-	free(wgt);
-	free(pic);
-
-	return out;
-}
-
 Var* kjn_smoothy(vfuncptr func, Var* arg)
 {
 	Var* obj       = NULL; /* the object to be smoothed */
@@ -1,6 +1,7 @@
 #include "dvio.h"
 #include "ff_modules.h"
 #include "parser.h"
+#include "parallel.h"
 
 #define XAXIS 1;
 #define YAXIS 2;
@@ -1323,191 +1324,191 @@ Var* thm_rad2tb(vfuncptr func, Var* arg)
 	return (out);
 }
 
-float* rad2tb(Var* radiance, Var* temp_rad, int* bandlist, int bx, float nullval, float maxem)
-{
-
-	float* btemps;              /* the output interpolated brightness temperature data */
-	float *m = NULL, *b = NULL; /* slope and intercept arrays */
-	float* temps = NULL;        /* linear temperature lookup array extracted from temp_rad */
-	float* rads  = NULL;        /* linear radiance lookup array extracted from temp_rad */
-	int x, y;                   /* dimensions of input/output arrays */
-	int pt1, pt2, mid;          /* array indices used in finding bounding points */
-	int w;                      /* y-size of lookup table */
-	int i, j, k;                /* loop indices */
-	int band;                   /* which band is currently being converted */
-	float cur_val = 0.0;        /* temporary extracted radiance value*/
-
-	/*
-	  radiance is a THEMIS radiance cube of up to 10 bands
-	  temp_rad is the radiance/temperature conversion table
-	  bandlist is an integer list of which THEMIS bands are in the radiance cube
-	  bx is the number of elements in bandlist, also the number of bands in the radiance cube
-	  nullval is the null data value
-	  maxem is the maximum allowable emissivity value
-	*/
-
-	x = GetX(radiance);
-	y = GetY(radiance);
-	w = GetY(temp_rad);
-
-	/* assigning memory for the interpolated data, temps and rads */
-	btemps = (float*)calloc(sizeof(DV_FLOAT), x * y * bx);
-	temps  = (float*)malloc(sizeof(DV_FLOAT) * w);
-	rads   = (float*)malloc(sizeof(DV_FLOAT) * w);
+/*
+** temp_rad lookup tables for rad2tb() and tb2rad(): for each band in the
+** bandlist, w keys in ascending order, the w values they map to, and the
+** slope and intercept of each of the w-1 segments.  Each band takes w+1
+** entries; the extra one repeats the last so a value off the top of the
+** table comes back as the last value rather than reading past the end.
+*/
+typedef struct {
+	float *key, *val, *m, *b;
+	int w;
+} thm_table;
 
-	/* slopes and intercepts arrays */
-	m = (float*)calloc(sizeof(DV_FLOAT), w - 1);
-	b = (float*)calloc(sizeof(DV_FLOAT), w - 1);
+static int thm_table_init(thm_table* t, Var* temp_rad, int* bandlist, int bx, int inverse)
+{
+	int i, k, w = GetY(temp_rad);
+	float *key, *val;
 
-	/* extract the linear temperature array */
-	for (i = 0; i < w; i++) {
-		temps[i] = extract_float(temp_rad, cpos(0, i, 0, temp_rad));
-	}
+	t->w   = w;
+	t->key = (float*)calloc(sizeof(DV_FLOAT), (size_t)bx * (w + 1));
+	t->val = (float*)calloc(sizeof(DV_FLOAT), (size_t)bx * (w + 1));
+	t->m   = (float*)calloc(sizeof(DV_FLOAT), (size_t)bx * (w + 1));
+	t->b   = (float*)calloc(sizeof(DV_FLOAT), (size_t)bx * (w + 1));
+	if (t->key == NULL || t->val == NULL || t->m == NULL || t->b == NULL) return (0);
 
-	/* loop through the bands */
 	for (k = 0; k < bx; k++) {
+		key = t->key + k * (w + 1);
+		val = t->val + k * (w + 1);
 
-		band = bandlist[k];
-
-		/* extract linear radiances to temperatures array */
+		/* rad2tb looks up radiance to get temperature, tb2rad the reverse */
 		for (i = 0; i < w; i++) {
-			rads[i] = extract_float(temp_rad, cpos(band, i, 0, temp_rad));
+			key[i] = extract_float(temp_rad, cpos(inverse ? 0 : bandlist[k], i, 0, temp_rad));
+			val[i] = extract_float(temp_rad, cpos(inverse ? bandlist[k] : 0, i, 0, temp_rad));
 		}
+		key[w] = key[w - 1];
+		val[w] = val[w - 1];
 
 		/* calculate the slopes and intercepts */
 		for (i = 1; i < w; i++) {
-			m[i - 1] = (temps[i] - temps[i - 1]) / (rads[i] - rads[i - 1]);
-			b[i - 1] = temps[i - 1] - m[i - 1] * rads[i - 1];
+			t->m[k * (w + 1) + i - 1] = (val[i] - val[i - 1]) / (key[i] - key[i - 1]);
+			t->b[k * (w + 1) + i - 1] = val[i - 1] - t->m[k * (w + 1) + i - 1] * key[i - 1];
 		}
+	}
+	return (1);
+}
 
-		/* work on a point at a time */
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				cur_val = extract_float(radiance, cpos(i, j, k, radiance));
-
-				/* correct for maximum emissivity designation */
-				cur_val *= 1.0 / maxem;
+static void thm_table_free(thm_table* t)
+{
+	free(t->key);
+	free(t->val);
+	free(t->m);
+	free(t->b);
+}
 
-				if (cur_val == -32768 || cur_val == 0 || cur_val == nullval) {
-					btemps[k * y * x + j * x + i] = 0;
-				} else {
-					/* locate the two bounding points in the rads array containing the radiance
-					 * value */
-					pt1 = 0;
-					pt2 = w;
-					mid = 0;
-
-					while ((pt2 - pt1) > 1) {
-						mid                           = (pt1 + pt2) / 2;
-						if (cur_val > rads[mid]) pt1  = mid;
-						if (cur_val < rads[mid]) pt2  = mid;
-						if (cur_val == rads[mid]) pt1 = pt2 = mid;
-					}
+/* interpolate cur_val in band k of the table */
+static float thm_table_lookup(const thm_table* t, int k, float cur_val)
+{
+	const float* key = t->key + k * (t->w + 1);
+	const float* val = t->val + k * (t->w + 1);
+	int pt1 = 0, pt2 = t->w, mid;
 
-					if (temps[pt2] == temps[pt1])
-						btemps[k * y * x + j * x + i] = temps[pt1];
-					else
-						btemps[k * y * x + j * x + i] = m[pt1] * cur_val + b[pt1];
-				}
-			}
-		}
+	/* locate the two bounding points in the key array containing the value */
+	while ((pt2 - pt1) > 1) {
+		mid                           = (pt1 + pt2) / 2;
+		if (cur_val > key[mid]) pt1  = mid;
+		if (cur_val < key[mid]) pt2  = mid;
+		if (cur_val == key[mid]) pt1 = pt2 = mid;
 	}
 
-	free(temps);
-	free(rads);
-	free(m);
-	free(b);
-	return (btemps);
+	if (val[pt2] == val[pt1]) return (val[pt1]);
+	return (t->m[k * (t->w + 1) + pt1] * cur_val + t->b[k * (t->w + 1) + pt1]);
 }
 
-float* tb2rad(float* btemp, Var* temp_rad, int* bandlist, int bx, float nullval, int x, int y)
+typedef struct {
+	thm_table table;
+	Var* radiance;    /* rad2tb input */
+	size_t stride[3]; /* of radiance */
+	float* btemp;     /* tb2rad input, a single band */
+	float* out;
+	size_t plane; /* x*y */
+	int x;
+	float nullval, maxem;
+} thm_job;
+
+static void rad2tb_kernel(void* ctx, size_t begin, size_t end, int tid)
 {
+	thm_job* job = (thm_job*)ctx;
+	size_t n, p;
+	int k;
+	float cur_val;
+
+	for (n = begin; n < end; n++) {
+		k       = n / job->plane;
+		p       = n % job->plane;
+		cur_val = extract_float(job->radiance, (p % job->x) * job->stride[0] +
+		                                           (p / job->x) * job->stride[1] + k * job->stride[2]);
+
+		/* correct for maximum emissivity designation */
+		cur_val *= 1.0 / job->maxem;
+
+		if (cur_val == -32768 || cur_val == 0 || cur_val == job->nullval) {
+			job->out[n] = 0;
+		} else {
+			job->out[n] = thm_table_lookup(&job->table, k, cur_val);
+		}
+	}
+}
 
-	float* irads;               /* output interpolated radiance values */
-	float *m = NULL, *b = NULL; /* slope and intercept arrays */
-	float* temps = NULL;        /* linear temperature lookup array extracted from temp_rad */
-	float* rads  = NULL;        /* linear radiance lookup array extracted from temp_rad */
-	int pt1, pt2, mid;          /* array indices used in finding bounding points */
-	int w;                      /* y-size of lookup table */
-	int i, j, k;                /* loop indices */
-	int band;                   /* which band is currently being converted */
-	float cur_val = 0.0;        /* temporary extracted radiance value*/
-
+float* rad2tb(Var* radiance, Var* temp_rad, int* bandlist, int bx, float nullval, float maxem)
+{
 	/*
-	  btemp is a single THEMIS brightness temperature map
+	  radiance is a THEMIS radiance cube of up to 10 bands
 	  temp_rad is the radiance/temperature conversion table
 	  bandlist is an integer list of which THEMIS bands are in the radiance cube
 	  bx is the number of elements in bandlist, also the number of bands in the radiance cube
 	  nullval is the null data value
+	  maxem is the maximum allowable emissivity value
 	*/
 
-	w = GetY(temp_rad);
-
-	/* assigning memory for the interpolated data, temps and rads */
-	irads = (float*)calloc(sizeof(DV_FLOAT), x * y * bx);
-	temps = (float*)malloc(sizeof(DV_FLOAT) * w);
-	rads  = (float*)malloc(sizeof(DV_FLOAT) * w);
+	thm_job job;
+
+	memset(&job, 0, sizeof(job));
+	job.x        = GetX(radiance);
+	job.plane    = (size_t)GetX(radiance) * GetY(radiance);
+	job.radiance = radiance;
+	job.nullval  = nullval;
+	job.maxem    = maxem;
+	cstrides(radiance, job.stride);
+
+	/* the interpolated brightness temperatures */
+	job.out = (float*)calloc(sizeof(DV_FLOAT), job.plane * bx);
+	if (job.out == NULL || !thm_table_init(&job.table, temp_rad, bandlist, bx, 0)) {
+		thm_table_free(&job.table);
+		free(job.out);
+		return (NULL);
+	}
 
-	/* slopes and intercepts arrays */
-	m = (float*)calloc(sizeof(DV_FLOAT), w - 1);
-	b = (float*)calloc(sizeof(DV_FLOAT), w - 1);
+	dv_parallel_for(job.plane * bx, 4096, rad2tb_kernel, &job);
 
-	/* extract the linear temperature array */
-	for (i = 0; i < w; i++) {
-		temps[i] = extract_float(temp_rad, cpos(0, i, 0, temp_rad));
-	}
+	thm_table_free(&job.table);
+	return (job.out);
+}
 
-	/* loop through the bands */
-	for (k = 0; k < bx; k++) {
+static void tb2rad_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	thm_job* job = (thm_job*)ctx;
+	size_t n;
+	float cur_val;
 
-		band = bandlist[k];
+	for (n = begin; n < end; n++) {
+		cur_val = job->btemp[n % job->plane];
+		if (cur_val == 0) job->out[n] = job->nullval;
+		if (cur_val > 0) job->out[n] = thm_table_lookup(&job->table, n / job->plane, cur_val);
+	}
+}
 
-		/* extract linear radiances array */
-		for (i = 0; i < w; i++) {
-			rads[i] = extract_float(temp_rad, cpos(band, i, 0, temp_rad));
-		}
+float* tb2rad(float* btemp, Var* temp_rad, int* bandlist, int bx, float nullval, int x, int y)
+{
+	/*
+	  btemp is a single THEMIS brightness temperature map
+	  temp_rad is the radiance/temperature conversion table
+	  bandlist is an integer list of which THEMIS bands are in the radiance cube
+	  bx is the number of elements in bandlist, also the number of bands in the radiance cube
+	  nullval is the null data value
+	*/
 
-		/* calculate the slopes and intercepts */
-		for (i = 1; i < w; i++) {
-			m[i - 1] = (rads[i] - rads[i - 1]) / (temps[i] - temps[i - 1]);
-			b[i - 1] = rads[i - 1] - m[i - 1] * temps[i - 1];
-		}
+	thm_job job;
 
-		/* work on a point at a time */
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				cur_val                                        = btemp[j * x + i];
-				if (cur_val == 0) irads[k * y * x + j * x + i] = nullval;
-
-				if (cur_val > 0) {
-
-					/* locate the two bounding points in the temps array containing the temperature
-					 * value */
-					pt1 = 0;
-					pt2 = w;
-					mid = 0;
-
-					while ((pt2 - pt1) > 1) {
-						mid                            = (pt1 + pt2) / 2;
-						if (cur_val > temps[mid]) pt1  = mid;
-						if (cur_val < temps[mid]) pt2  = mid;
-						if (cur_val == temps[mid]) pt1 = pt2 = mid;
-					}
+	memset(&job, 0, sizeof(job));
+	job.x       = x;
+	job.plane   = (size_t)x * y;
+	job.btemp   = btemp;
+	job.nullval = nullval;
 
-					if (rads[pt2] == rads[pt1])
-						irads[k * y * x + j * x + i] = rads[pt1];
-					else
-						irads[k * y * x + j * x + i] = m[pt1] * cur_val + b[pt1];
-				}
-			}
-		}
+	/* the interpolated radiances */
+	job.out = (float*)calloc(sizeof(DV_FLOAT), job.plane * bx);
+	if (job.out == NULL || !thm_table_init(&job.table, temp_rad, bandlist, bx, 1)) {
+		thm_table_free(&job.table);
+		free(job.out);
+		return (NULL);
 	}
 
-	free(temps);
-	free(rads);
-	free(m);
-	free(b);
-	return (irads);
+	dv_parallel_for(job.plane * bx, 4096, tb2rad_kernel, &job);
+
+	thm_table_free(&job.table);
+	return (job.out);
 }
 
 Var* thm_themissivity(vfuncptr func, Var* arg)
@@ -2491,6 +2492,30 @@ double* radcorrspace(Var* measured, float* bbody)
 	return (rcspace);
 }
 
+typedef struct {
+	float* btemp; /* x*y */
+	float* out;   /* x*y*z */
+	float *wl, *num; /* wavelength and c1/wl^5 of each band */
+	size_t plane;
+	float nullval;
+} bbrw_job;
+
+static void bbrw_k_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	bbrw_job* job = (bbrw_job*)ctx;
+	float c2      = 14387.9; // c constant in units of micron K
+	size_t n, k;
+	float t;
+
+	for (n = begin; n < end; n++) {
+		k = n / job->plane;
+		t = job->btemp[n % job->plane];
+		if (t != job->nullval) {
+			job->out[n] = job->num[k] / (exp(c2 / (job->wl[k] * t)) - 1.0);
+		}
+	}
+}
+
 float* bbrw_k(float* btemp, int* bandlist, int x, int y, int z, float nullval)
 {
 	/* compute spectral radiance in units of W cm-2 str-1 micron-1
@@ -2499,13 +2524,12 @@ float* bbrw_k(float* btemp, int* bandlist, int x, int y, int z, float nullval)
 	   z MUST be the number of bands in bandlist
 	   btemp is a single band of maximum brightness temperature with dimensions x*y */
 
-	int i, j, k;
+	int k;
 	float* irads       = NULL;
 	float* wavelengths = NULL;
 	float c1           = 11911.0; // a constant in units of W cm-2 micron^4 str-1
-	float c2           = 14387.9; // c constant in units of micron K
 	int wl             = 0;       // current themis band in bandlist
-	float numerator    = 0.0;
+	bbrw_job job;
 
 	/* wavelengths of themis bands in microns */
 	wavelengths    = (float*)calloc(sizeof(DV_FLOAT), 10);
@@ -2523,20 +2547,23 @@ float* bbrw_k(float* btemp, int* bandlist, int x, int y, int z, float nullval)
 	/* create new calculated radiance array */
 	irads = (float*)calloc(sizeof(DV_FLOAT), x * y * z);
 
-	for (k = 0; k < z; k++) {
-		wl        = bandlist[k] - 1;
-		numerator = (c1 / pow(wavelengths[wl], 5));
+	job.btemp   = btemp;
+	job.out     = irads;
+	job.plane   = (size_t)x * y;
+	job.nullval = nullval;
+	job.wl      = (float*)calloc(sizeof(DV_FLOAT), z);
+	job.num     = (float*)calloc(sizeof(DV_FLOAT), z);
 
-		for (j = 0; j < y; j++) {
-			for (i = 0; i < x; i++) {
-				if (btemp[j * x + i] != nullval) {
-					irads[k * y * x + j * x + i] =
-					    numerator / (exp(c2 / (wavelengths[wl] * btemp[j * x + i])) - 1.0);
-				}
-			}
-		}
+	for (k = 0; k < z; k++) {
+		wl         = bandlist[k] - 1;
+		job.wl[k]  = wavelengths[wl];
+		job.num[k] = (c1 / pow(wavelengths[wl], 5));
 	}
 
+	dv_parallel_for(job.plane * z, 4096, bbrw_k_kernel, &job);
+
+	free(job.wl);
+	free(job.num);
 	free(wavelengths);
 	return (irads);
 }
@@ -201,6 +201,10 @@ Var* evaluate(Var* n)
 	case ID_RSHIFT:
 	case ID_MOD:
 	case ID_POW:
+		if (pp_fuse(n, &p1)) {
+			push(scope, p1);
+			break;
+		}
 		if (left) evaluate(left);
 		if (right) evaluate(right);
 		p2 = pop(scope);
@@ -209,6 +213,10 @@ Var* evaluate(Var* n)
 		break;
 
 	case ID_UMINUS:
+		if (pp_fuse(n, &p1)) {
+			push(scope, p1);
+			break;
+		}
 		if (left) evaluate(left);
 		if (right) evaluate(right);
 		p1 = pop(scope);
@@ -301,6 +309,11 @@ Var* evaluate(Var* n)
 		break;
 
 	case ID_FUNCT:
+		if (pp_fuse(n, &p1)) {
+			push(scope, p1);
+			scope->returned = 0;
+			break;
+		}
 		p1 = NULL;
 		if (right != NULL) {
 			evaluate(right);
@@ -0,0 +1,102 @@
+#include "parser.h"
+#include "parallel.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#define MAX_THREADS 256
+
+int dv_num_threads(void)
+{
+	static int ncpus = 0;
+
+	if (NTHREADS > 0) return min(NTHREADS, MAX_THREADS);
+
+	if (ncpus == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (ncpus < 1) ncpus = 1;
+		if (ncpus > MAX_THREADS) ncpus = MAX_THREADS;
+	}
+	return ncpus;
+}
+
+/**
+ ** Number of chunks (and so the number of distinct tids) dv_parallel_for()
+ ** will use for n items; use it to size per-thread scratch space.
+ **/
+int dv_parallel_chunks(size_t n, size_t grain)
+{
+	size_t nchunks;
+
+	if (n == 0) return 0;
+	if (grain < 1) grain = 1;
+
+	nchunks = (n + grain - 1) / grain;
+	return (int)min(nchunks, (size_t)dv_num_threads());
+}
+
+typedef struct {
+	dv_range_fn fn;
+	void* ctx;
+	size_t begin;
+	size_t end;
+	int tid;
+} range_job;
+
+#ifdef HAVE_LIBPTHREAD
+static void* run_range_job(void* arg)
+{
+	range_job* job = (range_job*)arg;
+
+	job->fn(job->ctx, job->begin, job->end, job->tid);
+	return NULL;
+}
+#endif
+
+void dv_parallel_for(size_t n, size_t grain, dv_range_fn fn, void* ctx)
+{
+	int nchunks = dv_parallel_chunks(n, grain);
+	int i;
+
+	if (nchunks <= 1) {
+		if (n) fn(ctx, 0, n, 0);
+		return;
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	{
+		range_job jobs[MAX_THREADS];
+		pthread_t threads[MAX_THREADS];
+		int started[MAX_THREADS];
+
+		for (i = 0; i < nchunks; i++) {
+			jobs[i].fn    = fn;
+			jobs[i].ctx   = ctx;
+			jobs[i].begin = n * i / nchunks;
+			jobs[i].end   = n * (i + 1) / nchunks;
+			jobs[i].tid   = i;
+		}
+
+		// if a thread can't be started its chunk just runs here instead
+		for (i = 1; i < nchunks; i++) {
+			started[i] = (pthread_create(&threads[i], NULL, run_range_job, &jobs[i]) == 0);
+		}
+		fn(ctx, jobs[0].begin, jobs[0].end, 0);
+
+		for (i = 1; i < nchunks; i++) {
+			if (started[i]) {
+				pthread_join(threads[i], NULL);
+			} else {
+				fn(ctx, jobs[i].begin, jobs[i].end, i);
+			}
+		}
+	}
+#else
+	for (i = 0; i < nchunks; i++) {
+		fn(ctx, n * i / nchunks, n * (i + 1) / nchunks, i);
+	}
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+/**
+ ** Minimal data-parallel helper for the number crunching builtins.
+ **
+ ** dv_parallel_for() splits [0, n) into at most dv_num_threads() contiguous
+ ** chunks of at least grain items each and calls fn(ctx, begin, end, tid)
+ ** once per chunk, tid running 0 .. nchunks-1.  The split only depends on
+ ** n, grain and the thread count, so a kernel that keeps per-tid partial
+ ** results and combines them in tid order is reproducible.  The calling
+ ** thread runs chunk 0 and the call returns when every chunk is done.
+ **
+ ** Kernels run outside the interpreter: they must not call parse_error(),
+ ** create Vars or touch any other interpreter state.
+ **
+ ** The thread count comes from the NTHREADS reserved variable; 0 (the
+ ** default) means one thread per online CPU.  Without pthreads everything
+ ** runs serially on the calling thread.
+ **/
+
+typedef void (*dv_range_fn)(void* ctx, size_t begin, size_t end, int tid);
+
+int dv_num_threads(void);
+int dv_parallel_chunks(size_t n, size_t grain);
+void dv_parallel_for(size_t n, size_t grain, dv_range_fn fn, void* ctx);
+
+#endif /* PARALLEL_H */
@@ -63,6 +63,7 @@
 
 typedef double (*dfunc)(double);
 typedef double (*ddfunc)(double, double);
+typedef void (*bdfunc)(const double*, const double*, double*, size_t); /* ddfunc over n values */
 
 
 #define YYSTYPE varptr
@@ -60,9 +60,21 @@ typedef struct Node {
 	int token_number; /* Where in the value table is this puppy located? */
 } Node;
 
+/*
+** The rows of a TEXT array are either malloc()ed one by one (store is
+** NULL) or point into a TextStore, which copies and whole-row subsets
+** share until one of them is changed (see text_unshare()).
+*/
+typedef struct TextStore {
+	int refs;
+	char* chars; /* every row, NUL terminated */
+	char** rows; /* where each row starts in chars */
+} TextStore;
+
 typedef struct TextArray {
 	int Row;
 	char** text;
+	TextStore* store;
 } TextArray;
 
 struct _var {
@@ -90,7 +102,7 @@ struct _vfuncptr {
 	const char* name;
 	vfunc fptr;
 	void* fdata;
-	void* fdata2;
+	void* bind; /* parse_args() bindings, see misc.c */
 };
 
 
@@ -43,14 +43,17 @@ Var* V_DUP(Var* v)
 		r = (Var*)duplicate_struct(v); break;
 
 	case ID_TEXT: /*Added: Thu Mar  2 16:49:11 MST 2000*/
-	{
-		int i;
-		V_TEXT(r).Row  = V_TEXT(v).Row;
-		V_TEXT(r).text = (char**)calloc(sizeof(char*), V_TEXT(r).Row);
-		for (i = 0; i < V_TEXT(r).Row; i++) {
-			V_TEXT(r).text[i] = strdup(V_TEXT(v).text[i]);
+		/* the copy shares v's rows until one of them is changed */
+		if (V_TEXT(v).store != NULL) {
+			V_TEXT(v).store->refs++;
+		} else if ((V_TEXT(r).store = text_store_copy(V_TEXT(v).text, V_TEXT(v).Row)) != NULL) {
+			V_TEXT(r).text = V_TEXT(r).store->rows;
+		} else {
+			V_TEXT(r).Row  = 0;
+			V_TEXT(r).text = NULL;
+			return (NULL);
 		}
-	} break;
+		break;
 	default: return (NULL);
 	}
 	return (r);
@@ -335,6 +338,7 @@ Var* pp_set_var(Var* id, Var* range, Var* exp)
 		if (!strcmp(V_NAME(exp), "SCALE")) SCALE = V_INT(exp);
 		if (!strcmp(V_NAME(exp), "debug")) debug = V_INT(exp);
 		if (!strcmp(V_NAME(exp), "DEPTH")) DEPTH = V_INT(exp);
+		if (!strcmp(V_NAME(exp), "NTHREADS")) NTHREADS = V_INT(exp);
 
 		exp = put_sym(exp);
 	}
@@ -431,6 +435,7 @@ Var* pp_inc_var(Var* id, Var* range, Var* exp)
 		if (!strcmp(V_NAME(exp), "SCALE")) SCALE = V_INT(exp);
 		if (!strcmp(V_NAME(exp), "debug")) debug = V_INT(exp);
 		if (!strcmp(V_NAME(exp), "DEPTH")) DEPTH = V_INT(exp);
+		if (!strcmp(V_NAME(exp), "NTHREADS")) NTHREADS = V_INT(exp);
 
 		exp = put_sym(exp);
 	}
@@ -1075,8 +1080,7 @@ Var* pp_shell(char* cmd)
 Var* pp_set_where(Var* id, Var* where, Var* exp)
 {
 	Var* v;
-	size_t i, j, k, l, dsize;
-	int format;
+	size_t i, j, k, l;
 	double dval;
 
 	/**
@@ -1113,6 +1117,11 @@ Var* pp_set_where(Var* id, Var* where, Var* exp)
 	    V_TYPE(where) == ID_VAL)
 		return (where_text(id, where, exp));
 
+	if (V_TYPE(id) != ID_VAL || V_TYPE(where) != ID_VAL || V_TYPE(exp) != ID_VAL) {
+		parse_error("where: only numeric values can be assigned");
+		return (NULL);
+	}
+
 	if (V_DSIZE(exp) != 1) {
 		for (i = 0; i < 3; i++) {
 			j = V_SIZE(id)[orders[V_ORG(id)][i]];
@@ -1140,50 +1149,45 @@ Var* pp_set_where(Var* id, Var* where, Var* exp)
 	}
 
 	if (V_DSIZE(exp) == 1) {
-		dsize  = V_DSIZE(id);
-		format = V_FORMAT(id);
+		union {
+			u8 u8;
+			u16 u16;
+			u32 u32;
+			u64 u64;
+			i8 i8;
+			i16 i16;
+			i32 i32;
+			i64 i64;
+			float f;
+			double d;
+		} val;
 
 		// NOTE(rswinkle)
 		u64 uval = extract_u64(exp, 0);
 		i64 ival = extract_i64(exp, 0);
 		dval = extract_double(exp, 0);
 
-		for (i = 0; i < dsize; i++) {
-			j = rpos(i, id, where);
-			if (extract_int(where, j)) {
-				switch (format) {
-				case DV_UINT8: ((u8*)V_DATA(id))[i]   = uval; break;
-				case DV_UINT16: ((u16*)V_DATA(id))[i] = uval; break;
-				case DV_UINT32: ((u32*)V_DATA(id))[i] = uval; break;
-				case DV_UINT64: ((u64*)V_DATA(id))[i] = uval; break;
-
-				case DV_INT8: ((i8*)V_DATA(id))[i]    = ival; break;
-				case DV_INT16: ((i16*)V_DATA(id))[i]  = ival; break;
-				case DV_INT32: ((i32*)V_DATA(id))[i]  = ival; break;
-				case DV_INT64: ((i64*)V_DATA(id))[i]  = ival; break;
-
-				case DV_FLOAT: ((float*)V_DATA(id))[i]   = dval; break;
-				case DV_DOUBLE: ((double*)V_DATA(id))[i] = dval; break;
-				}
-			}
+		switch (V_FORMAT(id)) {
+		case DV_UINT8: val.u8   = uval; break;
+		case DV_UINT16: val.u16 = uval; break;
+		case DV_UINT32: val.u32 = uval; break;
+		case DV_UINT64: val.u64 = uval; break;
+
+		case DV_INT8: val.i8   = ival; break;
+		case DV_INT16: val.i16 = ival; break;
+		case DV_INT32: val.i32 = ival; break;
+		case DV_INT64: val.i64 = ival; break;
+
+		case DV_FLOAT: val.f  = dval; break;
+		case DV_DOUBLE: val.d = dval; break;
 		}
-	} else {
-		dsize  = V_DSIZE(id);
-		format = V_FORMAT(id);
-
-		for (i = 0; i < dsize; i++) {
-			j = rpos(i, id, where);
-			if (extract_int(where, j)) {
-				k = rpos(i, id, exp);
-				switch (format) {
-				case DV_UINT8: ((u_char*)V_DATA(id))[i]  = extract_int(exp, k); break;
-				case DV_INT16: ((short*)V_DATA(id))[i]   = extract_int(exp, k); break;
-				case DV_INT32: ((int*)V_DATA(id))[i]     = extract_int(exp, k); break;
-				case DV_FLOAT: ((float*)V_DATA(id))[i]   = extract_double(exp, k); break;
-				case DV_DOUBLE: ((double*)V_DATA(id))[i] = extract_double(exp, k); break;
-				}
-			}
+		if (!where_fill(id, where, &val)) {
+			parse_error("Unable to allocate memory");
+			return (NULL);
 		}
+	} else if (!where_copy(id, where, exp)) {
+		parse_error("Unable to allocate memory");
+		return (NULL);
 	}
 	return (id);
 }
@@ -0,0 +1,516 @@
+#include "parallel.h"
+#include "parser.h"
+
+/**
+ ** pp_fuse() - evaluate a tree of element-wise math in one pass
+ **
+ ** evaluate() hands every arithmetic, comparison or math function node
+ ** (sin(), sqrt(), ... anything run by ff_dfunc()) to pp_fuse().  When
+ ** that node heads a tree of two or more of them, the leaves of the tree
+ ** are evaluated as usual and, if they are all numeric arrays of one
+ ** size and organization (or single values), the whole tree is run as
+ ** one loop over the output, in parallel chunks, streaming each input
+ ** once.  None of the full size temporaries that pp_math() would make
+ ** for the inner nodes are allocated.
+ **
+ ** Each node works in the same types and with the same clamping as
+ ** pp_math() and ff_dfunc() do, so the answer is the same either way.
+ ** Any other tree is done node by node with pp_math(), as before.
+ **/
+
+#define FUSE_MAXNODES 64   /* bigger trees aren't fused */
+#define FUSE_BLOCK 256     /* elements a node works on at a time */
+#define FUSE_MIN 4096      /* smaller arrays aren't worth it */
+
+/* kinds of node besides the ID_ operators */
+enum { FUSE_LEAF = -1, FUSE_DFUNC = -2 };
+
+/* what a node keeps its values in */
+enum { FUSE_INT, FUSE_FLT, FUSE_DBL };
+
+typedef struct {
+	int op;        /* ID_ADD .. ID_GE, ID_OR, ID_AND, FUSE_LEAF or FUSE_DFUNC */
+	int a, b;      /* operands: b for functions, a and b for operators */
+	Var* tree;     /* parse node; a NULL leaf is the 0 of unary minus */
+	Var* v;        /* leaf value as evaluated */
+	Var* r;        /* leaf value resolved to an ID_VAL */
+	int format;    /* format of the node's result */
+	int in_format; /* format the operands are combined in */
+	dfunc fn;
+} fuse_node;
+
+typedef struct {
+	fuse_node node[FUSE_MAXNODES];
+	int n;
+	int nops;
+} fuse_tree;
+
+typedef struct {
+	fuse_node* node;
+	int n;
+	void* out;
+	char* scratch;  /* per thread: a block per node, plus two */
+	size_t* dzero;  /* per thread and node: divisions by zero */
+} fuse_job;
+
+static int fuse_class(int format)
+{
+	if (format == DV_FLOAT) return FUSE_FLT;
+	if (format == DV_DOUBLE) return FUSE_DBL;
+	return FUSE_INT;
+}
+
+/*
+** Is n an element-wise node?  Returns the operator, FUSE_DFUNC (with the
+** function argument in *arg), or FUSE_LEAF.
+*/
+static int fuse_op(Var* n, Var** arg)
+{
+	Var *left, *args;
+	vfuncptr f;
+
+	switch (V_TYPE(n)) {
+	case ID_OR:
+	case ID_AND:
+	case ID_EQ:
+	case ID_NE:
+	case ID_LT:
+	case ID_GT:
+	case ID_LE:
+	case ID_GE:
+	case ID_ADD:
+	case ID_SUB:
+	case ID_MULT:
+	case ID_DIV:
+	case ID_MOD:
+	case ID_POW:
+		if (V_NODE(n)->left && V_NODE(n)->right) return V_TYPE(n);
+		break;
+	case ID_UMINUS:
+		if (V_NODE(n)->right) return ID_UMINUS;
+		break;
+
+	case ID_FUNCT:
+		/* name(expr), where name is a builtin run by ff_dfunc() */
+		left = V_NODE(n)->left;
+		args = V_NODE(n)->right;
+		if (left == NULL || V_TYPE(left) == ID_DEREF || V_NAME(left) == NULL ||
+		    V_NAME(left)[0] == '$')
+			break;
+		if (args == NULL || V_TYPE(args) != ID_ARGS || V_NODE(args)->left != NULL) break;
+		args = V_NODE(args)->right;
+		if (args == NULL || V_TYPE(args) != ID_ARG || V_NODE(args)->left != NULL) break;
+		if ((f = find_vfunc(V_NAME(left))) == NULL || f->fptr != ff_dfunc || f->fdata == NULL) break;
+		*arg = V_NODE(args)->right;
+		return FUSE_DFUNC;
+	}
+	return FUSE_LEAF;
+}
+
+/* add n and its subtree to t in post order; returns its index or -1 */
+static int fuse_add(fuse_tree* t, Var* n)
+{
+	fuse_node node;
+	Var* arg = NULL;
+	int op   = fuse_op(n, &arg);
+
+	memset(&node, 0, sizeof(node));
+	node.tree = n;
+	node.a = node.b = -1;
+
+	switch (op) {
+	case FUSE_LEAF: break;
+	case FUSE_DFUNC:
+		if ((node.b = fuse_add(t, arg)) < 0) return -1;
+		node.fn = (dfunc)find_vfunc(V_NAME(V_NODE(n)->left))->fdata;
+		break;
+	case ID_UMINUS:
+		/* pp_math(NULL, ID_SUB, x) */
+		if (t->n == FUSE_MAXNODES) return -1;
+		memset(&t->node[t->n], 0, sizeof(fuse_node));
+		t->node[t->n].op = FUSE_LEAF;
+		t->node[t->n].a = t->node[t->n].b = -1;
+		node.a = t->n++;
+		if ((node.b = fuse_add(t, V_NODE(n)->right)) < 0) return -1;
+		op = ID_SUB;
+		break;
+	default:
+		if ((node.a = fuse_add(t, V_NODE(n)->left)) < 0) return -1;
+		if ((node.b = fuse_add(t, V_NODE(n)->right)) < 0) return -1;
+		break;
+	}
+	if (t->n == FUSE_MAXNODES) return -1;
+
+	node.op = op;
+	if (op != FUSE_LEAF) t->nops++;
+	t->node[t->n] = node;
+	return t->n++;
+}
+
+/*
+** Can the tree run fused?  Works out the node formats and the shape
+** of the result, which is taken from *shape.
+*/
+static int fuse_check(fuse_tree* t, Var** shape)
+{
+	int k;
+	fuse_node* p;
+
+	*shape = NULL;
+	for (k = 0; k < t->n; k++) {
+		p = &t->node[k];
+		if (p->op == FUSE_LEAF) {
+			if (p->r == NULL || V_TYPE(p->r) != ID_VAL || V_DATA(p->r) == NULL) return 0;
+			if (V_DSIZE(p->r) != 1) {
+				if (*shape == NULL) {
+					*shape = p->r;
+				} else if (V_ORG(p->r) != V_ORG(*shape) || V_SIZE(p->r)[0] != V_SIZE(*shape)[0] ||
+				           V_SIZE(p->r)[1] != V_SIZE(*shape)[1] || V_SIZE(p->r)[2] != V_SIZE(*shape)[2]) {
+					return 0;
+				}
+			}
+			p->format = V_FORMAT(p->r);
+		} else if (p->op == FUSE_DFUNC) {
+			p->format = p->in_format = DV_DOUBLE;
+		} else {
+			p->in_format = p->format = combine_formats(t->node[p->a].format, t->node[p->b].format);
+			if (is_relop(p->op)) p->format = DV_UINT8;
+		}
+	}
+	return *shape != NULL && V_DSIZE(*shape) >= FUSE_MIN;
+}
+
+/* load n values of leaf p, starting at i, into its block */
+#define FUSE_LOAD(T, R)                                              \
+	{                                                                \
+		T* s = (T*)V_DATA(p->r);                                     \
+		if (V_DSIZE(p->r) == 1)                                      \
+			for (j = 0; j < n; j++) R[j] = s[0];                     \
+		else                                                         \
+			for (j = 0; j < n; j++) R[j] = s[i + j];                 \
+	}
+
+static void fuse_load(fuse_node* p, void* reg, size_t i, size_t n)
+{
+	size_t j;
+	i64* ri    = (i64*)reg;
+	float* rf  = (float*)reg;
+	double* rd = (double*)reg;
+
+	switch (p->format) {
+	case DV_UINT8: FUSE_LOAD(u8, ri); break;
+	case DV_UINT16: FUSE_LOAD(u16, ri); break;
+	case DV_UINT32: FUSE_LOAD(u32, ri); break;
+	case DV_UINT64: FUSE_LOAD(u64, ri); break;
+	case DV_INT8: FUSE_LOAD(i8, ri); break;
+	case DV_INT16: FUSE_LOAD(i16, ri); break;
+	case DV_INT32: FUSE_LOAD(i32, ri); break;
+	case DV_INT64: FUSE_LOAD(i64, ri); break;
+	case DV_FLOAT: FUSE_LOAD(float, rf); break;
+	case DV_DOUBLE: FUSE_LOAD(double, rd); break;
+	}
+}
+
+/*
+** Convert the block of node p to the type a parent works in, the way
+** the extract_ functions would.  Integers are held as i64 (a uint64 as
+** its bits); as32 truncates them like extract_int().
+*/
+static void fuse_convert(fuse_node* p, const void* reg, int to, int as32, void* dst, size_t n)
+{
+	size_t j;
+	const i64* ri    = (const i64*)reg;
+	const float* rf  = (const float*)reg;
+	const double* rd = (const double*)reg;
+	int u64s         = p->format == DV_UINT64;
+
+	switch (fuse_class(p->format) * 3 + to) {
+	case FUSE_INT * 3 + FUSE_INT:
+		if (as32)
+			for (j = 0; j < n; j++) ((i64*)dst)[j] = (i32)ri[j];
+		else
+			memcpy(dst, ri, n * sizeof(i64));
+		break;
+	case FUSE_INT * 3 + FUSE_FLT:
+		if (u64s)
+			for (j = 0; j < n; j++) ((float*)dst)[j] = (float)(u64)ri[j];
+		else
+			for (j = 0; j < n; j++) ((float*)dst)[j] = (float)ri[j];
+		break;
+	case FUSE_INT * 3 + FUSE_DBL:
+		if (u64s)
+			for (j = 0; j < n; j++) ((double*)dst)[j] = (double)(u64)ri[j];
+		else
+			for (j = 0; j < n; j++) ((double*)dst)[j] = (double)ri[j];
+		break;
+	case FUSE_FLT * 3 + FUSE_FLT: memcpy(dst, rf, n * sizeof(float)); break;
+	case FUSE_FLT * 3 + FUSE_DBL:
+		for (j = 0; j < n; j++) ((double*)dst)[j] = rf[j];
+		break;
+	case FUSE_DBL * 3 + FUSE_DBL: memcpy(dst, rd, n * sizeof(double)); break;
+	case FUSE_DBL * 3 + FUSE_FLT:
+		for (j = 0; j < n; j++) ((float*)dst)[j] = (float)rd[j];
+		break;
+	default: /* floating point into an integer node; combine_formats() never does this */
+		for (j = 0; j < n; j++) ((i64*)dst)[j] = (i64)(to == FUSE_FLT ? rf[j] : rd[j]);
+	}
+}
+
+/*
+** The loops of DO_MATH_LOOP() and DO_RELOP_LOOP() in pp_math.c, a block
+** at a time.  x and y are the operands in the type the node works in,
+** r the result.
+*/
+#define FUSE_MATH(T2, _S_)                                                           \
+	switch (op) {                                                                    \
+	case ID_ADD:                                                                     \
+		for (j = 0; j < n; j++) r[j] = (T2)_S_(x[j] + y[j]);                          \
+		break;                                                                       \
+	case ID_SUB:                                                                     \
+		for (j = 0; j < n; j++) r[j] = (T2)_S_(x[j] - y[j]);                          \
+		break;                                                                       \
+	case ID_MULT:                                                                    \
+		for (j = 0; j < n; j++) r[j] = (T2)_S_(x[j] * y[j]);                          \
+		break;                                                                       \
+	case ID_DIV:                                                                     \
+		for (j = 0; j < n; j++) {                                                    \
+			if (y[j] != 0) {                                                         \
+				r[j] = (T2)_S_(x[j] / y[j]);                                         \
+			} else {                                                                 \
+				r[j] = (T2)_S_(0);                                                   \
+				dzero++;                                                             \
+			}                                                                        \
+		}                                                                            \
+		break;                                                                       \
+	case ID_MOD:                                                                     \
+		for (j = 0; j < n; j++) r[j] = (T2)_S_(fmod((double)x[j], (double)y[j]));    \
+		break;                                                                       \
+	case ID_POW:                                                                     \
+		for (j = 0; j < n; j++) r[j] = (T2)_S_(pow((double)x[j], (double)y[j]));     \
+		break;                                                                       \
+	}
+
+#define FUSE_RELOP()                                              \
+	switch (op) {                                                 \
+	case ID_EQ: for (j = 0; j < n; j++) r[j] = (x[j] == y[j]); break; \
+	case ID_NE: for (j = 0; j < n; j++) r[j] = (x[j] != y[j]); break; \
+	case ID_LT: for (j = 0; j < n; j++) r[j] = (x[j] < y[j]); break;  \
+	case ID_GT: for (j = 0; j < n; j++) r[j] = (x[j] > y[j]); break;  \
+	case ID_LE: for (j = 0; j < n; j++) r[j] = (x[j] <= y[j]); break; \
+	case ID_GE: for (j = 0; j < n; j++) r[j] = (x[j] >= y[j]); break; \
+	case ID_OR: for (j = 0; j < n; j++) r[j] = (x[j] || y[j]); break; \
+	case ID_AND: for (j = 0; j < n; j++) r[j] = (x[j] && y[j]); break; \
+	}
+
+static size_t fuse_int_op(int op, int format, const i64* x, const i64* y, i64* r, size_t n)
+{
+	size_t j, dzero = 0;
+
+	switch (format) {
+	case DV_UINT8: FUSE_MATH(u8, clamp_byte); break;
+	case DV_UINT16: FUSE_MATH(u16, clamp_u16); break;
+	case DV_UINT32: FUSE_MATH(u32, clamp_u32); break;
+	case DV_UINT64: FUSE_MATH(u64, (u64)); break;
+	case DV_INT8: FUSE_MATH(i8, clamp_i8); break;
+	case DV_INT16: FUSE_MATH(i16, clamp_short); break;
+	case DV_INT32: FUSE_MATH(i32, clamp_i32); break;
+	case DV_INT64: FUSE_MATH(i64, (i64)); break;
+	}
+	return dzero;
+}
+
+static size_t fuse_flt_op(int op, const float* x, const float* y, float* r, size_t n)
+{
+	size_t j, dzero = 0;
+	FUSE_MATH(float, (float));
+	return dzero;
+}
+
+static size_t fuse_dbl_op(int op, const double* x, const double* y, double* r, size_t n)
+{
+	size_t j, dzero = 0;
+	FUSE_MATH(double, (double));
+	return dzero;
+}
+
+static void fuse_relop(int op, int cls, const void* xv, const void* yv, i64* r, size_t n)
+{
+	size_t j;
+
+	if (cls == FUSE_INT) {
+		const i64 *x = (const i64*)xv, *y = (const i64*)yv;
+		FUSE_RELOP();
+	} else if (cls == FUSE_FLT) {
+		const float *x = (const float*)xv, *y = (const float*)yv;
+		FUSE_RELOP();
+	} else {
+		const double *x = (const double*)xv, *y = (const double*)yv;
+		FUSE_RELOP();
+	}
+}
+
+#define FUSE_STORE(T, R)                                       \
+	for (j = 0; j < n; j++) ((T*)out)[i + j] = (T)R[j];
+
+static void fuse_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	fuse_job* job = (fuse_job*)ctx;
+	size_t block  = FUSE_BLOCK * sizeof(double);
+	char* regs    = job->scratch + (size_t)tid * (job->n + 2) * block;
+	char *x = regs + job->n * block, *y = x + block;
+	size_t* dzero = job->dzero + (size_t)tid * job->n;
+	fuse_node *p, *root = &job->node[job->n - 1];
+	size_t i, j, n;
+	int k, cls, as32;
+	void* out = job->out;
+	i64* ri;
+	float* rf;
+	double* rd;
+
+	for (i = begin; i < end; i += n) {
+		n = min(FUSE_BLOCK, end - i);
+
+		for (k = 0; k < job->n; k++) {
+			p = &job->node[k];
+			if (p->op == FUSE_LEAF) {
+				fuse_load(p, regs + k * block, i, n);
+				continue;
+			}
+
+			if (p->op == FUSE_DFUNC) {
+				/* ff_dfunc(): fn(extract_double()) */
+				fuse_convert(&job->node[p->b], regs + p->b * block, FUSE_DBL, 0, y, n);
+				rd = (double*)(regs + k * block);
+				for (j = 0; j < n; j++) rd[j] = p->fn(((double*)y)[j]);
+				continue;
+			}
+
+			/* pp_math() takes ints out with extract_int() for the narrower formats */
+			cls  = fuse_class(p->in_format);
+			as32 = !is_relop(p->op) && cls == FUSE_INT && p->format != DV_INT64 && p->format != DV_UINT64;
+			fuse_convert(&job->node[p->a], regs + p->a * block, cls, as32, x, n);
+			fuse_convert(&job->node[p->b], regs + p->b * block, cls, as32, y, n);
+
+			if (is_relop(p->op)) {
+				fuse_relop(p->op, cls, x, y, (i64*)(regs + k * block), n);
+			} else if (cls == FUSE_INT) {
+				dzero[k] += fuse_int_op(p->op, p->format, (i64*)x, (i64*)y, (i64*)(regs + k * block), n);
+			} else if (cls == FUSE_FLT) {
+				dzero[k] += fuse_flt_op(p->op, (float*)x, (float*)y, (float*)(regs + k * block), n);
+			} else {
+				dzero[k] += fuse_dbl_op(p->op, (double*)x, (double*)y, (double*)(regs + k * block), n);
+			}
+		}
+
+		ri = (i64*)(regs + (job->n - 1) * block);
+		rf = (float*)ri;
+		rd = (double*)ri;
+		switch (root->format) {
+		case DV_UINT8: FUSE_STORE(u8, ri); break;
+		case DV_UINT16: FUSE_STORE(u16, ri); break;
+		case DV_UINT32: FUSE_STORE(u32, ri); break;
+		case DV_UINT64: FUSE_STORE(u64, ri); break;
+		case DV_INT8: FUSE_STORE(i8, ri); break;
+		case DV_INT16: FUSE_STORE(i16, ri); break;
+		case DV_INT32: FUSE_STORE(i32, ri); break;
+		case DV_INT64: FUSE_STORE(i64, ri); break;
+		case DV_FLOAT: FUSE_STORE(float, rf); break;
+		case DV_DOUBLE: FUSE_STORE(double, rd); break;
+		}
+	}
+}
+
+/* run the tree as one loop; NULL if out of memory */
+static Var* fuse_run(fuse_tree* t, Var* shape)
+{
+	fuse_job job;
+	size_t dsize = V_DSIZE(shape);
+	size_t grain = 16 * FUSE_BLOCK;
+	int chunks   = dv_parallel_chunks(dsize, grain);
+	int format   = t->node[t->n - 1].format;
+	int k, c;
+	size_t dz;
+	Var* val;
+
+	job.node    = t->node;
+	job.n       = t->n;
+	job.out     = malloc(dsize * NBYTES(format));
+	job.scratch = malloc((size_t)chunks * (t->n + 2) * FUSE_BLOCK * sizeof(double));
+	job.dzero   = (size_t*)calloc((size_t)chunks * t->n, sizeof(size_t));
+	if (job.out == NULL || job.scratch == NULL || job.dzero == NULL) {
+		free(job.out);
+		free(job.scratch);
+		free(job.dzero);
+		return NULL;
+	}
+
+	dv_parallel_for(dsize, grain, fuse_kernel, &job);
+
+	for (k = 0; k < t->n; k++) {
+		for (dz = 0, c = 0; c < chunks; c++) dz += job.dzero[c * t->n + k];
+		if (dz) parse_error("Division by zero, %d times", (int)dz);
+	}
+	free(job.scratch);
+	free(job.dzero);
+
+	val           = newVar();
+	V_TYPE(val)   = ID_VAL;
+	V_FORMAT(val) = format;
+	V_DSIZE(val)  = dsize;
+	V_ORDER(val)  = V_ORDER(shape);
+	V_DATA(val)   = job.out;
+	V_SIZE(val)[0] = V_SIZE(shape)[0];
+	V_SIZE(val)[1] = V_SIZE(shape)[1];
+	V_SIZE(val)[2] = V_SIZE(shape)[2];
+	return val;
+}
+
+/*
+** Returns 0, having done nothing, if n doesn't head a tree worth
+** fusing.  Otherwise evaluates it into *result and returns 1.
+*/
+int pp_fuse(Var* n, Var** result)
+{
+	fuse_tree t;
+	Scope* scope = scope_tos();
+	Var *shape, *arg, *val[FUSE_MAXNODES];
+	fuse_node* p;
+	int k;
+
+	t.n    = 0;
+	t.nops = 0;
+	if (fuse_op(n, &arg) == FUSE_LEAF) return 0;
+	if (fuse_add(&t, n) < 0 || t.nops < 2) return 0;
+
+	/* the leaves, left to right, as evaluate() would have */
+	for (k = 0; k < t.n; k++) {
+		p = &t.node[k];
+		if (p->op != FUSE_LEAF) continue;
+		if (p->tree == NULL) {
+			p->v = VZERO;
+		} else {
+			evaluate(p->tree);
+			p->v = pop(scope);
+		}
+		p->r = eval(p->v);
+	}
+
+	if (fuse_check(&t, &shape) && (*result = fuse_run(&t, shape)) != NULL) {
+		return 1;
+	}
+
+	/* one node at a time */
+	for (k = 0; k < t.n; k++) {
+		p = &t.node[k];
+		if (p->op == FUSE_LEAF) {
+			val[k] = p->r ? p->r : p->v;
+		} else if (p->op == FUSE_DFUNC) {
+			val[k]          = pp_func(V_NODE(p->tree)->left, pp_mk_arglist(NULL, val[p->b]));
+			scope->returned = 0;
+		} else {
+			val[k] = pp_math(val[p->a], p->op, val[p->b]);
+		}
+	}
+	*result = val[t.n - 1];
+	return 1;
+}
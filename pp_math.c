@@ -434,6 +434,22 @@ size_t cpos(size_t x, size_t y, size_t z, Var* v)
 	return (0);
 }
 
+/**
+ ** Element strides of the x, y and z axes of v, ie. the values
+ ** cpos() steps by when x, y or z is incremented.
+ **/
+void cstrides(Var* v, size_t stride[3])
+{
+	size_t s0 = V_SIZE(v)[0], s01 = V_SIZE(v)[0] * V_SIZE(v)[1];
+
+	switch (V_ORG(v)) {
+	case BSQ: stride[0] = 1, stride[1] = s0, stride[2] = s01; break;
+	case BIP: stride[0] = s0, stride[1] = s01, stride[2] = 1; break;
+	case BIL: stride[0] = 1, stride[1] = s01, stride[2] = s0; break;
+	default: stride[0] = stride[1] = stride[2] = 0;
+	}
+}
+
 //TODO(rswinkle) change to size_t, fix all uses
 void xpos(size_t i, Var* v, int* x, int* y, int* z)
 {
@@ -0,0 +1,355 @@
+#include "parallel.h"
+#include "parser.h"
+
+/**
+ ** Masked assignment and selection: x[where mask] = value, set_deleted()
+ ** and compress().
+ **
+ ** The object is walked a line (its fastest varying axis) at a time, in
+ ** parallel chunks of lines.  The mask and the values are indexed the
+ ** way rpos() would index them: along each axis of the object they
+ ** either match it, have a size of 1 and are repeated, or wrap around.
+ ** Nothing is made full size first, so a one band mask applies to every
+ ** band of a cube as it stands.
+ **
+ ** A mask element is set when extract_int() of it is non-zero.
+ **/
+
+#define WHERE_GRAIN 16384 /* elements in the smallest chunk */
+
+/* how a line of values is read for the object's format */
+enum { WHERE_I32, WHERE_I64, WHERE_U64, WHERE_DBL };
+
+/* where the elements of v are, along the storage axes of obj */
+typedef struct {
+	char* data;
+	int format;
+	size_t size[3];
+	size_t stride[3];
+} where_map;
+
+typedef struct {
+	Var* obj;
+	size_t n[3];    /* obj sizes, fastest axis first */
+	where_map mask;
+	where_map src;  /* values for where_copy() */
+	const void* value; /* or one value for where_fill() */
+	int mode;
+	char* scratch;  /* per thread: a line of values and one of flags */
+	size_t scratch_size;
+	size_t* count;  /* per thread: selected elements */
+	char* out;      /* where_select() result */
+} where_job;
+
+static void where_setmap(where_map* m, Var* v, Var* obj)
+{
+	size_t stride[3];
+	int i, k;
+
+	cstrides(v, stride);
+	m->data   = V_DATA(v);
+	m->format = V_FORMAT(v);
+	for (i = 0; i < 3; i++) {
+		k            = orders[V_ORG(obj)][i]; /* storage axis of obj for axis i */
+		m->size[k]   = V_SIZE(v)[orders[V_ORG(v)][i]];
+		m->stride[k] = stride[i];
+	}
+}
+
+static void where_init(where_job* job, Var* obj, Var* mask)
+{
+	memset(job, 0, sizeof(*job));
+	job->obj  = obj;
+	job->n[0] = V_SIZE(obj)[0];
+	job->n[1] = V_SIZE(obj)[1];
+	job->n[2] = V_SIZE(obj)[2];
+	where_setmap(&job->mask, mask, obj);
+}
+
+/* offset in m of the start of line l of the object */
+static size_t where_base(const where_job* job, const where_map* m, size_t l)
+{
+	size_t y = l % job->n[1], z = l / job->n[1];
+	return (y % m->size[1]) * m->stride[1] + (z % m->size[2]) * m->stride[2];
+}
+
+#define WHERE_LINE(T, _S_)                                  \
+	{                                                       \
+		const T* p = (const T*)m->data + base;              \
+		size_t c = 0, j = 0;                                \
+		for (k = 0; k < n; k++) {                           \
+			_S_;                                            \
+			if (++c == m->size[0]) {                        \
+				c = j = 0;                                  \
+			} else {                                        \
+				j += m->stride[0];                          \
+			}                                               \
+		}                                                   \
+	}
+
+#define WHERE_FLAGS(T) WHERE_LINE(T, flag[k] = ((i32)p[j] != 0))
+
+/*
+** The mask along line l of the object, as 0 or 1.  A uint8 mask laid
+** out like the object is used where it is.
+*/
+static const u8* where_flags(const where_job* job, size_t l, u8* flag)
+{
+	const where_map* m = &job->mask;
+	size_t n = job->n[0], base = where_base(job, m, l), k;
+
+	if (m->format == DV_UINT8 && m->size[0] == n && m->stride[0] == 1) {
+		return (const u8*)m->data + base;
+	}
+	switch (m->format) {
+	case DV_UINT8: WHERE_FLAGS(u8); break;
+	case DV_UINT16: WHERE_FLAGS(u16); break;
+	case DV_UINT32: WHERE_FLAGS(u32); break;
+	case DV_UINT64: WHERE_FLAGS(u64); break;
+	case DV_INT8: WHERE_FLAGS(i8); break;
+	case DV_INT16: WHERE_FLAGS(i16); break;
+	case DV_INT32: WHERE_FLAGS(i32); break;
+	case DV_INT64: WHERE_FLAGS(i64); break;
+	case DV_FLOAT: WHERE_FLAGS(float); break;
+	case DV_DOUBLE: WHERE_FLAGS(double); break;
+	}
+	return flag;
+}
+
+#define WHERE_VALUES(T)                                                    \
+	switch (job->mode) {                                                   \
+	case WHERE_I32: WHERE_LINE(T, ((i64*)val)[k] = (i32)p[j]); break;      \
+	case WHERE_I64: WHERE_LINE(T, ((i64*)val)[k] = (i64)p[j]); break;      \
+	case WHERE_U64: WHERE_LINE(T, ((u64*)val)[k] = (u64)p[j]); break;      \
+	case WHERE_DBL: WHERE_LINE(T, ((double*)val)[k] = (double)p[j]); break; \
+	}
+
+/* the values along line l of the object, as i64, u64 or double */
+static void where_values(const where_job* job, size_t l, void* val)
+{
+	const where_map* m = &job->src;
+	size_t n = job->n[0], base = where_base(job, m, l), k;
+
+	switch (m->format) {
+	case DV_UINT8: WHERE_VALUES(u8); break;
+	case DV_UINT16: WHERE_VALUES(u16); break;
+	case DV_UINT32: WHERE_VALUES(u32); break;
+	case DV_UINT64: WHERE_VALUES(u64); break;
+	case DV_INT8: WHERE_VALUES(i8); break;
+	case DV_INT16: WHERE_VALUES(i16); break;
+	case DV_INT32: WHERE_VALUES(i32); break;
+	case DV_INT64: WHERE_VALUES(i64); break;
+	case DV_FLOAT: WHERE_VALUES(float); break;
+	case DV_DOUBLE: WHERE_VALUES(double); break;
+	}
+}
+
+#define WHERE_FILL(T)                                  \
+	{                                                  \
+		T v, *d = (T*)dst;                             \
+		memcpy(&v, job->value, sizeof(T));            \
+		for (k = 0; k < n; k++)                        \
+			if (flag[k]) d[k] = v;                     \
+	}
+
+#define WHERE_COPY(T, S)                               \
+	{                                                  \
+		const S* s = (const S*)val;                    \
+		T* d       = (T*)dst;                          \
+		for (k = 0; k < n; k++)                        \
+			if (flag[k]) d[k] = (T)s[k];               \
+	}
+
+static void where_fill_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	where_job* job = ctx;
+	size_t n = job->n[0], nb = NBYTES(V_FORMAT(job->obj)), k, l;
+	u8* buf = (u8*)job->scratch + tid * job->scratch_size;
+	const u8* flag;
+	char* dst;
+
+	for (l = begin; l < end; l++) {
+		flag = where_flags(job, l, buf);
+		dst  = (char*)V_DATA(job->obj) + l * n * nb;
+		switch (nb) {
+		case 1: WHERE_FILL(u8); break;
+		case 2: WHERE_FILL(u16); break;
+		case 4: WHERE_FILL(u32); break;
+		case 8: WHERE_FILL(u64); break;
+		}
+	}
+}
+
+static void where_copy_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	where_job* job = ctx;
+	size_t n = job->n[0], k, l;
+	int format = V_FORMAT(job->obj);
+	void* val  = job->scratch + tid * job->scratch_size;
+	u8* buf    = (u8*)val + n * sizeof(double);
+	const u8* flag;
+	char* dst;
+
+	for (l = begin; l < end; l++) {
+		flag = where_flags(job, l, buf);
+		where_values(job, l, val);
+		dst = (char*)V_DATA(job->obj) + l * n * NBYTES(format);
+		switch (format) {
+		case DV_UINT8: WHERE_COPY(u8, i64); break;
+		case DV_UINT16: WHERE_COPY(u16, i64); break;
+		case DV_UINT32: WHERE_COPY(u32, i64); break;
+		case DV_UINT64: WHERE_COPY(u64, u64); break;
+		case DV_INT8: WHERE_COPY(i8, i64); break;
+		case DV_INT16: WHERE_COPY(i16, i64); break;
+		case DV_INT32: WHERE_COPY(i32, i64); break;
+		case DV_INT64: WHERE_COPY(i64, i64); break;
+		case DV_FLOAT: WHERE_COPY(float, double); break;
+		case DV_DOUBLE: WHERE_COPY(double, double); break;
+		}
+	}
+}
+
+/* run fn over every line, with size bytes of scratch for each thread */
+static int where_run(where_job* job, dv_range_fn fn, size_t size)
+{
+	size_t lines = job->n[1] * job->n[2];
+	size_t grain = WHERE_GRAIN / job->n[0] + 1;
+
+	job->scratch_size = (size + 7) / 8 * 8;
+	job->scratch      = malloc(dv_parallel_chunks(lines, grain) * job->scratch_size);
+	if (job->scratch == NULL) return 0;
+	dv_parallel_for(lines, grain, fn, job);
+	free(job->scratch);
+	return 1;
+}
+
+/**
+ ** where_fill() - set obj to value wherever mask is set
+ **
+ ** value points at one element in the format of obj.
+ ** Returns 0 when out of memory.
+ **/
+int where_fill(Var* obj, Var* mask, const void* value)
+{
+	where_job job;
+
+	where_init(&job, obj, mask);
+	job.value = value;
+	return where_run(&job, where_fill_kernel, job.n[0]);
+}
+
+/**
+ ** where_copy() - set obj to src wherever mask is set
+ **
+ ** Values are converted the way pp_set_where() always has: through
+ ** extract_int() into the narrower integer formats, through
+ ** extract_double() into float and double.
+ ** Returns 0 when out of memory.
+ **/
+int where_copy(Var* obj, Var* mask, Var* src)
+{
+	where_job job;
+
+	where_init(&job, obj, mask);
+	where_setmap(&job.src, src, obj);
+	switch (V_FORMAT(obj)) {
+	case DV_UINT32:
+	case DV_INT64: job.mode = WHERE_I64; break;
+	case DV_UINT64: job.mode = WHERE_U64; break;
+	case DV_FLOAT:
+	case DV_DOUBLE: job.mode = WHERE_DBL; break;
+	default: job.mode = WHERE_I32;
+	}
+	return where_run(&job, where_copy_kernel, job.n[0] * (sizeof(double) + 1));
+}
+
+static void where_count_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	where_job* job = ctx;
+	size_t n = job->n[0], k, l, count = 0;
+	u8* buf    = (u8*)job->scratch + tid * job->scratch_size;
+	const u8* flag;
+
+	for (l = begin; l < end; l++) {
+		flag = where_flags(job, l, buf);
+		for (k = 0; k < n; k++) count += (flag[k] != 0);
+	}
+	job->count[tid] = count;
+}
+
+#define WHERE_GATHER(T)                                \
+	{                                                  \
+		const T* s = (const T*)src;                    \
+		T* d       = (T*)job->out + i;                 \
+		for (k = 0; k < n; k++)                        \
+			if (flag[k]) *d++ = s[k];                  \
+		i = d - (T*)job->out;                          \
+	}
+
+static void where_gather_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	where_job* job = ctx;
+	size_t n = job->n[0], nb = NBYTES(V_FORMAT(job->obj)), k, l;
+	size_t i   = job->count[tid]; /* where this chunk's elements go */
+	u8* buf    = (u8*)job->scratch + tid * job->scratch_size;
+	const u8* flag;
+	const char* src;
+
+	for (l = begin; l < end; l++) {
+		flag = where_flags(job, l, buf);
+		src  = (const char*)V_DATA(job->obj) + l * n * nb;
+		switch (nb) {
+		case 1: WHERE_GATHER(u8); break;
+		case 2: WHERE_GATHER(u16); break;
+		case 4: WHERE_GATHER(u32); break;
+		case 8: WHERE_GATHER(u64); break;
+		}
+	}
+}
+
+/**
+ ** where_select() - the elements of obj where mask is set
+ **
+ ** They are returned in a 1 by N by 1 array of obj's format, in the
+ ** order they are stored in obj.  Sets *count to N; the result is NULL
+ ** when N is 0 or when out of memory.
+ **/
+Var* where_select(Var* obj, Var* mask, size_t* count)
+{
+	where_job job;
+	size_t lines, grain, i, c, total;
+	int chunks, t;
+
+	where_init(&job, obj, mask);
+	lines  = job.n[1] * job.n[2];
+	grain  = WHERE_GRAIN / job.n[0] + 1;
+	chunks = dv_parallel_chunks(lines, grain);
+
+	*count    = 0;
+	job.count = calloc(chunks, sizeof(size_t));
+	if (job.count == NULL) return NULL;
+	if (!where_run(&job, where_count_kernel, job.n[0])) {
+		free(job.count);
+		return NULL;
+	}
+
+	/* turn the counts into where each chunk starts */
+	for (t = 0, total = 0; t < chunks; t++) {
+		c            = job.count[t];
+		job.count[t] = total;
+		total += c;
+	}
+	*count = total;
+
+	if (total == 0 || (job.out = malloc(total * NBYTES(V_FORMAT(obj)))) == NULL) {
+		free(job.count);
+		return NULL;
+	}
+	i = where_run(&job, where_gather_kernel, job.n[0]);
+	free(job.count);
+	if (i == 0) {
+		free(job.out);
+		return NULL;
+	}
+	return newVal(BSQ, 1, total, 1, V_FORMAT(obj), job.out);
+}
@@ -50,22 +50,26 @@
 //#include <unistd.h>
 #endif
 
-#define PF(out, f, func)                                               \
-	{                                                                  \
-		char* b = NULL;                                                \
-		if (fieldwidth)                                                \
-			if (precision)                                             \
-				(void)dv_asprintf(&b, f, fieldwidth, precision, func); \
-			else                                                       \
-				(void)dv_asprintf(&b, f, fieldwidth, func);            \
-		else if (precision)                                            \
-			(void)dv_asprintf(&b, f, precision, func);                 \
-		else                                                           \
-			(void)dv_asprintf(&b, f, func);                            \
-		if (b) {                                                       \
-			out = str_append(out, b);                                  \
-			free(b);                                                   \
-		}                                                              \
+#include "textout.h"
+
+#define PF(out, f, func)                                                      \
+	{                                                                         \
+		if (fieldwidth)                                                       \
+			if (precision)                                                    \
+				text_printf(&out, f, (int)fieldwidth, (int)precision, func); \
+			else                                                              \
+				text_printf(&out, f, (int)fieldwidth, func);                  \
+		else if (precision)                                                   \
+			text_printf(&out, f, (int)precision, func);                       \
+		else                                                                  \
+			text_printf(&out, f, func);                                       \
+	}
+
+/* a number from one of the dv_fmt_*() functions, onto the end of out */
+#define FMT(out, call)                                   \
+	{                                                    \
+		char* b = dv_text_room(&out, DV_FMT_MAX);        \
+		if (b) out.len += call;                          \
 	}
 
 static void escape __P((char*));
@@ -75,7 +79,8 @@ static i64 get_i64 __P((Var*, i64*));
 static u64 get_u64 __P((Var*, u64*));
 static int getstr __P((Var*, char**));
 static char* mklong __P((char*, int));
-static int dv_asprintf(char**, char*, ...);
+static void text_printf(dv_text*, const char*, ...);
+static int plain_conversion(const char*);
 char* do_sprintf(int ac, Var** av);
 
 char* dv_locate_file(const char* fname);
@@ -175,11 +180,42 @@ Var* ff_sprintf(vfuncptr func, Var* arg)
 	return s;
 }
 
-char* str_append(char* s1, char* s2)
+/* printf() onto the end of out */
+static void text_printf(dv_text* out, const char* f, ...)
 {
-	s1 = (char*)realloc(s1, strlen(s1) + strlen(s2) + 1);
-	strcat(s1, s2);
-	return s1;
+	size_t room = out->size - out->len;
+	va_list ap;
+	int n;
+
+	va_start(ap, f);
+	n = vsnprintf(out->s ? out->s + out->len : NULL, room, f, ap);
+	va_end(ap);
+	if (n < 0) return;
+	if ((size_t)n >= room) {
+		if (dv_text_room(out, n + 1) == NULL) return;
+		va_start(ap, f);
+		vsnprintf(out->s + out->len, n + 1, f, ap);
+		va_end(ap);
+	}
+	out->len += n;
+}
+
+/*
+** For a conversion with no flags or width, like "%d" or "%.4f": its
+** precision, or -1 if it has none.  -2 for anything else.
+*/
+static int plain_conversion(const char* start)
+{
+	const char* s = start + 1;
+	int prec      = -1;
+
+	if (*s == '.') {
+		for (prec = 0, s++; *s >= '0' && *s <= '9'; s++) {
+			if (prec > 99) return (-2);
+			prec = prec * 10 + (*s - '0');
+		}
+	}
+	return (s[0] != '\0' && s[1] == '\0' ? prec : -2);
 }
 
 char* do_sprintf(int ac, Var** av)
@@ -189,8 +225,8 @@ char* do_sprintf(int ac, Var** av)
 	i64 fieldwidth, precision;
 	char convch, nextch, *format, *fmt, *start;
 	Var *v, *e;
-	char* out;
-	int gv;
+	dv_text out = {NULL, 0, 0, 0};
+	int gv, prec;
 
 	/*
 	 * Basic algorithm is to scan the format string for conversion
@@ -214,7 +250,6 @@ char* do_sprintf(int ac, Var** av)
 		return NULL;
 	}
 
-	out = (char*)calloc(1, 1);
 	escape(fmt = format = V_STRING(v)); /* backslash interpretation */
 	gv = 2;
 
@@ -227,13 +262,18 @@ char* do_sprintf(int ac, Var** av)
 				/* avoid infinite loop */
 				if (end == 1) {
 					fprintf(stderr, "missing format character");
-					free(out);
+					dv_text_free(&out);
 					return NULL;
 				}
-				end                  = 1;
-				if (fmt > start) out = str_append(out, start);
+				end = 1;
+				if (fmt > start) dv_text_add(&out, start, fmt - start);
 				if (gv == ac) {
-					return out;
+					dv_text_add(&out, "", 1);
+					if (out.error) {
+						parse_error("sprintf: out of memory");
+						dv_text_free(&out);
+					}
+					return out.s;
 				}
 				fmt = format;
 				goto next;
@@ -242,7 +282,7 @@ char* do_sprintf(int ac, Var** av)
 			if (*fmt == '%') {
 				if (*++fmt != '%') break;
 				*fmt++ = '\0';
-				out    = str_append(out, start);
+				dv_text_add(&out, start, strlen(start));
 				goto next;
 			}
 		}
@@ -252,7 +292,7 @@ char* do_sprintf(int ac, Var** av)
 			;
 		if (*fmt == '*') {
 			if (!get_i64(av[gv++], &fieldwidth)) {
-				free(out);
+				dv_text_free(&out);
 				return NULL;
 			}
 			++fmt;
@@ -268,7 +308,7 @@ char* do_sprintf(int ac, Var** av)
 			++fmt;
 			if (*fmt == '*') {
 				if (!get_i64(av[gv++], &precision)) {
-					free(out);
+					dv_text_free(&out);
 					return NULL;
 				}
 				++fmt;
@@ -283,7 +323,7 @@ char* do_sprintf(int ac, Var** av)
 			precision = 0;
 		if (!*fmt) {
 			fprintf(stderr, "missing format character");
-			free(out);
+			dv_text_free(&out);
 			return NULL;
 		}
 
@@ -295,7 +335,7 @@ char* do_sprintf(int ac, Var** av)
 			char p;
 
 			if (!getchr(av[gv++], &p)) {
-				free(out);
+				dv_text_free(&out);
 				return NULL;
 			}
 
@@ -306,7 +346,7 @@ char* do_sprintf(int ac, Var** av)
 			char* p;
 
 			if (!getstr(av[gv++], &p)) {
-				free(out);
+				dv_text_free(&out);
 				return NULL;
 			}
 			PF(out, start, p);
@@ -319,12 +359,16 @@ char* do_sprintf(int ac, Var** av)
 			u64 p;
 			char* f;
 
-			//mklong can never return NULL, see definition
-			f = mklong(start, convch);
 			if (!get_u64(av[gv++], &p)) {
-				free(out);
+				dv_text_free(&out);
 				return NULL;
 			}
+			if (convch == 'u' && plain_conversion(start) == -1) {
+				FMT(out, dv_fmt_u64(b, p));
+				break;
+			}
+			//mklong can never return NULL, see definition
+			f = mklong(start, convch);
 			PF(out, f, p);
 			break;
 		}
@@ -334,12 +378,16 @@ char* do_sprintf(int ac, Var** av)
 			i64 p;
 			char* f;
 
-			//mklong can never return NULL, see definition
-			f = mklong(start, convch);
 			if (!get_i64(av[gv++], &p)) {
-				free(out);
+				dv_text_free(&out);
 				return NULL;
 			}
+			if (plain_conversion(start) == -1) {
+				FMT(out, dv_fmt_i64(b, p));
+				break;
+			}
+			//mklong can never return NULL, see definition
+			f = mklong(start, convch);
 			PF(out, f, p);
 			break;
 		}
@@ -351,15 +399,24 @@ char* do_sprintf(int ac, Var** av)
 			double p;
 
 			if (!getdouble(av[gv++], &p)) {
-				free(out);
+				dv_text_free(&out);
 				return NULL;
 			}
-			PF(out, start, p);
+			/* plain %f and %g, with no more than 17 digits */
+			prec = plain_conversion(start);
+			if (prec == -1) prec = 6;
+			if (convch == 'f' && prec >= 0 && prec <= 17) {
+				FMT(out, dv_fmt_fixed(b, p, prec));
+			} else if (convch == 'g' && prec >= 0 && prec <= 17) {
+				FMT(out, dv_fmt_general(b, p, prec));
+			} else {
+				PF(out, start, p);
+			}
 			break;
 		}
 		default:
 			fprintf(stderr, "illegal format character %c", convch);
-			free(out);
+			dv_text_free(&out);
 			return NULL;
 		}
 		*fmt = nextch;
@@ -618,14 +675,3 @@ int dv_vasprintf(char** result, char* format, va_list args)
 {
 	return dv_int_vasprintf(result, format, args);
 }
-
-int dv_asprintf(char** str, char* fmt, ...)
-{
-	int ret;
-	va_list ap;
-
-	va_start(ap, fmt);
-	ret = dv_vasprintf(str, fmt, ap);
-	va_end(ap);
-	return ret;
-}
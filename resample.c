@@ -0,0 +1,488 @@
+#include "parser.h"
+#include "parallel.h"
+#include "resample.h"
+
+/*
+** rs_scale() is separable: every input row is first resampled along x
+** into a double precision [z][y][nx] buffer (a weighted sum and, with an
+** ignore value, the sum of the weights that were used), then every output
+** row is a weighted sum of rows of that buffer.  The weights for each
+** output column and row are computed once, up front.
+**
+** rs_warp() can't separate the axes, so each output pixel gets its own
+** taps, with the kernel read from a table rather than evaluated.
+**
+** Both are threaded over output rows and read the input in its own type.
+*/
+
+#define RS_LUT_RES 1024 /* kernel table samples per pixel */
+#define RS_MAX_TAPS 6   /* 2 * largest kernel radius */
+
+int rs_kernel(const char* name)
+{
+	if (name == NULL || *name == '\0') return -1;
+	if (!strcasecmp(name, "nearest") || !strcasecmp(name, "none")) return RS_NEAREST;
+	if (!strcasecmp(name, "bilinear")) return RS_BILINEAR;
+	if (!strcasecmp(name, "bicubic")) return RS_BICUBIC;
+	if (!strcasecmp(name, "lanczos")) return RS_LANCZOS;
+	if (!strcasecmp(name, "area")) return RS_AREA;
+	return -1;
+}
+
+static double rs_radius(int kernel)
+{
+	switch (kernel) {
+	case RS_BILINEAR: return 1;
+	case RS_BICUBIC: return 2;
+	case RS_LANCZOS: return 3;
+	}
+	return 0.5;
+}
+
+static double rs_weight(int kernel, double d)
+{
+	d = fabs(d);
+	switch (kernel) {
+	case RS_BILINEAR: return d < 1 ? 1 - d : 0;
+
+	case RS_BICUBIC: /* Keys, a = -0.5 */
+		if (d < 1) return (1.5 * d - 2.5) * d * d + 1;
+		if (d < 2) return ((-0.5 * d + 2.5) * d - 4) * d + 2;
+		return 0;
+
+	case RS_LANCZOS: /* a = 3 */
+		if (d < 1e-8) return 1;
+		if (d < 3) return 3 * sin(M_PI * d) * sin(M_PI * d / 3) / (M_PI * M_PI * d * d);
+		return 0;
+	}
+	return d < 0.5 ? 1 : 0;
+}
+
+/* store v in element p of out, rounded and clamped to its type */
+static void rs_store(Var* out, size_t p, double v)
+{
+	void* d = V_DATA(out);
+
+	switch (V_FORMAT(out)) {
+	case DV_UINT8: ((u8*)d)[p]  = clamp_u8(floor(v + 0.5)); break;
+	case DV_UINT16: ((u16*)d)[p] = clamp_u16(floor(v + 0.5)); break;
+	case DV_UINT32: ((u32*)d)[p] = clamp_u32(floor(v + 0.5)); break;
+	case DV_UINT64: ((u64*)d)[p] = clamp_u64(floor(v + 0.5)); break;
+	case DV_INT8: ((i8*)d)[p]   = clamp_i8(floor(v + 0.5)); break;
+	case DV_INT16: ((i16*)d)[p]  = clamp_i16(floor(v + 0.5)); break;
+	case DV_INT32: ((i32*)d)[p]  = clamp_i32(floor(v + 0.5)); break;
+	case DV_INT64: ((i64*)d)[p]  = clamp_i64(floor(v + 0.5)); break;
+	case DV_FLOAT: ((float*)d)[p]  = v; break;
+	case DV_DOUBLE: ((double*)d)[p] = v; break;
+	}
+}
+
+static Var* rs_new(int org, int format, size_t x, size_t y, size_t z)
+{
+	Var* out;
+	void* data;
+
+	if ((data = calloc(x * y * z, NBYTES(format))) == NULL) return NULL;
+
+	out                                = newVar();
+	V_TYPE(out)                        = ID_VAL;
+	V_ORG(out)                         = org;
+	V_FORMAT(out)                      = format;
+	V_DSIZE(out)                       = x * y * z;
+	V_SIZE(out)[orders[V_ORG(out)][0]] = x;
+	V_SIZE(out)[orders[V_ORG(out)][1]] = y;
+	V_SIZE(out)[orders[V_ORG(out)][2]] = z;
+	V_DATA(out)                        = data;
+	return out;
+}
+
+/*
+** Scaling
+*/
+
+typedef struct rs_axis {
+	size_t taps;     /* weights per output coordinate */
+	size_t* idx;     /* [n][taps] input coordinates, clamped to the edges */
+	double* w;       /* [n][taps] weights, summing to 1 */
+	size_t* nearest; /* [n] input coordinate under each output center */
+} rs_axis;
+
+static void rs_axis_free(rs_axis* a)
+{
+	free(a->idx);
+	free(a->w);
+	free(a->nearest);
+}
+
+static int rs_axis_init(rs_axis* a, size_t n_in, size_t n_out, double f, int kernel)
+{
+	double support, stretch = 1, c, h = 0, sum, lo, hi;
+	size_t i, t;
+	long k, first;
+
+	if (kernel == RS_BILINEAR && f < 1) kernel = RS_AREA;
+
+	if (kernel == RS_NEAREST) {
+		support = 0.5;
+	} else if (kernel == RS_AREA) {
+		h       = 0.5 / f; /* half width of an output pixel on the input */
+		support = h + 0.5;
+	} else {
+		if (f < 1) stretch = f;
+		support = rs_radius(kernel) / stretch;
+	}
+
+	a->taps    = (kernel == RS_NEAREST) ? 1 : max((size_t)ceil(2 * support), 1);
+	a->idx     = calloc(n_out * a->taps, sizeof(size_t));
+	a->w       = calloc(n_out * a->taps, sizeof(double));
+	a->nearest = calloc(n_out, sizeof(size_t));
+	if (a->idx == NULL || a->w == NULL || a->nearest == NULL) return 0; /* caller frees */
+
+	for (i = 0; i < n_out; i++) {
+		c             = (i + 0.5) / f; /* output center on the input */
+		a->nearest[i] = min((size_t)c, n_in - 1);
+		c -= 0.5; /* ... relative to input centers */
+
+		if (kernel == RS_NEAREST) {
+			a->idx[i] = a->nearest[i];
+			a->w[i]   = 1;
+			continue;
+		}
+
+		first = (long)floor(c - support) + 1;
+		sum   = 0;
+		for (t = 0; t < a->taps; t++) {
+			k = first + t;
+			if (kernel == RS_AREA) {
+				lo = max(c - h, k - 0.5);
+				hi = min(c + h, k + 0.5);
+				a->w[i * a->taps + t] = hi > lo ? hi - lo : 0;
+			} else {
+				a->w[i * a->taps + t] = rs_weight(kernel, (c - k) * stretch);
+			}
+			a->idx[i * a->taps + t] = k < 0 ? 0 : min((size_t)k, n_in - 1);
+			sum += a->w[i * a->taps + t];
+		}
+		if (sum != 0) {
+			for (t = 0; t < a->taps; t++) a->w[i * a->taps + t] /= sum;
+		}
+	}
+	return 1;
+}
+
+typedef struct rs_scale_job {
+	Var* src;
+	Var* out;
+	size_t xx, yy, nx, ny;
+	size_t stride[3]; /* element strides of src */
+	size_t ostride[3];
+	rs_axis ax, ay;
+	int hasign;
+	double ignore;
+	double* num;       /* [zz][yy][nx] weighted sums along x */
+	double* den;       /* [zz][yy][nx] weights used, with ignore */
+	u8* ok;            /* [zz][yy][nx] input under the output is valid */
+	double* scratch;   /* per-thread line buffers */
+	size_t scratch_size;
+} rs_scale_job;
+
+#define RS_LOAD_ROW(type)                                                  \
+	{                                                                      \
+		const type* d = (const type*)V_DATA(job->src);                     \
+		for (i = 0; i < job->xx; i++) line[i] = d[base + i * job->stride[0]]; \
+	}                                                                      \
+	break
+
+static void rs_scale_x_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	rs_scale_job* job = (rs_scale_job*)ctx;
+	double* line      = job->scratch + tid * job->scratch_size;
+	size_t taps       = job->ax.taps;
+	size_t r, i, t, base, off;
+	const size_t* idx;
+	const double* w;
+	double num, den, v;
+
+	for (r = begin; r < end; r++) {
+		base = (r % job->yy) * job->stride[1] + (r / job->yy) * job->stride[2];
+		off  = r * job->nx;
+
+		switch (V_FORMAT(job->src)) {
+		case DV_UINT8: RS_LOAD_ROW(u8);
+		case DV_UINT16: RS_LOAD_ROW(u16);
+		case DV_UINT32: RS_LOAD_ROW(u32);
+		case DV_UINT64: RS_LOAD_ROW(u64);
+		case DV_INT8: RS_LOAD_ROW(i8);
+		case DV_INT16: RS_LOAD_ROW(i16);
+		case DV_INT32: RS_LOAD_ROW(i32);
+		case DV_INT64: RS_LOAD_ROW(i64);
+		case DV_FLOAT: RS_LOAD_ROW(float);
+		case DV_DOUBLE: RS_LOAD_ROW(double);
+		}
+
+		for (i = 0; i < job->nx; i++) {
+			idx = job->ax.idx + i * taps;
+			w   = job->ax.w + i * taps;
+			num = den = 0;
+			if (job->hasign) {
+				for (t = 0; t < taps; t++) {
+					v = line[idx[t]];
+					if (v == job->ignore) continue;
+					num += w[t] * v;
+					den += w[t];
+				}
+				job->den[off + i] = den;
+				job->ok[off + i]  = (line[job->ax.nearest[i]] != job->ignore);
+			} else {
+				for (t = 0; t < taps; t++) num += w[t] * line[idx[t]];
+			}
+			job->num[off + i] = num;
+		}
+	}
+}
+
+static void rs_scale_y_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	rs_scale_job* job = (rs_scale_job*)ctx;
+	double* accn      = job->scratch + tid * job->scratch_size;
+	double* accd      = accn + job->nx;
+	size_t taps       = job->ay.taps;
+	size_t r, i, t, j, k, row, near;
+	double w, v;
+
+	for (r = begin; r < end; r++) {
+		k = r / job->ny;
+		j = r % job->ny;
+
+		memset(accn, 0, 2 * job->nx * sizeof(double));
+		for (t = 0; t < taps; t++) {
+			w   = job->ay.w[j * taps + t];
+			row = (k * job->yy + job->ay.idx[j * taps + t]) * job->nx;
+			if (w == 0) continue;
+			for (i = 0; i < job->nx; i++) accn[i] += w * job->num[row + i];
+			if (job->hasign) {
+				for (i = 0; i < job->nx; i++) accd[i] += w * job->den[row + i];
+			}
+		}
+
+		near = (k * job->yy + job->ay.nearest[j]) * job->nx;
+		for (i = 0; i < job->nx; i++) {
+			v = accn[i];
+			if (job->hasign) {
+				v = (job->ok[near + i] && accd[i] > 0) ? accn[i] / accd[i] : job->ignore;
+			}
+			rs_store(job->out, i * job->ostride[0] + j * job->ostride[1] + k * job->ostride[2], v);
+		}
+	}
+}
+
+Var* rs_scale(Var* src, size_t nx, size_t ny, double xf, double yf, int kernel, const double* ignore)
+{
+	rs_scale_job job;
+	size_t zz = GetZ(src);
+	size_t n;
+	int nthreads;
+
+	memset(&job, 0, sizeof(job));
+	job.src    = src;
+	job.xx     = GetX(src);
+	job.yy     = GetY(src);
+	job.nx     = nx;
+	job.ny     = ny;
+	job.hasign = (ignore != NULL);
+	job.ignore = ignore ? *ignore : 0;
+	cstrides(src, job.stride);
+
+	if ((job.out = rs_new(V_ORG(src), V_FORMAT(src), nx, ny, zz)) == NULL) return NULL;
+	cstrides(job.out, job.ostride);
+	if (nx == 0 || ny == 0 || zz == 0 || job.xx == 0 || job.yy == 0) return job.out;
+
+	if (!rs_axis_init(&job.ax, job.xx, nx, xf, kernel)) goto nomem;
+	if (!rs_axis_init(&job.ay, job.yy, ny, yf, kernel)) goto nomem;
+
+	n       = nx * job.yy * zz;
+	job.num = calloc(n, sizeof(double));
+	if (job.num == NULL) goto nomem;
+	if (job.hasign) {
+		job.den = calloc(n, sizeof(double));
+		job.ok  = calloc(n, sizeof(u8));
+		if (job.den == NULL || job.ok == NULL) goto nomem;
+	}
+
+	job.scratch_size = max(job.xx, 2 * nx);
+	nthreads         = max(dv_parallel_chunks(job.yy * zz, 8), dv_parallel_chunks(ny * zz, 8));
+	job.scratch      = calloc(nthreads * job.scratch_size, sizeof(double));
+	if (job.scratch == NULL) goto nomem;
+
+	dv_parallel_for(job.yy * zz, 8, rs_scale_x_kernel, &job);
+	dv_parallel_for(ny * zz, 8, rs_scale_y_kernel, &job);
+
+	free(job.scratch);
+	free(job.num);
+	free(job.den);
+	free(job.ok);
+	rs_axis_free(&job.ax);
+	rs_axis_free(&job.ay);
+	return job.out;
+
+nomem:
+	free(job.scratch);
+	free(job.num);
+	free(job.den);
+	free(job.ok);
+	rs_axis_free(&job.ax);
+	rs_axis_free(&job.ay);
+	if (mem_claim(job.out)) free_var(job.out);
+	return NULL;
+}
+
+/*
+** Warping
+*/
+
+typedef struct rs_warp_job {
+	Var* src;
+	Var* out;
+	size_t w, h, nz, nx, ny;
+	size_t stride[3];
+	size_t ostride[3];
+	double m[9];
+	double x0, y0;
+	int kernel;
+	int radius;
+	double ignore;
+	double* lut; /* kernel weight at distance d is lut[(int)(d * RS_LUT_RES + .5)] */
+} rs_warp_job;
+
+#define RS_GATHER(type)                                                    \
+	{                                                                      \
+		const type* d = (const type*)V_DATA(job->src);                     \
+		for (b = 0; b < ntaps; b++) {                                      \
+			for (a = 0; a < ntaps; a++) {                                  \
+				v = d[off + ty[b] + tx[a]];                                \
+				if (v == job->ignore) continue;                            \
+				num += wy[b] * wx[a] * v;                                  \
+				den += wy[b] * wx[a];                                      \
+			}                                                              \
+		}                                                                  \
+		centre = d[off + cy + cx];                                         \
+	}                                                                      \
+	break
+
+static void rs_warp_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	rs_warp_job* job = (rs_warp_job*)ctx;
+	size_t tx[RS_MAX_TAPS], ty[RS_MAX_TAPS];
+	double wx[RS_MAX_TAPS], wy[RS_MAX_TAPS];
+	double X, Y, sx, sy, sw, d, num, den, v, centre;
+	size_t plane = job->ostride[2];
+	size_t i, j, z, off, cx, cy, p;
+	int a, b, ntaps = (job->kernel == RS_NEAREST) ? 1 : 2 * job->radius;
+	long k, first;
+
+	for (j = begin; j < end; j++) {
+		for (i = 0; i < job->nx; i++) {
+			p = i * job->ostride[0] + j * job->ostride[1];
+
+			X  = i + job->x0 + 0.5;
+			Y  = j + job->y0 + 0.5;
+			sw = X * job->m[2] + Y * job->m[5] + job->m[8];
+			sx = (X * job->m[0] + Y * job->m[3] + job->m[6]) / sw;
+			sy = (X * job->m[1] + Y * job->m[4] + job->m[7]) / sw;
+
+			if (!(sx >= 0 && sx < job->w && sy >= 0 && sy < job->h)) {
+				for (z = 0; z < job->nz; z++) rs_store(job->out, p + z * plane, job->ignore);
+				continue;
+			}
+
+			cx = (size_t)sx * job->stride[0];
+			cy = (size_t)sy * job->stride[1];
+
+			if (ntaps == 1) {
+				tx[0] = cx;
+				ty[0] = cy;
+				wx[0] = wy[0] = 1;
+			} else {
+				sx -= 0.5;
+				sy -= 0.5;
+				first = (long)floor(sx) - job->radius + 1;
+				for (a = 0; a < ntaps; a++) {
+					k     = first + a;
+					d     = fabs(sx - k);
+					wx[a] = d < job->radius ? job->lut[(int)(d * RS_LUT_RES + 0.5)] : 0;
+					tx[a] = (k < 0 ? 0 : min((size_t)k, job->w - 1)) * job->stride[0];
+				}
+				first = (long)floor(sy) - job->radius + 1;
+				for (b = 0; b < ntaps; b++) {
+					k     = first + b;
+					d     = fabs(sy - k);
+					wy[b] = d < job->radius ? job->lut[(int)(d * RS_LUT_RES + 0.5)] : 0;
+					ty[b] = (k < 0 ? 0 : min((size_t)k, job->h - 1)) * job->stride[1];
+				}
+			}
+
+			for (z = 0; z < job->nz; z++) {
+				off = z * job->stride[2];
+				num = den = 0;
+				switch (V_FORMAT(job->src)) {
+				case DV_UINT8: RS_GATHER(u8);
+				case DV_UINT16: RS_GATHER(u16);
+				case DV_UINT32: RS_GATHER(u32);
+				case DV_UINT64: RS_GATHER(u64);
+				case DV_INT8: RS_GATHER(i8);
+				case DV_INT16: RS_GATHER(i16);
+				case DV_INT32: RS_GATHER(i32);
+				case DV_INT64: RS_GATHER(i64);
+				case DV_FLOAT: RS_GATHER(float);
+				case DV_DOUBLE: RS_GATHER(double);
+				default: centre = job->ignore;
+				}
+				v = (centre != job->ignore && den > 0) ? num / den : job->ignore;
+				rs_store(job->out, p + z * plane, v);
+			}
+		}
+	}
+}
+
+Var* rs_warp(Var* src, const double m[9], double x0, double y0, size_t nx, size_t ny, int kernel,
+             double ignore, int format)
+{
+	rs_warp_job job;
+	size_t i, n;
+
+	memset(&job, 0, sizeof(job));
+	job.src    = src;
+	job.w      = GetX(src);
+	job.h      = GetY(src);
+	job.nz     = GetZ(src);
+	job.nx     = nx;
+	job.ny     = ny;
+	job.x0     = x0;
+	job.y0     = y0;
+	job.kernel = kernel;
+	job.ignore = ignore;
+	memcpy(job.m, m, sizeof(job.m));
+	cstrides(src, job.stride);
+
+	/* area averaging needs a scale; for a general mapping use bilinear */
+	if (kernel == RS_AREA) job.kernel = RS_BILINEAR;
+	job.radius = (int)rs_radius(job.kernel);
+
+	if ((job.out = rs_new(V_ORG(src), format, nx, ny, job.nz)) == NULL) return NULL;
+	cstrides(job.out, job.ostride);
+	if (nx == 0 || ny == 0 || job.nz == 0 || job.w == 0 || job.h == 0) return job.out;
+
+	if (job.kernel != RS_NEAREST) {
+		n = job.radius * RS_LUT_RES + 2;
+		if ((job.lut = calloc(n, sizeof(double))) == NULL) {
+			if (mem_claim(job.out)) free_var(job.out);
+			return NULL;
+		}
+		for (i = 0; i < n; i++) job.lut[i] = rs_weight(job.kernel, (double)i / RS_LUT_RES);
+	}
+
+	dv_parallel_for(ny, 4, rs_warp_kernel, &job);
+
+	free(job.lut);
+	return job.out;
+}
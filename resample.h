@@ -0,0 +1,43 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "parser.h"
+
+/**
+ ** Resampling engine shared by image_resize(), warp() and rotation().
+ **
+ ** Pixel (i,j) covers [i,i+1) x [j,j+1) and has its center at (i+.5,j+.5).
+ ** Every band at a location is resampled with the same weights, so the
+ ** weights are worked out once per output pixel (per output row and
+ ** column for rs_scale()) and applied to all of them.
+ **
+ ** Pixels equal to the ignore value don't contribute: the weights of the
+ ** remaining taps are renormalized.  An output pixel is set to ignore if
+ ** the input pixel under it is ignore, or has no valid taps at all.
+ **
+ ** Both return NULL when out of memory; the caller reports the error.
+ **/
+
+enum { RS_NEAREST, RS_BILINEAR, RS_BICUBIC, RS_LANCZOS, RS_AREA };
+
+/* kernel named by an interp= value, or -1 */
+int rs_kernel(const char* name);
+
+/*
+** Scale by xf, yf to nx by ny with separable weight tables.  The output
+** has the format and organization of src.  When downsampling, bilinear
+** becomes an area average and the other kernels are widened by 1/f.
+** ignore may be NULL.
+*/
+Var* rs_scale(Var* src, size_t nx, size_t ny, double xf, double yf, int kernel, const double* ignore);
+
+/*
+** General 3x3 (projective) mapping.  Output pixel (i,j) is taken from
+** (i+x0+.5, j+y0+.5, 1) * m in the input, m applied to the row vector.
+** Outside the input the output is ignore.  The result is an nx by ny
+** array with every band and the organization of src, in the given format.
+*/
+Var* rs_warp(Var* src, const double m[9], double x0, double y0, size_t nx, size_t ny, int kernel,
+             double ignore, int format);
+
+#endif /* RESAMPLE_H */
@@ -0,0 +1,193 @@
+#include "parser.h"
+#include "parallel.h"
+#include "rng.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+#define TWO_PI 6.283185307179586
+
+void rng_block(uint64_t key, uint64_t ctr, uint32_t sub, uint32_t out[4])
+{
+	uint32_t c0 = (uint32_t)ctr, c1 = (uint32_t)(ctr >> 32), c2 = sub, c3 = 0;
+	uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+	uint64_t p0, p1;
+	int r;
+
+	for (r = 0; r < 10; r++) {
+		p0 = (uint64_t)PHILOX_M0 * c0;
+		p1 = (uint64_t)PHILOX_M1 * c2;
+		c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		c1 = (uint32_t)p1;
+		c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c3 = (uint32_t)p0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+/* [0,1) from 24 or 53 bits; the _open forms are in (0,1] for logs */
+static inline float u24(uint32_t a)
+{
+	return (a >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline double u53(uint32_t a, uint32_t b)
+{
+	return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+}
+
+static inline float u24_open(uint32_t a)
+{
+	return ((a >> 8) + 1) * (1.0f / 16777216.0f);
+}
+
+static inline double u53_open(uint32_t a, uint32_t b)
+{
+	return ((a >> 5) * 67108864.0 + (b >> 6) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+** Poisson values need a varying number of uniforms; value ctr takes
+** them from blocks (ctr, 0), (ctr, 1), ...
+*/
+typedef struct {
+	uint64_t key, ctr;
+	uint32_t sub;
+	uint32_t w[4];
+	int used;
+} rng_stream;
+
+static double stream_uniform(rng_stream* s)
+{
+	if (s->used == 4) {
+		rng_block(s->key, s->ctr, s->sub++, s->w);
+		s->used = 0;
+	}
+	s->used += 2;
+	return u53(s->w[s->used - 2], s->w[s->used - 1]);
+}
+
+/*
+** Multiplication for small means; the transformed rejection of
+** Hormann, "The transformed rejection method for generating Poisson
+** random variables" (1993) otherwise.  This runs on worker threads,
+** so it uses lgamma_r(); lgamma() writes the global signgam.
+*/
+static double poisson(rng_stream* s, double lambda)
+{
+	double L, p, k, slam, loglam, a, b, invalpha, vr, U, V, us;
+	int sign;
+
+	if (lambda <= 0) return 0;
+
+	if (lambda < 10) {
+		L = exp(-lambda);
+		p = stream_uniform(s);
+		for (k = 0; p > L; k++) {
+			p *= stream_uniform(s);
+		}
+		return k;
+	}
+
+	slam     = sqrt(lambda);
+	loglam   = log(lambda);
+	b        = 0.931 + 2.53 * slam;
+	a        = -0.059 + 0.02483 * b;
+	invalpha = 1.1239 + 1.1328 / (b - 3.4);
+	vr       = 0.9277 - 3.6224 / (b - 2);
+
+	for (;;) {
+		U  = stream_uniform(s) - 0.5;
+		V  = stream_uniform(s);
+		us = 0.5 - fabs(U);
+		k  = floor((2 * a / us + b) * U + lambda + 0.43);
+		if (us >= 0.07 && V <= vr) return k;
+		if (k < 0 || (us < 0.013 && V > us)) continue;
+		if (log(V) + log(invalpha) - log(a / (us * us) + b) <= -lambda + k * loglam - lgamma_r(k + 1, &sign)) {
+			return k;
+		}
+	}
+}
+
+typedef struct {
+	void* out;
+	int format, dist;
+	double lambda;
+	uint64_t key, first;
+} fill_job;
+
+/*
+** Uniform floats take a word each, four to a block; uniform doubles two
+** words, two to a block.  Normals come in Box-Muller pairs from a block.
+*/
+static void fill_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	fill_job* job = (fill_job*)ctx;
+	float* f      = (float*)job->out;
+	double* d     = (double*)job->out;
+	uint64_t have = UINT64_MAX, blk;
+	uint32_t w[4];
+	uint64_t n;
+	size_t i;
+	rng_stream s;
+
+	for (i = begin; i < end; i++) {
+		n = job->first + i;
+
+		if (job->dist == RNG_POISSON) {
+			s.key  = job->key;
+			s.ctr  = n;
+			s.sub  = 0;
+			s.used = 4;
+			if (job->format == DV_FLOAT) {
+				f[i] = poisson(&s, job->lambda);
+			} else {
+				d[i] = poisson(&s, job->lambda);
+			}
+			continue;
+		}
+
+		blk = (job->dist == RNG_UNIFORM && job->format == DV_FLOAT) ? n >> 2 : n >> 1;
+		if (blk != have) {
+			rng_block(job->key, blk, 0, w);
+			have = blk;
+		}
+
+		if (job->dist == RNG_UNIFORM) {
+			if (job->format == DV_FLOAT) {
+				f[i] = u24(w[n & 3]);
+			} else {
+				d[i] = u53(w[2 * (n & 1)], w[2 * (n & 1) + 1]);
+			}
+		} else if (job->format == DV_FLOAT) {
+			float r = sqrtf(-2.0f * logf(u24_open(w[0])));
+			float t = (float)TWO_PI * u24(w[1]);
+			f[i]    = (n & 1) ? r * sinf(t) : r * cosf(t);
+		} else {
+			double r = sqrt(-2.0 * log(u53_open(w[0], w[1])));
+			double t = TWO_PI * u53(w[2], w[3]);
+			d[i]     = (n & 1) ? r * sin(t) : r * cos(t);
+		}
+	}
+}
+
+void rng_fill(void* out, int format, size_t n, int dist, double lambda, uint64_t key, uint64_t first)
+{
+	fill_job job;
+
+	job.out    = out;
+	job.format = format;
+	job.dist   = dist;
+	job.lambda = lambda;
+	job.key    = key;
+	job.first  = first;
+
+	dv_parallel_for(n, 16384, fill_kernel, &job);
+}
@@ -0,0 +1,30 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ ** Counter-based random numbers for random(), rnoise() and gnoise().
+ **
+ ** Every value is made from Philox4x32-10 blocks (Salmon et al., "Parallel
+ ** random numbers: as easy as 1, 2, 3", SC11) picked by its position in
+ ** the stream and a 64 bit key.  Nothing is carried from one value to the
+ ** next, so any range of a stream can be made on its own and the result
+ ** doesn't depend on how the work was split between threads.
+ **/
+
+enum { RNG_UNIFORM, RNG_NORMAL, RNG_POISSON };
+
+/* block (ctr, sub) of stream key */
+void rng_block(uint64_t key, uint64_t ctr, uint32_t sub, uint32_t out[4]);
+
+/*
+** Set out[0 .. n) to values first .. first+n-1 of stream key, as DV_FLOAT
+** or DV_DOUBLE.  Uniform values are in [0,1), normal values have a mean
+** of 0 and a standard deviation of 1 and Poisson values have a mean of
+** lambda.  Float output is made directly from 24 bit uniforms.
+*/
+void rng_fill(void* out, int format, size_t n, int dist, double lambda, uint64_t key, uint64_t first);
+
+#endif /* RNG_H */
@@ -1,25 +1,82 @@
 #include "func.h"
 #include "parser.h"
+#include "parallel.h"
 
 Var* make_mask(int size, float dir);
 
+typedef struct distance_map_ctx {
+	Var *o1, *o2;
+	int x, y;
+	float run, rise;
+	int skip, radius;
+	int *dist, *diff;
+	int* extents; /* per-thread xmin, xmax, ymin, ymax */
+} distance_map_ctx;
+
+/* each row is searched independently; rows are 1 + [begin, end) */
+static void distance_map_rows(void* ctx, size_t begin, size_t end, int tid)
+{
+	distance_map_ctx* dm = (distance_map_ctx*)ctx;
+	Var* o1              = dm->o1;
+	Var* o2              = dm->o2;
+	int x = dm->x, y = dm->y;
+	int* ext = dm->extents + 4 * tid;
+	int* dist = dm->dist;
+	int* diff = dm->diff;
+	int i, j, k, v, q;
+	int dx, dy, pos, skipv;
+
+	for (j = begin + 1; j < end + 1; j++) {
+		for (i = 1; i < x; i++) {
+			pos       = cpos(i, j, 0, o2);
+			dist[pos] = -1;
+			q         = extract_int(o1, pos);
+			if (q >= -32752) {
+				if (i < ext[0]) ext[0] = i;
+				if (i > ext[1]) ext[1] = i;
+				if (j < ext[2]) ext[2] = j;
+				if (j > ext[3]) ext[3] = j;
+				skipv              = dm->skip;
+				for (k = 0;; k++) {
+					dx = i + dm->run * k;
+					dy = j + dm->rise * k;
+					// if (dx == i && dy == j) continue; 	/* same as start */
+					if (dx < 0 || dx > x - 1) break; /* fell off image */
+					if (dy < 0 || dy > y - 1) break; /* fell off image */
+					v = extract_int(o2, cpos(dx, dy, 0, o2));
+					if (v >= -32752) {
+						if (skipv == 0) {
+							dist[pos] = k;
+							diff[pos] = (v - extract_int(o1, cpos(dx, dy, 0, o1))) *
+							            ((float)(dm->radius - k) / dm->radius);
+							if (diff[pos] < 0) diff[pos] = 0;
+							break;
+						} else {
+							skipv--;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
 Var* ff_distance_map(vfuncptr func, Var* arg)
 {
 	size_t x, y, z;
-	int dx, dy;
 	Var* o1 = NULL;
 	Var* o2 = NULL;
 	Var* a;
 	Var* ignore = NULL;
 	Var *dval, *mask;
 	float dir = 0.0;
-	float rise, run;
 	int *dist, *diff;
 	int smooth = 0;
 	int xmin, xmax, ymin, ymax;
+	distance_map_ctx dm;
 
-	int i, j, k, v, q;
-	int pos, skip = 0, skipv, radius = 100;
+	int i, nchunks;
+	int skip = 0, radius = 100;
 
 	Alist alist[8];
 	alist[0]      = make_alist("o1", ID_VAL, NULL, &o1);
@@ -56,48 +113,41 @@ Var* ff_distance_map(vfuncptr func, Var* arg)
 	/* for each pixel in src image, find first pixel in dest image,
 	   along directional vector
 	 */
-	run  = cos(dir);
-	rise = -sin(dir);
-	dist = (int*)calloc(x * y, sizeof(int));
-	diff = (int*)calloc(x * y, sizeof(int));
+	dm.o1     = o1;
+	dm.o2     = o2;
+	dm.x      = x;
+	dm.y      = y;
+	dm.run    = cos(dir);
+	dm.rise   = -sin(dir);
+	dm.skip   = skip;
+	dm.radius = radius;
+	dm.dist   = (int*)calloc(x * y, sizeof(int));
+	dm.diff   = (int*)calloc(x * y, sizeof(int));
+
+	nchunks    = dv_parallel_chunks(y > 1 ? y - 1 : 0, 16);
+	dm.extents = (int*)malloc(sizeof(int) * 4 * max(nchunks, 1));
+	for (i = 0; i < nchunks; i++) {
+		dm.extents[4 * i + 0] = x;
+		dm.extents[4 * i + 1] = 0;
+		dm.extents[4 * i + 2] = y;
+		dm.extents[4 * i + 3] = 0;
+	}
+	if (y > 1) dv_parallel_for(y - 1, 16, distance_map_rows, &dm);
 
 	xmin = x;
 	ymin = y;
 	xmax = 0;
 	ymax = 0;
-	for (j = 1; j < y; j++) {
-		for (i = 1; i < x; i++) {
-			pos       = cpos(i, j, 0, o2);
-			dist[pos] = -1;
-			q         = extract_int(o1, pos);
-			if (q >= -32752) {
-				if (i < xmin) xmin = i;
-				if (i > xmax) xmax = i;
-				if (j < ymin) ymin = j;
-				if (j > ymax) ymax = j;
-				skipv              = skip;
-				for (k = 0;; k++) {
-					dx = i + run * k;
-					dy = j + rise * k;
-					// if (dx == i && dy == j) continue; 	/* same as start */
-					if (dx < 0 || dx > x - 1) break; /* fell off image */
-					if (dy < 0 || dy > y - 1) break; /* fell off image */
-					v = extract_int(o2, cpos(dx, dy, 0, o2));
-					if (v >= -32752) {
-						if (skipv == 0) {
-							dist[pos] = k;
-							diff[pos] = (v - extract_int(o1, cpos(dx, dy, 0, o1))) *
-							            ((float)(radius - k) / radius);
-							if (diff[pos] < 0) diff[pos] = 0;
-							break;
-						} else {
-							skipv--;
-						}
-					}
-				}
-			}
-		}
+	for (i = 0; i < nchunks; i++) {
+		xmin = min(xmin, dm.extents[4 * i + 0]);
+		xmax = max(xmax, dm.extents[4 * i + 1]);
+		ymin = min(ymin, dm.extents[4 * i + 2]);
+		ymax = max(ymax, dm.extents[4 * i + 3]);
 	}
+	free(dm.extents);
+	dist = dm.dist;
+	diff = dm.diff;
+
 	dval = newVal(BSQ, x, y, 1, DV_INT32, diff);
 	a    = new_struct(3);
 	add_struct(a, "dist", newVal(BSQ, x, y, 1, DV_INT32, dist));
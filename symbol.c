@@ -275,6 +275,10 @@ void free_var(Var* v)
 		break;
 	case ID_STRUCT: free_struct(v); break;
 	case ID_TEXT: /*Added: Thu Mar  2 16:03:49 MST 2000*/
+		if (V_TEXT(v).store != NULL) {
+			text_store_release(V_TEXT(v).store);
+			break;
+		}
 		for (i = 0; i < V_TEXT(v).Row; i++) {
 			free(V_TEXT(v).text[i]);
 		}
@@ -0,0 +1,546 @@
+#include "parser.h"
+#include "parallel.h"
+#include "textout.h"
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int dv_fmt_u64(char* buf, uint64_t v)
+{
+	char tmp[20];
+	int n = 20;
+
+	while (v >= 100) {
+		n -= 2;
+		memcpy(tmp + n, digit_pairs + 2 * (v % 100), 2);
+		v /= 100;
+	}
+	if (v >= 10) {
+		n -= 2;
+		memcpy(tmp + n, digit_pairs + 2 * v, 2);
+	} else {
+		tmp[--n] = '0' + (char)v;
+	}
+	memcpy(buf, tmp + n, 20 - n);
+	return (20 - n);
+}
+
+int dv_fmt_i64(char* buf, int64_t v)
+{
+	if (v < 0) {
+		buf[0] = '-';
+		return (1 + dv_fmt_u64(buf + 1, -(uint64_t)v));
+	}
+	return (dv_fmt_u64(buf, (uint64_t)v));
+}
+
+/**
+ ** Grisu2.  A diyfp is f * 2^e, with a 64 bit f.
+ **/
+
+typedef struct {
+	uint64_t f;
+	int e;
+} diyfp;
+
+/* 10^k as normalized diyfps, k = -348, -340, ..., 340 */
+static const uint64_t pow10_f[] = {
+	UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76), UINT64_C(0x8b16fb203055ac76),
+	UINT64_C(0xcf42894a5dce35ea), UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+	UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f), UINT64_C(0xbe5691ef416bd60c),
+	UINT64_C(0x8dd01fad907ffc3c), UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+	UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d), UINT64_C(0x823c12795db6ce57),
+	UINT64_C(0xc21094364dfb5637), UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+	UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5), UINT64_C(0xb23867fb2a35b28e),
+	UINT64_C(0x84c8d4dfd2c63f3b), UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+	UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6), UINT64_C(0xf3e2f893dec3f126),
+	UINT64_C(0xb5b5ada8aaff80b8), UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+	UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd), UINT64_C(0xa6dfbd9fb8e5b88f),
+	UINT64_C(0xf8a95fcf88747d94), UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+	UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac), UINT64_C(0xe45c10c42a2b3b06),
+	UINT64_C(0xaa242499697392d3), UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+	UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c), UINT64_C(0x9c40000000000000),
+	UINT64_C(0xe8d4a51000000000), UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+	UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70), UINT64_C(0xd5d238a4abe98068),
+	UINT64_C(0x9f4f2726179a2245), UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+	UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a), UINT64_C(0x924d692ca61be758),
+	UINT64_C(0xda01ee641a708dea), UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+	UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2), UINT64_C(0xc83553c5c8965d3d),
+	UINT64_C(0x952ab45cfa97a0b3), UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+	UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece), UINT64_C(0x88fcf317f22241e2),
+	UINT64_C(0xcc20ce9bd35c78a5), UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+	UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c), UINT64_C(0xbb764c4ca7a44410),
+	UINT64_C(0x8bab8eefb6409c1a), UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+	UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429), UINT64_C(0x80444b5e7aa7cf85),
+	UINT64_C(0xbf21e44003acdd2d), UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+	UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9), UINT64_C(0xaf87023b9bf0ee6b)
+};
+
+static const short pow10_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+	-954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+	-688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+	-422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+	-157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+	109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+	641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+	907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint32_t pow10_u32[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static diyfp diy_mul(diyfp x, diyfp y)
+{
+	uint64_t a = x.f >> 32, b = x.f & 0xFFFFFFFF;
+	uint64_t c = y.f >> 32, d = y.f & 0xFFFFFFFF;
+	uint64_t bc = b * c, ad = a * d;
+	uint64_t t = ((b * d) >> 32) + (ad & 0xFFFFFFFF) + (bc & 0xFFFFFFFF) + (UINT64_C(1) << 31);
+	diyfp r;
+
+	r.f = a * c + (ad >> 32) + (bc >> 32) + (t >> 32);
+	r.e = x.e + y.e + 64;
+	return (r);
+}
+
+static diyfp diy_normalize(diyfp x)
+{
+	while (!(x.f & (UINT64_C(0xFFC) << 52))) {
+		x.f <<= 10;
+		x.e -= 10;
+	}
+	while (!(x.f & (UINT64_C(1) << 63))) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return (x);
+}
+
+static void grisu_round(char* buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+	       (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+		buf[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int digit_gen(diyfp w, diyfp mp, uint64_t delta, char* buf, int* K)
+{
+	int shift     = -mp.e;
+	uint64_t one  = UINT64_C(1) << shift;
+	uint64_t wp_w = mp.f - w.f;
+	uint32_t p1   = (uint32_t)(mp.f >> shift);
+	uint64_t p2   = mp.f & (one - 1);
+	uint64_t ten  = 1;
+	int kappa = 10, len = 0;
+	uint32_t d;
+
+	while (kappa > 1 && p1 < pow10_u32[kappa - 1]) kappa--;
+
+	while (kappa > 0) {
+		d = p1 / pow10_u32[kappa - 1];
+		p1 %= pow10_u32[kappa - 1];
+		if (d || len) buf[len++] = '0' + (char)d;
+		kappa--;
+		if (((uint64_t)p1 << shift) + p2 <= delta) {
+			*K += kappa;
+			grisu_round(buf, len, delta, ((uint64_t)p1 << shift) + p2, (uint64_t)pow10_u32[kappa] << shift, wp_w);
+			return (len);
+		}
+	}
+
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		ten *= 10;
+		d = (uint32_t)(p2 >> shift);
+		if (d || len) buf[len++] = '0' + (char)d;
+		p2 &= one - 1;
+		kappa--;
+		if (p2 < delta) {
+			*K += kappa;
+			grisu_round(buf, len, delta, p2, one, kappa >= -19 ? wp_w * ten : 0);
+			return (len);
+		}
+	}
+}
+
+/*
+** The digits of a finite, nonzero |v| (or |(float)v| with single):
+** v = digits * 10^K.  Returns the number of digits, at most 17.
+*/
+static int grisu2(double v, int single, char* buf, int* K)
+{
+	diyfp w, plus, minus, c;
+	int lower_closer, k, index;
+	double dk;
+
+	if (single) {
+		float f = (float)v;
+		uint32_t bits, frac;
+		int biased;
+
+		memcpy(&bits, &f, sizeof(bits));
+		biased = (bits >> 23) & 0xFF;
+		frac   = bits & 0x7FFFFF;
+		w.f    = biased ? frac | (UINT32_C(1) << 23) : frac;
+		w.e    = biased ? biased - 150 : -149;
+		lower_closer = (frac == 0 && biased > 1);
+	} else {
+		uint64_t bits, frac;
+		int biased;
+
+		memcpy(&bits, &v, sizeof(bits));
+		biased = (int)((bits >> 52) & 0x7FF);
+		frac   = bits & ((UINT64_C(1) << 52) - 1);
+		w.f    = biased ? frac | (UINT64_C(1) << 52) : frac;
+		w.e    = biased ? biased - 1075 : -1074;
+		lower_closer = (frac == 0 && biased > 1);
+	}
+
+	/* the halfway points to the neighbouring values */
+	plus.f = (w.f << 1) + 1;
+	plus.e = w.e - 1;
+	plus   = diy_normalize(plus);
+	if (lower_closer) {
+		minus.f = (w.f << 2) - 1;
+		minus.e = w.e - 2;
+	} else {
+		minus.f = (w.f << 1) - 1;
+		minus.e = w.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+	w       = diy_normalize(w);
+
+	/* a power of ten that brings the exponent into [-60, -32] */
+	dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+	k  = (int)dk;
+	if (dk - k > 0.0) k++;
+	index = (k >> 3) + 1;
+	*K    = 348 - index * 8;
+	c.f   = pow10_f[index];
+	c.e   = pow10_e[index];
+
+	w     = diy_mul(w, c);
+	plus  = diy_mul(plus, c);
+	minus = diy_mul(minus, c);
+	minus.f++;
+	plus.f--;
+	return (digit_gen(w, plus, plus.f - minus.f, buf, K));
+}
+
+/* d.ddde+XX */
+static int put_exponent(char* p, int x)
+{
+	int n = 0;
+
+	p[n++] = 'e';
+	p[n++] = x < 0 ? '-' : '+';
+	if (x < 0) x = -x;
+	if (x >= 100) {
+		p[n++] = '0' + x / 100;
+		x %= 100;
+	}
+	memcpy(p + n, digit_pairs + 2 * x, 2);
+	return (n + 2);
+}
+
+/*
+** Lay out digits d[0..len) with decimal exponent x (the exponent of d[0])
+** in the style of %g: scientific when x < -4 or x >= limit, otherwise
+** positional.  With point, integral values get a ".0".
+*/
+static int layout(char* p, const char* d, int len, int x, int limit, int point)
+{
+	int n = 0;
+
+	if (x < -4 || x >= limit) {
+		p[n++] = d[0];
+		if (len > 1) {
+			p[n++] = '.';
+			memcpy(p + n, d + 1, len - 1);
+			n += len - 1;
+		}
+		return (n + put_exponent(p + n, x));
+	}
+	if (x < 0) {
+		p[n++] = '0';
+		p[n++] = '.';
+		memset(p + n, '0', -x - 1);
+		n += -x - 1;
+		memcpy(p + n, d, len);
+		return (n + len);
+	}
+	if (len <= x + 1) {
+		memcpy(p, d, len);
+		memset(p + len, '0', x + 1 - len);
+		n = x + 1;
+		if (point) {
+			p[n++] = '.';
+			p[n++] = '0';
+		}
+		return (n);
+	}
+	memcpy(p, d, x + 1);
+	p[x + 1] = '.';
+	memcpy(p + x + 2, d + x + 1, len - x - 1);
+	return (len + 1);
+}
+
+static int fmt_special(char* buf, double v)
+{
+	if (isnan(v)) {
+		memcpy(buf, "nan", 3);
+		return (3);
+	}
+	if (v < 0) {
+		memcpy(buf, "-inf", 4);
+		return (4);
+	}
+	memcpy(buf, "inf", 3);
+	return (3);
+}
+
+int dv_fmt_shortest(char* buf, double v, int single)
+{
+	char d[24];
+	int n = 0, len, K;
+
+	if (single) v = (float)v;
+	if (!isfinite(v)) return (fmt_special(buf, v));
+	if (signbit(v)) buf[n++] = '-';
+	if (v == 0) {
+		memcpy(buf + n, "0.0", 3);
+		return (n + 3);
+	}
+	len = grisu2(v, single, d, &K);
+	return (n + layout(buf + n, d, len, len + K - 1, 16, 1));
+}
+
+static int fmt_snprintf(char* buf, const char* fmt, int prec, double v)
+{
+	int n = snprintf(buf, DV_FMT_MAX, fmt, prec, v);
+
+	if (n < 0) return (0);
+	return (n < DV_FMT_MAX ? n : DV_FMT_MAX - 1);
+}
+
+/*
+** The Grisu2 digits S of v are within about 1.1e-16 * v of it, so
+** rounding S gives the same answer as rounding v unless the digits cut
+** off are within 12 units of S's last digit of a tie.  With len <= p
+** nothing is cut off, and S is close enough to v for p <= 15.  Neither
+** holds for denormals, which have fewer bits.
+*/
+int dv_fmt_general(char* buf, double v, int p)
+{
+	char d[24];
+	int n = 0, len, K, x, i;
+	uint64_t tail, half;
+
+	if (p == 0) p = 1;
+	if (p < 0 || p > 17 || !isfinite(v) || (v != 0 && fabs(v) < DBL_MIN)) {
+		return (fmt_snprintf(buf, "%.*g", p, v));
+	}
+	if (v == 0) {
+		if (signbit(v)) buf[n++] = '-';
+		buf[n++] = '0';
+		return (n);
+	}
+
+	len = grisu2(fabs(v), 0, d, &K);
+	x   = len + K - 1;
+	if (len <= p) {
+		if (p > 15) return (fmt_snprintf(buf, "%.*g", p, v));
+	} else {
+		tail = 0;
+		half = 5;
+		for (i = p; i < len; i++) {
+			tail = tail * 10 + (d[i] - '0');
+			if (i > p) half *= 10;
+		}
+		if ((tail > half ? tail - half : half - tail) <= 12) {
+			return (fmt_snprintf(buf, "%.*g", p, v));
+		}
+		len = p;
+		if (tail > half) {
+			for (i = len - 1; i >= 0 && d[i] == '9'; i--) d[i] = '0';
+			if (i < 0) {
+				d[0] = '1';
+				x++;
+			} else {
+				d[i]++;
+			}
+		}
+	}
+	while (len > 1 && d[len - 1] == '0') len--;
+
+	if (v < 0) buf[n++] = '-';
+	return (n + layout(buf + n, d, len, x, p, 0));
+}
+
+/*
+** |v| * 10^decimals is exact to within half an ulp, so below 2^53 the
+** integer part and the first fraction digit are right unless the
+** fraction is within that of one half.
+*/
+int dv_fmt_fixed(char* buf, double v, int decimals)
+{
+	static const double p10[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,
+	                             1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17};
+	double t, f;
+	uint64_t m, ip, fp, scale;
+	int n = 0, len;
+	char tmp[24];
+
+	if (decimals < 0 || decimals > 17) return (fmt_snprintf(buf, "%.*f", decimals, v));
+	t = fabs(v) * p10[decimals];
+	if (!(t < 1e15)) return (fmt_snprintf(buf, "%.*f", decimals, v));
+	f = floor(t);
+	if (fabs(t - f - 0.5) <= t * 4.5e-16) return (fmt_snprintf(buf, "%.*f", decimals, v));
+	m = (uint64_t)f + (t - f > 0.5);
+
+	scale = (uint64_t)p10[decimals];
+	ip    = m / scale;
+	fp    = m % scale;
+	if (signbit(v)) buf[n++] = '-';
+	n += dv_fmt_u64(buf + n, ip);
+	if (decimals > 0) {
+		buf[n++] = '.';
+		len = dv_fmt_u64(tmp, fp);
+		memset(buf + n, '0', decimals - len);
+		memcpy(buf + n + decimals - len, tmp, len);
+		n += decimals;
+	}
+	return (n);
+}
+
+int dv_fmt_value(char* buf, Var* v, size_t i, int precision)
+{
+	switch (V_FORMAT(v)) {
+	case DV_UINT8: return (dv_fmt_u64(buf, ((u8*)V_DATA(v))[i]));
+	case DV_UINT16: return (dv_fmt_u64(buf, ((u16*)V_DATA(v))[i]));
+	case DV_UINT32: return (dv_fmt_u64(buf, ((u32*)V_DATA(v))[i]));
+	case DV_UINT64: return (dv_fmt_u64(buf, ((u64*)V_DATA(v))[i]));
+	case DV_INT8: return (dv_fmt_i64(buf, ((i8*)V_DATA(v))[i]));
+	case DV_INT16: return (dv_fmt_i64(buf, ((i16*)V_DATA(v))[i]));
+	case DV_INT32: return (dv_fmt_i64(buf, ((i32*)V_DATA(v))[i]));
+	case DV_INT64: return (dv_fmt_i64(buf, ((i64*)V_DATA(v))[i]));
+	case DV_FLOAT:
+		if (precision <= 0) return (dv_fmt_shortest(buf, ((float*)V_DATA(v))[i], 1));
+		return (dv_fmt_general(buf, ((float*)V_DATA(v))[i], precision));
+	case DV_DOUBLE:
+		if (precision <= 0) return (dv_fmt_shortest(buf, ((double*)V_DATA(v))[i], 0));
+		return (dv_fmt_general(buf, ((double*)V_DATA(v))[i], precision));
+	}
+	return (0);
+}
+
+/**
+ ** Text buffers
+ **/
+
+char* dv_text_room(dv_text* t, size_t n)
+{
+	size_t size;
+	char* s;
+
+	if (t->error) return (NULL);
+	if (t->len + n > t->size) {
+		size = t->size ? t->size : 4096;
+		while (size < t->len + n) size *= 2;
+		if ((s = (char*)realloc(t->s, size)) == NULL) {
+			t->error = 1;
+			return (NULL);
+		}
+		t->s    = s;
+		t->size = size;
+	}
+	return (t->s + t->len);
+}
+
+void dv_text_add(dv_text* t, const char* s, size_t n)
+{
+	char* p = dv_text_room(t, n);
+
+	if (p != NULL) {
+		memcpy(p, s, n);
+		t->len += n;
+	}
+}
+
+void dv_text_free(dv_text* t)
+{
+	free(t->s);
+	t->s    = NULL;
+	t->len  = 0;
+	t->size = 0;
+}
+
+/*
+** Each batch gives every thread about DV_TEXT_TARGET bytes, going by
+** the bytes per item of the batch before.
+*/
+#define DV_TEXT_FIRST 256
+#define DV_TEXT_TARGET (1 << 20)
+
+typedef struct {
+	dv_text_fn fn;
+	void* ctx;
+	size_t first;
+	dv_text* out;
+} text_job;
+
+static void text_kernel(void* ctx, size_t begin, size_t end, int tid)
+{
+	text_job* job = (text_job*)ctx;
+
+	job->out[tid].len = 0;
+	job->fn(job->ctx, job->first + begin, job->first + end, &job->out[tid]);
+}
+
+int dv_write_text(FILE* fp, size_t n, dv_text_fn fn, void* ctx)
+{
+	text_job job;
+	size_t per = DV_TEXT_FIRST, m, bytes;
+	int i, nt = dv_num_threads(), nc, ok = 1;
+
+	job.fn    = fn;
+	job.ctx   = ctx;
+	job.first = 0;
+	job.out   = (dv_text*)calloc(nt, sizeof(dv_text));
+	if (job.out == NULL) return (0);
+
+	while (ok && job.first < n) {
+		m  = n - job.first < per * nt ? n - job.first : per * nt;
+		nc = dv_parallel_chunks(m, per);
+		dv_parallel_for(m, per, text_kernel, &job);
+
+		bytes = 0;
+		for (i = 0; i < nc && ok; i++) {
+			dv_text* t = &job.out[i];
+			if (t->error || fwrite(t->s, 1, t->len, fp) != t->len) ok = 0;
+			bytes += t->len;
+		}
+		job.first += m;
+
+		per = bytes ? (size_t)((double)DV_TEXT_TARGET * m / bytes) : per * 2;
+		if (per < 1) per = 1;
+		if (per > DV_TEXT_TARGET) per = DV_TEXT_TARGET;
+	}
+
+	for (i = 0; i < nt; i++) dv_text_free(&job.out[i]);
+	free(job.out);
+	return (ok);
+}
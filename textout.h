@@ -0,0 +1,72 @@
+#ifndef TEXTOUT_H
+#define TEXTOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ ** Number formatting and buffered text output for write(type="csv"),
+ ** write(type="ascii") and the printf() family.
+ **
+ ** The dv_fmt_*() functions put one number in buf, which must have room
+ ** for DV_FMT_MAX chars, and return its length.  They don't add a NUL
+ ** and, apart from the snprintf() they fall back on, don't depend on the
+ ** locale.
+ **
+ **   dv_fmt_i64(), dv_fmt_u64()   the same digits as %lld and %llu
+ **   dv_fmt_fixed(v, d)           the same as %.*f with d decimals
+ **   dv_fmt_general(v, p)         the same as %.*g with p digits
+ **   dv_fmt_shortest(v, single)   the fewest digits that read back as v,
+ **                                or as (float)v with single, laid out
+ **                                like 0.1, 3.0, 1e+30 or 5e-07
+ **
+ ** dv_fmt_shortest() is Grisu2 (Loitsch, "Printing floating-point numbers
+ ** quickly and accurately with integers", PLDI 2010): the result always
+ ** reads back exactly and is almost always the shortest that does.
+ ** dv_fmt_fixed() and dv_fmt_general() use it, or integer arithmetic, and
+ ** only call snprintf() when a value is too close to a rounding tie to
+ ** be sure.
+ **/
+
+#define DV_FMT_MAX 352 /* %.17f of DBL_MAX, with room to spare */
+
+int dv_fmt_i64(char* buf, int64_t v);
+int dv_fmt_u64(char* buf, uint64_t v);
+int dv_fmt_fixed(char* buf, double v, int decimals);
+int dv_fmt_general(char* buf, double v, int digits);
+int dv_fmt_shortest(char* buf, double v, int single);
+
+/*
+** Element i of an ID_VAL: integers in full, floats and doubles with
+** dv_fmt_general(precision), or dv_fmt_shortest() for precision <= 0.
+*/
+int dv_fmt_value(char* buf, struct _var* v, size_t i, int precision);
+
+/*
+** A growable text buffer.  dv_text_room() returns space for n more
+** chars at s+len (the caller adds what it used to len), or NULL and sets
+** error if it can't be had.
+*/
+typedef struct {
+	char* s;
+	size_t len, size;
+	int error;
+} dv_text;
+
+char* dv_text_room(dv_text* t, size_t n);
+void dv_text_add(dv_text* t, const char* s, size_t n);
+void dv_text_free(dv_text* t);
+
+/*
+** dv_write_text() writes items [0, n) to fp, in order.  fn(ctx, begin,
+** end, out) appends the text for items [begin, end) to out; batches of
+** items are formatted in parallel (fn follows the dv_parallel_for()
+** kernel rules) and each batch is written with one fwrite() per thread.
+** Returns 0 if memory ran out or a write failed.
+*/
+typedef void (*dv_text_fn)(void* ctx, size_t begin, size_t end, dv_text* out);
+
+int dv_write_text(FILE* fp, size_t n, dv_text_fn fn, void* ctx);
+
+#endif /* TEXTOUT_H */
@@ -50,6 +50,59 @@ void dump_window(Window* w);
 void free_window(Window* w);
 void load_row(Window* w, Var* obj, int x1, int y1, int row, float ignore);
 
+/*
+** Tiled window functions
+**
+** These cut an image into tiles of window centers, and load each tile
+** with a halo big enough for every window centered in it, so tiles can
+** be worked on independently (and in parallel).
+**
+** Tile * create_tile(int width, int height);
+**
+**  Create a tile of up to WINDOW_TILE x WINDOW_TILE window centers for
+**  a width x height window.
+**
+** void load_tile(Tile *t, Var *obj, int x0, int y0, float ignore);
+**
+**  Load the tile, and its halo, with band 1 of <obj> for the centers
+**  starting at <x0,y0>.  Values that fall off the edge of the image
+**  are assigned the <ignore> value.
+**
+** float ** tile_window(Tile *t, int i, int j);
+**
+**  The rows of the window centered at tile center <i,j>, indexed
+**  the same way as the rows of a Window.
+**
+** void free_tile(Tile *t);
+**
+**  Destroy a Tile.
+**
+** int window_tiles(Var *obj, int width, int height, float ignore,
+**                  tile_fn fn, void *ctx);
+**
+**  Cover <obj> with tiles and call fn(ctx, t, x0, y0, nx, ny, tid) for
+**  each one, nx x ny centers from <x0,y0>, on dv_parallel_for() threads.
+**  tid is below dv_num_threads(), for per-thread scratch space; fn must
+**  follow the rules for parallel kernels.  Returns 0 if out of memory.
+*/
+
+#define WINDOW_TILE 256
+
+typedef struct tag_Tile {
+	int width, height; /* window size */
+	int bw, bh;        /* tile size, with the halo */
+	float* data;       /* bw x bh values */
+	float** row;       /* rows of the last tile_window() */
+} Tile;
+
+typedef void (*tile_fn)(void* ctx, Tile* t, int x0, int y0, int nx, int ny, int tid);
+
+Tile* create_tile(int width, int height);
+void load_tile(Tile* t, Var* obj, int x0, int y0, float ignore);
+float** tile_window(Tile* t, int i, int j);
+void free_tile(Tile* t);
+int window_tiles(Var* obj, int width, int height, float ignore, tile_fn fn, void* ctx);
+
 typedef struct tag_Histogram {
 	int count;
 	int min;